@@ -0,0 +1,785 @@
+// Micro-benchmarks for the BitNet kernels.
+//
+// Every shape in kernel_config.ini is run through ggml_vec_dot_i2_i8_s and
+// quantize_i2_s, and on TL1 builds through ggml_preprocessor, ggml_qgemm_lut
+// and their threaded variants, for each requested thread count and batch
+// size. Each case is checked once before it is timed:
+//   - vec_dot_i2_i8_s against a scalar dot product over the unpacked weights,
+//     and vec_dot_i2_i8_s_sparse the same way on a weight with half of its
+//     blocks empty
+//   - the threaded preprocessor and GEMMs bit-exactly against the serial
+//     generated kernels (the TL1 weight permutation lives in the Python
+//     converter, so the serial kernel is the reference on the C side)
+//   - the fused matmul epilogue against the same ops on the serial output
+//   - that two TL1 weights multiplied in turn learn each other as the next
+//     matmul and prefetch its weights during decode
+//   - that a matmul reuses the LUT an earlier one built from the same
+//     activation, and never does so across graph evaluations
+// TL2 builds time the serial ggml_preprocessor and ggml_qgemm_lut only;
+// they have no threaded variant to compare against.
+// The process exits non-zero when any check fails, so the binary can gate
+// kernel changes.
+//
+//   bitnet-bench [--config FILE] [--threads 1,2,4] [--batch 1,4,8]
+//                [--filter SUBSTR] [--min-time SECONDS] [--reps N]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "ggml-bitnet.h"
+#include "ggml-quants.h"
+#include "bitnet-cpu-features.h"
+#include "bitnet-threading.h"
+#include "bitnet-lut-kernels-threaded.h"
+
+#ifndef BITNET_KERNEL_CONFIG
+#define BITNET_KERNEL_CONFIG "include/kernel_config.ini"
+#endif
+
+// Rows and columns per multi-row ggml_vec_dot_i2_i8_s call, the block the
+// kernels compute in registers
+#define BENCH_I2_S_NROWS 2
+
+struct bench_shape {
+    int m;
+    int k;
+};
+
+struct bench_options {
+    std::string config = BITNET_KERNEL_CONFIG;
+    std::vector<int> threads = { 1, bitnet_get_optimal_thread_count() };
+    std::vector<int> batch = { 1, 4, 8 };
+    std::string filter;
+    double min_time = 0.25;
+    int reps = 3;
+};
+
+// One timed kernel invocation. ops and bytes are per call. For the GEMMs
+// ops counts multiply-adds as two and bytes is the weight traffic; for the
+// preprocessor and quantizer ops is the element count and bytes the
+// activation traffic.
+struct bench_case {
+    std::string name;
+    int threads;
+    int batch;
+    double ops;
+    double bytes;
+    std::function<void()> run;
+    // empty when there is no reference to compare against
+    std::function<bool()> check;
+};
+
+static std::vector<int> parse_int_list(const char * s) {
+    std::vector<int> out;
+    std::stringstream ss(s);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        if (!item.empty()) {
+            out.push_back(std::max(1, atoi(item.c_str())));
+        }
+    }
+    return out;
+}
+
+// Reads the m/k pair of every [Kernels_*] section. Duplicates are dropped.
+static std::vector<bench_shape> load_shapes(const std::string & path) {
+    std::vector<bench_shape> shapes;
+    std::ifstream in(path);
+    if (!in) {
+        fprintf(stderr, "bitnet-bench: cannot open %s\n", path.c_str());
+        return shapes;
+    }
+    std::string line;
+    bench_shape cur = { 0, 0 };
+    auto flush = [&]() {
+        if (cur.m > 0 && cur.k > 0) {
+            bool seen = false;
+            for (const auto & s : shapes) {
+                seen |= s.m == cur.m && s.k == cur.k;
+            }
+            if (!seen) {
+                shapes.push_back(cur);
+            }
+        }
+        cur = { 0, 0 };
+    };
+    while (std::getline(in, line)) {
+        line.erase(std::remove_if(line.begin(), line.end(), ::isspace), line.end());
+        if (line.empty() || line[0] == '#' || line[0] == ';') {
+            continue;
+        }
+        if (line[0] == '[') {
+            flush();
+        } else if (line.compare(0, 2, "m=") == 0) {
+            cur.m = atoi(line.c_str() + 2);
+        } else if (line.compare(0, 2, "k=") == 0) {
+            cur.k = atoi(line.c_str() + 2);
+        }
+    }
+    flush();
+    return shapes;
+}
+
+// Recreates the global pool with n - 1 workers, since parallel_for
+// callers work as well. n == 1 keeps the pool at its smallest size; the
+// threaded cases are skipped for it and the serial ones stand in.
+static void bench_set_threads(int n) {
+    g_bitnet_thread_pool.reset();
+    g_bitnet_thread_pool = std::make_unique<BitNetThreadPool>(std::max(1, n - 1));
+}
+
+// Splits [0, n) across the pool, or runs it inline for one thread
+static void bench_parallel(int threads, int64_t n, int64_t grain, const std::function<void(int64_t, int64_t)> & fn) {
+    if (threads <= 1) {
+        fn(0, n);
+        return;
+    }
+    g_bitnet_thread_pool->parallel_for(0, n, grain, fn).wait();
+}
+
+template<typename T>
+static T * bench_alloc(size_t count) {
+    T * p = aligned_alloc<T>(std::max<size_t>(count, 1));
+    if (p == nullptr) {
+        fprintf(stderr, "bitnet-bench: out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+// Buffers owned by the cases of one shape and batch size
+struct bench_buffers {
+    std::vector<void *> ptrs;
+
+    template<typename T>
+    T * alloc(size_t count) {
+        T * p = bench_alloc<T>(count);
+        ptrs.push_back(p);
+        return p;
+    }
+
+    ~bench_buffers() {
+        for (void * p : ptrs) {
+            free(p);
+        }
+    }
+};
+
+static double bench_median_ns(const bench_case & c, const bench_options & opt, int64_t & iters_out) {
+    using clock = std::chrono::steady_clock;
+
+    // warm up and calibrate so one repetition lasts at least min_time
+    c.run();
+    int64_t iters = 1;
+    for (;;) {
+        const auto t0 = clock::now();
+        for (int64_t i = 0; i < iters; ++i) {
+            c.run();
+        }
+        const double dt = std::chrono::duration<double>(clock::now() - t0).count();
+        if (dt >= opt.min_time || iters >= (int64_t)1 << 30) {
+            break;
+        }
+        const double scale = dt > 0 ? opt.min_time / dt : 10.0;
+        iters = std::max(iters + 1, (int64_t)(iters * std::min(10.0, scale * 1.2)));
+    }
+
+    std::vector<double> samples;
+    for (int r = 0; r < opt.reps; ++r) {
+        const auto t0 = clock::now();
+        for (int64_t i = 0; i < iters; ++i) {
+            c.run();
+        }
+        samples.push_back(std::chrono::duration<double, std::nano>(clock::now() - t0).count() / iters);
+    }
+    std::sort(samples.begin(), samples.end());
+    iters_out = iters;
+    return samples[samples.size() / 2];
+}
+
+static void fill_random(int8_t * p, size_t n, std::mt19937 & rng) {
+    for (size_t i = 0; i < n; i++) {
+        p[i] = (int8_t)(rng() & 0xff);
+    }
+}
+
+static void fill_random(uint8_t * p, size_t n, std::mt19937 & rng) {
+    for (size_t i = 0; i < n; i++) {
+        p[i] = (uint8_t)(rng() & 0xff);
+    }
+}
+
+static void fill_random(float * p, size_t n, std::mt19937 & rng) {
+    std::normal_distribution<float> dist(0.0f, 1.0f);
+    for (size_t i = 0; i < n; i++) {
+        p[i] = dist(rng);
+    }
+}
+
+// Scalar I2_S dot product: plane p of byte j in a 128-weight block holds
+// weight p * 32 + j, stored as 0/1/2 from the high bits down
+static int32_t ref_dot_i2_i8_s(int k, const uint8_t * x, const int8_t * y) {
+    int32_t sum = 0;
+    for (int b = 0; b < k / 128; b++) {
+        for (int j = 0; j < 32; j++) {
+            const uint8_t q = x[b * 32 + j];
+            for (int p = 0; p < 4; p++) {
+                sum += ((q >> (6 - 2 * p)) & 3) * y[b * 128 + p * 32 + j];
+            }
+        }
+    }
+    return sum;
+}
+
+// ggml-style I2_S mat-mul: rows of the weight against n activation columns,
+// BENCH_I2_S_NROWS x BENCH_I2_S_NROWS blocks when both sides allow
+static void run_vec_dot_i2_i8_s(int threads, int m, int k, int n, const uint8_t * x, const int8_t * y, float * s) {
+    const int nr = BENCH_I2_S_NROWS;
+    const size_t bx = k / 4;
+    const size_t by = k;
+    bench_parallel(threads, (m + nr - 1) / nr, 16, [&](int64_t lo, int64_t hi) {
+        for (int64_t rb = lo; rb < hi; ++rb) {
+            const int r0 = rb * nr;
+            const int nrr = std::min(nr, m - r0);
+            int c0 = 0;
+            if (nrr == nr && n >= nr) {
+                for (; c0 + nr <= n; c0 += nr) {
+                    ggml_vec_dot_i2_i8_s(k, s + (size_t)c0 * m + r0, m, x + r0 * bx, bx, y + (size_t)c0 * by, by, nr);
+                }
+            }
+            for (; c0 < n; c0++) {
+                for (int r = r0; r < r0 + nrr; r++) {
+                    ggml_vec_dot_i2_i8_s(k, s + (size_t)c0 * m + r, 0, x + r * bx, 0, y + (size_t)c0 * by, 0, 1);
+                }
+            }
+        }
+    });
+}
+
+// run_vec_dot_i2_i8_s through the sparse kernel. y_sums holds the block
+// sums of every activation column, as a caller computes them once per
+// quantized activation.
+static void run_vec_dot_i2_i8_s_sparse(int threads, int m, int k, int n, const uint8_t * x, const int8_t * y, float * s,
+                                       const uint8_t * occupancy, const int32_t * y_sums) {
+    const int nr = BENCH_I2_S_NROWS;
+    const size_t bx = k / 4;
+    const size_t by = k;
+    const size_t occ = GGML_BITNET_I2_S_OCCUPANCY_ROW_SIZE(k);
+    const size_t nb = k / 128;
+    bench_parallel(threads, (m + nr - 1) / nr, 16, [&](int64_t lo, int64_t hi) {
+        for (int64_t rb = lo; rb < hi; ++rb) {
+            const int r0 = rb * nr;
+            const int nrr = std::min(nr, m - r0);
+            int c0 = 0;
+            if (nrr == nr && n >= nr) {
+                for (; c0 + nr <= n; c0 += nr) {
+                    ggml_vec_dot_i2_i8_s_sparse(k, s + (size_t)c0 * m + r0, m, x + r0 * bx, bx, y + (size_t)c0 * by, by, nr,
+                                                occupancy + r0 * occ, occ, y_sums + c0 * nb);
+                }
+            }
+            for (; c0 < n; c0++) {
+                for (int r = r0; r < r0 + nrr; r++) {
+                    ggml_vec_dot_i2_i8_s_sparse(k, s + (size_t)c0 * m + r, 0, x + r * bx, 0, y + (size_t)c0 * by, 0, 1,
+                                                occupancy + r * occ, occ, y_sums + c0 * nb);
+                }
+            }
+        }
+    });
+}
+
+static void add_i2_s_cases(std::vector<bench_case> & cases, bench_buffers & buf, const bench_shape & sh, int threads, int n, std::mt19937 & rng) {
+    const int m = sh.m;
+    const int k = sh.k;
+    if (k % 128 != 0) {
+        return;
+    }
+
+    uint8_t * x = buf.alloc<uint8_t>((size_t)m * k / 4);
+    int8_t * y = buf.alloc<int8_t>((size_t)n * k);
+    float * s = buf.alloc<float>((size_t)n * m);
+    fill_random(x, (size_t)m * k / 4, rng);
+    fill_random(y, (size_t)n * k, rng);
+
+    char name[128];
+    snprintf(name, sizeof(name), "vec_dot_i2_i8_s/%s/%dx%d", ggml_bitnet_i2_s_isa(), m, k);
+    cases.push_back({
+        name, threads, n, 2.0 * m * k * n, (double)m * k / 4,
+        [=]() { run_vec_dot_i2_i8_s(threads, m, k, n, x, y, s); },
+        [=]() {
+            run_vec_dot_i2_i8_s(threads, m, k, n, x, y, s);
+            for (int c = 0; c < n; c++) {
+                for (int r = 0; r < m; r++) {
+                    if (s[(size_t)c * m + r] != (float)ref_dot_i2_i8_s(k, x + (size_t)r * k / 4, y + (size_t)c * k)) {
+                        return false;
+                    }
+                }
+            }
+            return true;
+        },
+    });
+
+    // A pruned weight: runs of four empty blocks alternate with four dense ones
+    uint8_t * xs = buf.alloc<uint8_t>((size_t)m * k / 4);
+    uint8_t * occupancy = buf.alloc<uint8_t>((size_t)m * GGML_BITNET_I2_S_OCCUPANCY_ROW_SIZE(k));
+    int32_t * y_sums = buf.alloc<int32_t>((size_t)n * k / 128);
+    memcpy(xs, x, (size_t)m * k / 4);
+    for (size_t b = 0; b < (size_t)m * k / 128; b++) {
+        if (b / 4 % 2 == 1) {
+            memset(xs + b * 32, 0x55, 32);
+        }
+    }
+    const int64_t n_empty = ggml_bitnet_i2_s_occupancy(xs, m, k, occupancy);
+    for (int c = 0; c < n; c++) {
+        ggml_bitnet_i2_s_block_sums(k, y + (size_t)c * k, y_sums + (size_t)c * k / 128);
+    }
+    snprintf(name, sizeof(name), "vec_dot_i2_i8_s_sparse/%s/%dx%d", ggml_bitnet_i2_s_isa(), m, k);
+    cases.push_back({
+        name, threads, n, 2.0 * m * k * n, ((double)m * k / 128 - n_empty) * 32,
+        [=]() { run_vec_dot_i2_i8_s_sparse(threads, m, k, n, xs, y, s, occupancy, y_sums); },
+        [=]() {
+            run_vec_dot_i2_i8_s_sparse(threads, m, k, n, xs, y, s, occupancy, y_sums);
+            for (int c = 0; c < n; c++) {
+                for (int r = 0; r < m; r++) {
+                    if (s[(size_t)c * m + r] != (float)ref_dot_i2_i8_s(k, xs + (size_t)r * k / 4, y + (size_t)c * k)) {
+                        return false;
+                    }
+                }
+            }
+            return true;
+        },
+    });
+
+    // quantize_i2_s converts whole tensors, so it only runs once per shape.
+    // It always runs on the pool, which has at least two threads.
+    if (n == 1 && threads > 1) {
+        float * w = buf.alloc<float>((size_t)m * k);
+        uint8_t * q = buf.alloc<uint8_t>((size_t)m * k / 4 + 64);
+        fill_random(w, (size_t)m * k, rng);
+        snprintf(name, sizeof(name), "quantize_i2_s/%dx%d", m, k);
+        cases.push_back({
+            name, threads, 1, (double)m * k, (double)m * k * sizeof(float),
+            [=]() { quantize_i2_s(w, q, m, k, nullptr); },
+            nullptr,
+        });
+    }
+}
+
+#if defined(GGML_BITNET_ARM_TL1)
+// Serial full-matrix LUT GEMM: one generated tile kernel call per BM rows and column
+static void run_qgemm_lut_serial(const bitnet_lut_kernel * kern, int n, uint8_t * A, int8_t * LUT, bitnet_float_type * Scales,
+                                 bitnet_float_type * LUT_Scales, bitnet_float_type * C) {
+    const int m = kern->m;
+    const int k = kern->k;
+    for (int c = 0; c < n; c++) {
+        for (int t = 0; t < m / kern->BM; t++) {
+            ggml_qgemm_lut(m, k, A + (size_t)t * kern->BM * k / 4, LUT + (size_t)c * k * 16, Scales,
+                           LUT_Scales + c, C + (size_t)c * m + (size_t)t * kern->BM);
+        }
+    }
+}
+
+static void run_preprocessor_serial(int n, int m, int k, float * B, bitnet_float_type * LUT_Scales, int8_t * QLUT) {
+    for (int c = 0; c < n; c++) {
+        ggml_preprocessor(m, k, B + (size_t)c * k, LUT_Scales + c, QLUT + (size_t)c * k * 16);
+    }
+}
+
+// A TL1 weight as the model loader leaves it: transformed, with the extra
+// the kernels read it through. The kernels link every extra to the one
+// multiplied after it, so the tensors of the bench outlive the buffers of
+// their case and are never freed.
+static ggml_tensor * bench_tensor(const bitnet_lut_kernel * kern, uint8_t * A, bitnet_float_type * Scales) {
+    bitnet_tensor_extra * extra = new bitnet_tensor_extra();
+    extra->BK = kern->BK;
+    extra->n_tile_num = kern->m / kern->BM;
+    extra->qweights = A;
+    extra->scales = Scales;
+    ggml_tensor * tensor = new ggml_tensor();
+    tensor->type = GGML_TYPE_TL1;
+    tensor->backend = GGML_BACKEND_TYPE_CPU;
+    tensor->ne[0] = kern->k;
+    tensor->ne[1] = kern->m;
+    tensor->ne[2] = 1;
+    tensor->ne[3] = 1;
+    tensor->data = A;
+    tensor->extra = extra;
+    return tensor;
+}
+
+static void add_tl1_cases(std::vector<bench_case> & cases, bench_buffers & buf, const bench_shape & sh, int threads, int n, std::mt19937 & rng, bool report) {
+    const bitnet_lut_kernel * kern = ggml_bitnet_get_lut_kernel(sh.m, sh.k);
+    if (kern == nullptr) {
+        if (report) {
+            fprintf(stderr, "bitnet-bench: no TL1 kernel generated for %dx%d, skipping\n", sh.m, sh.k);
+        }
+        return;
+    }
+    const int m = kern->m;
+    const int k = kern->k;
+
+    uint8_t * A = buf.alloc<uint8_t>((size_t)m * k / 4);
+    float * B = buf.alloc<float>((size_t)n * k);
+    int8_t * QLUT = buf.alloc<int8_t>((size_t)n * k * 16);
+    int8_t * QLUT_ref = buf.alloc<int8_t>((size_t)n * k * 16);
+    bitnet_float_type * LUT_Scales = buf.alloc<bitnet_float_type>(n);
+    bitnet_float_type * LUT_Scales_ref = buf.alloc<bitnet_float_type>(n);
+    bitnet_float_type * Scales = buf.alloc<bitnet_float_type>(1);
+    bitnet_float_type * C = buf.alloc<bitnet_float_type>((size_t)n * m);
+    bitnet_float_type * C_ref = buf.alloc<bitnet_float_type>((size_t)n * m);
+    fill_random(A, (size_t)m * k / 4, rng);
+    fill_random(B, (size_t)n * k, rng);
+    memset(QLUT, 0, (size_t)n * k * 16);
+    memset(QLUT_ref, 0, (size_t)n * k * 16);
+    memset(LUT_Scales, 0, n * sizeof(bitnet_float_type));
+    memset(LUT_Scales_ref, 0, n * sizeof(bitnet_float_type));
+    Scales[0] = 1.0f;
+
+    // the GEMM cases run on a LUT built by the serial preprocessor, and
+    // their serial result is the reference for the threaded ones
+    run_preprocessor_serial(n, m, k, B, LUT_Scales_ref, QLUT_ref);
+    run_qgemm_lut_serial(kern, n, A, QLUT_ref, Scales, LUT_Scales_ref, C_ref);
+
+    const double pre_bytes = (double)n * k * (sizeof(float) + 16);
+    const double gemm_ops = 2.0 * m * k * n;
+    const double gemm_bytes = (double)m * k / 4;
+    char name[128];
+
+    auto same_lut = [=]() {
+        return memcmp(QLUT, QLUT_ref, (size_t)n * k * 16) == 0 &&
+               memcmp(LUT_Scales, LUT_Scales_ref, n * sizeof(bitnet_float_type)) == 0;
+    };
+    auto same_c = [=]() {
+        return memcmp(C, C_ref, (size_t)n * m * sizeof(bitnet_float_type)) == 0;
+    };
+
+    if (threads == 1) {
+        snprintf(name, sizeof(name), "ggml_preprocessor/%dx%d", m, k);
+        cases.push_back({
+            name, 1, n, (double)n * k, pre_bytes,
+            [=]() { run_preprocessor_serial(n, m, k, B, LUT_Scales, QLUT); },
+            [=]() { run_preprocessor_serial(n, m, k, B, LUT_Scales, QLUT); return same_lut(); },
+        });
+        snprintf(name, sizeof(name), "ggml_qgemm_lut/%dx%d", m, k);
+        cases.push_back({
+            name, 1, n, gemm_ops, gemm_bytes,
+            [=]() { run_qgemm_lut_serial(kern, n, A, QLUT_ref, Scales, LUT_Scales_ref, C); },
+            [=]() { run_qgemm_lut_serial(kern, n, A, QLUT_ref, Scales, LUT_Scales_ref, C); return same_c(); },
+        });
+        return;
+    }
+
+    auto run_pre = [=]() {
+        if (n == 1) {
+            ggml_preprocessor_threaded(m, k, B, LUT_Scales, QLUT);
+        } else {
+            ggml_preprocessor_batch_threaded(n, m, k, B, LUT_Scales, QLUT);
+        }
+    };
+    snprintf(name, sizeof(name), "ggml_preprocessor_threaded/%dx%d", m, k);
+    cases.push_back({
+        name, threads, n, (double)n * k, pre_bytes,
+        run_pre,
+        [=]() { run_pre(); return same_lut(); },
+    });
+
+    auto run_gemm = [=]() {
+        if (n == 1) {
+            bitnet_qgemm_lut_threaded(kern->tbl_impl, m, k, kern->BM, kern->BK, A, QLUT_ref, Scales, LUT_Scales_ref, C);
+        } else {
+            bitnet_qgemm_lut_batch_threaded(kern->tbl_impl_batch, n, m, k, kern->BM, kern->BK, A, QLUT_ref, Scales, LUT_Scales_ref, C);
+        }
+    };
+    snprintf(name, sizeof(name), "%s/%dx%d", n == 1 ? "bitnet_qgemm_lut_threaded" : "bitnet_qgemm_lut_batch_threaded", m, k);
+    cases.push_back({
+        name, threads, n, gemm_ops, gemm_bytes,
+        run_gemm,
+        [=]() { run_gemm(); return same_c(); },
+    });
+
+    // Two matmuls reading one activation, as Q and K do: the second reuses
+    // the LUT of the first. The check then negates the activation in
+    // place and runs the pair again without planning a graph, as a reused
+    // graph does on the next token, which must not hit the old LUT.
+    {
+        ggml_tensor * q_weight = bench_tensor(kern, A, Scales);
+        ggml_tensor * k_weight = bench_tensor(kern, A, Scales);
+        ggml_tensor * act = buf.alloc<ggml_tensor>(1);
+        memset(act, 0, sizeof(*act));
+        act->type = GGML_TYPE_F32;
+        act->ne[0] = k;
+        act->ne[1] = n;
+        act->data = B;
+        int8_t * QLUT_neg = buf.alloc<int8_t>((size_t)n * k * 16);
+        bitnet_float_type * LUT_Scales_neg = buf.alloc<bitnet_float_type>(n);
+        auto run_init = [=](void ** q, void ** sc) {
+            *q = QLUT;
+            *sc = LUT_Scales;
+            ggml_bitnet_mul_mat_task_init_tensor(q_weight, act, q, sc, n, k, m);
+            void * q2 = QLUT;
+            void * sc2 = LUT_Scales;
+            ggml_bitnet_mul_mat_task_init_tensor(k_weight, act, &q2, &sc2, n, k, m);
+            return q2 == *q && sc2 == *sc;
+        };
+        auto same_lut_at = [=](const void * q, const void * sc, const int8_t * q_ref, const bitnet_float_type * sc_ref) {
+            return memcmp(q, q_ref, (size_t)n * k * 16) == 0 && memcmp(sc, sc_ref, n * sizeof(bitnet_float_type)) == 0;
+        };
+        snprintf(name, sizeof(name), "ggml_bitnet_mul_mat_task_init_tensor/%dx%d", m, k);
+        cases.push_back({
+            name, threads, n, 2.0 * n * k, 2 * pre_bytes,
+            [=]() { void * q; void * sc; run_init(&q, &sc); },
+            [=]() {
+                void * q;
+                void * sc;
+                bool ok = run_init(&q, &sc) && same_lut_at(q, sc, QLUT_ref, LUT_Scales_ref);
+                for (size_t i = 0; i < (size_t)n * k; i++) {
+                    B[i] = -B[i];
+                }
+                run_preprocessor_serial(n, m, k, B, LUT_Scales_neg, QLUT_neg);
+                ok = ok && run_init(&q, &sc) && same_lut_at(q, sc, QLUT_neg, LUT_Scales_neg);
+                for (size_t i = 0; i < (size_t)n * k; i++) {
+                    B[i] = -B[i];
+                }
+                return ok && run_init(&q, &sc) && same_lut_at(q, sc, QLUT_ref, LUT_Scales_ref);
+            },
+        });
+    }
+
+    // The same GEMM as ggml's mul_mat runs it, through the weight tensor
+    ggml_tensor * weight = bench_tensor(kern, A, Scales);
+    auto run_tensor = [=]() {
+        ggml_bitnet_mul_mat_task_compute_tensor(weight, QLUT_ref, LUT_Scales_ref, C, n, k, m, nullptr);
+    };
+    snprintf(name, sizeof(name), "ggml_bitnet_mul_mat_task_compute_tensor/%dx%d", m, k);
+    cases.push_back({
+        name, threads, n, gemm_ops, gemm_bytes,
+        run_tensor,
+        [=]() { run_tensor(); return same_c(); },
+    });
+
+    // The BitNet FFN's bias and squared ReLU fused into the GEMM, against
+    // the same ops applied to the serial output. Only rounding may differ:
+    // the bias may be added with a fused multiply-add.
+    {
+        float * bias = buf.alloc<float>(m);
+        float * Y = buf.alloc<float>((size_t)n * m);
+        fill_random(bias, m, rng);
+        const ggml_bitnet_epilogue epi = { bias, nullptr, GGML_BITNET_ACT_RELU_SQR, GGML_BITNET_OUT_F32, 0.0f };
+        auto run_epi = [=]() {
+            ggml_bitnet_mul_mat_task_compute_tensor(weight, QLUT_ref, LUT_Scales_ref, Y, n, k, m, &epi);
+        };
+        snprintf(name, sizeof(name), "ggml_bitnet_mul_mat_task_compute_tensor/relu2/%dx%d", m, k);
+        cases.push_back({
+            name, threads, n, gemm_ops, gemm_bytes,
+            run_epi,
+            [=]() {
+                run_epi();
+                for (int c = 0; c < n; c++) {
+                    for (int r = 0; r < m; r++) {
+                        const float x = std::max(C_ref[(size_t)c * m + r] + bias[r], 0.0f);
+                        if (std::fabs(Y[(size_t)c * m + r] - x * x) > 1e-5f * std::max(1.0f, x * x)) {
+                            return false;
+                        }
+                    }
+                }
+                return true;
+            },
+        });
+    }
+
+    // Two weights multiplied in turn, as consecutive matmuls of a graph:
+    // after the first round each learns the other follows it, and decode
+    // calls prefetch the head of the other's tiles
+    if (n <= BITNET_BATCH_CHUNK_COLS) {
+        uint8_t * A2 = buf.alloc<uint8_t>((size_t)m * k / 4);
+        bitnet_float_type * C2 = buf.alloc<bitnet_float_type>((size_t)n * m);
+        memcpy(A2, A, (size_t)m * k / 4);
+        ggml_tensor * first = bench_tensor(kern, A, Scales);
+        ggml_tensor * second = bench_tensor(kern, A2, Scales);
+        auto run_pair = [=]() {
+            ggml_bitnet_mul_mat_task_compute_tensor(first, QLUT_ref, LUT_Scales_ref, C, n, k, m, nullptr);
+            ggml_bitnet_mul_mat_task_compute_tensor(second, QLUT_ref, LUT_Scales_ref, C2, n, k, m, nullptr);
+        };
+        const char * prefetch_env = getenv("BITNET_PREFETCH");
+        const bool prefetch = prefetch_env == nullptr || atoll(prefetch_env) > 0;
+        snprintf(name, sizeof(name), "ggml_bitnet_mul_mat_task_compute_tensor/next/%dx%d", m, k);
+        cases.push_back({
+            name, threads, n, 2 * gemm_ops, 2 * gemm_bytes,
+            run_pair,
+            [=]() {
+                run_pair();
+                run_pair();
+                const bitnet_tensor_extra * a = (const bitnet_tensor_extra *)first->extra;
+                const bitnet_tensor_extra * b = (const bitnet_tensor_extra *)second->extra;
+                return a->next == b && b->next == a &&
+                       (bitnet_prefetch_bytes(a, n) > 0) == prefetch && (bitnet_prefetch_bytes(b, n) > 0) == prefetch &&
+                       same_c() && memcmp(C2, C_ref, (size_t)n * m * sizeof(bitnet_float_type)) == 0;
+            },
+        });
+    }
+}
+#endif
+
+#if defined(GGML_BITNET_X86_TL2)
+// Batch sizes the generated TL2 kernels are instantiated for
+static bool tl2_batch_supported(int n) {
+    return n == 1 || n == 8 || n == 32 || n == 128 || n == 256 || n == 512;
+}
+
+// Serial TL2 GEMM, one BM tile at a time: the three-weight part of K
+// (BK == three_k) writes the accumulators and the two-weight tail
+// (BK == two_k) adds to them and applies the scales
+static void run_qgemm_lut_tl2(const bitnet_lut_kernel * kern, int n, uint8_t * A3, uint8_t * sign, uint8_t * A2,
+                              int8_t * LUT3, int8_t * LUT2, float * Scales, float * LUT_Scales, float * C) {
+    const int BM = kern->BM;
+    for (int t = 0; t < kern->m / BM; t++) {
+        float * Ct = C + (size_t)t * BM;
+        ggml_qgemm_lut(n, kern->m, kern->k, kern->three_k, A3 + (size_t)t * BM * kern->three_k / 6,
+                       sign + (size_t)t * BM * kern->three_k / 24, LUT3, Scales, LUT_Scales, Ct);
+        ggml_qgemm_lut(n, kern->m, kern->k, kern->two_k, A2 + (size_t)t * BM * kern->two_k / 4,
+                       nullptr, LUT2, Scales, LUT_Scales, Ct);
+    }
+}
+
+static void add_tl2_cases(std::vector<bench_case> & cases, bench_buffers & buf, const bench_shape & sh, int threads, int n, std::mt19937 & rng, bool report) {
+    const bitnet_lut_kernel * kern = ggml_bitnet_get_lut_kernel(sh.m, sh.k);
+    if (kern == nullptr) {
+        if (report) {
+            fprintf(stderr, "bitnet-bench: no TL2 kernel generated for %dx%d, skipping\n", sh.m, sh.k);
+        }
+        return;
+    }
+    if (threads != 1 || !tl2_batch_supported(n)) {
+        return;
+    }
+    const int m = kern->m;
+    const int k = kern->k;
+    const int three_k = kern->three_k;
+    const int two_k = kern->two_k;
+
+    uint8_t * A3 = buf.alloc<uint8_t>((size_t)m * three_k / 6);
+    uint8_t * sign = buf.alloc<uint8_t>((size_t)m * three_k / 24);
+    uint8_t * A2 = buf.alloc<uint8_t>((size_t)m * two_k / 4);
+    float * B = buf.alloc<float>((size_t)n * k);
+    int8_t * LUT3 = buf.alloc<int8_t>((size_t)n * three_k / 3 * 32);
+    int8_t * LUT2 = buf.alloc<int8_t>((size_t)n * two_k / 2 * 32);
+    float * LUT_Scales = buf.alloc<float>(n);
+    float * Scales = buf.alloc<float>(1);
+    float * C = buf.alloc<float>((size_t)n * m);
+    fill_random(A3, (size_t)m * three_k / 6, rng);
+    fill_random(sign, (size_t)m * three_k / 24, rng);
+    fill_random(A2, (size_t)m * two_k / 4, rng);
+    fill_random(B, (size_t)n * k, rng);
+    Scales[0] = 1.0f;
+    ggml_preprocessor(n, m, three_k, two_k, B, LUT_Scales, LUT3, LUT2);
+
+    char name[128];
+    snprintf(name, sizeof(name), "ggml_preprocessor/%dx%d", m, k);
+    cases.push_back({
+        name, 1, n, (double)n * k, (double)n * k * sizeof(float),
+        [=]() { ggml_preprocessor(n, m, three_k, two_k, B, LUT_Scales, LUT3, LUT2); },
+        nullptr,
+    });
+    snprintf(name, sizeof(name), "ggml_qgemm_lut/%dx%d", m, k);
+    cases.push_back({
+        name, 1, n, 2.0 * m * k * n, (double)m * (three_k / 6 + three_k / 24 + two_k / 4),
+        [=]() { run_qgemm_lut_tl2(kern, n, A3, sign, A2, LUT3, LUT2, Scales, LUT_Scales, C); },
+        nullptr,
+    });
+}
+#endif
+
+static bool parse_args(int argc, char ** argv, bench_options & opt) {
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        const bool has_value = i + 1 < argc;
+        if (arg == "--config" && has_value) {
+            opt.config = argv[++i];
+        } else if (arg == "--threads" && has_value) {
+            opt.threads = parse_int_list(argv[++i]);
+        } else if (arg == "--batch" && has_value) {
+            opt.batch = parse_int_list(argv[++i]);
+        } else if (arg == "--filter" && has_value) {
+            opt.filter = argv[++i];
+        } else if (arg == "--min-time" && has_value) {
+            opt.min_time = atof(argv[++i]);
+        } else if (arg == "--reps" && has_value) {
+            opt.reps = std::max(1, atoi(argv[++i]));
+        } else {
+            fprintf(stderr,
+                    "usage: %s [--config FILE] [--threads 1,2,4] [--batch 1,4,8]\n"
+                    "          [--filter SUBSTR] [--min-time SECONDS] [--reps N]\n", argv[0]);
+            return false;
+        }
+    }
+    std::sort(opt.threads.begin(), opt.threads.end());
+    opt.threads.erase(std::unique(opt.threads.begin(), opt.threads.end()), opt.threads.end());
+    return !opt.threads.empty() && !opt.batch.empty();
+}
+
+int main(int argc, char ** argv) {
+    bench_options opt;
+    if (!parse_args(argc, argv, opt)) {
+        return 2;
+    }
+
+    const std::vector<bench_shape> shapes = load_shapes(opt.config);
+    if (shapes.empty()) {
+        fprintf(stderr, "bitnet-bench: no kernel shapes in %s\n", opt.config.c_str());
+        return 2;
+    }
+
+    const bitnet_cpu_features * cpu = bitnet_get_cpu_features();
+    printf("i2_s isa: %s  (avx2=%d avxvnni=%d avx512vnni=%d dotprod=%d i8mm=%d)\n", ggml_bitnet_i2_s_isa(),
+           cpu->avx2, cpu->avxvnni, cpu->avx512vnni, cpu->dotprod, cpu->i8mm);
+    printf("%-56s %7s %5s %12s %10s %9s %9s %6s\n", "Benchmark", "threads", "batch", "Time(us)", "Iters", "GOPS", "GB/s", "Check");
+    printf("%s\n", std::string(121, '-').c_str());
+
+    int failures = 0;
+    std::mt19937 rng(42);
+    for (int threads : opt.threads) {
+        bench_set_threads(threads);
+        for (const bench_shape & sh : shapes) {
+            for (int n : opt.batch) {
+                std::vector<bench_case> cases;
+                bench_buffers buf;
+                add_i2_s_cases(cases, buf, sh, threads, n, rng);
+#if defined(GGML_BITNET_ARM_TL1)
+                add_tl1_cases(cases, buf, sh, threads, n, rng, threads == opt.threads[0] && n == opt.batch[0]);
+#endif
+#if defined(GGML_BITNET_X86_TL2)
+                add_tl2_cases(cases, buf, sh, threads, n, rng, threads == opt.threads[0] && n == opt.batch[0]);
+#endif
+                for (const bench_case & c : cases) {
+                    if (!opt.filter.empty() && c.name.find(opt.filter) == std::string::npos) {
+                        continue;
+                    }
+                    const bool ok = !c.check || c.check();
+                    failures += ok ? 0 : 1;
+                    int64_t iters = 0;
+                    const double ns = bench_median_ns(c, opt, iters);
+                    printf("%-56s %7d %5d %12.2f %10lld %9.2f %9.2f %6s\n", c.name.c_str(), c.threads, c.batch, ns / 1e3,
+                           (long long)iters, c.ops / ns, c.bytes / ns, !c.check ? "-" : ok ? "ok" : "FAIL");
+                    fflush(stdout);
+                }
+            }
+        }
+    }
+
+    bitnet_threading_cleanup();
+    if (failures > 0) {
+        fprintf(stderr, "bitnet-bench: %d correctness check(s) failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
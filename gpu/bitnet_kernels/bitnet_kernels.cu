@@ -34,4 +34,132 @@ extern "C" void bitlinear_int8xint2(int8_t* input0, int8_t* input1, __nv_bfloat1
     else{
         std::cout << "required ladder gemm kernel: M " << M << ", N " << N << ", K " << K << std::endl;
     }
-}
\ No newline at end of file
+}
+
+extern "C" void bitlinear_rmsnorm_int8xint2(__nv_bfloat16* input0, __nv_bfloat16* norm_w, float eps, int8_t* input1, __nv_bfloat16* output0, __nv_bfloat16* ws, int M, int N, int K, cudaStream_t stream){
+    if (M == 1 && N == 3840 && K == 2560){
+        ladder_rmsnorm_int8xint2_kernel<1, 3840, 2560, 3, 8, 16><<<dim3(240, 1, 1), dim3(8, 16, 1), 0, stream>>>(input0, norm_w, eps, input1, output0, ws);
+    }
+    else if (M == 1 && N == 2560 && K == 2560){
+        ladder_rmsnorm_int8xint2_kernel<1, 2560, 2560, 1, 8, 16><<<dim3(160, 1, 1), dim3(8, 16, 1), 0, stream>>>(input0, norm_w, eps, input1, output0, ws);
+    }
+    else if (M == 1 && N == 13824 && K == 2560){
+        ladder_rmsnorm_int8xint2_kernel<1, 13824, 2560, 2, 8, 16><<<dim3(864, 1, 1), dim3(8, 16, 1), 0, stream>>>(input0, norm_w, eps, input1, output0, ws);
+    }
+    else if (M == 1 && N == 2560 && K == 6912){
+        ladder_rmsnorm_int8xint2_kernel<1, 2560, 6912, 1, 8, 16><<<dim3(160, 1, 1), dim3(8, 16, 1), 0, stream>>>(input0, norm_w, eps, input1, output0, ws);
+    }
+    else if(M == 1 && N == 4800 && K == 3200){
+        ladder_rmsnorm_int8xint2_kernel<1, 4800, 3200, 6, 8, 16><<<dim3(300, 1, 1), dim3(8, 16, 1), 0, stream>>>(input0, norm_w, eps, input1, output0, ws);
+    }
+    else if(M == 1 && N == 3200 && K == 3200){
+        ladder_rmsnorm_int8xint2_kernel<1, 3200, 3200, 1, 8, 16><<<dim3(200, 1, 1), dim3(8, 16, 1), 0, stream>>>(input0, norm_w, eps, input1, output0, ws);
+    }
+    else if(M == 1 && N == 20480 && K == 3200){
+        ladder_rmsnorm_int8xint2_kernel<1, 20480, 3200, 2, 8, 16><<<dim3(1280, 1, 1), dim3(8, 16, 1), 0, stream>>>(input0, norm_w, eps, input1, output0, ws);
+    }
+    else if(M == 1 && N == 3200 && K == 10240){
+        ladder_rmsnorm_int8xint2_kernel<1, 3200, 10240, 1, 8, 16><<<dim3(200, 1, 1), dim3(8, 16, 1), 0, stream>>>(input0, norm_w, eps, input1, output0, ws);
+    }
+    else if(M == 1 && N == 5120 && K == 27648){
+        ladder_rmsnorm_int8xint2_kernel<1, 5120, 27648, 1, 8, 16><<<dim3(320, 1, 1), dim3(8, 16, 1), 0, stream>>>(input0, norm_w, eps, input1, output0, ws);
+    }
+    else if(M == 1 && N == 55296 && K == 5120){
+        ladder_rmsnorm_int8xint2_kernel<1, 55296, 5120, 1, 8, 16><<<dim3(3456, 1, 1), dim3(8, 16, 1), 0, stream>>>(input0, norm_w, eps, input1, output0, ws);
+    }
+    else{
+        std::cout << "required ladder rmsnorm gemm kernel: M " << M << ", N " << N << ", K " << K << std::endl;
+    }
+}
+
+
+// Weight scales per output range, as the GEMV table above uses them
+static int bitlinear_ws_num(int N, int K){
+    if (N == 3840 && K == 2560) return 3;
+    if ((N == 13824 && K == 2560) || (N == 20480 && K == 3200)) return 2;
+    if (N == 4800 && K == 3200) return 6;
+    return 1;
+}
+
+struct bitlinear_gemm_config {
+    int BM, BN, BK;
+};
+
+// Tile shapes the GEMM is built for; gpu/kernel_tuning.py picks one per shape and GPU
+static const bitlinear_gemm_config bitlinear_gemm_configs[] = {
+    { 16,  64, 128 },
+    { 32,  64, 128 },
+    { 64,  64,  64 },
+    { 64, 128,  64 },
+    {128,  64,  64 },
+    {128, 128,  64 },
+};
+
+extern "C" int bitlinear_gemm_num_configs(){
+    return sizeof(bitlinear_gemm_configs) / sizeof(bitlinear_gemm_configs[0]);
+}
+
+extern "C" int bitlinear_gemm_config_tile(int config, int* bm, int* bn, int* bk){
+    if (config < 0 || config >= bitlinear_gemm_num_configs())
+        return -1;
+    *bm = bitlinear_gemm_configs[config].BM;
+    *bn = bitlinear_gemm_configs[config].BN;
+    *bk = bitlinear_gemm_configs[config].BK;
+    return 0;
+}
+
+template <int BM, int BN, int BK, int WARPS_M, int WARPS_N>
+static void bitlinear_gemm_launch(int8_t* input0, int8_t* input1, __nv_bfloat16* output0, __nv_bfloat16* s, __nv_bfloat16* ws, int* partial, int M, int N, int K, int ws_num, int k_tiles_per_split, int split_k, cudaStream_t stream){
+    dim3 grid(N / BN, (M + BM - 1) / BM, split_k);
+    ladder_int8xint2_gemm_kernel<BM, BN, BK, WARPS_M, WARPS_N><<<grid, dim3(WARPS_M * WARPS_N * 32, 1, 1), 0, stream>>>(input0, input1, output0, s, ws, partial, M, N, K, ws_num, k_tiles_per_split);
+}
+
+// The GEMM needs int8 mma.sync; on GPUs before sm_80 its kernel is empty
+extern "C" int bitlinear_gemm_supported(){
+    int device = 0, major = 0;
+    if (cudaGetDevice(&device) != cudaSuccess ||
+        cudaDeviceGetAttribute(&major, cudaDevAttrComputeCapabilityMajor, device) != cudaSuccess)
+        return 0;
+    return major >= 8;
+}
+
+// Returns 0 once launched, -1 when config cannot tile (M, N, K), split-K has no workspace
+// or the current GPU is older than sm_80.
+// workspace holds M x N int32 sums and is only needed for split_k > 1.
+extern "C" int bitlinear_int8xint2_gemm(int8_t* input0, int8_t* input1, __nv_bfloat16* output0, __nv_bfloat16* s, __nv_bfloat16* ws, int* workspace, int M, int N, int K, int config, int split_k, cudaStream_t stream){
+    if (config < 0 || config >= bitlinear_gemm_num_configs() || M < 1 || split_k < 1)
+        return -1;
+    if (!bitlinear_gemm_supported())
+        return -1;
+    const bitlinear_gemm_config& c = bitlinear_gemm_configs[config];
+    if (N % c.BN != 0 || K % c.BK != 0)
+        return -1;
+
+    // Splits without K tiles left would only add zeros
+    const int k_tiles = K / c.BK;
+    const int k_tiles_per_split = (k_tiles + split_k - 1) / split_k;
+    split_k = (k_tiles + k_tiles_per_split - 1) / k_tiles_per_split;
+    int* partial = nullptr;
+    if (split_k > 1){
+        if (workspace == nullptr)
+            return -1;
+        partial = workspace;
+        cudaMemsetAsync(partial, 0, (size_t)M * N * sizeof(int), stream);
+    }
+
+    const int ws_num = bitlinear_ws_num(N, K);
+    switch (config){
+        case 0: bitlinear_gemm_launch< 16,  64, 128, 1, 2>(input0, input1, output0, s, ws, partial, M, N, K, ws_num, k_tiles_per_split, split_k, stream); break;
+        case 1: bitlinear_gemm_launch< 32,  64, 128, 1, 2>(input0, input1, output0, s, ws, partial, M, N, K, ws_num, k_tiles_per_split, split_k, stream); break;
+        case 2: bitlinear_gemm_launch< 64,  64,  64, 2, 2>(input0, input1, output0, s, ws, partial, M, N, K, ws_num, k_tiles_per_split, split_k, stream); break;
+        case 3: bitlinear_gemm_launch< 64, 128,  64, 2, 2>(input0, input1, output0, s, ws, partial, M, N, K, ws_num, k_tiles_per_split, split_k, stream); break;
+        case 4: bitlinear_gemm_launch<128,  64,  64, 2, 2>(input0, input1, output0, s, ws, partial, M, N, K, ws_num, k_tiles_per_split, split_k, stream); break;
+        case 5: bitlinear_gemm_launch<128, 128,  64, 2, 4>(input0, input1, output0, s, ws, partial, M, N, K, ws_num, k_tiles_per_split, split_k, stream); break;
+    }
+
+    if (split_k > 1){
+        const size_t n = (size_t)M * N;
+        ladder_int8xint2_gemm_finalize<<<dim3((unsigned)((n + 255) / 256), 1, 1), dim3(256, 1, 1), 0, stream>>>(partial, output0, s, ws, M, N, ws_num);
+    }
+    return 0;
+}
@@ -80,4 +80,280 @@ __global__ void __launch_bounds__(128) ladder_int8xint2_kernel(int8_t* __restric
   int ws_idx = out_idx / (N / ws_num);
   if (threadIdx.x == 0)
     dtype_transform[out_idx] = (__nv_bfloat16)(((float)red_buf0[0])/(float)s[0]*(float)ws[ws_idx]);
-}
\ No newline at end of file
+}
+struct BlockSumOp {
+  __device__ float operator()(float a, float b) const { return a + b; }
+};
+
+struct BlockMaxOp {
+  __device__ float operator()(float a, float b) const { return fmaxf(a, b); }
+};
+
+// Reduces v over the thread block; every thread gets the result
+template <int n_threads, typename Op>
+__device__ float block_reduce(float v, float* red, Op op) {
+  const int tid = threadIdx.y * blockDim.x + threadIdx.x;
+  #pragma unroll
+  for (int offset = 16; offset > 0; offset /= 2) {
+    v = op(v, __shfl_xor_sync(0xffffffff, v, offset));
+  }
+  if ((tid & 31) == 0)
+    red[tid >> 5] = v;
+  __syncthreads();
+  v = red[0];
+  #pragma unroll
+  for (int i = 1; i < n_threads / 32; ++i) {
+    v = op(v, red[i]);
+  }
+  // red is reused by the next reduction
+  __syncthreads();
+  return v;
+}
+
+// RMSNorm + per-token int8 quantization + ladder_int8xint2_kernel + scale in
+// one launch, for decode where the per-matmul launches and the round trips
+// between them cost more than the weights take to stream. Each block
+// normalizes and quantizes the whole activation row into shared memory
+// itself: redoing K elements per block is cheaper than a grid-wide sync.
+template <int M, int N, int K, int ws_num, int K_block_size, int N_block_size>
+__global__ void __launch_bounds__(128) ladder_rmsnorm_int8xint2_kernel(__nv_bfloat16* __restrict__ X, __nv_bfloat16* __restrict__ norm_w, float eps, int8_t* __restrict__ B, __nv_bfloat16* __restrict__ dtype_transform, __nv_bfloat16* __restrict__ ws) {
+  constexpr int n_threads = K_block_size * N_block_size;
+  constexpr int K_per_loop = 16;
+  constexpr int wmma_K = 32;
+  constexpr int wmma_N = 16;
+  __shared__ __align__(16) signed char A_shared[K];
+  __shared__ float red[n_threads / 32];
+  const int tid = ((int)threadIdx.y) * K_block_size + ((int)threadIdx.x);
+
+  float sum_sq = 0.0f;
+  for (int k = tid; k < K; k += n_threads) {
+    const float v = __bfloat162float(X[k]);
+    sum_sq += v * v;
+  }
+  const float rstd = rsqrtf(block_reduce<n_threads>(sum_sq, red, BlockSumOp()) / K + eps);
+
+  float amax = 0.0f;
+  for (int k = tid; k < K; k += n_threads) {
+    amax = fmaxf(amax, fabsf(__bfloat162float(X[k]) * rstd * __bfloat162float(norm_w[k])));
+  }
+  const float s = 127.0f / fmaxf(block_reduce<n_threads>(amax, red, BlockMaxOp()), 1e-5f);
+
+  for (int k = tid; k < K; k += n_threads) {
+    const float q = rintf(__bfloat162float(X[k]) * rstd * __bfloat162float(norm_w[k]) * s);
+    A_shared[k] = (signed char)fminf(fmaxf(q, -128.0f), 127.0f);
+  }
+  __syncthreads();
+
+  int in_thread_C_local[1];
+  signed char A_local[K_per_loop];
+  int B_reshape_local[1];
+  signed char B_decode_local[K_per_loop];
+  int red_buf0[1];
+  in_thread_C_local[0] = 0;
+  #pragma unroll
+  for (int k_0 = 0; k_0 < K/(K_per_loop * K_block_size); ++k_0) {
+    *(int4*)(A_local + 0) = *(int4*)(A_shared + ((k_0 * K_per_loop * K_block_size) + (((int)threadIdx.x) * K_per_loop)));
+    B_reshape_local[0] = *(int*)(B + 
+      (((int)blockIdx.x) * N_block_size * K / 4) + 
+      (k_0 * K_block_size * K_per_loop * wmma_N / 4) +
+      ((((int)threadIdx.x) >> 1) * wmma_K * wmma_N / 4) +
+      ((((int)threadIdx.y) >> 3) * (wmma_K * wmma_N / 2) / 4) + 
+      ((((int)threadIdx.x) & 1) * (wmma_K * wmma_N / 4) / 4) + 
+      ((((int)threadIdx.y) & 7) * (wmma_K / 2) / 4)
+      );
+    decode_i2s_to_i8s(B_reshape_local, B_decode_local, 16);
+    #pragma unroll
+    for (int k_2_0 = 0; k_2_0 < 4; ++k_2_0) {
+      in_thread_C_local[0] = __dp4a(*(int *)&A_local[((k_2_0 * 4))],*(int *)&B_decode_local[((k_2_0 * 4))], in_thread_C_local[0]);
+    }
+  }
+  red_buf0[0] = in_thread_C_local[0];
+  #pragma unroll
+  for (int offset = K_block_size/2; offset > 0; offset /= 2) {
+    red_buf0[0] += __shfl_down_sync(__activemask(), red_buf0[0], offset, K_block_size);
+  }
+  int out_idx = ((((int)blockIdx.x) * N_block_size) + ((int)threadIdx.y));
+  int ws_idx = out_idx / (N / ws_num);
+  if (threadIdx.x == 0)
+    dtype_transform[out_idx] = (__nv_bfloat16)(((float)red_buf0[0])/s*(float)ws[ws_idx]);
+}
+
+// Tensor-core GEMM for prefill and batched decode: C[M, N] = A[M, K] x B[N, K]^T
+// with int8 activations and the permuted 2-bit weights the GEMV reads.
+// Every BN x BK weight tile is decoded into shared memory, next to the BM x BK
+// activation tile, and each warp runs m16n8k32 int8 mma.sync over its
+// (BM / WARPS_M) x (BN / WARPS_N) piece. The next K tile is fetched into
+// registers while the current one is multiplied.
+//
+// With split-K, blockIdx.z takes k_tiles_per_split of the K tiles and adds its
+// sums into partial, which ladder_int8xint2_gemm_finalize scales; integer adds
+// keep the result independent of the order the splits land in.
+template <int BM, int BN, int BK, int WARPS_M, int WARPS_N>
+__global__ void __launch_bounds__(WARPS_M * WARPS_N * 32) ladder_int8xint2_gemm_kernel(const int8_t* __restrict__ A, const int8_t* __restrict__ B, __nv_bfloat16* __restrict__ C, const __nv_bfloat16* __restrict__ s, const __nv_bfloat16* __restrict__ ws, int* __restrict__ partial, int M, int N, int K, int ws_num, int k_tiles_per_split) {
+#if defined(__CUDA_ARCH__) && __CUDA_ARCH__ >= 800
+  constexpr int n_threads = WARPS_M * WARPS_N * 32;
+  // A 16-byte pad per row keeps the fragment loads of a warp on distinct banks
+  constexpr int LDS = BK + 16;
+  constexpr int WTM = BM / WARPS_M;
+  constexpr int WTN = BN / WARPS_N;
+  constexpr int MI = WTM / 16;
+  constexpr int NI = WTN / 8;
+  // 16-byte loads per tile; a packed one holds 64 weights
+  constexpr int A_CHUNKS = BM * BK / 16;
+  constexpr int B_CHUNKS = BN * BK / 64;
+  constexpr int A_ITERS = (A_CHUNKS + n_threads - 1) / n_threads;
+  constexpr int B_ITERS = (B_CHUNKS + n_threads - 1) / n_threads;
+  static_assert(WTM % 16 == 0 && WTN % 8 == 0 && BN % 16 == 0 && BK % 32 == 0, "unsupported gemm tile");
+
+  __shared__ __align__(16) signed char As[2][BM][LDS];
+  __shared__ __align__(16) signed char Bs[2][BN][LDS];
+
+  const int tid = (int)threadIdx.x;
+  const int lane = tid & 31;
+  const int warp = tid >> 5;
+  const int wm = warp / WARPS_N;
+  const int wn = warp % WARPS_N;
+  const int g = lane >> 2;
+  const int tg = lane & 3;
+  const int n0 = (int)blockIdx.x * BN;
+  const int m0 = (int)blockIdx.y * BM;
+  const int kt0 = (int)blockIdx.z * k_tiles_per_split;
+  const int n_kt = min(K / BK - kt0, k_tiles_per_split);
+  if (n_kt <= 0)
+    return;
+
+  uint4 a_reg[A_ITERS];
+  uint4 b_reg[B_ITERS];
+
+  auto load = [&](int kt) {
+    #pragma unroll
+    for (int i = 0; i < A_ITERS; ++i) {
+      const int c = tid + i * n_threads;
+      const int row = c / (BK / 16);
+      a_reg[i] = make_uint4(0, 0, 0, 0);
+      if (c < A_CHUNKS && m0 + row < M)
+        a_reg[i] = *(const uint4*)(A + (size_t)(m0 + row) * K + kt * BK + (c % (BK / 16)) * 16);
+    }
+    #pragma unroll
+    for (int i = 0; i < B_ITERS; ++i) {
+      const int c = tid + i * n_threads;
+      // Each 16-row group of the tile is 4 * BK contiguous bytes of 16x32 blocks
+      if (c < B_CHUNKS)
+        b_reg[i] = *(const uint4*)(B + ((size_t)(n0 / 16 + c / (BK / 4)) * (K / 32) + kt * (BK / 32)) * 128 + (c % (BK / 4)) * 16);
+    }
+  };
+
+  auto store = [&](int buf) {
+    #pragma unroll
+    for (int i = 0; i < A_ITERS; ++i) {
+      const int c = tid + i * n_threads;
+      if (c < A_CHUNKS)
+        *(uint4*)&As[buf][c / (BK / 16)][(c % (BK / 16)) * 16] = a_reg[i];
+    }
+    #pragma unroll
+    for (int i = 0; i < B_ITERS; ++i) {
+      const int c = tid + i * n_threads;
+      if (c >= B_CHUNKS)
+        continue;
+      const uint words[4] = { b_reg[i].x, b_reg[i].y, b_reg[i].z, b_reg[i].w };
+      #pragma unroll
+      for (int w = 0; w < 4; ++w) {
+        // Word t of a 16x32 block holds row (t / 16) * 8 + t % 8, columns
+        // 16 * ((t % 16) / 8) + [0, 16), as pack_weight.py lays them out
+        const int q = (c % (BK / 4)) * 4 + w;
+        const int t = q % 32;
+        const int row = (c / (BK / 4)) * 16 + (t / 16) * 8 + t % 8;
+        const int col = (q / 32) * 32 + 16 * ((t % 16) / 8);
+        uint4 decoded;
+        decode_i2s_to_i8s(&words[w], (signed char*)&decoded, 16);
+        *(uint4*)&Bs[buf][row][col] = decoded;
+      }
+    }
+  };
+
+  int acc[MI][NI][4];
+  #pragma unroll
+  for (int mi = 0; mi < MI; ++mi)
+    #pragma unroll
+    for (int ni = 0; ni < NI; ++ni)
+      #pragma unroll
+      for (int r = 0; r < 4; ++r)
+        acc[mi][ni][r] = 0;
+
+  load(kt0);
+  store(0);
+  __syncthreads();
+
+  for (int i = 0; i < n_kt; ++i) {
+    const int buf = i & 1;
+    if (i + 1 < n_kt)
+      load(kt0 + i + 1);
+
+    #pragma unroll
+    for (int kk = 0; kk < BK; kk += 32) {
+      int af[MI][4];
+      int bf[NI][2];
+      #pragma unroll
+      for (int mi = 0; mi < MI; ++mi) {
+        const int row = wm * WTM + mi * 16 + g;
+        af[mi][0] = *(const int*)&As[buf][row][kk + tg * 4];
+        af[mi][1] = *(const int*)&As[buf][row + 8][kk + tg * 4];
+        af[mi][2] = *(const int*)&As[buf][row][kk + 16 + tg * 4];
+        af[mi][3] = *(const int*)&As[buf][row + 8][kk + 16 + tg * 4];
+      }
+      #pragma unroll
+      for (int ni = 0; ni < NI; ++ni) {
+        const int n = wn * WTN + ni * 8 + g;
+        bf[ni][0] = *(const int*)&Bs[buf][n][kk + tg * 4];
+        bf[ni][1] = *(const int*)&Bs[buf][n][kk + 16 + tg * 4];
+      }
+      #pragma unroll
+      for (int mi = 0; mi < MI; ++mi)
+        #pragma unroll
+        for (int ni = 0; ni < NI; ++ni)
+          asm volatile("mma.sync.aligned.m16n8k32.row.col.s32.s8.s8.s32 {%0, %1, %2, %3}, {%4, %5, %6, %7}, {%8, %9}, {%0, %1, %2, %3};\n"
+                       : "+r"(acc[mi][ni][0]), "+r"(acc[mi][ni][1]), "+r"(acc[mi][ni][2]), "+r"(acc[mi][ni][3])
+                       : "r"(af[mi][0]), "r"(af[mi][1]), "r"(af[mi][2]), "r"(af[mi][3]), "r"(bf[ni][0]), "r"(bf[ni][1]));
+    }
+
+    // The other buffer was last read before the previous barrier
+    if (i + 1 < n_kt)
+      store(buf ^ 1);
+    __syncthreads();
+  }
+
+  const int ws_group = N / ws_num;
+  #pragma unroll
+  for (int mi = 0; mi < MI; ++mi) {
+    #pragma unroll
+    for (int ni = 0; ni < NI; ++ni) {
+      const int col = n0 + wn * WTN + ni * 8 + tg * 2;
+      #pragma unroll
+      for (int h = 0; h < 2; ++h) {
+        const int row = m0 + wm * WTM + mi * 16 + g + 8 * h;
+        if (row >= M)
+          continue;
+        if (partial != nullptr) {
+          atomicAdd(&partial[(size_t)row * N + col], acc[mi][ni][2 * h]);
+          atomicAdd(&partial[(size_t)row * N + col + 1], acc[mi][ni][2 * h + 1]);
+        } else {
+          const float row_s = (float)s[row];
+          *(__nv_bfloat162*)&C[(size_t)row * N + col] = __floats2bfloat162_rn(
+            (float)acc[mi][ni][2 * h] / row_s * (float)ws[col / ws_group],
+            (float)acc[mi][ni][2 * h + 1] / row_s * (float)ws[(col + 1) / ws_group]);
+        }
+      }
+    }
+  }
+#endif
+}
+
+// Scales the split-K sums of ladder_int8xint2_gemm_kernel into C
+__global__ void ladder_int8xint2_gemm_finalize(const int* __restrict__ partial, __nv_bfloat16* __restrict__ C, const __nv_bfloat16* __restrict__ s, const __nv_bfloat16* __restrict__ ws, int M, int N, int ws_num) {
+  const size_t i = (size_t)blockIdx.x * blockDim.x + threadIdx.x;
+  if (i >= (size_t)M * N)
+    return;
+  const int row = (int)(i / N);
+  const int col = (int)(i % N);
+  C[i] = (__nv_bfloat16)((float)partial[i] / (float)s[row] * (float)ws[col / (N / ws_num)]);
+}
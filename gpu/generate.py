@@ -36,6 +36,8 @@ class GenArgs:
 
 class FastGen:
     GRAPH_WARMUPS: int = 1
+    # Decode steps between host checks for eos; every check waits for the GPU
+    EOS_CHECK_INTERVAL: int = 8
     tokenizer: Tokenizer
 
     @staticmethod
@@ -46,10 +48,13 @@ class FastGen:
         tokenizer_path: Optional[str] = None,
         num_layers: int = 13,
         use_full_vocab: bool = False,
+        kernel_prefill: bool = False,
     ) -> "FastGen":
         """
         Load a Llama or Code Llama checkpoint and return a new
-        generator for this model.
+        generator for this model. With kernel_prefill the prompt also runs
+        through the W2A8 kernels (the tensor-core GEMM) instead of the bf16
+        model, and the bf16 checkpoint is not loaded.
         """
         start_time = time.time()
 
@@ -60,16 +65,19 @@ class FastGen:
         torch.set_default_device(device)
         torch.set_default_dtype(torch.bfloat16)
 
-        prefill_model = fast.Transformer(model_args_prefill)
         decode_model = fast.Transformer(model_args_decode)
-
-        fp16_ckpt_path = str(Path(ckpt_dir) / "model_state_fp16.pt")
-        fp16_checkpoint = torch.load(fp16_ckpt_path, map_location="cpu")
         int2_ckpt_path = str(Path(ckpt_dir) / "model_state_int2.pt")
         int2_checkpoint = torch.load(int2_ckpt_path, map_location="cpu")
-        prefill_model.load_state_dict(fp16_checkpoint, strict=True)
         decode_model.load_state_dict(int2_checkpoint, strict=True)
 
+        if kernel_prefill:
+            prefill_model = decode_model
+        else:
+            prefill_model = fast.Transformer(model_args_prefill)
+            fp16_ckpt_path = str(Path(ckpt_dir) / "model_state_fp16.pt")
+            fp16_checkpoint = torch.load(fp16_ckpt_path, map_location="cpu")
+            prefill_model.load_state_dict(fp16_checkpoint, strict=True)
+
         torch.cuda.synchronize()
         print(f"loaded model in {time.time() - start_time:.2f} seconds")
         start_time = time.time()
@@ -93,6 +101,7 @@ class FastGen:
         self.tokenizer = tokenizer
         self._prefill_cuda_graph, self._prefill_compile_model, self._prefill_inputs, self._prefill_logits = None, None, None, None
         self._generate_cuda_graph, self._generate_compile_model, self._generate_inputs, self._generate_logits = None, None, None, None
+        self._generate_next = None
         self._cache = None
         start_time = time.time()
         self._prefill_compile_model = self.compile_prefill()
@@ -201,6 +210,8 @@ class FastGen:
                 attn_bias=self._generate_inputs[1],
                 cache=self._cache,
             )
+            # Greedy decoding picks the next token inside the graph too
+            self._generate_next = torch.argmax(self._generate_logits, dim=-1)
 
         def replay(tokens, seq_lens):
             self._generate_inputs[0].copy_(tokens)
@@ -237,7 +248,8 @@ class FastGen:
         kv_seqlen = bias.k_seqinfo.seqlen
         prompts = [prompt + [1] * (self.gen_args.prompt_length - len(prompt)) for prompt in prompts]
         tokens = torch.IntTensor(sum(prompts, [])).cuda()
-        out_tokens = torch.zeros((max_seq_length, bs), dtype=torch.int)
+        # Kept on the GPU so decode steps queue up without waiting on the host
+        out_tokens = torch.zeros((max_seq_length, bs), dtype=torch.int, device="cuda")
 
         stats = Stats()
         torch.cuda.synchronize()
@@ -264,28 +276,35 @@ class FastGen:
         stats.phase("decode" if use_cuda_graphs else "total")
 
         eos_id = self.tokenizer.eot_id
+        checked = 0  # rows before this one hold no eos
         for niter in range(1, gen_length):
             kv_seqlen.add_(kv_seqlen < max_seq_length)
             output = self._generate_compile_model(next_token, kv_seqlen)
 
-            logits = output.view(bs, self.model_args.vocab_size)
-
             if use_sampling:
+                logits = output.view(bs, self.model_args.vocab_size)
                 temp = 0.7
                 top_p = 0.95
                 probs = torch.softmax(logits / temp, dim=-1)
                 next_token = sample_utils.top_p(probs, top_p)
             else:
-                next_token = torch.argmax(logits, dim=-1)
+                next_token = self._generate_next
 
             next_token = next_token.reshape(bs)
             out_tokens[niter, :] = next_token
 
-            if next_token.eq(eos_id).any():
-                break
+            # trim_answer cuts the tokens decoded past eos
+            if niter % self.EOS_CHECK_INTERVAL == 0:
+                if out_tokens[checked : niter + 1].eq(eos_id).any():
+                    break
+                checked = niter + 1
 
+        # Every sequence counts its tokens up to its first eos, which the
+        # loop may have run past by up to EOS_CHECK_INTERVAL steps
+        is_eos = out_tokens[: niter + 1].eq(eos_id)
+        n_tokens = torch.where(is_eos.any(dim=0), is_eos.int().argmax(dim=0) + 1, niter + 1)
         torch.cuda.synchronize()
-        stats.end_phase(tokens=niter * bs)
+        stats.end_phase(tokens=int(n_tokens.sum()))
 
         def trim_answer(prompt_len, tokens):
             # print(prompt, tokens)
@@ -319,13 +338,13 @@ def get_prompts(interactive: bool) -> Iterable[list[str]]:
         ]
 
 
-def main(ckpt_dir: str, interactive: bool = False, chat_format: bool = False, sampling: bool = False):
+def main(ckpt_dir: str, interactive: bool = False, chat_format: bool = False, sampling: bool = False, kernel_prefill: bool = False):
 
     local_rank = 0
     device = f"cuda:{local_rank}"
     torch.cuda.set_device(local_rank)
 
-    g = FastGen.build(ckpt_dir, GenArgs(), device)
+    g = FastGen.build(ckpt_dir, GenArgs(), device, kernel_prefill=kernel_prefill)
 
     if chat_format:
         g.tokenizer = ChatFormat(g.tokenizer)
@@ -0,0 +1,224 @@
+"""On-device autotuner for the W2A8 tensor-core GEMM.
+
+The GEMM in bitnet_kernels/ is built for a few tile shapes (BM x BN x BK),
+each of which can also split K across thread blocks. Which one wins depends
+on the GPU and on the shape: the skinny 2560-wide projections leave most SMs
+idle unless K is split, the wide FFN ones prefer the largest tiles. For every
+weight shape of the model and every batch size in --batch this times each
+valid (tile, split-K) pair on the GPU it runs on, after checking it against
+a reference, and keeps the fastest.
+
+Results are cached per GPU under ~/.cache/bitnet/kernels/<gpu>/gemm_tuning.json,
+where model.py looks them up; shapes or batch sizes without an entry fall
+back to a heuristic.
+
+usage: python kernel_tuning.py --batch 16,64,256,1024
+"""
+
+import argparse
+import ctypes
+import json
+import logging
+import re
+from pathlib import Path
+
+import torch
+
+logger = logging.getLogger("kernel_tuning")
+
+DEFAULT_CACHE_DIR = "~/.cache/bitnet/kernels"
+TUNING_FILE = "gemm_tuning.json"
+SPLIT_K_CHOICES = [1, 2, 4, 8]
+# Fewest K tiles worth giving a split
+MIN_K_TILES_PER_SPLIT = 4
+
+# (N, K) of the BitLinear layers: wqkv, wo, w13, w2
+MODEL_SHAPES = {
+    "2B": [(3840, 2560), (2560, 2560), (13824, 2560), (2560, 6912)],
+}
+
+
+def gpu_name(device=None):
+    """A stable name for the GPU, used as the cache key."""
+    props = torch.cuda.get_device_properties(device)
+    name = "{}-sm{}{}".format(props.name, props.major, props.minor)
+    return re.sub(r"[^A-Za-z0-9]+", "-", name).strip("-").lower()
+
+
+def gemm_configs(lib):
+    configs = []
+    for i in range(lib.bitlinear_gemm_num_configs()):
+        bm, bn, bk = ctypes.c_int(), ctypes.c_int(), ctypes.c_int()
+        lib.bitlinear_gemm_config_tile(i, ctypes.byref(bm), ctypes.byref(bn), ctypes.byref(bk))
+        configs.append((bm.value, bn.value, bk.value))
+    return configs
+
+
+def run_gemm(lib, input0, input1, s, ws, ret, workspace, config, split_k):
+    M, K = input0.shape
+    N = input1.shape[0]
+    stream = torch.cuda.current_stream()
+    status = lib.bitlinear_int8xint2_gemm(*[ctypes.c_void_p(input0.data_ptr()), ctypes.c_void_p(input1.data_ptr()),
+                                            ctypes.c_void_p(ret.data_ptr()), ctypes.c_void_p(s.data_ptr()),
+                                            ctypes.c_void_p(ws.data_ptr()),
+                                            ctypes.c_void_p(workspace.data_ptr() if workspace is not None else 0),
+                                            ctypes.c_int(M), ctypes.c_int(N), ctypes.c_int(K),
+                                            ctypes.c_int(config), ctypes.c_int(split_k),
+                                            ctypes.c_void_p(stream.cuda_stream)])
+    if status != 0:
+        raise RuntimeError(f"no W2A8 GEMM for M {M}, N {N}, K {K} with config {config}, split-K {split_k}")
+    return ret
+
+
+class GemmTuning:
+    """Picks (config, split-K) for a GEMM: the cached tuning of this GPU when
+    it has the shape, the heuristic otherwise."""
+
+    def __init__(self, lib, cache_dir=DEFAULT_CACHE_DIR, device=None):
+        self.lib = lib
+        self.configs = gemm_configs(lib)
+        self.n_sm = torch.cuda.get_device_properties(device).multi_processor_count
+        self.tuned = {}
+        path = Path(cache_dir).expanduser() / gpu_name(device) / TUNING_FILE
+        if path.exists():
+            with open(path) as f:
+                for entry in json.load(f)["shapes"]:
+                    best = entry["best"]
+                    # A rebuilt library may number its tiles differently
+                    if best["config"] >= len(self.configs) or self.configs[best["config"]] != (best["BM"], best["BN"], best["BK"]):
+                        continue
+                    self.tuned.setdefault((entry["N"], entry["K"]), []).append((entry["M"], best["config"], best["split_k"]))
+            for entries in self.tuned.values():
+                entries.sort()
+        self.cache = {}
+
+    def valid(self, config, N, K):
+        _, bn, bk = self.configs[config]
+        return N % bn == 0 and K % bk == 0
+
+    def heuristic(self, M, N, K):
+        # The tallest tile M fills, then the widest one that divides N
+        fits = [i for i in range(len(self.configs)) if self.valid(i, N, K)]
+        if not fits:
+            return None
+        smallest = min(self.configs[i][0] for i in fits)
+        filled = [i for i in fits if self.configs[i][0] <= max(M, smallest)]
+        config = max(filled or fits, key=lambda i: self.configs[i][:2])
+        bm, bn, bk = self.configs[config]
+        # Split K until the grid fills the SMs or the splits get too short
+        blocks = ((M + bm - 1) // bm) * (N // bn)
+        split_k = 1
+        while (split_k * 2 in SPLIT_K_CHOICES and blocks * split_k < self.n_sm
+               and K // bk // (split_k * 2) >= MIN_K_TILES_PER_SPLIT):
+            split_k *= 2
+        return config, split_k
+
+    def lookup(self, M, N, K):
+        key = (M, N, K)
+        if key not in self.cache:
+            choice = None
+            # The tuned batch size nearest above M, else the largest one
+            entries = self.tuned.get((N, K), [])
+            for tuned_m, config, split_k in entries:
+                if tuned_m >= M:
+                    choice = (config, split_k)
+                    break
+            if choice is None and entries:
+                choice = entries[-1][1:]
+            if choice is None or not self.valid(choice[0], N, K):
+                choice = self.heuristic(M, N, K)
+            self.cache[key] = choice
+        return self.cache[key]
+
+
+def reference(input0, weight, s, ws):
+    return ((input0.float() @ weight.float().T) / s.float() * ws.float()[0]).to(torch.bfloat16)
+
+
+def time_gemm(lib, args, config, split_k, reps):
+    run_gemm(lib, *args, config, split_k)
+    start, end = torch.cuda.Event(enable_timing=True), torch.cuda.Event(enable_timing=True)
+    start.record()
+    for _ in range(reps):
+        run_gemm(lib, *args, config, split_k)
+    end.record()
+    torch.cuda.synchronize()
+    return start.elapsed_time(end) * 1e3 / reps
+
+
+def tune(lib, shapes, batches, reps):
+    from pack_weight import convert_weight_int8_to_int2
+
+    configs = gemm_configs(lib)
+    results = []
+    for N, K in shapes:
+        weight = torch.randint(-1, 2, (N, K), dtype=torch.int8, device="cuda")
+        weight_compressed = convert_weight_int8_to_int2(weight).to("cuda")
+        ws = torch.ones(6, dtype=torch.bfloat16, device="cuda")
+        for M in batches:
+            input0 = torch.randint(-128, 127, (M, K), dtype=torch.int8, device="cuda")
+            s = torch.full((M, 1), 64, dtype=torch.bfloat16, device="cuda")
+            ret = torch.empty((M, N), dtype=torch.bfloat16, device="cuda")
+            workspace = torch.empty((M, N), dtype=torch.int32, device="cuda")
+            expected = reference(input0, weight, s, ws)
+            args = (input0, weight_compressed, s, ws, ret, workspace)
+
+            tried = []
+            for config, (bm, bn, bk) in enumerate(configs):
+                if N % bn != 0 or K % bk != 0:
+                    continue
+                for split_k in SPLIT_K_CHOICES:
+                    if split_k > 1 and K // bk // split_k < MIN_K_TILES_PER_SPLIT:
+                        continue
+                    ret.fill_(0)
+                    run_gemm(lib, *args, config, split_k)
+                    if not torch.equal(ret, expected):
+                        logger.warning(f"{N}x{K} M={M}: config {config} split-K {split_k} is wrong, skipped")
+                        continue
+                    us = time_gemm(lib, args, config, split_k, reps)
+                    tried.append({"config": config, "BM": bm, "BN": bn, "BK": bk, "split_k": split_k, "us": us})
+            if not tried:
+                raise RuntimeError(f"no GEMM config passed its check for {N}x{K} at M={M}")
+            best = min(tried, key=lambda t: t["us"])
+            logger.info("{}x{} M={}: BM={} BN={} BK={} split-K {} {:.1f} us".format(
+                N, K, M, best["BM"], best["BN"], best["BK"], best["split_k"], best["us"]))
+            results.append({"N": N, "K": K, "M": M, "best": best, "tried": tried})
+    return results
+
+
+def main():
+    args = parse_args()
+    logging.basicConfig(level=logging.INFO)
+    lib = ctypes.CDLL(args.lib)
+
+    cache_dir = Path(args.cache_dir).expanduser() / gpu_name()
+    path = cache_dir / TUNING_FILE
+    logger.info(f"Tuning cache: {path}")
+    if path.exists() and not args.force:
+        logger.info("Using the cached tuning, pass --force to tune again")
+        return
+
+    shapes = MODEL_SHAPES[args.model]
+    batches = [int(b) for b in args.batch.split(",")]
+    results = tune(lib, shapes, batches, args.reps)
+    cache_dir.mkdir(parents=True, exist_ok=True)
+    with open(path, "w") as f:
+        json.dump({"gpu": gpu_name(), "model": args.model, "shapes": results}, f, indent=2)
+
+
+def parse_args():
+    parser = argparse.ArgumentParser(description="Autotune the W2A8 GEMM tiles on this GPU")
+    parser.add_argument("--model", "-m", type=str, default="2B", choices=MODEL_SHAPES.keys(),
+                        help="Model whose weight shapes are tuned")
+    parser.add_argument("--batch", "-b", type=str, default="16,64,256,1024",
+                        help="Comma-separated token counts per GEMM to tune for")
+    parser.add_argument("--reps", type=int, default=50, help="Launches each candidate is timed over")
+    parser.add_argument("--lib", type=str, default="bitnet_kernels/libbitnet.so", help="The built kernel library")
+    parser.add_argument("--cache-dir", type=str, default=DEFAULT_CACHE_DIR,
+                        help="Where tunings are cached per GPU")
+    parser.add_argument("--force", action="store_true", help="Tune again even if a cached result exists")
+    return parser.parse_args()
+
+
+if __name__ == "__main__":
+    main()
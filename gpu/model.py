@@ -18,6 +18,24 @@ from xformers.ops.fmha.attn_bias import (
 import ctypes
 bitnet_lib = ctypes.CDLL('bitnet_kernels/libbitnet.so')
 
+from kernel_tuning import GemmTuning, run_gemm
+_gemm_tuning = None
+
+def bitnet_int8xint2_gemm(input0, input1, s, ws, ret):
+    # Prefill and batched decode: tensor-core GEMM with the tiles tuned for this GPU
+    global _gemm_tuning
+    if _gemm_tuning is None:
+        _gemm_tuning = GemmTuning(bitnet_lib, device=input0.device)
+
+    M, K = input0.shape
+    N = input1.shape[0]
+    choice = _gemm_tuning.lookup(M, N, K)
+    if choice is None:
+        raise RuntimeError(f"no W2A8 GEMM tile divides N {N}, K {K}")
+    config, split_k = choice
+    workspace = torch.empty((M, N), dtype=torch.int32, device=input0.device) if split_k > 1 else None
+    return run_gemm(bitnet_lib, input0, input1, s, ws, ret, workspace, config, split_k)
+
 def bitnet_int8xint2_linear(input0, input1, s, ws):
     out_shape = list(input0.shape)
     out_shape[-1] = input1.shape[0]
@@ -30,9 +48,32 @@ def bitnet_int8xint2_linear(input0, input1, s, ws):
     N = input1.shape[0]
     K = input1.shape[1] * 4
 
-    ret = torch.zeros(*out_shape, dtype=torch.bfloat16, device=input0.device)
+    # Every output is written, so no memset launch
+    ret = torch.empty(*out_shape, dtype=torch.bfloat16, device=input0.device)
+
+    if M > 1 and bitnet_lib.bitlinear_gemm_supported():
+        bitnet_int8xint2_gemm(input0.reshape(M, K), input1, s.reshape(M, 1), ws, ret.view(M, N))
+        return ret
+
+    # Decode, or prefill on GPUs before sm_80 one row at a time
+    for m in range(M):
+        bitnet_lib.bitlinear_int8xint2(*[ctypes.c_void_p(input0.data_ptr() + m * K), ctypes.c_void_p(input1.data_ptr()), ctypes.c_void_p(ret.data_ptr() + m * N * ret.element_size()), ctypes.c_void_p(s.data_ptr() + m * s.element_size()), ctypes.c_void_p(ws.data_ptr()), ctypes.c_int(1), ctypes.c_int(N), ctypes.c_int(K), ctypes.c_void_p(stream.cuda_stream)])
+
+    return ret
+
+def bitnet_rmsnorm_int8xint2_linear(input0, norm_weight, eps, input1, ws):
+    # RMSNorm, activation quantization and the GEMV in one launch; decode only
+    out_shape = list(input0.shape)
+    out_shape[-1] = input1.shape[0]
+
+    stream = torch.cuda.current_stream()
+
+    N = input1.shape[0]
+    K = input1.shape[1] * 4
+
+    ret = torch.empty(*out_shape, dtype=torch.bfloat16, device=input0.device)
 
-    bitnet_lib.bitlinear_int8xint2(*[ctypes.c_void_p(input0.data_ptr()), ctypes.c_void_p(input1.data_ptr()), ctypes.c_void_p(ret.data_ptr()), ctypes.c_void_p(s.data_ptr()), ctypes.c_void_p(ws.data_ptr()), ctypes.c_int(M), ctypes.c_int(N), ctypes.c_int(K), ctypes.c_void_p(stream.cuda_stream)])
+    bitnet_lib.bitlinear_rmsnorm_int8xint2(*[ctypes.c_void_p(input0.data_ptr()), ctypes.c_void_p(norm_weight.data_ptr()), ctypes.c_float(eps), ctypes.c_void_p(input1.data_ptr()), ctypes.c_void_p(ret.data_ptr()), ctypes.c_void_p(ws.data_ptr()), ctypes.c_int(1), ctypes.c_int(N), ctypes.c_int(K), ctypes.c_void_p(stream.cuda_stream)])
 
     return ret
 
@@ -70,7 +111,11 @@ class BitLinearKernel(nn.Module):
         s = 127 / input.abs().max(dim=-1, keepdim=True).values.clamp_(min=1e-5)
         return (input * s).round().clamp(-128, 127).to(torch.int8), s
 
-    def forward(self, input):
+    def forward(self, input, norm=None):
+        if norm is not None:
+            if input.dim() == 2 and input.shape[0] == 1 and input.is_contiguous():
+                return bitnet_rmsnorm_int8xint2_linear(input, norm.weight, norm.eps, self.weight, self.weight_scale)
+            input = norm(input)
         input, s = self.quant_input(input)
         return bitnet_int8xint2_linear(input, self.weight, s, self.weight_scale)
 
@@ -80,7 +125,9 @@ class BitLinear(nn.Linear):
         s = 127 / input.abs().max(dim=-1, keepdim=True).values.clamp_(min=1e-5)
         return (input * s).round().clamp(-128, 127) / s
 
-    def forward(self, input):
+    def forward(self, input, norm=None):
+        if norm is not None:
+            input = norm(input)
         input = self.quant_input(input)
         return F.linear(input, self.weight)
 
@@ -123,9 +170,12 @@ class Attention(nn.Module):
         x: torch.Tensor,
         cache: LayerCache,
         attn_bias: AttnBias,
+        norm: Optional[RMSNorm] = None,
     ) -> torch.Tensor:
 
-        xqkv = self.wqkv(x)
+        # Every projection takes the norm in front of it, which the decode
+        # kernels fuse into the GEMV
+        xqkv = self.wqkv(x, norm)
         xq = xqkv[:, : (self.n_local_heads * self.head_dim)]
         xkv = xqkv[:, (self.n_local_heads * self.head_dim) :]
         xk, xv = xkv.chunk(2, 1)
@@ -156,8 +206,7 @@ class Attention(nn.Module):
         )
 
         output = output.reshape(output_shape)
-        output = self.attn_sub_norm(output)
-        output = self.wo(output)
+        output = self.wo(output, self.attn_sub_norm)
 
         return output
 
@@ -189,11 +238,10 @@ class FeedForward(nn.Module):
         )
         self.ffn_sub_norm = RMSNorm(hidden_dim, norm_eps)
 
-    def forward(self, x: torch.Tensor) -> torch.Tensor:
-        x13 = self.w13(x)
+    def forward(self, x: torch.Tensor, norm: Optional[RMSNorm] = None) -> torch.Tensor:
+        x13 = self.w13(x, norm)
         x1, x3 = x13.chunk(2, -1)
-        inner = self.ffn_sub_norm(squared_relu(x1) * x3)
-        output = self.w2(inner)
+        output = self.w2(squared_relu(x1) * x3, self.ffn_sub_norm)
         return output
 
 
@@ -235,11 +283,12 @@ class TransformerBlock(nn.Module):
         attn_bias: AttnBias,
     ) -> torch.Tensor:
         h = x + self.attention.forward(
-            self.attention_norm(x),
+            x,
             cache,
             attn_bias,
+            self.attention_norm,
         )
-        out = h + self.feed_forward(self.ffn_norm(h))
+        out = h + self.feed_forward(h, self.ffn_norm)
         return out
 
 
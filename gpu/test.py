@@ -3,6 +3,7 @@ from torch.utils import benchmark
 from torch import nn
 
 from pack_weight import convert_weight_int8_to_int2
+from kernel_tuning import GemmTuning, gemm_configs, run_gemm
 from torch.profiler import profile, record_function, ProfilerActivity
 import ctypes
 import numpy as np
@@ -28,6 +29,23 @@ def bitnet_int8xint2_linear(input0, input1, s, ws, ret):
 
     return ret
 
+def bitnet_rmsnorm_int8xint2_linear(x, norm_w, eps, input1, ws, ret):
+    N = input1.shape[0]
+    K = input1.shape[1] * 4
+
+    stream = torch.cuda.current_stream()
+
+    bitnet_lib.bitlinear_rmsnorm_int8xint2(*[ctypes.c_void_p(x.data_ptr()), ctypes.c_void_p(norm_w.data_ptr()), ctypes.c_float(eps), ctypes.c_void_p(input1.data_ptr()), ctypes.c_void_p(ret.data_ptr()), ctypes.c_void_p(ws.data_ptr()), ctypes.c_int(1), ctypes.c_int(N), ctypes.c_int(K), ctypes.c_void_p(stream.cuda_stream)])
+
+    return ret
+
+def rmsnorm_int8xint2_reference(x, norm_w, eps, weight):
+    x = x.float()
+    y = x * torch.rsqrt(x.pow(2).mean(-1, keepdim=True) + eps) * norm_w.float()
+    s = 127 / y.abs().max(dim=-1, keepdim=True).values.clamp(min=1e-5)
+    q = (y * s).round().clamp(-128, 127)
+    return (q @ weight.float().T) / s
+
 if __name__ == '__main__':
     test_list = [
         (2560,  2560), 
@@ -60,6 +78,31 @@ if __name__ == '__main__':
 
             print(f'custom == np {torch.all(out==out_np)}')
 
+            x = torch.randn((1, K), dtype=torch.bfloat16, device='cuda')
+            norm_w = torch.rand(K, dtype=torch.bfloat16, device='cuda') + 0.5
+            ret = torch.empty((1,N), dtype=torch.bfloat16, device=x.device)
+            out = bitnet_rmsnorm_int8xint2_linear(x, norm_w, 1e-5, weight_compressed, ws, ret).float()
+            ref = rmsnorm_int8xint2_reference(x, norm_w, 1e-5, weight)
+            err = ((out - ref).norm() / ref.norm()).item()
+            print(f'fused rmsnorm == reference {err < 1e-2} (rel err {err:.2e})')
+
+            # Prefill / batched GEMM, every tile and a split of K, ragged M included
+            for M in (16, 100, 512):
+                input0 = torch.randint(-128,127,(M, K),dtype=torch.int8, device='cuda')
+                s = torch.full((M, 1), 64, dtype=torch.bfloat16, device='cuda')
+                ws = torch.ones(6, dtype=torch.bfloat16, device='cuda')
+                expected = ((input0.float() @ weight.float().T) / s.float()).to(torch.bfloat16)
+                ret = torch.empty((M, N), dtype=torch.bfloat16, device='cuda')
+                workspace = torch.empty((M, N), dtype=torch.int32, device='cuda')
+                ok = True
+                for config, (bm, bn, bk) in enumerate(gemm_configs(bitnet_lib)):
+                    if N % bn != 0 or K % bk != 0:
+                        continue
+                    for split_k in (1, 2):
+                        run_gemm(bitnet_lib, input0, weight_compressed, s, ws, ret, workspace, config, split_k)
+                        ok = ok and torch.equal(ret, expected)
+                print(f'gemm M={M} == reference {ok}')
+
         input0 = torch.randint(-128,127,(1, K),dtype=torch.int8, device='cuda')
         input0_fp16 = input0.to(torch.float16)
         input0_bf16 = input0.to(torch.bfloat16)
@@ -80,10 +123,41 @@ if __name__ == '__main__':
             num_threads=1,
         )
 
+        x = torch.randn((1, K), dtype=torch.bfloat16, device='cuda')
+        norm_w = torch.ones(K, dtype=torch.bfloat16, device='cuda')
+        t2 = benchmark.Timer(
+            stmt="bitnet_rmsnorm_int8xint2_linear(x, norm_w, 1e-5, weight_compressed, ws, ret)",
+            setup="from __main__ import x, norm_w, weight_compressed, ws, ret, bitnet_rmsnorm_int8xint2_linear",
+            num_threads=1,
+        )
+
         time0 = t0.timeit(50)
         time1 = t1.timeit(50)
+        time2 = t2.timeit(50)
+
+        print(f'Shape{N,K}, W2A8: {time0.mean * 1e6:.2f}us, torch BF16: {time1.mean * 1e6:.2f}us, fused RMSNorm+W2A8: {time2.mean * 1e6:.2f}us')
+
+        M = 512
+        input0 = torch.randint(-128,127,(M, K),dtype=torch.int8, device='cuda')
+        input0_bf16 = input0.to(torch.bfloat16)
+        s = torch.ones((M, 1), dtype=torch.bfloat16, device='cuda')
+        ret = torch.empty((M, N), dtype=torch.bfloat16, device='cuda')
+        workspace = torch.empty((M, N), dtype=torch.int32, device='cuda')
+        config, split_k = GemmTuning(bitnet_lib).lookup(M, N, K)
+        t3 = benchmark.Timer(
+            stmt="run_gemm(bitnet_lib, input0, weight_compressed, s, ws, ret, workspace, config, split_k)",
+            setup="from __main__ import bitnet_lib, input0, weight_compressed, s, ws, ret, workspace, config, split_k, run_gemm",
+            num_threads=1,
+        )
+        t4 = benchmark.Timer(
+            stmt="torch.matmul(input0_bf16,weight_bf16)",
+            setup="from __main__ import input0_bf16, weight_bf16",
+            num_threads=1,
+        )
+        time3 = t3.timeit(50)
+        time4 = t4.timeit(50)
 
-        print(f'Shape{N,K}, W2A8: {time0.mean * 1e6:.2f}us, torch BF16: {time1.mean * 1e6:.2f}us')
+        print(f'Shape{M,N,K}, W2A8 GEMM: {time3.mean * 1e6:.2f}us, torch BF16: {time4.mean * 1e6:.2f}us')
         # activities = [ ProfilerActivity.CUDA, 
         #             #   ProfilerActivity.CPU
         #               ]
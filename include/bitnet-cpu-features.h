@@ -0,0 +1,29 @@
+#pragma once
+
+// CPU features the BitNet kernels dispatch on. They are probed once, from
+// CPUID on x86 and getauxval(AT_HWCAP/AT_HWCAP2) on aarch64 Linux, so one
+// build can ship to every board and still pick the fastest kernel each
+// machine supports.
+struct bitnet_cpu_features {
+    bool avx2;
+    bool avxvnni;
+    bool avx512vnni;  // together with avx512bw
+    bool neon;
+    bool dotprod;
+    bool i8mm;
+};
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+// A comma separated BITNET_CPU_DISABLE (e.g. "avx512vnni,i8mm") masks
+// features off, for testing the slower variants on a newer machine
+const struct bitnet_cpu_features * bitnet_get_cpu_features(void);
+
+// Name of the variant ggml_vec_dot_i2_i8_s runs on this machine
+const char * ggml_bitnet_i2_s_isa(void);
+
+#ifdef  __cplusplus
+}
+#endif
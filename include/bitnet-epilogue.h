@@ -0,0 +1,9 @@
+#pragma once
+
+#include "ggml-bitnet.h"
+
+// ggml_bitnet_epilogue_rows for the int32 accumulators of the LUT kernels.
+// With epi NULL this stores (float)acc * scale, the expression the
+// generated qgemm_lut_* use, so threaded and serial results are identical.
+void bitnet_epilogue_rows_i32(const int32_t * acc, float scale, const ggml_bitnet_epilogue * epi,
+                              void * dst, int64_t col, int m, int row0, int n);
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "ggml-bitnet.h"
+
+// Extras of transformed tensors live in one arena per weight buffer, i.e.
+// per loaded model. Every extra gets its own cache line, and those of
+// consecutive tensors - the weights of one layer - are adjacent, so the
+// dispatch path touches one line per matmul. Arenas grow a block at a time
+// and hold any number of tensors.
+#define BITNET_EXTRAS_PER_BLOCK 256
+
+// A zeroed extra for tensor, owned by the arena of tensor->buffer
+bitnet_tensor_extra * bitnet_extras_alloc(const struct ggml_tensor * tensor);
+
+// Occupancy bitmap of n_blocks consecutive weight blocks of block_bytes
+// each, for bitnet_tensor_extra::occupancy: bit i is set unless every byte
+// of block i is empty, the packed form of all-zero weights. Returns NULL
+// unless BITNET_SPARSE=1 and some block is empty; the arena frees it with
+// the extra.
+uint8_t * bitnet_extras_occupancy(const uint8_t * qweights, int64_t n_blocks, size_t block_bytes, uint8_t empty);
+
+// Releases the arenas of every buffer, with the NUMA copies of their weights
+void bitnet_extras_release_all();
+
+// Bumped whenever extras are released; a thread that remembers an extra
+// across calls must forget it once this has changed
+uint64_t bitnet_extras_generation();
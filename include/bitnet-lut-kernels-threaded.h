@@ -1,27 +1,80 @@
 #pragma once
 
-#include "bitnet-lut-kernels.h"
+#include "ggml-bitnet.h"
 #include "bitnet-threading.h"
 
+#if defined(GGML_BITNET_ARM_TL1)
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-// Threaded versions of the LUT kernels
-int32_t qgemm_lut_3200_8640_threaded(void* A, void* LUT, void* Scales, void* LUT_Scales, void* C);
-int32_t qgemm_lut_3200_3200_threaded(void* A, void* LUT, void* Scales, void* LUT_Scales, void* C);
-int32_t qgemm_lut_8640_3200_threaded(void* A, void* LUT, void* Scales, void* LUT_Scales, void* C);
+// Largest BM tile any generated TL1 kernel uses
+#define BITNET_MAX_BM 512
+
+// Fewest K blocks a thread gets when a tile is split along K
+#define BITNET_MIN_K_BLOCKS_PER_SLICE 4
+
+// Most activation columns one batched work item accumulates. Every weight
+// K block is read once for all of them, so decode batches of many server
+// slots cost little more weight bandwidth than one; the int32 accumulators
+// (BITNET_MAX_BM per column) stay on the worker's stack.
+#define BITNET_BATCH_CHUNK_COLS 16
+
+// Most activation columns whose LUTs are built in GGML_BITNET_LUT_CHUNK
+// pieces spread over the pool; wider batches give every thread a column
+#define BITNET_LUT_SPLIT_MAX_COLS BITNET_BATCH_CHUNK_COLS
+
+// Generic threaded LUT GEMM over m rows (m / BM tiles). Tiles are spread
+// across the pool; when there are fewer tiles than threads each tile is also
+// split along K into private partial accumulators that are summed before
+// scaling. The output is bit-identical to the single-threaded kernel.
+int32_t bitnet_qgemm_lut_threaded(bitnet_tbl_impl_t tbl_impl, int m, int k, int BM, int BK,
+                                  void* A, void* LUT, void* Scales, void* LUT_Scales, void* C);
+
+// Bytes of pool scratch bitnet_qgemm_lut_threaded borrows for
+// split-K partials of an (m, k) weight on the current pool, 0 if none
+size_t bitnet_qgemm_lut_threaded_scratch_size(int m, int k, int BM, int BK);
+
+// Batched threaded LUT GEMM for n activation columns. Each work item runs
+// one BM tile against up to BITNET_BATCH_CHUNK_COLS columns, in evenly sized
+// groups of at most GGML_BITNET_TL1_MAX_BATCH, so every weight vector is
+// unpacked once per group instead of once per column.
+// C is column-major with m rows per column.
+int32_t bitnet_qgemm_lut_batch_threaded(bitnet_tbl_impl_batch_t tbl_impl_batch, int n, int m, int k, int BM, int BK,
+                                        void* A, void* LUT, void* Scales, void* LUT_Scales, void* C);
 
 // Threaded preprocessor functions
 void ggml_preprocessor_threaded(int m, int k, void* B, void* LUT_Scales, void* QLUT);
+// Builds the LUTs of n activation columns in parallel: a column per thread
+// when there are enough of them, otherwise in chunks of every column
+void ggml_preprocessor_batch_threaded(int n, int m, int k, void* B, void* LUT_Scales, void* QLUT);
 
 // Main threaded dispatch function
 void ggml_qgemm_lut_threaded(int m, int k, void* A, void* LUT, void* Scales, void* LUT_Scales, void* C);
 
 // Threaded matrix multiplication with automatic kernel selection
-void ggml_bitnet_mul_mat_threaded(void* src0, void* scales, void* qlut, void* lut_scales, 
-                                 void* lut_biases, void* dst, int n, int k, int m, int bits);
+void ggml_bitnet_mul_mat_threaded(void* src0, void* scales, void* qlut, void* lut_scales,
+                                 void* dst, int n, int k, int m);
+
+// Threaded matrix multiplication for a weight prepared by
+// ggml_bitnet_transform_tensor, tiled with the extra's BK and n_tile_num.
+// Weights it placed on NUMA nodes are read from the caller's node first.
+void ggml_bitnet_mul_mat_extra_threaded(const struct bitnet_tensor_extra* extra, void* qlut, void* lut_scales,
+                                        void* dst, int n, int k, int m);
+
+// ggml_bitnet_mul_mat_extra_threaded with epi applied to every output tile
+// while its accumulators are still in registers and L1; dst has epi->type
+// elements. epi NULL stores plain f32.
+void ggml_bitnet_mul_mat_extra_epilogue(const struct bitnet_tensor_extra* extra, void* qlut, void* lut_scales,
+                                        void* dst, int n, int k, int m, const struct ggml_bitnet_epilogue* epi);
+
+// Bytes of the next matmul's weights a call of extra over n columns
+// prefetches, 0 until extra has learned which matmul follows it
+int64_t bitnet_prefetch_bytes(const struct bitnet_tensor_extra* extra, int n);
 
 #ifdef __cplusplus
 }
 #endif
+
+#endif
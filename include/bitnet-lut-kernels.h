@@ -1,9 +1,8 @@
 #if defined(GGML_BITNET_ARM_TL1)
 #include "ggml-bitnet.h"
-#define GGML_BITNET_MAX_NODES 8192
+#include "bitnet-numa.h"
+#include "bitnet-extras.h"
 static bool initialized = false;
-static bitnet_tensor_extra * bitnet_tensor_extras = nullptr;
-static size_t bitnet_tensor_extras_index = 0;
 static void * aligned_malloc(size_t size) {{
 #if defined(_WIN32)
     return _aligned_malloc(size, 64);
@@ -21,18 +20,26 @@ static void aligned_free(void * ptr) {{
 #endif
 }}
 
-void per_tensor_quant(int k, void* lut_scales_, void* b_) {{
-    bitnet_float_type* lut_scales = (bitnet_float_type*)lut_scales_;
-    bitnet_float_type* b = (bitnet_float_type*)b_;
+// Abs-max of k activations, the reduction the LUT scale is taken from
+float lut_abs_max(int k, const bitnet_float_type* b) {{
 #ifdef __ARM_NEON
-    float32x4_t temp_max = vdupq_n_f32(0);
-    for (int i=0; i < k / 4; i++) {{
-      float32x4_t vec_bs = vld1q_f32(b + 4 * i);
-      float32x4_t abssum = vabsq_f32(vec_bs);
-      temp_max = vmaxq_f32(abssum, temp_max);
+    // four independent maxima so the loop is bound by loads, not vmaxq latency
+    float32x4_t temp_max0 = vdupq_n_f32(0);
+    float32x4_t temp_max1 = vdupq_n_f32(0);
+    float32x4_t temp_max2 = vdupq_n_f32(0);
+    float32x4_t temp_max3 = vdupq_n_f32(0);
+    int i = 0;
+    for (; i + 16 <= k; i += 16) {{
+      temp_max0 = vmaxq_f32(vabsq_f32(vld1q_f32(b + i)), temp_max0);
+      temp_max1 = vmaxq_f32(vabsq_f32(vld1q_f32(b + i + 4)), temp_max1);
+      temp_max2 = vmaxq_f32(vabsq_f32(vld1q_f32(b + i + 8)), temp_max2);
+      temp_max3 = vmaxq_f32(vabsq_f32(vld1q_f32(b + i + 12)), temp_max3);
+    }}
+    for (; i + 4 <= k; i += 4) {{
+      temp_max0 = vmaxq_f32(vabsq_f32(vld1q_f32(b + i)), temp_max0);
     }}
-    float32_t scales = 127 / vmaxvq_f32(temp_max);
-    *lut_scales = scales;
+    float32x4_t temp_max = vmaxq_f32(vmaxq_f32(temp_max0, temp_max1), vmaxq_f32(temp_max2, temp_max3));
+    return vmaxvq_f32(temp_max);
 #elif defined __AVX2__
     __m256 max_vec = _mm256_set1_ps(0.f);
     const __m256 vec_sign = _mm256_set1_ps(-0.0f);
@@ -45,11 +52,23 @@ void per_tensor_quant(int k, void* lut_scales_, void* b_) {{
     __m128 max1 = _mm_max_ps(_mm256_extractf128_ps(max_vec, 1), _mm256_castps256_ps128(max_vec));
     max1 = _mm_max_ps(max1, _mm_movehl_ps(max1, max1));
     max1 = _mm_max_ss(max1, _mm_movehdup_ps(max1));
-    float scales = 127 / _mm_cvtss_f32(max1);
-    *lut_scales = scales;
+    return _mm_cvtss_f32(max1);
+#else
+    float max = 0;
+    for (int i = 0; i < k; i++) {{
+        const float a = b[i] < 0 ? -b[i] : b[i];
+        max = a > max ? a : max;
+    }}
+    return max;
 #endif
 }}
 
+void per_tensor_quant(int k, void* lut_scales_, void* b_) {{
+    bitnet_float_type* lut_scales = (bitnet_float_type*)lut_scales_;
+    bitnet_float_type* b = (bitnet_float_type*)b_;
+    *lut_scales = 127 / lut_abs_max(k, b);
+}}
+
 void partial_max_reset(void* lut_scales_) {{
     bitnet_float_type* lut_scales = (bitnet_float_type*)lut_scales_;
     *lut_scales = 0.0;
@@ -291,12 +310,144 @@ int32_t qgemm_lut_14336_4096(void* A, void* LUT, void* Scales, void* LUT_Scales,
     for (int32_t k_outer = 0; k_outer < 4096 / BBK14336_4096; ++k_outer) {
         tbl_impl_14336_4096((&(((int32_t*)CBits)[0])), (&(((int8_t*)LUT)[(k_outer * BBK14336_4096 / 2 * 32)])), (&(((uint8_t*)A)[(k_outer * BBK14336_4096 / 2 / 2 * BM14336_4096)])));
     }
+    // One divide per tile; bitnet_epilogue_rows_i32 uses the same expression
+    const bitnet_float_type scale = ((bitnet_float_type*)Scales)[0] / ((bitnet_float_type*)LUT_Scales)[0];
 #pragma unroll
-    for (int i = 0; i < BM14336_4096; i++) {
-        ((bitnet_float_type*)C)[i] = (((int32_t*)CBits)[i]) / ((bitnet_float_type*)LUT_Scales)[0] * ((bitnet_float_type*)Scales)[0];
+    for (int i = 0; i < BM14336_4096; i += 4) {
+        vst1q_f32(((bitnet_float_type*)C) + i, vmulq_n_f32(vcvtq_f32_s32(vld1q_s32(((int32_t*)CBits) + i)), scale));
     }
   return 0;
 };
+
+template<int BATCH_SIZE>
+inline void tbl_impl_batch_14336_4096_b(int32_t* c, int8_t* lut, uint8_t* a) {
+#ifdef __ARM_NEON
+    const int KK = BBK14336_4096 / 2;
+    const int BM_ = BM14336_4096;
+    const int LUT_STRIDE = 4096 / 2 * 32;
+    const uint8x16_t vec_mask = vdupq_n_u8(0x0f);
+    const int8x16_t vec_zero = vdupq_n_s16(0x0000);
+    int16x8_t vec_c[BATCH_SIZE][4];
+
+#pragma unroll
+    for (int i = 0; i < BM14336_4096; i += 32) {
+#pragma unroll
+        for (int bs = 0; bs < BATCH_SIZE; bs++) {
+            #pragma unroll
+            for (int i=0; i<4; i++) {
+                vec_c[bs][i] = vandq_s16(vec_c[bs][i], vec_zero);
+            }
+        }
+
+#pragma unroll
+        for (int k = 0; k < KK / 4; k++) {
+            
+            uint8x16_t vec_a_0 = vld1q_u8(a + i * KK / 2 + k * 32 * 2 + 0 * 16);
+            uint8x16_t vec_a0_top = vshrq_n_u8(vec_a_0, 4);
+            uint8x16_t vec_a0_bot = vandq_u8(vec_a_0, vec_mask);
+#pragma unroll
+            for (int bs = 0; bs < BATCH_SIZE; bs++) {
+                const int8_t* lut_bs = lut + bs * LUT_STRIDE;
+                int8x16_t  vec_v_0_left_tmp0 = vqtbl1q_s8(vld1q_s8(lut_bs + (8 * k + 0) * 16), vec_a0_top);
+                int8x16_t  vec_v_0_left_tmp1 = vqtbl1q_s8(vld1q_s8(lut_bs + (8 * k + 1) * 16), vec_a0_top);
+                int8x16_t  vec_v_0_right_tmp0 = vqtbl1q_s8(vld1q_s8(lut_bs + (8 * k + 2) * 16), vec_a0_bot);
+                int8x16_t  vec_v_0_right_tmp1 = vqtbl1q_s8(vld1q_s8(lut_bs + (8 * k + 3) * 16), vec_a0_bot);
+                int8x16x2_t  vec_v_left_0 = vzipq_s8(vec_v_0_left_tmp1, vec_v_0_left_tmp0);
+                int8x16x2_t  vec_v_right_0 = vzipq_s8(vec_v_0_right_tmp1, vec_v_0_right_tmp0);
+                vec_c[bs][0] += vec_v_left_0.val[0];
+                vec_c[bs][0] += vec_v_right_0.val[0];
+                vec_c[bs][1] += vec_v_left_0.val[1];
+                vec_c[bs][1] += vec_v_right_0.val[1];
+            }
+        
+            uint8x16_t vec_a_1 = vld1q_u8(a + i * KK / 2 + k * 32 * 2 + 1 * 16);
+            uint8x16_t vec_a1_top = vshrq_n_u8(vec_a_1, 4);
+            uint8x16_t vec_a1_bot = vandq_u8(vec_a_1, vec_mask);
+#pragma unroll
+            for (int bs = 0; bs < BATCH_SIZE; bs++) {
+                const int8_t* lut_bs = lut + bs * LUT_STRIDE;
+                int8x16_t  vec_v_1_left_tmp0 = vqtbl1q_s8(vld1q_s8(lut_bs + (8 * k + 4) * 16), vec_a1_top);
+                int8x16_t  vec_v_1_left_tmp1 = vqtbl1q_s8(vld1q_s8(lut_bs + (8 * k + 5) * 16), vec_a1_top);
+                int8x16_t  vec_v_1_right_tmp0 = vqtbl1q_s8(vld1q_s8(lut_bs + (8 * k + 6) * 16), vec_a1_bot);
+                int8x16_t  vec_v_1_right_tmp1 = vqtbl1q_s8(vld1q_s8(lut_bs + (8 * k + 7) * 16), vec_a1_bot);
+                int8x16x2_t  vec_v_left_1 = vzipq_s8(vec_v_1_left_tmp1, vec_v_1_left_tmp0);
+                int8x16x2_t  vec_v_right_1 = vzipq_s8(vec_v_1_right_tmp1, vec_v_1_right_tmp0);
+                vec_c[bs][0] += vec_v_left_1.val[0];
+                vec_c[bs][0] += vec_v_right_1.val[0];
+                vec_c[bs][1] += vec_v_left_1.val[1];
+                vec_c[bs][1] += vec_v_right_1.val[1];
+            }
+        
+            uint8x16_t vec_a_2 = vld1q_u8(a + i * KK / 2 + k * 32 * 2 + 2 * 16);
+            uint8x16_t vec_a2_top = vshrq_n_u8(vec_a_2, 4);
+            uint8x16_t vec_a2_bot = vandq_u8(vec_a_2, vec_mask);
+#pragma unroll
+            for (int bs = 0; bs < BATCH_SIZE; bs++) {
+                const int8_t* lut_bs = lut + bs * LUT_STRIDE;
+                int8x16_t  vec_v_2_left_tmp0 = vqtbl1q_s8(vld1q_s8(lut_bs + (8 * k + 0) * 16), vec_a2_top);
+                int8x16_t  vec_v_2_left_tmp1 = vqtbl1q_s8(vld1q_s8(lut_bs + (8 * k + 1) * 16), vec_a2_top);
+                int8x16_t  vec_v_2_right_tmp0 = vqtbl1q_s8(vld1q_s8(lut_bs + (8 * k + 2) * 16), vec_a2_bot);
+                int8x16_t  vec_v_2_right_tmp1 = vqtbl1q_s8(vld1q_s8(lut_bs + (8 * k + 3) * 16), vec_a2_bot);
+                int8x16x2_t  vec_v_left_2 = vzipq_s8(vec_v_2_left_tmp1, vec_v_2_left_tmp0);
+                int8x16x2_t  vec_v_right_2 = vzipq_s8(vec_v_2_right_tmp1, vec_v_2_right_tmp0);
+                vec_c[bs][2] += vec_v_left_2.val[0];
+                vec_c[bs][2] += vec_v_right_2.val[0];
+                vec_c[bs][3] += vec_v_left_2.val[1];
+                vec_c[bs][3] += vec_v_right_2.val[1];
+            }
+        
+            uint8x16_t vec_a_3 = vld1q_u8(a + i * KK / 2 + k * 32 * 2 + 3 * 16);
+            uint8x16_t vec_a3_top = vshrq_n_u8(vec_a_3, 4);
+            uint8x16_t vec_a3_bot = vandq_u8(vec_a_3, vec_mask);
+#pragma unroll
+            for (int bs = 0; bs < BATCH_SIZE; bs++) {
+                const int8_t* lut_bs = lut + bs * LUT_STRIDE;
+                int8x16_t  vec_v_3_left_tmp0 = vqtbl1q_s8(vld1q_s8(lut_bs + (8 * k + 4) * 16), vec_a3_top);
+                int8x16_t  vec_v_3_left_tmp1 = vqtbl1q_s8(vld1q_s8(lut_bs + (8 * k + 5) * 16), vec_a3_top);
+                int8x16_t  vec_v_3_right_tmp0 = vqtbl1q_s8(vld1q_s8(lut_bs + (8 * k + 6) * 16), vec_a3_bot);
+                int8x16_t  vec_v_3_right_tmp1 = vqtbl1q_s8(vld1q_s8(lut_bs + (8 * k + 7) * 16), vec_a3_bot);
+                int8x16x2_t  vec_v_left_3 = vzipq_s8(vec_v_3_left_tmp1, vec_v_3_left_tmp0);
+                int8x16x2_t  vec_v_right_3 = vzipq_s8(vec_v_3_right_tmp1, vec_v_3_right_tmp0);
+                vec_c[bs][2] += vec_v_left_3.val[0];
+                vec_c[bs][2] += vec_v_right_3.val[0];
+                vec_c[bs][3] += vec_v_left_3.val[1];
+                vec_c[bs][3] += vec_v_right_3.val[1];
+            }
+        
+       }
+
+#pragma unroll
+        for (int bs = 0; bs < BATCH_SIZE; bs++) {
+            int32x4_t vec_v_bot_low_low_0 = vmovl_s16(vget_low_s16(vec_c[bs][0]));
+            int32x4_t vec_v_bot_low_high_0 = vmovl_high_s16(vec_c[bs][0]);
+            vst1q_s32(c + bs * BM_ + i + 0, vld1q_s32(c + bs * BM_ + i + 0) + vec_v_bot_low_low_0);
+            vst1q_s32(c + bs * BM_ + i + 4, vld1q_s32(c + bs * BM_ + i + 4) + vec_v_bot_low_high_0);
+            int32x4_t vec_v_bot_low_low_1 = vmovl_s16(vget_low_s16(vec_c[bs][1]));
+            int32x4_t vec_v_bot_low_high_1 = vmovl_high_s16(vec_c[bs][1]);
+            vst1q_s32(c + bs * BM_ + i + 8, vld1q_s32(c + bs * BM_ + i + 8) + vec_v_bot_low_low_1);
+            vst1q_s32(c + bs * BM_ + i + 12, vld1q_s32(c + bs * BM_ + i + 12) + vec_v_bot_low_high_1);
+            int32x4_t vec_v_bot_low_low_2 = vmovl_s16(vget_low_s16(vec_c[bs][2]));
+            int32x4_t vec_v_bot_low_high_2 = vmovl_high_s16(vec_c[bs][2]);
+            vst1q_s32(c + bs * BM_ + i + 16, vld1q_s32(c + bs * BM_ + i + 16) + vec_v_bot_low_low_2);
+            vst1q_s32(c + bs * BM_ + i + 20, vld1q_s32(c + bs * BM_ + i + 20) + vec_v_bot_low_high_2);
+            int32x4_t vec_v_bot_low_low_3 = vmovl_s16(vget_low_s16(vec_c[bs][3]));
+            int32x4_t vec_v_bot_low_high_3 = vmovl_high_s16(vec_c[bs][3]);
+            vst1q_s32(c + bs * BM_ + i + 24, vld1q_s32(c + bs * BM_ + i + 24) + vec_v_bot_low_low_3);
+            vst1q_s32(c + bs * BM_ + i + 28, vld1q_s32(c + bs * BM_ + i + 28) + vec_v_bot_low_high_3);
+        }
+
+    }
+#endif
+}
+
+inline void tbl_impl_batch_14336_4096(int32_t* c, int8_t* lut, uint8_t* a, int bs) {
+    switch (bs) {
+        case 4: tbl_impl_batch_14336_4096_b<4>(c, lut, a); break;
+        case 3: tbl_impl_batch_14336_4096_b<3>(c, lut, a); break;
+        case 2: tbl_impl_batch_14336_4096_b<2>(c, lut, a); break;
+        default: tbl_impl_batch_14336_4096_b<1>(c, lut, a); break;
+    }
+}
 #include <arm_neon.h>
 
 #define BM4096_14336 128
@@ -425,12 +576,160 @@ int32_t qgemm_lut_4096_14336(void* A, void* LUT, void* Scales, void* LUT_Scales,
     for (int32_t k_outer = 0; k_outer < 14336 / BBK4096_14336; ++k_outer) {
         tbl_impl_4096_14336((&(((int32_t*)CBits)[0])), (&(((int8_t*)LUT)[(k_outer * BBK4096_14336 / 2 * 32)])), (&(((uint8_t*)A)[(k_outer * BBK4096_14336 / 2 / 2 * BM4096_14336)])));
     }
+    // One divide per tile; bitnet_epilogue_rows_i32 uses the same expression
+    const bitnet_float_type scale = ((bitnet_float_type*)Scales)[0] / ((bitnet_float_type*)LUT_Scales)[0];
 #pragma unroll
-    for (int i = 0; i < BM4096_14336; i++) {
-        ((bitnet_float_type*)C)[i] = (((int32_t*)CBits)[i]) / ((bitnet_float_type*)LUT_Scales)[0] * ((bitnet_float_type*)Scales)[0];
+    for (int i = 0; i < BM4096_14336; i += 4) {
+        vst1q_f32(((bitnet_float_type*)C) + i, vmulq_n_f32(vcvtq_f32_s32(vld1q_s32(((int32_t*)CBits) + i)), scale));
     }
   return 0;
 };
+
+template<int BATCH_SIZE>
+inline void tbl_impl_batch_4096_14336_b(int32_t* c, int8_t* lut, uint8_t* a) {
+#ifdef __ARM_NEON
+    const int KK = BBK4096_14336 / 2;
+    const int BM_ = BM4096_14336;
+    const int LUT_STRIDE = 14336 / 2 * 32;
+    const uint8x16_t vec_mask = vdupq_n_u8(0x0f);
+    const int8x16_t vec_zero = vdupq_n_s16(0x0000);
+    int16x8_t vec_c[BATCH_SIZE][8];
+
+#pragma unroll
+    for (int i = 0; i < BM4096_14336; i += 64) {
+#pragma unroll
+        for (int bs = 0; bs < BATCH_SIZE; bs++) {
+            #pragma unroll
+            for (int i=0; i<8; i++) {
+                vec_c[bs][i] = vandq_s16(vec_c[bs][i], vec_zero);
+            }
+        }
+
+#pragma unroll
+        for (int k = 0; k < KK / 2; k++) {
+            
+            uint8x16_t vec_a_0 = vld1q_u8(a + i * KK / 2 + k * 32 * 2 + 0 * 16);
+            uint8x16_t vec_a0_top = vshrq_n_u8(vec_a_0, 4);
+            uint8x16_t vec_a0_bot = vandq_u8(vec_a_0, vec_mask);
+#pragma unroll
+            for (int bs = 0; bs < BATCH_SIZE; bs++) {
+                const int8_t* lut_bs = lut + bs * LUT_STRIDE;
+                int8x16_t  vec_v_0_left_tmp0 = vqtbl1q_s8(vld1q_s8(lut_bs + (4 * k + 0) * 16), vec_a0_top);
+                int8x16_t  vec_v_0_left_tmp1 = vqtbl1q_s8(vld1q_s8(lut_bs + (4 * k + 1) * 16), vec_a0_top);
+                int8x16_t  vec_v_0_right_tmp0 = vqtbl1q_s8(vld1q_s8(lut_bs + (4 * k + 2) * 16), vec_a0_bot);
+                int8x16_t  vec_v_0_right_tmp1 = vqtbl1q_s8(vld1q_s8(lut_bs + (4 * k + 3) * 16), vec_a0_bot);
+                int8x16x2_t  vec_v_left_0 = vzipq_s8(vec_v_0_left_tmp1, vec_v_0_left_tmp0);
+                int8x16x2_t  vec_v_right_0 = vzipq_s8(vec_v_0_right_tmp1, vec_v_0_right_tmp0);
+                vec_c[bs][0] += vec_v_left_0.val[0];
+                vec_c[bs][0] += vec_v_right_0.val[0];
+                vec_c[bs][1] += vec_v_left_0.val[1];
+                vec_c[bs][1] += vec_v_right_0.val[1];
+            }
+        
+            uint8x16_t vec_a_1 = vld1q_u8(a + i * KK / 2 + k * 32 * 2 + 1 * 16);
+            uint8x16_t vec_a1_top = vshrq_n_u8(vec_a_1, 4);
+            uint8x16_t vec_a1_bot = vandq_u8(vec_a_1, vec_mask);
+#pragma unroll
+            for (int bs = 0; bs < BATCH_SIZE; bs++) {
+                const int8_t* lut_bs = lut + bs * LUT_STRIDE;
+                int8x16_t  vec_v_1_left_tmp0 = vqtbl1q_s8(vld1q_s8(lut_bs + (4 * k + 0) * 16), vec_a1_top);
+                int8x16_t  vec_v_1_left_tmp1 = vqtbl1q_s8(vld1q_s8(lut_bs + (4 * k + 1) * 16), vec_a1_top);
+                int8x16_t  vec_v_1_right_tmp0 = vqtbl1q_s8(vld1q_s8(lut_bs + (4 * k + 2) * 16), vec_a1_bot);
+                int8x16_t  vec_v_1_right_tmp1 = vqtbl1q_s8(vld1q_s8(lut_bs + (4 * k + 3) * 16), vec_a1_bot);
+                int8x16x2_t  vec_v_left_1 = vzipq_s8(vec_v_1_left_tmp1, vec_v_1_left_tmp0);
+                int8x16x2_t  vec_v_right_1 = vzipq_s8(vec_v_1_right_tmp1, vec_v_1_right_tmp0);
+                vec_c[bs][2] += vec_v_left_1.val[0];
+                vec_c[bs][2] += vec_v_right_1.val[0];
+                vec_c[bs][3] += vec_v_left_1.val[1];
+                vec_c[bs][3] += vec_v_right_1.val[1];
+            }
+        
+            uint8x16_t vec_a_2 = vld1q_u8(a + i * KK / 2 + k * 32 * 2 + 2 * 16);
+            uint8x16_t vec_a2_top = vshrq_n_u8(vec_a_2, 4);
+            uint8x16_t vec_a2_bot = vandq_u8(vec_a_2, vec_mask);
+#pragma unroll
+            for (int bs = 0; bs < BATCH_SIZE; bs++) {
+                const int8_t* lut_bs = lut + bs * LUT_STRIDE;
+                int8x16_t  vec_v_2_left_tmp0 = vqtbl1q_s8(vld1q_s8(lut_bs + (4 * k + 0) * 16), vec_a2_top);
+                int8x16_t  vec_v_2_left_tmp1 = vqtbl1q_s8(vld1q_s8(lut_bs + (4 * k + 1) * 16), vec_a2_top);
+                int8x16_t  vec_v_2_right_tmp0 = vqtbl1q_s8(vld1q_s8(lut_bs + (4 * k + 2) * 16), vec_a2_bot);
+                int8x16_t  vec_v_2_right_tmp1 = vqtbl1q_s8(vld1q_s8(lut_bs + (4 * k + 3) * 16), vec_a2_bot);
+                int8x16x2_t  vec_v_left_2 = vzipq_s8(vec_v_2_left_tmp1, vec_v_2_left_tmp0);
+                int8x16x2_t  vec_v_right_2 = vzipq_s8(vec_v_2_right_tmp1, vec_v_2_right_tmp0);
+                vec_c[bs][4] += vec_v_left_2.val[0];
+                vec_c[bs][4] += vec_v_right_2.val[0];
+                vec_c[bs][5] += vec_v_left_2.val[1];
+                vec_c[bs][5] += vec_v_right_2.val[1];
+            }
+        
+            uint8x16_t vec_a_3 = vld1q_u8(a + i * KK / 2 + k * 32 * 2 + 3 * 16);
+            uint8x16_t vec_a3_top = vshrq_n_u8(vec_a_3, 4);
+            uint8x16_t vec_a3_bot = vandq_u8(vec_a_3, vec_mask);
+#pragma unroll
+            for (int bs = 0; bs < BATCH_SIZE; bs++) {
+                const int8_t* lut_bs = lut + bs * LUT_STRIDE;
+                int8x16_t  vec_v_3_left_tmp0 = vqtbl1q_s8(vld1q_s8(lut_bs + (4 * k + 0) * 16), vec_a3_top);
+                int8x16_t  vec_v_3_left_tmp1 = vqtbl1q_s8(vld1q_s8(lut_bs + (4 * k + 1) * 16), vec_a3_top);
+                int8x16_t  vec_v_3_right_tmp0 = vqtbl1q_s8(vld1q_s8(lut_bs + (4 * k + 2) * 16), vec_a3_bot);
+                int8x16_t  vec_v_3_right_tmp1 = vqtbl1q_s8(vld1q_s8(lut_bs + (4 * k + 3) * 16), vec_a3_bot);
+                int8x16x2_t  vec_v_left_3 = vzipq_s8(vec_v_3_left_tmp1, vec_v_3_left_tmp0);
+                int8x16x2_t  vec_v_right_3 = vzipq_s8(vec_v_3_right_tmp1, vec_v_3_right_tmp0);
+                vec_c[bs][6] += vec_v_left_3.val[0];
+                vec_c[bs][6] += vec_v_right_3.val[0];
+                vec_c[bs][7] += vec_v_left_3.val[1];
+                vec_c[bs][7] += vec_v_right_3.val[1];
+            }
+        
+       }
+
+#pragma unroll
+        for (int bs = 0; bs < BATCH_SIZE; bs++) {
+            int32x4_t vec_v_bot_low_low_0 = vmovl_s16(vget_low_s16(vec_c[bs][0]));
+            int32x4_t vec_v_bot_low_high_0 = vmovl_high_s16(vec_c[bs][0]);
+            vst1q_s32(c + bs * BM_ + i + 0, vld1q_s32(c + bs * BM_ + i + 0) + vec_v_bot_low_low_0);
+            vst1q_s32(c + bs * BM_ + i + 4, vld1q_s32(c + bs * BM_ + i + 4) + vec_v_bot_low_high_0);
+            int32x4_t vec_v_bot_low_low_1 = vmovl_s16(vget_low_s16(vec_c[bs][1]));
+            int32x4_t vec_v_bot_low_high_1 = vmovl_high_s16(vec_c[bs][1]);
+            vst1q_s32(c + bs * BM_ + i + 8, vld1q_s32(c + bs * BM_ + i + 8) + vec_v_bot_low_low_1);
+            vst1q_s32(c + bs * BM_ + i + 12, vld1q_s32(c + bs * BM_ + i + 12) + vec_v_bot_low_high_1);
+            int32x4_t vec_v_bot_low_low_2 = vmovl_s16(vget_low_s16(vec_c[bs][2]));
+            int32x4_t vec_v_bot_low_high_2 = vmovl_high_s16(vec_c[bs][2]);
+            vst1q_s32(c + bs * BM_ + i + 16, vld1q_s32(c + bs * BM_ + i + 16) + vec_v_bot_low_low_2);
+            vst1q_s32(c + bs * BM_ + i + 20, vld1q_s32(c + bs * BM_ + i + 20) + vec_v_bot_low_high_2);
+            int32x4_t vec_v_bot_low_low_3 = vmovl_s16(vget_low_s16(vec_c[bs][3]));
+            int32x4_t vec_v_bot_low_high_3 = vmovl_high_s16(vec_c[bs][3]);
+            vst1q_s32(c + bs * BM_ + i + 24, vld1q_s32(c + bs * BM_ + i + 24) + vec_v_bot_low_low_3);
+            vst1q_s32(c + bs * BM_ + i + 28, vld1q_s32(c + bs * BM_ + i + 28) + vec_v_bot_low_high_3);
+            int32x4_t vec_v_bot_low_low_4 = vmovl_s16(vget_low_s16(vec_c[bs][4]));
+            int32x4_t vec_v_bot_low_high_4 = vmovl_high_s16(vec_c[bs][4]);
+            vst1q_s32(c + bs * BM_ + i + 32, vld1q_s32(c + bs * BM_ + i + 32) + vec_v_bot_low_low_4);
+            vst1q_s32(c + bs * BM_ + i + 36, vld1q_s32(c + bs * BM_ + i + 36) + vec_v_bot_low_high_4);
+            int32x4_t vec_v_bot_low_low_5 = vmovl_s16(vget_low_s16(vec_c[bs][5]));
+            int32x4_t vec_v_bot_low_high_5 = vmovl_high_s16(vec_c[bs][5]);
+            vst1q_s32(c + bs * BM_ + i + 40, vld1q_s32(c + bs * BM_ + i + 40) + vec_v_bot_low_low_5);
+            vst1q_s32(c + bs * BM_ + i + 44, vld1q_s32(c + bs * BM_ + i + 44) + vec_v_bot_low_high_5);
+            int32x4_t vec_v_bot_low_low_6 = vmovl_s16(vget_low_s16(vec_c[bs][6]));
+            int32x4_t vec_v_bot_low_high_6 = vmovl_high_s16(vec_c[bs][6]);
+            vst1q_s32(c + bs * BM_ + i + 48, vld1q_s32(c + bs * BM_ + i + 48) + vec_v_bot_low_low_6);
+            vst1q_s32(c + bs * BM_ + i + 52, vld1q_s32(c + bs * BM_ + i + 52) + vec_v_bot_low_high_6);
+            int32x4_t vec_v_bot_low_low_7 = vmovl_s16(vget_low_s16(vec_c[bs][7]));
+            int32x4_t vec_v_bot_low_high_7 = vmovl_high_s16(vec_c[bs][7]);
+            vst1q_s32(c + bs * BM_ + i + 56, vld1q_s32(c + bs * BM_ + i + 56) + vec_v_bot_low_low_7);
+            vst1q_s32(c + bs * BM_ + i + 60, vld1q_s32(c + bs * BM_ + i + 60) + vec_v_bot_low_high_7);
+        }
+
+    }
+#endif
+}
+
+inline void tbl_impl_batch_4096_14336(int32_t* c, int8_t* lut, uint8_t* a, int bs) {
+    switch (bs) {
+        case 4: tbl_impl_batch_4096_14336_b<4>(c, lut, a); break;
+        case 3: tbl_impl_batch_4096_14336_b<3>(c, lut, a); break;
+        case 2: tbl_impl_batch_4096_14336_b<2>(c, lut, a); break;
+        default: tbl_impl_batch_4096_14336_b<1>(c, lut, a); break;
+    }
+}
 #include <arm_neon.h>
 
 #define BM1024_4096 256
@@ -543,12 +842,144 @@ int32_t qgemm_lut_1024_4096(void* A, void* LUT, void* Scales, void* LUT_Scales,
     for (int32_t k_outer = 0; k_outer < 4096 / BBK1024_4096; ++k_outer) {
         tbl_impl_1024_4096((&(((int32_t*)CBits)[0])), (&(((int8_t*)LUT)[(k_outer * BBK1024_4096 / 2 * 32)])), (&(((uint8_t*)A)[(k_outer * BBK1024_4096 / 2 / 2 * BM1024_4096)])));
     }
+    // One divide per tile; bitnet_epilogue_rows_i32 uses the same expression
+    const bitnet_float_type scale = ((bitnet_float_type*)Scales)[0] / ((bitnet_float_type*)LUT_Scales)[0];
 #pragma unroll
-    for (int i = 0; i < BM1024_4096; i++) {
-        ((bitnet_float_type*)C)[i] = (((int32_t*)CBits)[i]) / ((bitnet_float_type*)LUT_Scales)[0] * ((bitnet_float_type*)Scales)[0];
+    for (int i = 0; i < BM1024_4096; i += 4) {
+        vst1q_f32(((bitnet_float_type*)C) + i, vmulq_n_f32(vcvtq_f32_s32(vld1q_s32(((int32_t*)CBits) + i)), scale));
     }
   return 0;
 };
+
+template<int BATCH_SIZE>
+inline void tbl_impl_batch_1024_4096_b(int32_t* c, int8_t* lut, uint8_t* a) {
+#ifdef __ARM_NEON
+    const int KK = BBK1024_4096 / 2;
+    const int BM_ = BM1024_4096;
+    const int LUT_STRIDE = 4096 / 2 * 32;
+    const uint8x16_t vec_mask = vdupq_n_u8(0x0f);
+    const int8x16_t vec_zero = vdupq_n_s16(0x0000);
+    int16x8_t vec_c[BATCH_SIZE][4];
+
+#pragma unroll
+    for (int i = 0; i < BM1024_4096; i += 32) {
+#pragma unroll
+        for (int bs = 0; bs < BATCH_SIZE; bs++) {
+            #pragma unroll
+            for (int i=0; i<4; i++) {
+                vec_c[bs][i] = vandq_s16(vec_c[bs][i], vec_zero);
+            }
+        }
+
+#pragma unroll
+        for (int k = 0; k < KK / 4; k++) {
+            
+            uint8x16_t vec_a_0 = vld1q_u8(a + i * KK / 2 + k * 32 * 2 + 0 * 16);
+            uint8x16_t vec_a0_top = vshrq_n_u8(vec_a_0, 4);
+            uint8x16_t vec_a0_bot = vandq_u8(vec_a_0, vec_mask);
+#pragma unroll
+            for (int bs = 0; bs < BATCH_SIZE; bs++) {
+                const int8_t* lut_bs = lut + bs * LUT_STRIDE;
+                int8x16_t  vec_v_0_left_tmp0 = vqtbl1q_s8(vld1q_s8(lut_bs + (8 * k + 0) * 16), vec_a0_top);
+                int8x16_t  vec_v_0_left_tmp1 = vqtbl1q_s8(vld1q_s8(lut_bs + (8 * k + 1) * 16), vec_a0_top);
+                int8x16_t  vec_v_0_right_tmp0 = vqtbl1q_s8(vld1q_s8(lut_bs + (8 * k + 2) * 16), vec_a0_bot);
+                int8x16_t  vec_v_0_right_tmp1 = vqtbl1q_s8(vld1q_s8(lut_bs + (8 * k + 3) * 16), vec_a0_bot);
+                int8x16x2_t  vec_v_left_0 = vzipq_s8(vec_v_0_left_tmp1, vec_v_0_left_tmp0);
+                int8x16x2_t  vec_v_right_0 = vzipq_s8(vec_v_0_right_tmp1, vec_v_0_right_tmp0);
+                vec_c[bs][0] += vec_v_left_0.val[0];
+                vec_c[bs][0] += vec_v_right_0.val[0];
+                vec_c[bs][1] += vec_v_left_0.val[1];
+                vec_c[bs][1] += vec_v_right_0.val[1];
+            }
+        
+            uint8x16_t vec_a_1 = vld1q_u8(a + i * KK / 2 + k * 32 * 2 + 1 * 16);
+            uint8x16_t vec_a1_top = vshrq_n_u8(vec_a_1, 4);
+            uint8x16_t vec_a1_bot = vandq_u8(vec_a_1, vec_mask);
+#pragma unroll
+            for (int bs = 0; bs < BATCH_SIZE; bs++) {
+                const int8_t* lut_bs = lut + bs * LUT_STRIDE;
+                int8x16_t  vec_v_1_left_tmp0 = vqtbl1q_s8(vld1q_s8(lut_bs + (8 * k + 4) * 16), vec_a1_top);
+                int8x16_t  vec_v_1_left_tmp1 = vqtbl1q_s8(vld1q_s8(lut_bs + (8 * k + 5) * 16), vec_a1_top);
+                int8x16_t  vec_v_1_right_tmp0 = vqtbl1q_s8(vld1q_s8(lut_bs + (8 * k + 6) * 16), vec_a1_bot);
+                int8x16_t  vec_v_1_right_tmp1 = vqtbl1q_s8(vld1q_s8(lut_bs + (8 * k + 7) * 16), vec_a1_bot);
+                int8x16x2_t  vec_v_left_1 = vzipq_s8(vec_v_1_left_tmp1, vec_v_1_left_tmp0);
+                int8x16x2_t  vec_v_right_1 = vzipq_s8(vec_v_1_right_tmp1, vec_v_1_right_tmp0);
+                vec_c[bs][0] += vec_v_left_1.val[0];
+                vec_c[bs][0] += vec_v_right_1.val[0];
+                vec_c[bs][1] += vec_v_left_1.val[1];
+                vec_c[bs][1] += vec_v_right_1.val[1];
+            }
+        
+            uint8x16_t vec_a_2 = vld1q_u8(a + i * KK / 2 + k * 32 * 2 + 2 * 16);
+            uint8x16_t vec_a2_top = vshrq_n_u8(vec_a_2, 4);
+            uint8x16_t vec_a2_bot = vandq_u8(vec_a_2, vec_mask);
+#pragma unroll
+            for (int bs = 0; bs < BATCH_SIZE; bs++) {
+                const int8_t* lut_bs = lut + bs * LUT_STRIDE;
+                int8x16_t  vec_v_2_left_tmp0 = vqtbl1q_s8(vld1q_s8(lut_bs + (8 * k + 0) * 16), vec_a2_top);
+                int8x16_t  vec_v_2_left_tmp1 = vqtbl1q_s8(vld1q_s8(lut_bs + (8 * k + 1) * 16), vec_a2_top);
+                int8x16_t  vec_v_2_right_tmp0 = vqtbl1q_s8(vld1q_s8(lut_bs + (8 * k + 2) * 16), vec_a2_bot);
+                int8x16_t  vec_v_2_right_tmp1 = vqtbl1q_s8(vld1q_s8(lut_bs + (8 * k + 3) * 16), vec_a2_bot);
+                int8x16x2_t  vec_v_left_2 = vzipq_s8(vec_v_2_left_tmp1, vec_v_2_left_tmp0);
+                int8x16x2_t  vec_v_right_2 = vzipq_s8(vec_v_2_right_tmp1, vec_v_2_right_tmp0);
+                vec_c[bs][2] += vec_v_left_2.val[0];
+                vec_c[bs][2] += vec_v_right_2.val[0];
+                vec_c[bs][3] += vec_v_left_2.val[1];
+                vec_c[bs][3] += vec_v_right_2.val[1];
+            }
+        
+            uint8x16_t vec_a_3 = vld1q_u8(a + i * KK / 2 + k * 32 * 2 + 3 * 16);
+            uint8x16_t vec_a3_top = vshrq_n_u8(vec_a_3, 4);
+            uint8x16_t vec_a3_bot = vandq_u8(vec_a_3, vec_mask);
+#pragma unroll
+            for (int bs = 0; bs < BATCH_SIZE; bs++) {
+                const int8_t* lut_bs = lut + bs * LUT_STRIDE;
+                int8x16_t  vec_v_3_left_tmp0 = vqtbl1q_s8(vld1q_s8(lut_bs + (8 * k + 4) * 16), vec_a3_top);
+                int8x16_t  vec_v_3_left_tmp1 = vqtbl1q_s8(vld1q_s8(lut_bs + (8 * k + 5) * 16), vec_a3_top);
+                int8x16_t  vec_v_3_right_tmp0 = vqtbl1q_s8(vld1q_s8(lut_bs + (8 * k + 6) * 16), vec_a3_bot);
+                int8x16_t  vec_v_3_right_tmp1 = vqtbl1q_s8(vld1q_s8(lut_bs + (8 * k + 7) * 16), vec_a3_bot);
+                int8x16x2_t  vec_v_left_3 = vzipq_s8(vec_v_3_left_tmp1, vec_v_3_left_tmp0);
+                int8x16x2_t  vec_v_right_3 = vzipq_s8(vec_v_3_right_tmp1, vec_v_3_right_tmp0);
+                vec_c[bs][2] += vec_v_left_3.val[0];
+                vec_c[bs][2] += vec_v_right_3.val[0];
+                vec_c[bs][3] += vec_v_left_3.val[1];
+                vec_c[bs][3] += vec_v_right_3.val[1];
+            }
+        
+       }
+
+#pragma unroll
+        for (int bs = 0; bs < BATCH_SIZE; bs++) {
+            int32x4_t vec_v_bot_low_low_0 = vmovl_s16(vget_low_s16(vec_c[bs][0]));
+            int32x4_t vec_v_bot_low_high_0 = vmovl_high_s16(vec_c[bs][0]);
+            vst1q_s32(c + bs * BM_ + i + 0, vld1q_s32(c + bs * BM_ + i + 0) + vec_v_bot_low_low_0);
+            vst1q_s32(c + bs * BM_ + i + 4, vld1q_s32(c + bs * BM_ + i + 4) + vec_v_bot_low_high_0);
+            int32x4_t vec_v_bot_low_low_1 = vmovl_s16(vget_low_s16(vec_c[bs][1]));
+            int32x4_t vec_v_bot_low_high_1 = vmovl_high_s16(vec_c[bs][1]);
+            vst1q_s32(c + bs * BM_ + i + 8, vld1q_s32(c + bs * BM_ + i + 8) + vec_v_bot_low_low_1);
+            vst1q_s32(c + bs * BM_ + i + 12, vld1q_s32(c + bs * BM_ + i + 12) + vec_v_bot_low_high_1);
+            int32x4_t vec_v_bot_low_low_2 = vmovl_s16(vget_low_s16(vec_c[bs][2]));
+            int32x4_t vec_v_bot_low_high_2 = vmovl_high_s16(vec_c[bs][2]);
+            vst1q_s32(c + bs * BM_ + i + 16, vld1q_s32(c + bs * BM_ + i + 16) + vec_v_bot_low_low_2);
+            vst1q_s32(c + bs * BM_ + i + 20, vld1q_s32(c + bs * BM_ + i + 20) + vec_v_bot_low_high_2);
+            int32x4_t vec_v_bot_low_low_3 = vmovl_s16(vget_low_s16(vec_c[bs][3]));
+            int32x4_t vec_v_bot_low_high_3 = vmovl_high_s16(vec_c[bs][3]);
+            vst1q_s32(c + bs * BM_ + i + 24, vld1q_s32(c + bs * BM_ + i + 24) + vec_v_bot_low_low_3);
+            vst1q_s32(c + bs * BM_ + i + 28, vld1q_s32(c + bs * BM_ + i + 28) + vec_v_bot_low_high_3);
+        }
+
+    }
+#endif
+}
+
+inline void tbl_impl_batch_1024_4096(int32_t* c, int8_t* lut, uint8_t* a, int bs) {
+    switch (bs) {
+        case 4: tbl_impl_batch_1024_4096_b<4>(c, lut, a); break;
+        case 3: tbl_impl_batch_1024_4096_b<3>(c, lut, a); break;
+        case 2: tbl_impl_batch_1024_4096_b<2>(c, lut, a); break;
+        default: tbl_impl_batch_1024_4096_b<1>(c, lut, a); break;
+    }
+}
 #include <arm_neon.h>
 
 #define BM4096_4096 128
@@ -677,19 +1108,187 @@ int32_t qgemm_lut_4096_4096(void* A, void* LUT, void* Scales, void* LUT_Scales,
     for (int32_t k_outer = 0; k_outer < 4096 / BBK4096_4096; ++k_outer) {
         tbl_impl_4096_4096((&(((int32_t*)CBits)[0])), (&(((int8_t*)LUT)[(k_outer * BBK4096_4096 / 2 * 32)])), (&(((uint8_t*)A)[(k_outer * BBK4096_4096 / 2 / 2 * BM4096_4096)])));
     }
+    // One divide per tile; bitnet_epilogue_rows_i32 uses the same expression
+    const bitnet_float_type scale = ((bitnet_float_type*)Scales)[0] / ((bitnet_float_type*)LUT_Scales)[0];
 #pragma unroll
-    for (int i = 0; i < BM4096_4096; i++) {
-        ((bitnet_float_type*)C)[i] = (((int32_t*)CBits)[i]) / ((bitnet_float_type*)LUT_Scales)[0] * ((bitnet_float_type*)Scales)[0];
+    for (int i = 0; i < BM4096_4096; i += 4) {
+        vst1q_f32(((bitnet_float_type*)C) + i, vmulq_n_f32(vcvtq_f32_s32(vld1q_s32(((int32_t*)CBits) + i)), scale));
     }
   return 0;
 };
 
+template<int BATCH_SIZE>
+inline void tbl_impl_batch_4096_4096_b(int32_t* c, int8_t* lut, uint8_t* a) {
+#ifdef __ARM_NEON
+    const int KK = BBK4096_4096 / 2;
+    const int BM_ = BM4096_4096;
+    const int LUT_STRIDE = 4096 / 2 * 32;
+    const uint8x16_t vec_mask = vdupq_n_u8(0x0f);
+    const int8x16_t vec_zero = vdupq_n_s16(0x0000);
+    int16x8_t vec_c[BATCH_SIZE][8];
+
+#pragma unroll
+    for (int i = 0; i < BM4096_4096; i += 64) {
+#pragma unroll
+        for (int bs = 0; bs < BATCH_SIZE; bs++) {
+            #pragma unroll
+            for (int i=0; i<8; i++) {
+                vec_c[bs][i] = vandq_s16(vec_c[bs][i], vec_zero);
+            }
+        }
+
+#pragma unroll
+        for (int k = 0; k < KK / 2; k++) {
+            
+            uint8x16_t vec_a_0 = vld1q_u8(a + i * KK / 2 + k * 32 * 2 + 0 * 16);
+            uint8x16_t vec_a0_top = vshrq_n_u8(vec_a_0, 4);
+            uint8x16_t vec_a0_bot = vandq_u8(vec_a_0, vec_mask);
+#pragma unroll
+            for (int bs = 0; bs < BATCH_SIZE; bs++) {
+                const int8_t* lut_bs = lut + bs * LUT_STRIDE;
+                int8x16_t  vec_v_0_left_tmp0 = vqtbl1q_s8(vld1q_s8(lut_bs + (4 * k + 0) * 16), vec_a0_top);
+                int8x16_t  vec_v_0_left_tmp1 = vqtbl1q_s8(vld1q_s8(lut_bs + (4 * k + 1) * 16), vec_a0_top);
+                int8x16_t  vec_v_0_right_tmp0 = vqtbl1q_s8(vld1q_s8(lut_bs + (4 * k + 2) * 16), vec_a0_bot);
+                int8x16_t  vec_v_0_right_tmp1 = vqtbl1q_s8(vld1q_s8(lut_bs + (4 * k + 3) * 16), vec_a0_bot);
+                int8x16x2_t  vec_v_left_0 = vzipq_s8(vec_v_0_left_tmp1, vec_v_0_left_tmp0);
+                int8x16x2_t  vec_v_right_0 = vzipq_s8(vec_v_0_right_tmp1, vec_v_0_right_tmp0);
+                vec_c[bs][0] += vec_v_left_0.val[0];
+                vec_c[bs][0] += vec_v_right_0.val[0];
+                vec_c[bs][1] += vec_v_left_0.val[1];
+                vec_c[bs][1] += vec_v_right_0.val[1];
+            }
+        
+            uint8x16_t vec_a_1 = vld1q_u8(a + i * KK / 2 + k * 32 * 2 + 1 * 16);
+            uint8x16_t vec_a1_top = vshrq_n_u8(vec_a_1, 4);
+            uint8x16_t vec_a1_bot = vandq_u8(vec_a_1, vec_mask);
+#pragma unroll
+            for (int bs = 0; bs < BATCH_SIZE; bs++) {
+                const int8_t* lut_bs = lut + bs * LUT_STRIDE;
+                int8x16_t  vec_v_1_left_tmp0 = vqtbl1q_s8(vld1q_s8(lut_bs + (4 * k + 0) * 16), vec_a1_top);
+                int8x16_t  vec_v_1_left_tmp1 = vqtbl1q_s8(vld1q_s8(lut_bs + (4 * k + 1) * 16), vec_a1_top);
+                int8x16_t  vec_v_1_right_tmp0 = vqtbl1q_s8(vld1q_s8(lut_bs + (4 * k + 2) * 16), vec_a1_bot);
+                int8x16_t  vec_v_1_right_tmp1 = vqtbl1q_s8(vld1q_s8(lut_bs + (4 * k + 3) * 16), vec_a1_bot);
+                int8x16x2_t  vec_v_left_1 = vzipq_s8(vec_v_1_left_tmp1, vec_v_1_left_tmp0);
+                int8x16x2_t  vec_v_right_1 = vzipq_s8(vec_v_1_right_tmp1, vec_v_1_right_tmp0);
+                vec_c[bs][2] += vec_v_left_1.val[0];
+                vec_c[bs][2] += vec_v_right_1.val[0];
+                vec_c[bs][3] += vec_v_left_1.val[1];
+                vec_c[bs][3] += vec_v_right_1.val[1];
+            }
+        
+            uint8x16_t vec_a_2 = vld1q_u8(a + i * KK / 2 + k * 32 * 2 + 2 * 16);
+            uint8x16_t vec_a2_top = vshrq_n_u8(vec_a_2, 4);
+            uint8x16_t vec_a2_bot = vandq_u8(vec_a_2, vec_mask);
+#pragma unroll
+            for (int bs = 0; bs < BATCH_SIZE; bs++) {
+                const int8_t* lut_bs = lut + bs * LUT_STRIDE;
+                int8x16_t  vec_v_2_left_tmp0 = vqtbl1q_s8(vld1q_s8(lut_bs + (4 * k + 0) * 16), vec_a2_top);
+                int8x16_t  vec_v_2_left_tmp1 = vqtbl1q_s8(vld1q_s8(lut_bs + (4 * k + 1) * 16), vec_a2_top);
+                int8x16_t  vec_v_2_right_tmp0 = vqtbl1q_s8(vld1q_s8(lut_bs + (4 * k + 2) * 16), vec_a2_bot);
+                int8x16_t  vec_v_2_right_tmp1 = vqtbl1q_s8(vld1q_s8(lut_bs + (4 * k + 3) * 16), vec_a2_bot);
+                int8x16x2_t  vec_v_left_2 = vzipq_s8(vec_v_2_left_tmp1, vec_v_2_left_tmp0);
+                int8x16x2_t  vec_v_right_2 = vzipq_s8(vec_v_2_right_tmp1, vec_v_2_right_tmp0);
+                vec_c[bs][4] += vec_v_left_2.val[0];
+                vec_c[bs][4] += vec_v_right_2.val[0];
+                vec_c[bs][5] += vec_v_left_2.val[1];
+                vec_c[bs][5] += vec_v_right_2.val[1];
+            }
+        
+            uint8x16_t vec_a_3 = vld1q_u8(a + i * KK / 2 + k * 32 * 2 + 3 * 16);
+            uint8x16_t vec_a3_top = vshrq_n_u8(vec_a_3, 4);
+            uint8x16_t vec_a3_bot = vandq_u8(vec_a_3, vec_mask);
+#pragma unroll
+            for (int bs = 0; bs < BATCH_SIZE; bs++) {
+                const int8_t* lut_bs = lut + bs * LUT_STRIDE;
+                int8x16_t  vec_v_3_left_tmp0 = vqtbl1q_s8(vld1q_s8(lut_bs + (4 * k + 0) * 16), vec_a3_top);
+                int8x16_t  vec_v_3_left_tmp1 = vqtbl1q_s8(vld1q_s8(lut_bs + (4 * k + 1) * 16), vec_a3_top);
+                int8x16_t  vec_v_3_right_tmp0 = vqtbl1q_s8(vld1q_s8(lut_bs + (4 * k + 2) * 16), vec_a3_bot);
+                int8x16_t  vec_v_3_right_tmp1 = vqtbl1q_s8(vld1q_s8(lut_bs + (4 * k + 3) * 16), vec_a3_bot);
+                int8x16x2_t  vec_v_left_3 = vzipq_s8(vec_v_3_left_tmp1, vec_v_3_left_tmp0);
+                int8x16x2_t  vec_v_right_3 = vzipq_s8(vec_v_3_right_tmp1, vec_v_3_right_tmp0);
+                vec_c[bs][6] += vec_v_left_3.val[0];
+                vec_c[bs][6] += vec_v_right_3.val[0];
+                vec_c[bs][7] += vec_v_left_3.val[1];
+                vec_c[bs][7] += vec_v_right_3.val[1];
+            }
+        
+       }
+
+#pragma unroll
+        for (int bs = 0; bs < BATCH_SIZE; bs++) {
+            int32x4_t vec_v_bot_low_low_0 = vmovl_s16(vget_low_s16(vec_c[bs][0]));
+            int32x4_t vec_v_bot_low_high_0 = vmovl_high_s16(vec_c[bs][0]);
+            vst1q_s32(c + bs * BM_ + i + 0, vld1q_s32(c + bs * BM_ + i + 0) + vec_v_bot_low_low_0);
+            vst1q_s32(c + bs * BM_ + i + 4, vld1q_s32(c + bs * BM_ + i + 4) + vec_v_bot_low_high_0);
+            int32x4_t vec_v_bot_low_low_1 = vmovl_s16(vget_low_s16(vec_c[bs][1]));
+            int32x4_t vec_v_bot_low_high_1 = vmovl_high_s16(vec_c[bs][1]);
+            vst1q_s32(c + bs * BM_ + i + 8, vld1q_s32(c + bs * BM_ + i + 8) + vec_v_bot_low_low_1);
+            vst1q_s32(c + bs * BM_ + i + 12, vld1q_s32(c + bs * BM_ + i + 12) + vec_v_bot_low_high_1);
+            int32x4_t vec_v_bot_low_low_2 = vmovl_s16(vget_low_s16(vec_c[bs][2]));
+            int32x4_t vec_v_bot_low_high_2 = vmovl_high_s16(vec_c[bs][2]);
+            vst1q_s32(c + bs * BM_ + i + 16, vld1q_s32(c + bs * BM_ + i + 16) + vec_v_bot_low_low_2);
+            vst1q_s32(c + bs * BM_ + i + 20, vld1q_s32(c + bs * BM_ + i + 20) + vec_v_bot_low_high_2);
+            int32x4_t vec_v_bot_low_low_3 = vmovl_s16(vget_low_s16(vec_c[bs][3]));
+            int32x4_t vec_v_bot_low_high_3 = vmovl_high_s16(vec_c[bs][3]);
+            vst1q_s32(c + bs * BM_ + i + 24, vld1q_s32(c + bs * BM_ + i + 24) + vec_v_bot_low_low_3);
+            vst1q_s32(c + bs * BM_ + i + 28, vld1q_s32(c + bs * BM_ + i + 28) + vec_v_bot_low_high_3);
+            int32x4_t vec_v_bot_low_low_4 = vmovl_s16(vget_low_s16(vec_c[bs][4]));
+            int32x4_t vec_v_bot_low_high_4 = vmovl_high_s16(vec_c[bs][4]);
+            vst1q_s32(c + bs * BM_ + i + 32, vld1q_s32(c + bs * BM_ + i + 32) + vec_v_bot_low_low_4);
+            vst1q_s32(c + bs * BM_ + i + 36, vld1q_s32(c + bs * BM_ + i + 36) + vec_v_bot_low_high_4);
+            int32x4_t vec_v_bot_low_low_5 = vmovl_s16(vget_low_s16(vec_c[bs][5]));
+            int32x4_t vec_v_bot_low_high_5 = vmovl_high_s16(vec_c[bs][5]);
+            vst1q_s32(c + bs * BM_ + i + 40, vld1q_s32(c + bs * BM_ + i + 40) + vec_v_bot_low_low_5);
+            vst1q_s32(c + bs * BM_ + i + 44, vld1q_s32(c + bs * BM_ + i + 44) + vec_v_bot_low_high_5);
+            int32x4_t vec_v_bot_low_low_6 = vmovl_s16(vget_low_s16(vec_c[bs][6]));
+            int32x4_t vec_v_bot_low_high_6 = vmovl_high_s16(vec_c[bs][6]);
+            vst1q_s32(c + bs * BM_ + i + 48, vld1q_s32(c + bs * BM_ + i + 48) + vec_v_bot_low_low_6);
+            vst1q_s32(c + bs * BM_ + i + 52, vld1q_s32(c + bs * BM_ + i + 52) + vec_v_bot_low_high_6);
+            int32x4_t vec_v_bot_low_low_7 = vmovl_s16(vget_low_s16(vec_c[bs][7]));
+            int32x4_t vec_v_bot_low_high_7 = vmovl_high_s16(vec_c[bs][7]);
+            vst1q_s32(c + bs * BM_ + i + 56, vld1q_s32(c + bs * BM_ + i + 56) + vec_v_bot_low_low_7);
+            vst1q_s32(c + bs * BM_ + i + 60, vld1q_s32(c + bs * BM_ + i + 60) + vec_v_bot_low_high_7);
+        }
+
+    }
+#endif
+}
+
+inline void tbl_impl_batch_4096_4096(int32_t* c, int8_t* lut, uint8_t* a, int bs) {
+    switch (bs) {
+        case 4: tbl_impl_batch_4096_4096_b<4>(c, lut, a); break;
+        case 3: tbl_impl_batch_4096_4096_b<3>(c, lut, a); break;
+        case 2: tbl_impl_batch_4096_4096_b<2>(c, lut, a); break;
+        default: tbl_impl_batch_4096_4096_b<1>(c, lut, a); break;
+    }
+}
+
+// Abs-max and LUT construction back to back on one column: the int8 LUT
+// needs the column-wide scale first, and the max sweep leaves B in L1 for
+// lut_ctor. per_tensor_quant writes the scale, so no reset is needed.
 template<int K>
 void preprocessor_k(void* B, void* LUT_Scales, void* QLUT) {{
-  partial_max_reset((&(((bitnet_float_type*)LUT_Scales)[0])));
-  per_tensor_quant(K, (&(((bitnet_float_type*)LUT_Scales)[0])), (&(((bitnet_float_type*)B)[0])));
-  
-  lut_ctor<K>((&(((int8_t*)QLUT)[0])), (&(((bitnet_float_type*)B)[0])), (&(((bitnet_float_type*)LUT_Scales)[0])));
+  bitnet_float_type* b = (bitnet_float_type*)B;
+  bitnet_float_type* lut_scales = (bitnet_float_type*)LUT_Scales;
+  per_tensor_quant(K, lut_scales, b);
+  lut_ctor<K>((int8_t*)QLUT, b, lut_scales);
+}}
+float ggml_bitnet_lut_abs_max(int k, const void* B) {{
+  return lut_abs_max(k, (const bitnet_float_type*)B);
+}}
+// lut_ctor writes 16 LUT bytes per activation, 16 activations at a time,
+// so any run of them is built by the same code as the whole column
+void ggml_bitnet_lut_ctor(int k, void* B, void* LUT_Scales, void* QLUT) {{
+  int8_t* qlut = (int8_t*)QLUT;
+  bitnet_float_type* b = (bitnet_float_type*)B;
+  bitnet_float_type* lut_scales = (bitnet_float_type*)LUT_Scales;
+  int i = 0;
+  for (; i + GGML_BITNET_LUT_CHUNK <= k; i += GGML_BITNET_LUT_CHUNK) {{
+    lut_ctor<GGML_BITNET_LUT_CHUNK>(qlut + i * 16, b + i, lut_scales);
+  }}
+  for (; i < k; i += 16) {{
+    lut_ctor<16>(qlut + i * 16, b + i, lut_scales);
+  }}
 }}
 void ggml_preprocessor(int m, int k, void* B, void* LUT_Scales, void* QLUT) {
     if (m == 14336 && k == 4096) {
@@ -720,6 +1319,22 @@ void ggml_qgemm_lut(int m, int k, void* A, void* LUT, void* Scales, void* LUT_Sc
     }
 }
 
+static const bitnet_lut_kernel bitnet_lut_kernels[] = {
+    { 14336, 4096, BM14336_4096, BBK14336_4096, tbl_impl_14336_4096, tbl_impl_batch_14336_4096, qgemm_lut_14336_4096, preprocessor_k<4096> },
+    { 4096, 14336, BM4096_14336, BBK4096_14336, tbl_impl_4096_14336, tbl_impl_batch_4096_14336, qgemm_lut_4096_14336, preprocessor_k<14336> },
+    { 1024, 4096, BM1024_4096, BBK1024_4096, tbl_impl_1024_4096, tbl_impl_batch_1024_4096, qgemm_lut_1024_4096, preprocessor_k<4096> },
+    { 4096, 4096, BM4096_4096, BBK4096_4096, tbl_impl_4096_4096, tbl_impl_batch_4096_4096, qgemm_lut_4096_4096, preprocessor_k<4096> },
+};
+
+const bitnet_lut_kernel * ggml_bitnet_get_lut_kernel(int m, int k) {
+    for (size_t i = 0; i < sizeof(bitnet_lut_kernels) / sizeof(bitnet_lut_kernels[0]); i++) {
+        if (bitnet_lut_kernels[i].m == m && bitnet_lut_kernels[i].k == k) {
+            return &bitnet_lut_kernels[i];
+        }
+    }
+    return nullptr;
+}
+
 void ggml_bitnet_transform_tensor(struct ggml_tensor * tensor) {
     if (!(is_type_supported(tensor->type) && tensor->backend == GGML_BACKEND_TYPE_CPU && tensor->extra == nullptr)) {
         return;
@@ -754,18 +1369,32 @@ else if (m == 4096 && k == 4096) {
     uint8_t * qweights;
     bitnet_float_type * scales;
 
-    scales = (bitnet_float_type *) aligned_malloc(sizeof(bitnet_float_type));
     qweights = (uint8_t *) tensor->data;
-    float * i2_scales = (float * )(qweights + k * m / 4);
-    scales[0] = (bitnet_float_type) i2_scales[0];
+    // The converter stores the fp32 scale right behind the packed weights,
+    // so the extra points into the mmap'd tensor data instead of a copy
+    scales = (bitnet_float_type *) (qweights + k * m / 4);
+
+    // Multi-socket hosts keep the packed weights next to the threads reading them
+    bitnet_numa_weights * numa = bitnet_numa_place(qweights, (size_t)k * m / 4, (size_t)bm * k / 4, n_tile_num);
+    if (numa != nullptr && numa->mode == GGML_BITNET_NUMA_PARTITION) {
+        qweights = numa->data;
+    }
+
+    // Pruned weights have (row tile, K block) blocks of zero pairs only (0x44),
+    // which the kernels skip
+    uint8_t * occupancy = bitnet_extras_occupancy(qweights, (int64_t)n_tile_num * (k / BK), (size_t)BK / 4 * bm, 0x44);
 
-    tensor->extra = bitnet_tensor_extras + bitnet_tensor_extras_index;
-    bitnet_tensor_extras[bitnet_tensor_extras_index++] = {
+    bitnet_tensor_extra * extra = bitnet_extras_alloc(tensor);
+    GGML_ASSERT(extra != nullptr);
+    tensor->extra = extra;
+    *extra = {
         /* .lut_scales_size = */ lut_scales_size,
         /* .BK              = */ BK,
         /* .n_tile_num      = */ n_tile_num,
         /* .qweights        = */ qweights,
-        /* .scales          = */ scales
+        /* .scales          = */ scales,
+        /* .numa            = */ numa,
+        /* .occupancy       = */ occupancy
     };
 }
 #endif
\ No newline at end of file
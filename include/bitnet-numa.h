@@ -0,0 +1,35 @@
+#pragma once
+
+#include "ggml-bitnet.h"
+
+#include <cstddef>
+#include <cstdint>
+
+// Most NUMA nodes one weight is spread over
+#define BITNET_NUMA_MAX_NODES 8
+
+// Packed weights of one tensor placed on the NUMA nodes the pool runs on
+struct bitnet_numa_weights {
+    enum ggml_bitnet_numa_mode mode;
+    int n_nodes;
+    int nodes[BITNET_NUMA_MAX_NODES];           // OS node ids
+    // GGML_BITNET_NUMA_REPLICATE: a full copy of the weights on every node
+    uint8_t * replicas[BITNET_NUMA_MAX_NODES];
+    // GGML_BITNET_NUMA_PARTITION: node i holds the row tiles
+    // [tile_begin[i], tile_begin[i + 1]) of one copy in data
+    int tile_begin[BITNET_NUMA_MAX_NODES + 1];
+    uint8_t * data;
+    size_t size;                                // bytes of every mapping
+};
+
+// Copies size bytes of packed weights into node-local memory as the current
+// mode asks. tile_size is the byte stride of one row tile, or 0 when tiles
+// are not contiguous (TL2), which limits the weight to replication. Returns
+// NULL, leaving the weights where they are, when the mode is off, the pool
+// runs on a single node or the memory cannot be placed.
+bitnet_numa_weights * bitnet_numa_place(const uint8_t * qweights, size_t size, size_t tile_size, int n_tiles);
+
+void bitnet_numa_release(bitnet_numa_weights * numa);
+
+// Index into numa->nodes of the calling thread's node, 0 if it is none of them
+int bitnet_numa_local_index(const bitnet_numa_weights * numa);
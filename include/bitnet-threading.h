@@ -6,75 +6,504 @@
 #include <functional>
 #include <mutex>
 #include <condition_variable>
-#include <queue>
 #include <memory>
+#include <new>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <algorithm>
 
 #ifdef __ARM_NEON
 #include <arm_neon.h>
 #endif
 
-// Threading configuration for Raspberry Pi 5 (4 cores)
-#define BITNET_MAX_THREADS 4
 #define BITNET_CACHE_LINE_SIZE 64
 
-// Work stealing queue for better load balancing
+// Spin iterations a worker burns looking for work before it parks
+#define BITNET_SPIN_COUNT 2048
+
+inline void bitnet_cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield" ::: "memory");
+#endif
+}
+
+// Most models one process registers with bitnet_tenant_register
+#define BITNET_MAX_TENANTS 16
+
+// A model sharing the process-wide pool with others. parallel_for calls
+// made on its behalf use at most n_threads threads, counting the caller,
+// and those of batch tenants give way to interactive ones: their helpers
+// queue behind interactive jobs and leave between chunks while an
+// interactive job waits for threads.
+struct bitnet_tenant {
+    char name[32];
+    int n_threads;      // <= 0 for the whole pool
+    bool batch;
+};
+
+// Registers a tenant and returns its id, or -1 once BITNET_MAX_TENANTS are
+// taken. Tenant 0 is everything else: the whole pool at interactive priority.
+int bitnet_tenant_register(const char* name, int n_threads, bool batch);
+
+// The tenant id, or tenant 0 for ids that were never registered
+const bitnet_tenant& bitnet_tenant_get(int id);
+
+// Tenant the calling thread's parallel_for calls run as
+int bitnet_tenant_current();
+
+// Runs the calling thread as tenant until the scope ends
+class BitNetTenantScope {
+private:
+    int prev;
+
+public:
+    explicit BitNetTenantScope(int tenant);
+    ~BitNetTenantScope();
+
+    BitNetTenantScope(const BitNetTenantScope&) = delete;
+    BitNetTenantScope& operator=(const BitNetTenantScope&) = delete;
+};
+
+// Unit of work executed by BitNetThreadPool
+struct BitNetTask {
+    virtual ~BitNetTask() = default;
+    virtual void execute() = 0;
+};
+
+// Chase-Lev work stealing deque (Le et al., "Correct and Efficient
+// Work-Stealing for Weak Memory Models"). The owning worker pushes and pops
+// at the bottom, any other thread steals from the top. T must be trivially
+// copyable; the pool stores BitNetTask pointers.
 template<typename T>
 class WorkStealingQueue {
 private:
-    std::queue<T> tasks;
-    mutable std::mutex mtx;
-    std::condition_variable cv;
-    std::atomic<bool> finished{false};
+    struct Ring {
+        int64_t capacity;
+        int64_t mask;
+        std::unique_ptr<std::atomic<T>[]> slots;
+
+        explicit Ring(int64_t cap) : capacity(cap), mask(cap - 1), slots(new std::atomic<T>[cap]) {}
+
+        T load(int64_t i) const {
+            return slots[i & mask].load(std::memory_order_relaxed);
+        }
+
+        void store(int64_t i, T v) {
+            slots[i & mask].store(v, std::memory_order_relaxed);
+        }
+
+        Ring* grow(int64_t b, int64_t t) const {
+            Ring* r = new Ring(capacity * 2);
+            for (int64_t i = t; i < b; ++i) {
+                r->store(i, load(i));
+            }
+            return r;
+        }
+    };
+
+    alignas(BITNET_CACHE_LINE_SIZE) std::atomic<int64_t> top{0};
+    alignas(BITNET_CACHE_LINE_SIZE) std::atomic<int64_t> bottom{0};
+    alignas(BITNET_CACHE_LINE_SIZE) std::atomic<Ring*> ring;
+    // Stealers may still be reading a ring that was replaced by grow(), so
+    // old rings are kept until the deque itself goes away.
+    std::vector<std::unique_ptr<Ring>> retired;
 
 public:
-    void push(T task) {
-        std::lock_guard<std::mutex> lock(mtx);
-        tasks.push(task);
-        cv.notify_one();
+    explicit WorkStealingQueue(int64_t capacity = 256) : ring(new Ring(capacity)) {}
+
+    ~WorkStealingQueue() {
+        delete ring.load(std::memory_order_relaxed);
     }
 
-    bool try_pop(T& task) {
-        std::lock_guard<std::mutex> lock(mtx);
-        if (tasks.empty()) return false;
-        task = tasks.front();
-        tasks.pop();
-        return true;
+    WorkStealingQueue(const WorkStealingQueue&) = delete;
+    WorkStealingQueue& operator=(const WorkStealingQueue&) = delete;
+
+    // Owner thread only
+    void push(T item) {
+        int64_t b = bottom.load(std::memory_order_relaxed);
+        int64_t t = top.load(std::memory_order_acquire);
+        Ring* r = ring.load(std::memory_order_relaxed);
+        if (b - t > r->capacity - 1) {
+            retired.emplace_back(r);
+            r = r->grow(b, t);
+            ring.store(r, std::memory_order_release);
+        }
+        r->store(b, item);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom.store(b + 1, std::memory_order_relaxed);
     }
 
-    void wait_and_pop(T& task) {
-        std::unique_lock<std::mutex> lock(mtx);
-        cv.wait(lock, [this] { return !tasks.empty() || finished.load(); });
-        if (!tasks.empty()) {
-            task = tasks.front();
-            tasks.pop();
+    // Owner thread only, LIFO
+    bool pop(T& item) {
+        int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+        Ring* r = ring.load(std::memory_order_relaxed);
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top.load(std::memory_order_relaxed);
+        if (t > b) {
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return false;
         }
+        item = r->load(b);
+        if (t == b) {
+            // Last element, race against stealers
+            bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return won;
+        }
+        return true;
     }
 
-    void finish() {
-        finished.store(true);
-        cv.notify_all();
+    // Any thread, FIFO
+    bool steal(T& item) {
+        int64_t t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom.load(std::memory_order_acquire);
+        if (t >= b) {
+            return false;
+        }
+        Ring* r = ring.load(std::memory_order_acquire);
+        T x = r->load(t);
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            return false;
+        }
+        item = x;
+        return true;
     }
 
     bool empty() const {
-        std::lock_guard<std::mutex> lock(mtx);
-        return tasks.empty();
+        int64_t b = bottom.load(std::memory_order_relaxed);
+        int64_t t = top.load(std::memory_order_relaxed);
+        return b <= t;
+    }
+};
+
+// Bytes of callable a parallel_for job stores inline; larger callables are
+// copied to the heap
+#define BITNET_JOB_INLINE_SIZE 192
+
+// Most finished jobs kept for reuse
+#define BITNET_JOB_FREE_LIST_SIZE 64
+
+// Shared state of one parallel_for call. Helper copies of the job are queued
+// on the pool, each claims grain-sized chunks until the range is exhausted.
+// Jobs are recycled through a free list and keep the callable inline, so a
+// parallel_for call does not allocate once a few jobs exist.
+class BitNetParallelJob : public BitNetTask {
+private:
+    alignas(std::max_align_t) unsigned char storage[BITNET_JOB_INLINE_SIZE];
+    void* callable = nullptr;
+    void (*invoke)(void*, int64_t, int64_t) = nullptr;
+    void (*destroy)(void*, bool) = nullptr;
+    int64_t begin = 0;
+    int64_t end = 0;
+    int64_t grain = 1;
+    int64_t n_chunks = 0;
+    // Interactive jobs waiting for threads, which helpers of a batch job
+    // leave for; NULL for interactive jobs
+    const std::atomic<int>* yield_to = nullptr;
+    alignas(BITNET_CACHE_LINE_SIZE) std::atomic<int64_t> next_chunk{0};
+    alignas(BITNET_CACHE_LINE_SIZE) std::atomic<int64_t> remaining{0};
+    std::atomic<int> refs{1};
+    std::mutex done_mtx;
+    std::condition_variable done_cv;
+
+    struct FreeList {
+        std::mutex mtx;
+        std::vector<BitNetParallelJob*> jobs;
+    };
+
+    // Never destroyed: helpers of finished jobs can still be released by
+    // workers draining their queues during static destruction
+    static FreeList& free_list() {
+        static FreeList* list = [] {
+            FreeList* l = new FreeList();
+            l->jobs.reserve(BITNET_JOB_FREE_LIST_SIZE);
+            return l;
+        }();
+        return *list;
+    }
+
+    BitNetParallelJob() = default;
+
+    template<typename F>
+    void bind(F&& f) {
+        using Fn = typename std::decay<F>::type;
+        if (sizeof(Fn) <= sizeof(storage) && alignof(Fn) <= alignof(std::max_align_t)) {
+            callable = new (storage) Fn(std::forward<F>(f));
+        } else {
+            callable = new Fn(std::forward<F>(f));
+        }
+        invoke = [](void* c, int64_t lo, int64_t hi) { (*static_cast<Fn*>(c))(lo, hi); };
+        destroy = [](void* c, bool in_place) {
+            if (in_place) {
+                static_cast<Fn*>(c)->~Fn();
+            } else {
+                delete static_cast<Fn*>(c);
+            }
+        };
+    }
+
+public:
+    BitNetParallelJob(const BitNetParallelJob&) = delete;
+    BitNetParallelJob& operator=(const BitNetParallelJob&) = delete;
+
+    // A job for fn over [begin, end), reused from the free list when possible
+    template<typename F>
+    static BitNetParallelJob* create(int64_t begin, int64_t end, int64_t grain, F&& fn) {
+        BitNetParallelJob* job = nullptr;
+        {
+            FreeList& list = free_list();
+            std::lock_guard<std::mutex> lock(list.mtx);
+            if (!list.jobs.empty()) {
+                job = list.jobs.back();
+                list.jobs.pop_back();
+            }
+        }
+        if (job == nullptr) {
+            job = new BitNetParallelJob();
+        }
+        job->bind(std::forward<F>(fn));
+        job->begin = begin;
+        job->end = end;
+        job->grain = std::max<int64_t>(1, grain);
+        job->n_chunks = end > begin ? (end - begin + job->grain - 1) / job->grain : 0;
+        job->next_chunk.store(0, std::memory_order_relaxed);
+        job->remaining.store(job->n_chunks, std::memory_order_relaxed);
+        job->refs.store(1, std::memory_order_relaxed);
+        job->yield_to = nullptr;
+        return job;
+    }
+
+    void execute() override {
+        run_chunks(yield_to);
+        release();
+    }
+
+    // Helpers of a batch job give way to interactive work
+    void set_yield_to(const std::atomic<int>* waiting) { yield_to = waiting; }
+
+    // Claims and runs chunks until none are left to claim, or until *yield
+    // is nonzero. The caller passes none, so it claims whatever helpers
+    // leave and every chunk still runs.
+    void run_chunks(const std::atomic<int>* yield = nullptr) {
+        int64_t done = 0;
+        while (yield == nullptr || yield->load(std::memory_order_relaxed) == 0) {
+            const int64_t c = next_chunk.fetch_add(1, std::memory_order_relaxed);
+            if (c >= n_chunks) {
+                break;
+            }
+            int64_t lo = begin + c * grain;
+            invoke(callable, lo, std::min(lo + grain, end));
+            ++done;
+        }
+        if (done > 0 && remaining.fetch_sub(done, std::memory_order_acq_rel) == done) {
+            std::lock_guard<std::mutex> lock(done_mtx);
+            done_cv.notify_all();
+        }
+    }
+
+    bool done() const { return remaining.load(std::memory_order_acquire) == 0; }
+
+    void wait() {
+        if (done()) {
+            return;
+        }
+        std::unique_lock<std::mutex> lock(done_mtx);
+        done_cv.wait(lock, [this] { return done(); });
+    }
+
+    int64_t chunks() const { return n_chunks; }
+
+    void retain() { refs.fetch_add(1, std::memory_order_relaxed); }
+
+    void release() {
+        if (refs.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+            return;
+        }
+        destroy(callable, callable == storage);
+        callable = nullptr;
+        {
+            FreeList& list = free_list();
+            std::lock_guard<std::mutex> lock(list.mtx);
+            if (list.jobs.size() < BITNET_JOB_FREE_LIST_SIZE) {
+                list.jobs.push_back(this);
+                return;
+            }
+        }
+        delete this;
+    }
+};
+
+// Completion token of a single parallel_for call. Waiting on it only waits
+// for that call's chunks, not for unrelated work queued on the pool.
+// Destroying a token that has not been waited on waits implicitly.
+class BitNetCompletion {
+private:
+    BitNetParallelJob* job = nullptr;
+
+public:
+    BitNetCompletion() = default;
+    explicit BitNetCompletion(BitNetParallelJob* job) : job(job) {}
+
+    BitNetCompletion(BitNetCompletion&& other) noexcept : job(other.job) { other.job = nullptr; }
+
+    BitNetCompletion& operator=(BitNetCompletion&& other) noexcept {
+        if (this != &other) {
+            reset();
+            job = other.job;
+            other.job = nullptr;
+        }
+        return *this;
+    }
+
+    BitNetCompletion(const BitNetCompletion&) = delete;
+    BitNetCompletion& operator=(const BitNetCompletion&) = delete;
+
+    ~BitNetCompletion() { reset(); }
+
+    bool done() const { return job == nullptr || job->done(); }
+
+    void wait() {
+        if (job != nullptr) {
+            job->wait();
+        }
+    }
+
+private:
+    void reset() {
+        if (job != nullptr) {
+            job->wait();
+            job->release();
+            job = nullptr;
+        }
+    }
+};
+
+// Cache-aligned scratch memory that only ever grows. Kernels take their
+// temporaries from it instead of the heap, so once it has been sized the
+// token-generation path makes no allocations.
+class BitNetScratch {
+private:
+    void* data = nullptr;
+    size_t capacity = 0;
+
+public:
+    BitNetScratch() = default;
+    ~BitNetScratch() { free(data); }
+
+    BitNetScratch(const BitNetScratch&) = delete;
+    BitNetScratch& operator=(const BitNetScratch&) = delete;
+
+    // Grows the arena to at least bytes; the old contents are not kept
+    bool reserve(size_t bytes) {
+        if (bytes <= capacity) {
+            return true;
+        }
+        bytes = (bytes + BITNET_CACHE_LINE_SIZE - 1) / BITNET_CACHE_LINE_SIZE * BITNET_CACHE_LINE_SIZE;
+        void* ptr = nullptr;
+        if (posix_memalign(&ptr, BITNET_CACHE_LINE_SIZE, bytes) != 0) {
+            return false;
+        }
+        free(data);
+        data = ptr;
+        capacity = bytes;
+        return true;
     }
+
+    // Start of the arena as count Ts, or NULL if it cannot grow that far
+    template<typename T>
+    T* get(size_t count) {
+        return reserve(count * sizeof(T)) ? static_cast<T*>(data) : nullptr;
+    }
+
+    size_t size() const { return capacity; }
 };
 
-// Thread pool optimized for Raspberry Pi 5
+class BitNetThreadPool;
+
+// A scratch arena lent to one kernel call by BitNetThreadPool::lease_scratch
+// and handed back when the lease goes out of scope.
+class BitNetScratchLease {
+private:
+    std::atomic<bool>* busy;
+    BitNetScratch* arena;
+
+public:
+    BitNetScratchLease(std::atomic<bool>* busy, BitNetScratch* arena) : busy(busy), arena(arena) {}
+    BitNetScratchLease(BitNetScratchLease&& other) noexcept : busy(other.busy), arena(other.arena) { other.busy = nullptr; }
+    ~BitNetScratchLease() {
+        if (busy != nullptr) {
+            busy->store(false, std::memory_order_release);
+        }
+    }
+
+    BitNetScratchLease(const BitNetScratchLease&) = delete;
+    BitNetScratchLease& operator=(const BitNetScratchLease&) = delete;
+
+    BitNetScratch* operator->() const { return arena; }
+};
+
+// Work stealing thread pool. Every worker owns a Chase-Lev deque, idle
+// workers steal from random victims, spin briefly and then park on a
+// condition variable so an idle pool costs no CPU between tokens.
 class BitNetThreadPool {
 private:
-    std::vector<std::thread> workers;
-    WorkStealingQueue<std::function<void()>> task_queue;
+    struct alignas(BITNET_CACHE_LINE_SIZE) Worker {
+        WorkStealingQueue<BitNetTask*> deque;
+        uint64_t rng_state;
+    };
+
+    // Scratch arenas kernel calls borrow, one per thread that can run a
+    // kernel at a time: every worker plus one caller
+    struct alignas(BITNET_CACHE_LINE_SIZE) ScratchSlot {
+        std::atomic<bool> busy{false};
+        BitNetScratch scratch;
+    };
+
+    std::vector<std::thread> threads;
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::unique_ptr<ScratchSlot>> scratch_slots;
+
+    // Tasks submitted from threads that are not workers of this pool, one
+    // queue per priority, interactive first. Rings that only grow, so
+    // steady-state submits do not allocate
+    struct InjectQueue {
+        std::vector<BitNetTask*> ring;
+        size_t head = 0;
+        std::atomic<int> size{0};
+    };
+    std::mutex inject_mtx;
+    InjectQueue inject[2];
+
+    // Parking: workers sleep until wake_epoch moves past the value they saw
+    std::mutex park_mtx;
+    std::condition_variable park_cv;
+    std::atomic<uint64_t> wake_epoch{0};
+    std::atomic<int> num_parked{0};
+
+    // Completion latch for wait_all()
+    alignas(BITNET_CACHE_LINE_SIZE) std::atomic<int64_t> pending{0};
+    std::mutex done_mtx;
+    std::condition_variable done_cv;
+    std::atomic<int> num_waiters{0};
+
     std::atomic<bool> stop{false};
-    std::atomic<int> active_workers{0};
-    
-    // NUMA awareness for Pi 5
-    void set_cpu_affinity(int thread_id) {
+
+    // Workers below n_active take tasks, the others wait on resize_cv, so
+    // the pool is resized in place and never replaced under a caller
+    std::atomic<int> n_active{0};
+    std::condition_variable resize_cv;
+
+    // Pins the calling worker to one logical CPU of bitnet_get_topology()
+    void set_cpu_affinity(int cpu) {
 #ifdef __linux__
         cpu_set_t cpuset;
         CPU_ZERO(&cpuset);
-        CPU_SET(thread_id % 4, &cpuset);  // Pi 5 has 4 cores
+        CPU_SET(cpu, &cpuset);
         
         if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset) != 0) {
             // Fallback: use sched_setaffinity
@@ -83,55 +512,94 @@ private:
 #endif
     }
 
+    void worker_loop(int id);
+    void submit(BitNetTask* task, bool batch = false);
+    BitNetTask* find_task(int id);
+    BitNetTask* steal_task(uint64_t& rng_state, int skip);
+    void run_task(BitNetTask* task);
+    void wake_one();
+
 public:
-    BitNetThreadPool() {
-        int num_threads = std::min(BITNET_MAX_THREADS, (int)std::thread::hardware_concurrency());
-        
-        for (int i = 0; i < num_threads; ++i) {
-            workers.emplace_back([this, i]() {
-                set_cpu_affinity(i);
-                worker_loop();
-            });
-        }
-    }
+    // n_threads workers, bitnet_get_optimal_thread_count() if <= 0, out of
+    // max_threads started (at least n_threads) that resize() can activate.
+    // Workers are pinned in topology order from its second CPU on, leaving
+    // the first to the calling thread, when they all fit on a CPU of their
+    // own.
+    explicit BitNetThreadPool(int n_threads = 0, int max_threads = 0);
+    ~BitNetThreadPool();
 
-    ~BitNetThreadPool() {
-        stop.store(true);
-        task_queue.finish();
-        
-        for (auto& worker : workers) {
-            if (worker.joinable()) {
-                worker.join();
-            }
-        }
-    }
+    BitNetThreadPool(const BitNetThreadPool&) = delete;
+    BitNetThreadPool& operator=(const BitNetThreadPool&) = delete;
 
     template<typename F, typename... Args>
     void enqueue(F&& f, Args&&... args) {
-        auto task = std::bind(std::forward<F>(f), std::forward<Args>(args)...);
-        task_queue.push(task);
+        struct FunctionTask : BitNetTask {
+            std::function<void()> fn;
+            explicit FunctionTask(std::function<void()> f) : fn(std::move(f)) {}
+            void execute() override {
+                fn();
+                delete this;
+            }
+        };
+        submit(new FunctionTask(std::bind(std::forward<F>(f), std::forward<Args>(args)...)));
     }
 
-    void wait_all() {
-        while (!task_queue.empty() || active_workers.load() > 0) {
-            std::this_thread::yield();
+    // Splits [begin, end) into grain-sized chunks and runs fn(lo, hi) on each.
+    // The calling thread claims chunks as well and only returns once every
+    // chunk has been claimed; the token then waits for the ones still running
+    // on workers. At most concurrency() threads take part.
+    template<typename F>
+    BitNetCompletion parallel_for(int64_t begin, int64_t end, int64_t grain, F&& fn) {
+        BitNetParallelJob* job = BitNetParallelJob::create(begin, end, grain, std::forward<F>(fn));
+        const bool batch = bitnet_tenant_get(bitnet_tenant_current()).batch;
+        if (batch) {
+            job->set_yield_to(&inject[0].size);
+        }
+        int64_t helpers = std::min<int64_t>(concurrency() - 1, job->chunks() - 1);
+        for (int64_t i = 0; i < helpers; ++i) {
+            job->retain();
+            submit(job, batch);
         }
+        job->run_chunks();
+        return BitNetCompletion(job);
     }
 
-private:
-    void worker_loop() {
-        while (!stop.load()) {
-            std::function<void()> task;
-            
-            if (task_queue.try_pop(task)) {
-                active_workers.fetch_add(1);
-                task();
-                active_workers.fetch_sub(1);
-            } else {
-                std::this_thread::yield();
-            }
-        }
+    // Blocks until every task enqueued so far has finished. The caller helps
+    // with queued work and then sleeps on a latch, it never spins.
+    void wait_all();
+
+    // Workers taking tasks, and workers started
+    int num_threads() const { return n_active.load(std::memory_order_relaxed); }
+    int max_threads() const { return (int)threads.size(); }
+
+    // Lets n_threads workers, clamped to [1, max_threads()], take tasks; the
+    // rest park once their current task is done. Safe while other threads
+    // are inside parallel_for: jobs already split keep their helpers.
+    void resize(int n_threads);
+
+    // Threads a parallel_for call of the calling thread's tenant may use,
+    // counting the caller; what kernels size their work split by
+    int concurrency() const {
+        const int quota = bitnet_tenant_get(bitnet_tenant_current()).n_threads;
+        return quota > 0 ? std::min(quota, num_threads() + 1) : num_threads() + 1;
     }
+
+    // Index of the calling worker thread in this pool, -1 for other threads
+    int current_worker() const;
+
+    // Lends the calling thread a free scratch arena of the pool until the
+    // lease is destroyed. Any thread may borrow one, pool worker or not, so
+    // ggml compute threads the planner never ran on find an arena
+    // reserve_scratch already sized. Only when more threads hold leases than
+    // the pool has arenas does the caller get its own thread_local one,
+    // which may still have to grow.
+    BitNetScratchLease lease_scratch();
+
+    // Grows every arena of the pool to at least bytes, so the kernel calls
+    // borrowing them never allocate. Arenas on loan, e.g. to another model's
+    // kernel, are waited for, so call it outside the kernels and without a
+    // lease of its own, e.g. while the graph is planned.
+    bool reserve_scratch(size_t bytes);
 };
 
 // Thread-safe matrix tile for parallel processing
@@ -183,20 +651,19 @@ public:
         return true;
     }
     
+    const MatrixTile& tile_at(int64_t tile_id) const { return tiles[tile_id]; }
+    
     int total_tiles() const { return tiles.size(); }
 };
 
-// Memory prefetching for better cache utilization
+// Memory prefetching for better cache utilization. GCC and Clang, the only
+// supported compilers, lower these to PRFM on ARM and PREFETCHh on x86.
 inline void prefetch_for_read(const void* addr) {
-#ifdef __ARM_NEON
     __builtin_prefetch(addr, 0, 3);  // Temporal locality
-#endif
 }
 
 inline void prefetch_for_write(const void* addr) {
-#ifdef __ARM_NEON
     __builtin_prefetch(addr, 1, 3);  // Temporal locality, write
-#endif
 }
 
 // Cache-aligned memory allocation
@@ -209,40 +676,16 @@ T* aligned_alloc(size_t count) {
     return static_cast<T*>(ptr);
 }
 
-// Thread-safe progress tracking
-class ProgressTracker {
-private:
-    std::atomic<int> completed_tiles{0};
-    int total_tiles;
-    std::mutex progress_mtx;
-    
-public:
-    ProgressTracker(int total) : total_tiles(total) {}
-    
-    void mark_completed() {
-        int completed = completed_tiles.fetch_add(1) + 1;
-        
-        // Optional: Log progress every 10%
-        if (completed % (total_tiles / 10 + 1) == 0) {
-            std::lock_guard<std::mutex> lock(progress_mtx);
-            printf("BitNet threading progress: %d/%d tiles (%.1f%%)\n", 
-                   completed, total_tiles, 100.0f * completed / total_tiles);
-        }
-    }
-    
-    bool is_complete() const {
-        return completed_tiles.load() >= total_tiles;
-    }
-};
-
 // Global thread pool instance
 extern std::unique_ptr<BitNetThreadPool> g_bitnet_thread_pool;
 
 // Initialize threading system
 void bitnet_threading_init();
 
-// Cleanup threading system
+// Cleanup threading system; nothing may be using the pool any more
 void bitnet_threading_cleanup();
 
-// Get optimal number of threads for current system
+// Threads worth running on this machine, counting the calling thread: one
+// per physical performance core of the allowed CPUs, or per physical core
+// when all cores are alike, capped by the cgroup CPU quota
 int bitnet_get_optimal_thread_count();
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// One logical CPU the process may run on, as described by sysfs
+struct bitnet_cpu_info {
+    int cpu;            // logical CPU id
+    int core;           // lowest CPU id of its SMT siblings
+    int package;        // physical socket
+    int numa_node;      // -1 when the kernel has no NUMA information
+    int llc;            // lowest CPU id sharing its last-level cache
+    int capacity;       // cpu_capacity or max frequency, 0 if unknown
+    bool performance;   // in the fastest core class (big / P-core)
+    bool smt_primary;   // first allowed hardware thread of its core
+};
+
+struct bitnet_topology {
+    // Allowed CPUs in placement order: physical performance cores first,
+    // then efficiency cores, then SMT siblings. Within each class a NUMA
+    // node is filled before the next, and consecutive CPUs alternate
+    // between last-level cache domains so neighbouring workers do not
+    // share one LLC while another sits idle.
+    std::vector<bitnet_cpu_info> cpus;
+    int n_cores = 0;        // physical cores
+    int n_perf_cores = 0;   // physical cores of the fastest class
+    int n_llc = 0;          // last-level cache domains
+    int n_numa_nodes = 0;   // NUMA nodes with an allowed CPU
+    int cpu_quota = 0;      // CPUs worth of cgroup CPU time, 0 if unlimited
+    size_t llc_size = 0;    // bytes of one last-level cache, 0 if unknown
+    std::vector<int> node_of_cpu;   // NUMA node by logical CPU id, -1 if unknown
+};
+
+// Topology of the CPUs this process may use, discovered once. The set is the
+// affinity mask at first call, so taskset and cgroup cpusets apply, narrowed
+// to the BITNET_CPUS list (e.g. "0-7,16") when that is set.
+const bitnet_topology & bitnet_get_topology();
+
+// NUMA node of the CPU the calling thread runs on, -1 if unknown
+int bitnet_current_numa_node();
+
+// Parses a Linux CPU list such as "0-3,8,10-11"; malformed parts are skipped
+std::vector<int> bitnet_parse_cpu_list(const char * list);
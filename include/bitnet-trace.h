@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Kernel instrumentation. Every thread that runs BitNet work owns a slot of
+// counters it alone writes, so recording never takes a lock or bounces a
+// cache line between cores. It is off unless BITNET_TRACE or BITNET_METRICS
+// is set; a disabled probe costs one load and a predicted branch, and builds
+// configured with -DBITNET_TRACE=OFF compile the probes out.
+//
+//   BITNET_TRACE=<file>    Chrome trace / Perfetto JSON of the most recent
+//                          BITNET_TRACE_EVENTS spans of every thread,
+//                          written at exit
+//   BITNET_METRICS=<file>  Prometheus text exposition of the counters,
+//                          rewritten every second by a thread of its own,
+//                          e.g. for the node_exporter textfile collector
+
+// Spans kept per thread for the trace, older ones are overwritten
+#define BITNET_TRACE_EVENTS 65536
+// Threads with a slot of their own; later ones go untraced
+#define BITNET_TRACE_MAX_THREADS 256
+
+enum bitnet_trace_op {
+    BITNET_TRACE_LUT_BUILD,     // task_init: activations to LUTs
+    BITNET_TRACE_LUT_LOOKUP,    // task_compute: table lookups over the weights
+    BITNET_TRACE_POOL_TASK,     // a worker running a task
+    BITNET_TRACE_POOL_IDLE,     // a worker spinning or parked between tasks
+    BITNET_TRACE_OP_COUNT,
+};
+
+enum bitnet_trace_counter {
+    BITNET_TRACE_LUT_CACHE_HITS,    // task_init calls served from the LUT cache
+    BITNET_TRACE_POOL_STEALS,       // tasks taken from another deque or the injector
+    BITNET_TRACE_COUNTER_COUNT,
+};
+
+#define BITNET_TRACE_COUNTERS 1
+#define BITNET_TRACE_SPANS    2
+
+#if defined(GGML_BITNET_NO_TRACE)
+static inline bool bitnet_trace_enabled() { return false; }
+#else
+// BITNET_TRACE_COUNTERS | BITNET_TRACE_SPANS as the environment asks
+extern int bitnet_trace_mode;
+static inline bool bitnet_trace_enabled() { return bitnet_trace_mode != 0; }
+#endif
+
+// Monotonic clock the spans are measured in
+uint64_t bitnet_trace_now();
+
+// Adds one op of dur ns that started at t0, with its shape and the bytes it
+// streamed, to the calling thread's slot
+void bitnet_trace_record(enum bitnet_trace_op op, uint64_t t0, uint64_t dur, int n, int k, int m, uint64_t bytes);
+void bitnet_trace_count(enum bitnet_trace_counter counter, uint64_t value);
+
+// Names the calling thread's slot in the trace, e.g. "worker 3"
+void bitnet_trace_thread_name(const char * name);
+
+// Records the scope as one op when instrumentation is on
+class BitNetTraceScope {
+private:
+    uint64_t t0;
+    enum bitnet_trace_op op;
+    int n, k, m;
+    uint64_t bytes;
+
+public:
+    BitNetTraceScope(enum bitnet_trace_op op, int n, int k, int m, uint64_t bytes)
+        : t0(bitnet_trace_enabled() ? bitnet_trace_now() : 0), op(op), n(n), k(k), m(m), bytes(bytes) {}
+
+    ~BitNetTraceScope() {
+        if (t0 != 0) {
+            bitnet_trace_record(op, t0, bitnet_trace_now() - t0, n, k, m, bytes);
+        }
+    }
+
+    BitNetTraceScope(const BitNetTraceScope&) = delete;
+    BitNetTraceScope& operator=(const BitNetTraceScope&) = delete;
+};
@@ -0,0 +1,570 @@
+#pragma once
+
+// Kernel bodies behind ggml_vec_dot_i2_i8_s. This header is compiled once
+// per ISA: ggml-bitnet-mad.cpp builds the baseline variant and every
+// ggml-bitnet-mad-<isa>.cpp builds its own with the -march/-m flags set in
+// src/CMakeLists.txt. The intrinsics below are picked from that translation
+// unit's feature macros, and ggml-bitnet-mad.cpp chooses between the
+// compiled variants at startup from the CPU features of the host.
+
+#include <cstddef>
+#include <cstdint>
+
+#include "ggml-bitnet.h"
+
+#if defined(__AVX__) || defined(__AVX2__) || defined(__AVX512F__) || defined(__SSSE3__)
+#include <immintrin.h>
+#endif
+
+#define QK_I2_S 128
+
+typedef void (*bitnet_vec_dot_i2_i8_t)(int n, float * s, size_t bs, const void * vx, size_t bx, const void * vy, size_t by, int nrc);
+typedef void (*bitnet_vec_dot_i2_i8_sparse_t)(int n, float * s, size_t bs, const void * vx, size_t bx, const void * vy, size_t by, int nrc,
+                                              const uint8_t * occupancy, size_t occ_stride, const int32_t * y_sums);
+
+// One compiled variant of the I2_S kernels
+struct bitnet_mad_kernels {
+    const char * isa;
+    bitnet_vec_dot_i2_i8_t vec_dot_i2_i8_s;
+    bitnet_vec_dot_i2_i8_sparse_t vec_dot_i2_i8_s_sparse;
+};
+
+// Each returns NULL when its translation unit was built without the ISA flags
+const struct bitnet_mad_kernels * ggml_bitnet_mad_kernels_avx2(void);
+const struct bitnet_mad_kernels * ggml_bitnet_mad_kernels_avxvnni(void);
+const struct bitnet_mad_kernels * ggml_bitnet_mad_kernels_avx512vnni(void);
+const struct bitnet_mad_kernels * ggml_bitnet_mad_kernels_dotprod(void);
+const struct bitnet_mad_kernels * ggml_bitnet_mad_kernels_i8mm(void);
+
+#if defined(__AVX__) || defined(__AVX2__) || defined(__AVX512F__) || defined(__SSSE3__)
+// horizontally add 8 int32_t
+static inline int hsum_i32_8(const __m256i a) {
+    const __m128i sum128 = _mm_add_epi32(_mm256_castsi256_si128(a), _mm256_extractf128_si256(a, 1));
+    const __m128i hi64 = _mm_unpackhi_epi64(sum128, sum128);
+    const __m128i sum64 = _mm_add_epi32(hi64, sum128);
+    const __m128i hi32  = _mm_shuffle_epi32(sum64, _MM_SHUFFLE(2, 3, 0, 1));
+    return _mm_cvtsi128_si32(_mm_add_epi32(sum64, hi32));
+}
+#elif defined(__loongarch_asx)
+// horizontally add 8 int32_t
+static inline int hsum_i32_8(const __m256i a) {
+
+    __m256i tmp1 = __lasx_xvpermi_q(a, a, 0x11);
+    __m256i tmp2 = __lasx_xvpermi_q(a, a, 0x00);
+
+    __m128i  tmp1_128 = lasx_extracti128_lo(tmp1);
+    __m128i  tmp2_128 = lasx_extracti128_lo(tmp2);
+
+    __m128i sum128 = __lsx_vadd_w(tmp1_128, tmp2_128);
+
+    __m128i ev = __lsx_vpickev_w(sum128, sum128);
+    __m128i od = __lsx_vpickod_w(sum128, sum128);
+    __m128i sum64 = __lsx_vadd_w(ev, od);
+
+    int sum64_1, sum64_2;
+    sum64_1 = __lsx_vpickve2gr_w(sum64, 0);
+    sum64_2 = __lsx_vpickve2gr_w(sum64, 1);
+
+    return  sum64_1 + sum64_2;
+}
+#endif
+
+// Activation rows sharing one unpacked weight row per kernel call
+#if defined(__AVX2__)
+#define I2_S_BLOCK_COLS 4
+#else
+#define I2_S_BLOCK_COLS 2
+#endif
+
+// Occupancy of I2_S blocks [b0, b0 + count), b0 a multiple of 8 and count
+// at most 32: bit i is set when block b0 + i has a nonzero weight
+static inline uint32_t i2_s_occupancy_bits(const uint8_t * occupancy, int b0, int count) {
+    uint32_t bits = 0;
+    for (int i = 0; i < (count + 7) / 8; i++) {
+        bits |= (uint32_t)occupancy[b0 / 8 + i] << (8 * i);
+    }
+    return count < 32 ? bits & ((1u << count) - 1) : bits;
+}
+
+// Index of the lowest set bit, v != 0
+static inline int i2_s_ctz(uint32_t v) {
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long i;
+    _BitScanForward(&i, v);
+    return (int)i;
+#else
+    return __builtin_ctz(v);
+#endif
+}
+
+// Calls block(b) for the blocks [b0, b0 + count) of a row, or with SPARSE
+// for the occupied ones only. Those are found a 32-block word at a time,
+// lowest set bit first, so no empty block costs a test or a branch.
+template<bool SPARSE, typename F>
+static inline void i2_s_for_blocks(int b0, int count, const uint8_t * occupancy, F && block) {
+    if (SPARSE) {
+        for (int g = b0; g < b0 + count; g += 32) {
+            const int n = b0 + count - g < 32 ? b0 + count - g : 32;
+            for (uint32_t todo = i2_s_occupancy_bits(occupancy, g, n); todo != 0; todo &= todo - 1) {
+                block(g + i2_s_ctz(todo));
+            }
+        }
+    } else {
+        for (int b = b0; b < b0 + count; b++) {
+            block(b);
+        }
+    }
+}
+
+// Dot products of one I2_S weight row x against NC int8 activation rows y[].
+// Each 128-weight block is unpacked once and reused for every activation
+// row; the per-row arithmetic is the same as the single-row kernel, so the
+// results are identical to NC separate calls. With SPARSE the blocks the
+// occupancy bitmap marks empty are left out, weights and activations both.
+template<int NC, bool SPARSE = false>
+static inline void vec_dot_i2_i8_s_1xN(int n, int * sumi, const uint8_t * x, const int8_t * const * y, const uint8_t * occupancy = nullptr) {
+    const int nb = n / QK_I2_S;
+
+    for (int c = 0; c < NC; c++) {
+        sumi[c] = 0;
+    }
+
+#if defined(__AVX2__) || defined(__ARM_NEON)
+    const int group32_num = nb / 32;
+    const int la_num = nb % 32;
+    const int groupla_num = nb % 32 != 0 ? 1 : 0;
+#endif
+
+#if defined(__AVX2__)
+
+    __m256i mask = _mm256_set1_epi8(0x03);
+    __m256i accu[NC];
+    for (int c = 0; c < NC; c++) {
+        accu[c] = _mm256_setzero_si256();
+    }
+
+    // The trailing partial group continues the same layout with la_num blocks
+    for (int i = 0; i < group32_num + groupla_num; i++) {
+        const int j_num = i < group32_num ? 32 : la_num;
+        __m256i accu32[NC];
+        for (int c = 0; c < NC; c++) {
+            accu32[c] = _mm256_setzero_si256();
+        }
+        i2_s_for_blocks<SPARSE>(i * 32, j_num, occupancy, [&](int b) {
+            // 128 index
+            __m256i xq8_3 = _mm256_loadu_si256((const __m256i*)(x + b * 32));
+            __m256i xq8_2 = _mm256_srli_epi16(xq8_3, 2);
+            __m256i xq8_1 = _mm256_srli_epi16(xq8_3, 4);
+            __m256i xq8_0 = _mm256_srli_epi16(xq8_3, 6);
+
+            // each 32 index
+            xq8_3 = _mm256_and_si256(xq8_3, mask);
+            xq8_2 = _mm256_and_si256(xq8_2, mask);
+            xq8_1 = _mm256_and_si256(xq8_1, mask);
+            xq8_0 = _mm256_and_si256(xq8_0, mask);
+
+            for (int c = 0; c < NC; c++) {
+                // each 32 index
+                __m256i yq8_0 = _mm256_loadu_si256((const __m256i*)(y[c] + b * 128 + 0));
+                __m256i yq8_1 = _mm256_loadu_si256((const __m256i*)(y[c] + b * 128 + 32));
+                __m256i yq8_2 = _mm256_loadu_si256((const __m256i*)(y[c] + b * 128 + 64));
+                __m256i yq8_3 = _mm256_loadu_si256((const __m256i*)(y[c] + b * 128 + 96));
+
+                // 128 index accumulation add
+                // split into 32 accumulation block
+                // each block each 128 index accumulated 4index
+                // each index maximum 256
+                // each block maximum 4 * 256
+                // each block accumulation maximum 127 * 256
+                // each 32 group index (128 index in one group) needs cast to int32
+                yq8_0 = _mm256_maddubs_epi16(xq8_0, yq8_0);
+                yq8_1 = _mm256_maddubs_epi16(xq8_1, yq8_1);
+                yq8_2 = _mm256_maddubs_epi16(xq8_2, yq8_2);
+                yq8_3 = _mm256_maddubs_epi16(xq8_3, yq8_3);
+
+                accu32[c] = _mm256_add_epi16(accu32[c], _mm256_add_epi16(yq8_0, yq8_1));
+                accu32[c] = _mm256_add_epi16(accu32[c], _mm256_add_epi16(yq8_2, yq8_3));
+            }
+        });
+        for (int c = 0; c < NC; c++) {
+            accu[c] = _mm256_add_epi32(_mm256_madd_epi16(accu32[c], _mm256_set1_epi16(1)), accu[c]);
+        }
+    }
+    for (int c = 0; c < NC; c++) {
+        sumi[c] = hsum_i32_8(accu[c]);
+    }
+
+#elif defined(__ARM_NEON)
+
+    int32x4_t accu_0[NC];
+    int32x4_t accu_1[NC];
+    int32x4_t accu_2[NC];
+    int32x4_t accu_3[NC];
+    for (int c = 0; c < NC; c++) {
+        accu_0[c] = vdupq_n_s32(0);
+        accu_1[c] = vdupq_n_s32(0);
+        accu_2[c] = vdupq_n_s32(0);
+        accu_3[c] = vdupq_n_s32(0);
+    }
+    const uint8x16_t mask = vdupq_n_u8(3);
+
+    // The trailing partial group continues the same layout with la_num blocks
+    for (int i = 0; i < group32_num + groupla_num; i++) {
+        const int j_num = i < group32_num ? 32 : la_num;
+
+#if defined(__ARM_FEATURE_DOTPROD)
+        // Using dot product instructions - accumulate directly into int32x4_t
+#else
+        int16x8_t accu32_0[NC];
+        int16x8_t accu32_1[NC];
+        int16x8_t accu32_2[NC];
+        int16x8_t accu32_3[NC];
+        for (int c = 0; c < NC; c++) {
+            accu32_0[c] = vdupq_n_s16(0);
+            accu32_1[c] = vdupq_n_s16(0);
+            accu32_2[c] = vdupq_n_s16(0);
+            accu32_3[c] = vdupq_n_s16(0);
+        }
+#endif
+
+        i2_s_for_blocks<SPARSE>(i * 32, j_num, occupancy, [&](int b) {
+            uint8x16_t xq8_6 = vld1q_u8(x + b * 32);
+            uint8x16_t xq8_7 = vld1q_u8(x + b * 32 + 16);
+            uint8x16_t xq8_4 = vshrq_n_u8(xq8_6, 2);
+            uint8x16_t xq8_5 = vshrq_n_u8(xq8_7, 2);
+            uint8x16_t xq8_2 = vshrq_n_u8(xq8_6, 4);
+            uint8x16_t xq8_3 = vshrq_n_u8(xq8_7, 4);
+            uint8x16_t xq8_0 = vshrq_n_u8(xq8_6, 6);
+            uint8x16_t xq8_1 = vshrq_n_u8(xq8_7, 6);
+
+            int8x16_t q8_0 = vreinterpretq_s8_u8(vandq_u8(xq8_0, mask));
+            int8x16_t q8_1 = vreinterpretq_s8_u8(vandq_u8(xq8_1, mask));
+            int8x16_t q8_2 = vreinterpretq_s8_u8(vandq_u8(xq8_2, mask));
+            int8x16_t q8_3 = vreinterpretq_s8_u8(vandq_u8(xq8_3, mask));
+            int8x16_t q8_4 = vreinterpretq_s8_u8(vandq_u8(xq8_4, mask));
+            int8x16_t q8_5 = vreinterpretq_s8_u8(vandq_u8(xq8_5, mask));
+            int8x16_t q8_6 = vreinterpretq_s8_u8(vandq_u8(xq8_6, mask));
+            int8x16_t q8_7 = vreinterpretq_s8_u8(vandq_u8(xq8_7, mask));
+
+            for (int c = 0; c < NC; c++) {
+                const int8_t * yc = y[c] + b * 128;
+                const int8x16_t yq8_0 = vld1q_s8(yc + 0);
+                const int8x16_t yq8_1 = vld1q_s8(yc + 16);
+                const int8x16_t yq8_2 = vld1q_s8(yc + 32);
+                const int8x16_t yq8_3 = vld1q_s8(yc + 48);
+                const int8x16_t yq8_4 = vld1q_s8(yc + 64);
+                const int8x16_t yq8_5 = vld1q_s8(yc + 80);
+                const int8x16_t yq8_6 = vld1q_s8(yc + 96);
+                const int8x16_t yq8_7 = vld1q_s8(yc + 112);
+
+#if defined(__ARM_FEATURE_DOTPROD)
+                accu_0[c] = vdotq_s32(accu_0[c], q8_0, yq8_0);
+                accu_1[c] = vdotq_s32(accu_1[c], q8_1, yq8_1);
+                accu_2[c] = vdotq_s32(accu_2[c], q8_2, yq8_2);
+                accu_3[c] = vdotq_s32(accu_3[c], q8_3, yq8_3);
+                accu_0[c] = vdotq_s32(accu_0[c], q8_4, yq8_4);
+                accu_1[c] = vdotq_s32(accu_1[c], q8_5, yq8_5);
+                accu_2[c] = vdotq_s32(accu_2[c], q8_6, yq8_6);
+                accu_3[c] = vdotq_s32(accu_3[c], q8_7, yq8_7);
+#else
+                accu32_0[c] = vmlal_s8(accu32_0[c], vget_low_s8(q8_0), vget_low_s8(yq8_0));
+                accu32_1[c] = vmlal_s8(accu32_1[c], vget_high_s8(q8_0), vget_high_s8(yq8_0));
+                accu32_2[c] = vmlal_s8(accu32_2[c], vget_low_s8(q8_1), vget_low_s8(yq8_1));
+                accu32_3[c] = vmlal_s8(accu32_3[c], vget_high_s8(q8_1), vget_high_s8(yq8_1));
+                accu32_0[c] = vmlal_s8(accu32_0[c], vget_low_s8(q8_2), vget_low_s8(yq8_2));
+                accu32_1[c] = vmlal_s8(accu32_1[c], vget_high_s8(q8_2), vget_high_s8(yq8_2));
+                accu32_2[c] = vmlal_s8(accu32_2[c], vget_low_s8(q8_3), vget_low_s8(yq8_3));
+                accu32_3[c] = vmlal_s8(accu32_3[c], vget_high_s8(q8_3), vget_high_s8(yq8_3));
+                accu32_0[c] = vmlal_s8(accu32_0[c], vget_low_s8(q8_4), vget_low_s8(yq8_4));
+                accu32_1[c] = vmlal_s8(accu32_1[c], vget_high_s8(q8_4), vget_high_s8(yq8_4));
+                accu32_2[c] = vmlal_s8(accu32_2[c], vget_low_s8(q8_5), vget_low_s8(yq8_5));
+                accu32_3[c] = vmlal_s8(accu32_3[c], vget_high_s8(q8_5), vget_high_s8(yq8_5));
+                accu32_0[c] = vmlal_s8(accu32_0[c], vget_low_s8(q8_6), vget_low_s8(yq8_6));
+                accu32_1[c] = vmlal_s8(accu32_1[c], vget_high_s8(q8_6), vget_high_s8(yq8_6));
+                accu32_2[c] = vmlal_s8(accu32_2[c], vget_low_s8(q8_7), vget_low_s8(yq8_7));
+                accu32_3[c] = vmlal_s8(accu32_3[c], vget_high_s8(q8_7), vget_high_s8(yq8_7));
+#endif
+            }
+        });
+
+#if defined(__ARM_FEATURE_DOTPROD)
+        // Dot product path - no additional accumulation needed, 
+        // vdotq_s32 already accumulates into accu_0, accu_1, accu_2, accu_3
+#else
+        for (int c = 0; c < NC; c++) {
+            accu_0[c] = vaddq_s32(accu_0[c], vmovl_s16(vget_low_s16(accu32_0[c])));
+            accu_0[c] = vaddq_s32(accu_0[c], vmovl_high_s16(accu32_0[c]));
+            accu_1[c] = vaddq_s32(accu_1[c], vmovl_s16(vget_low_s16(accu32_1[c])));
+            accu_1[c] = vaddq_s32(accu_1[c], vmovl_high_s16(accu32_1[c]));
+            accu_2[c] = vaddq_s32(accu_2[c], vmovl_s16(vget_low_s16(accu32_2[c])));
+            accu_2[c] = vaddq_s32(accu_2[c], vmovl_high_s16(accu32_2[c]));
+            accu_3[c] = vaddq_s32(accu_3[c], vmovl_s16(vget_low_s16(accu32_3[c])));
+            accu_3[c] = vaddq_s32(accu_3[c], vmovl_high_s16(accu32_3[c]));
+        }
+#endif
+    }
+    for (int c = 0; c < NC; c++) {
+        int32x4_t sum_01 = vaddq_s32(accu_0[c], accu_1[c]);
+        int32x4_t sum_23 = vaddq_s32(accu_2[c], accu_3[c]);
+        sumi[c] = vaddlvq_s32(vaddq_s32(sum_01, sum_23));
+    }
+
+#else
+
+    // Portable fallback for baseline x86 builds without AVX2
+    i2_s_for_blocks<SPARSE>(0, nb, occupancy, [&](int b) {
+        for (int j = 0; j < 32; j++) {
+            const uint8_t q = x[b * 32 + j];
+            for (int c = 0; c < NC; c++) {
+                const int8_t * yc = y[c] + b * 128 + j;
+                sumi[c] += ((q >> 6) & 3) * yc[0] + ((q >> 4) & 3) * yc[32] + ((q >> 2) & 3) * yc[64] + (q & 3) * yc[96];
+            }
+        }
+    });
+
+#endif
+}
+
+#if defined(__AVX512VNNI__) && defined(__AVX512BW__)
+// AVX512-VNNI: one 32-byte weight block is broadcast to both halves of a
+// zmm and shifted per half, so each dpbusd covers two bit-planes against 64
+// contiguous activations. dpbusd accumulates straight into int32, so there
+// is no int16 intermediate to group around.
+template<int NC, bool SPARSE = false>
+static void vec_dot_i2_i8_s_1xN_avx512vnni(int n, int * sumi, const uint8_t * x, const int8_t * const * y, const uint8_t * occupancy = nullptr) {
+    const int nb = n / QK_I2_S;
+    const __m512i mask = _mm512_set1_epi8(0x03);
+    const __m512i shift_01 = _mm512_inserti64x4(_mm512_set1_epi16(6), _mm256_set1_epi16(4), 1);
+    const __m512i shift_23 = _mm512_inserti64x4(_mm512_set1_epi16(2), _mm256_set1_epi16(0), 1);
+
+    __m512i accu_0[NC];
+    __m512i accu_1[NC];
+    for (int c = 0; c < NC; c++) {
+        accu_0[c] = _mm512_setzero_si512();
+        accu_1[c] = _mm512_setzero_si512();
+    }
+
+    i2_s_for_blocks<SPARSE>(0, nb, occupancy, [&](int b) {
+        const __m512i xq8 = _mm512_broadcast_i64x4(_mm256_loadu_si256((const __m256i*)(x + b * 32)));
+        const __m512i xq8_01 = _mm512_and_si512(_mm512_srlv_epi16(xq8, shift_01), mask);
+        const __m512i xq8_23 = _mm512_and_si512(_mm512_srlv_epi16(xq8, shift_23), mask);
+        for (int c = 0; c < NC; c++) {
+            const __m512i yq8_01 = _mm512_loadu_si512((const void*)(y[c] + b * 128 + 0));
+            const __m512i yq8_23 = _mm512_loadu_si512((const void*)(y[c] + b * 128 + 64));
+            accu_0[c] = _mm512_dpbusd_epi32(accu_0[c], xq8_01, yq8_01);
+            accu_1[c] = _mm512_dpbusd_epi32(accu_1[c], xq8_23, yq8_23);
+        }
+    });
+    for (int c = 0; c < NC; c++) {
+        sumi[c] = _mm512_reduce_add_epi32(_mm512_add_epi32(accu_0[c], accu_1[c]));
+    }
+}
+#endif
+
+#if defined(__AVXVNNI__)
+// AVX-VNNI: the AVX2 kernel with each maddubs/add/madd chain replaced by a
+// single 256-bit dpbusd
+template<int NC, bool SPARSE = false>
+static void vec_dot_i2_i8_s_1xN_avxvnni(int n, int * sumi, const uint8_t * x, const int8_t * const * y, const uint8_t * occupancy = nullptr) {
+    const int nb = n / QK_I2_S;
+    const __m256i mask = _mm256_set1_epi8(0x03);
+
+    __m256i accu_0[NC];
+    __m256i accu_1[NC];
+    for (int c = 0; c < NC; c++) {
+        accu_0[c] = _mm256_setzero_si256();
+        accu_1[c] = _mm256_setzero_si256();
+    }
+
+    i2_s_for_blocks<SPARSE>(0, nb, occupancy, [&](int b) {
+        const __m256i xq8 = _mm256_loadu_si256((const __m256i*)(x + b * 32));
+        const __m256i xq8_0 = _mm256_and_si256(_mm256_srli_epi16(xq8, 6), mask);
+        const __m256i xq8_1 = _mm256_and_si256(_mm256_srli_epi16(xq8, 4), mask);
+        const __m256i xq8_2 = _mm256_and_si256(_mm256_srli_epi16(xq8, 2), mask);
+        const __m256i xq8_3 = _mm256_and_si256(xq8, mask);
+        for (int c = 0; c < NC; c++) {
+            const int8_t * yc = y[c] + b * 128;
+            accu_0[c] = _mm256_dpbusd_avx_epi32(accu_0[c], xq8_0, _mm256_loadu_si256((const __m256i*)(yc + 0)));
+            accu_1[c] = _mm256_dpbusd_avx_epi32(accu_1[c], xq8_1, _mm256_loadu_si256((const __m256i*)(yc + 32)));
+            accu_0[c] = _mm256_dpbusd_avx_epi32(accu_0[c], xq8_2, _mm256_loadu_si256((const __m256i*)(yc + 64)));
+            accu_1[c] = _mm256_dpbusd_avx_epi32(accu_1[c], xq8_3, _mm256_loadu_si256((const __m256i*)(yc + 96)));
+        }
+    });
+    for (int c = 0; c < NC; c++) {
+        const __m256i accu = _mm256_add_epi32(accu_0[c], accu_1[c]);
+        const __m128i sum128 = _mm_add_epi32(_mm256_castsi256_si128(accu), _mm256_extracti128_si256(accu, 1));
+        const __m128i sum64 = _mm_add_epi32(sum128, _mm_unpackhi_epi64(sum128, sum128));
+        sumi[c] = _mm_cvtsi128_si32(_mm_add_epi32(sum64, _mm_shuffle_epi32(sum64, _MM_SHUFFLE(2, 3, 0, 1))));
+    }
+}
+#endif
+
+#if defined(__ARM_FEATURE_MATMUL_INT8) && defined(GGML_BITNET_I8MM)
+// i8mm: a 2x2 tile of two weight rows against two activation rows. smmla
+// multiplies a 2x8 by an 8x2 int8 block, so the matching 8-byte halves of
+// both rows are zipped into one register on each side. It has not run on
+// an i8mm core yet, so it is only built with -DBITNET_I8MM=ON; bitnet-bench
+// checks it against the scalar reference through its nrc = 2 cases.
+static void vec_dot_i2_i8_s_2x2_i8mm(int n, int * sumi, const uint8_t * x0, const uint8_t * x1, const int8_t * y0, const int8_t * y1) {
+    const int nb = n / QK_I2_S;
+    const uint8x16_t mask = vdupq_n_u8(3);
+    int32x4_t accu_0 = vdupq_n_s32(0);
+    int32x4_t accu_1 = vdupq_n_s32(0);
+
+    for (int b = 0; b < nb; b++) {
+        const uint8x16_t xr0[2] = { vld1q_u8(x0 + b * 32), vld1q_u8(x0 + b * 32 + 16) };
+        const uint8x16_t xr1[2] = { vld1q_u8(x1 + b * 32), vld1q_u8(x1 + b * 32 + 16) };
+        // q8 plane k pairs with activations [16 * k, 16 * k + 16)
+        for (int k = 0; k < 8; k++) {
+            const int8x16_t shift = vdupq_n_s8(-(6 - 2 * (k / 2)));
+            const int8x16_t q0 = vreinterpretq_s8_u8(vandq_u8(vshlq_u8(xr0[k & 1], shift), mask));
+            const int8x16_t q1 = vreinterpretq_s8_u8(vandq_u8(vshlq_u8(xr1[k & 1], shift), mask));
+            const int8x16_t c0 = vld1q_s8(y0 + b * 128 + k * 16);
+            const int8x16_t c1 = vld1q_s8(y1 + b * 128 + k * 16);
+
+            const int8x16_t a_lo = vreinterpretq_s8_s64(vzip1q_s64(vreinterpretq_s64_s8(q0), vreinterpretq_s64_s8(q1)));
+            const int8x16_t a_hi = vreinterpretq_s8_s64(vzip2q_s64(vreinterpretq_s64_s8(q0), vreinterpretq_s64_s8(q1)));
+            const int8x16_t b_lo = vreinterpretq_s8_s64(vzip1q_s64(vreinterpretq_s64_s8(c0), vreinterpretq_s64_s8(c1)));
+            const int8x16_t b_hi = vreinterpretq_s8_s64(vzip2q_s64(vreinterpretq_s64_s8(c0), vreinterpretq_s64_s8(c1)));
+            accu_0 = vmmlaq_s32(accu_0, a_lo, b_lo);
+            accu_1 = vmmlaq_s32(accu_1, a_hi, b_hi);
+        }
+    }
+    // {x0.y0, x0.y1, x1.y0, x1.y1}
+    vst1q_s32(sumi, vaddq_s32(accu_0, accu_1));
+}
+#endif
+
+template<int NC, bool SPARSE = false>
+static inline void vec_dot_i2_i8_s_strip(int n, int * sumi, const uint8_t * x, const int8_t * const * y, const uint8_t * occupancy = nullptr) {
+#if defined(__AVX512VNNI__) && defined(__AVX512BW__)
+    vec_dot_i2_i8_s_1xN_avx512vnni<NC, SPARSE>(n, sumi, x, y, occupancy);
+#elif defined(__AVXVNNI__)
+    vec_dot_i2_i8_s_1xN_avxvnni<NC, SPARSE>(n, sumi, x, y, occupancy);
+#else
+    vec_dot_i2_i8_s_1xN<NC, SPARSE>(n, sumi, x, y, occupancy);
+#endif
+}
+
+// With nrc > 1 this computes the nrc x nrc block of dot products between
+// weight rows vx + r * bx and activation rows vy + c * by, storing row r,
+// column c at s[c * bs + r], as ggml expects from multi-row vec_dot.
+// ggml's I2_S type traits keep nrows = 1, so inference always takes the
+// nrc <= 1 path; the register-blocked strips serve direct callers such as
+// bitnet-bench.
+static inline void vec_dot_i2_i8_s_impl(int n, float * s, size_t bs, const void * vx, size_t bx, const void * vy, size_t by, int nrc) {
+    if (nrc <= 1) {
+        const int8_t * y = (const int8_t *)vy;
+        int sumi;
+        vec_dot_i2_i8_s_strip<1>(n, &sumi, (const uint8_t *)vx, &y);
+        *s = (float)sumi;
+        return;
+    }
+
+    int r0 = 0;
+#if defined(__ARM_FEATURE_MATMUL_INT8) && defined(GGML_BITNET_I8MM)
+    // i8mm tiles pairs of weight rows against pairs of activation rows
+    for (; r0 + 2 <= nrc; r0 += 2) {
+        const uint8_t * x0 = (const uint8_t *)vx + r0 * bx;
+        int c0 = 0;
+        for (; c0 + 2 <= nrc; c0 += 2) {
+            int sumi[4];
+            vec_dot_i2_i8_s_2x2_i8mm(n, sumi, x0, x0 + bx, (const int8_t *)vy + c0 * by, (const int8_t *)vy + (c0 + 1) * by);
+            s[c0 * bs + r0]           = (float)sumi[0];
+            s[(c0 + 1) * bs + r0]     = (float)sumi[1];
+            s[c0 * bs + r0 + 1]       = (float)sumi[2];
+            s[(c0 + 1) * bs + r0 + 1] = (float)sumi[3];
+        }
+        for (; c0 < nrc; c0++) {
+            const int8_t * y = (const int8_t *)vy + c0 * by;
+            int sumi[2];
+            vec_dot_i2_i8_s_strip<1>(n, sumi, x0, &y);
+            vec_dot_i2_i8_s_strip<1>(n, sumi + 1, x0 + bx, &y);
+            s[c0 * bs + r0]     = (float)sumi[0];
+            s[c0 * bs + r0 + 1] = (float)sumi[1];
+        }
+    }
+#endif
+
+    for (int r = r0; r < nrc; r++) {
+        const uint8_t * x = (const uint8_t *)vx + r * bx;
+        for (int c0 = 0; c0 < nrc; c0 += I2_S_BLOCK_COLS) {
+            const int nc = nrc - c0 < I2_S_BLOCK_COLS ? nrc - c0 : I2_S_BLOCK_COLS;
+            const int8_t * y[I2_S_BLOCK_COLS];
+            int sumi[I2_S_BLOCK_COLS];
+            for (int c = 0; c < nc; c++) {
+                y[c] = (const int8_t *)vy + (c0 + c) * by;
+            }
+            switch (nc) {
+#if I2_S_BLOCK_COLS > 2
+                case 4: vec_dot_i2_i8_s_strip<4>(n, sumi, x, y); break;
+                case 3: vec_dot_i2_i8_s_strip<3>(n, sumi, x, y); break;
+#endif
+                case 2: vec_dot_i2_i8_s_strip<2>(n, sumi, x, y); break;
+                default: vec_dot_i2_i8_s_strip<1>(n, sumi, x, y); break;
+            }
+            for (int c = 0; c < nc; c++) {
+                s[(c0 + c) * bs + r] = (float)sumi[c];
+            }
+        }
+    }
+}
+
+// vec_dot_i2_i8_s_strip over the occupied blocks of x only. An empty block
+// holds code 1 in every slot, i.e. adds its activations once, so its block
+// sum stands in for it and its weights are never loaded. Integer sums
+// reorder exactly, so the result is the dense one.
+template<int NC>
+static inline void vec_dot_i2_i8_s_strip_sparse(int n, int * sumi, const uint8_t * x, const int8_t * const * y,
+                                                const uint8_t * occupancy, const int32_t * const * y_sums) {
+    const int nb = n / QK_I2_S;
+    vec_dot_i2_i8_s_strip<NC, true>(n, sumi, x, y, occupancy);
+    for (int b0 = 0; b0 < nb; b0 += 32) {
+        const int count = nb - b0 < 32 ? nb - b0 : 32;
+        const uint32_t bits = i2_s_occupancy_bits(occupancy, b0, count);
+        if (bits == (count < 32 ? (1u << count) - 1 : ~0u)) {
+            continue;
+        }
+        // Masked rather than branchy: empty blocks are rarely regular
+        for (int c = 0; c < NC; c++) {
+            int32_t sum = 0;
+            for (int j = 0; j < count; j++) {
+                sum += y_sums[c][b0 + j] & ((int32_t)((bits >> j) & 1) - 1);
+            }
+            sumi[c] += sum;
+        }
+    }
+}
+
+// vec_dot_i2_i8_s_impl for weight rows with an occupancy bitmap each, see
+// ggml_vec_dot_i2_i8_s_sparse. Same output layout as the dense kernel.
+static inline void vec_dot_i2_i8_s_sparse_impl(int n, float * s, size_t bs, const void * vx, size_t bx, const void * vy, size_t by, int nrc,
+                                               const uint8_t * occupancy, size_t occ_stride, const int32_t * y_sums) {
+    const int nb = n / QK_I2_S;
+    const int n_rows = nrc > 1 ? nrc : 1;
+    for (int r = 0; r < n_rows; r++) {
+        const uint8_t * x = (const uint8_t *)vx + r * bx;
+        const uint8_t * occ = occupancy + r * occ_stride;
+        for (int c0 = 0; c0 < n_rows; c0 += I2_S_BLOCK_COLS) {
+            const int nc = n_rows - c0 < I2_S_BLOCK_COLS ? n_rows - c0 : I2_S_BLOCK_COLS;
+            const int8_t * y[I2_S_BLOCK_COLS];
+            const int32_t * ys[I2_S_BLOCK_COLS];
+            int sumi[I2_S_BLOCK_COLS];
+            for (int c = 0; c < nc; c++) {
+                y[c] = (const int8_t *)vy + (c0 + c) * by;
+                ys[c] = y_sums + (size_t)(c0 + c) * nb;
+            }
+            switch (nc) {
+#if I2_S_BLOCK_COLS > 2
+                case 4: vec_dot_i2_i8_s_strip_sparse<4>(n, sumi, x, y, occ, ys); break;
+                case 3: vec_dot_i2_i8_s_strip_sparse<3>(n, sumi, x, y, occ, ys); break;
+#endif
+                case 2: vec_dot_i2_i8_s_strip_sparse<2>(n, sumi, x, y, occ, ys); break;
+                default: vec_dot_i2_i8_s_strip_sparse<1>(n, sumi, x, y, occ, ys); break;
+            }
+            for (int c = 0; c < nc; c++) {
+                s[(c0 + c) * bs + r] = (float)sumi[c];
+            }
+        }
+    }
+}
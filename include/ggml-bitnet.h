@@ -14,12 +14,110 @@ typedef float bitnet_float_type;
 extern "C" {
 #endif
 
+// Where ggml_bitnet_transform_tensor puts the packed weights on multi-socket
+// hosts. The default comes from BITNET_NUMA=replicate|partition, else off.
+enum ggml_bitnet_numa_mode {
+    GGML_BITNET_NUMA_OFF,
+    // a copy of every weight on each node, threads read their local one
+    GGML_BITNET_NUMA_REPLICATE,
+    // row tiles split across nodes, threads run their local tiles first
+    GGML_BITNET_NUMA_PARTITION,
+};
+
+struct bitnet_numa_weights;
+
 struct bitnet_tensor_extra {
     int lut_scales_size;
     int BK;
     int n_tile_num;
     uint8_t * qweights;
     bitnet_float_type * scales;
+    // NULL unless the weights were placed on NUMA nodes
+    struct bitnet_numa_weights * numa;
+    // One bit per (row tile, K block), tile-major, clear when the block
+    // holds only zero weights; the kernels skip its loads and lookups.
+    // NULL unless BITNET_SPARSE=1 and some block holds only zeros.
+    uint8_t * occupancy;
+    // Kept by the kernels as the model runs: the extra of the matmul that
+    // followed this one last time, in graph order, and the qweights bytes
+    // of one row tile, 0 until the tensor has been multiplied
+    struct bitnet_tensor_extra * next;
+    int64_t tile_bytes;
+    // Tenant the matmuls of the tensor run as, see ggml_bitnet_tenant_bind
+    int tenant;
+    // LUT cache generation of the tensor's last task_init
+    uint64_t lut_generation;
+};
+
+#if defined(GGML_BITNET_ARM_TL1)
+// Most activation columns one batched TL1 kernel call handles
+#define GGML_BITNET_TL1_MAX_BATCH 4
+
+typedef void (*bitnet_tbl_impl_t)(int32_t* c, int8_t* lut, uint8_t* a);
+// c holds bs * BM accumulators, lut holds bs full-K column LUTs
+typedef void (*bitnet_tbl_impl_batch_t)(int32_t* c, int8_t* lut, uint8_t* a, int bs);
+typedef int32_t (*bitnet_qgemm_lut_t)(void* A, void* LUT, void* Scales, void* LUT_Scales, void* C);
+typedef void (*bitnet_preprocessor_t)(void* B, void* LUT_Scales, void* QLUT);
+
+// One generated kernel, registered by codegen in bitnet-lut-kernels.h
+struct bitnet_lut_kernel {
+    int m;
+    int k;
+    int BM;
+    int BK;
+    bitnet_tbl_impl_t tbl_impl;
+    bitnet_tbl_impl_batch_t tbl_impl_batch;
+    bitnet_qgemm_lut_t qgemm_lut;
+    bitnet_preprocessor_t preprocessor;
+};
+#endif
+#if defined(GGML_BITNET_X86_TL2)
+// One generated kernel, registered by codegen in bitnet-lut-kernels.h
+struct bitnet_lut_kernel {
+    int m;
+    int k;
+    int BM;
+    int BK;
+    int three_k;
+    int two_k;
+};
+#endif
+
+// Bytes of the occupancy bitmap of one I2_S row of n weights: one bit per
+// 128-weight block, block b in bit b % 8 of byte b / 8
+#define GGML_BITNET_I2_S_OCCUPANCY_ROW_SIZE(n) (((n) / 128 + 7) / 8)
+
+enum ggml_bitnet_activation {
+    GGML_BITNET_ACT_NONE,
+    GGML_BITNET_ACT_SILU,
+    GGML_BITNET_ACT_RELU_SQR,   // max(x, 0)^2, the BitNet b1.58 FFN activation
+};
+
+enum ggml_bitnet_out_type {
+    GGML_BITNET_OUT_F32,
+    GGML_BITNET_OUT_F16,
+    // symmetric int8, e.g. the input of the next LUT or I2_S matmul
+    GGML_BITNET_OUT_I8,
+};
+
+// Work a matmul does on its outputs before they are stored, in this order:
+// y = act(acc * scale + bias[row]) + residual, then conversion to type.
+// Outputs are column-major with m rows per column, as the f32 ones are.
+struct ggml_bitnet_epilogue {
+    const float * bias;                 // m values, NULL for none
+    const float * residual;             // f32 in the output layout, NULL for none
+    enum ggml_bitnet_activation act;
+    enum ggml_bitnet_out_type type;
+    float out_scale;                    // GGML_BITNET_OUT_I8 stores round(y / out_scale), saturated to +-127
+};
+
+// Scheduling class of a model sharing the thread pool, see
+// ggml_bitnet_tenant_register
+enum ggml_bitnet_priority {
+    // latency bound, e.g. chat sessions
+    GGML_BITNET_PRIORITY_INTERACTIVE,
+    // throughput bound, only gets the threads interactive models leave idle
+    GGML_BITNET_PRIORITY_BATCH,
 };
 
 GGML_API void ggml_bitnet_init(void);
@@ -31,13 +129,105 @@ GGML_API void ggml_bitnet_free(void);
 GGML_API bool ggml_bitnet_can_mul_mat(const struct ggml_tensor * src0, const struct ggml_tensor * src1, const struct ggml_tensor * dst);
 GGML_API size_t ggml_bitnet_mul_mat_get_wsize(const struct ggml_tensor * src0, const struct ggml_tensor * src1, const struct ggml_tensor * dst);
 GGML_API void ggml_bitnet_mul_mat_task_init(void * src1, void * qlut, void * lut_scales, void * lut_biases, int n, int k, int m, int bits);
+#if defined(GGML_BITNET_ARM_TL1)
+// ggml_bitnet_mul_mat_task_init for the matmul of the weight tensor src0
+// with src1, the counterpart of ggml_bitnet_mul_mat_task_compute_tensor.
+// It reuses the LUT when an earlier matmul of the same graph evaluation
+// already preprocessed src1 (Q/K/V, gate/up). The match is on the tensor,
+// not its values. A new evaluation starts when ggml plans a graph or when
+// a weight is multiplied a second time, so graphs that are re-run without
+// being planned again never see the LUT of old contents. On return *qlut
+// and *lut_scales point at the LUT to pass to task_compute. That is
+// storage of the calling thread, valid until its next call, or the
+// caller's buffers when the activation is too large to cache.
+GGML_API void ggml_bitnet_mul_mat_task_init_tensor(const struct ggml_tensor * src0, const struct ggml_tensor * src1, void ** qlut, void ** lut_scales, int n, int k, int m);
+#endif
 GGML_API void ggml_bitnet_mul_mat_task_compute(void * src0, void * scales, void * qlut, void * lut_scales, void * lut_biases, void * dst, int n, int k, int m, int bits);
+#if defined(GGML_BITNET_ARM_TL1)
+// ggml_bitnet_mul_mat_task_compute for the weight tensor src0 rather than
+// its data: it is transformed first if the model loader has not done so,
+// then multiplied through its extra, so the weights are read from where
+// ggml_bitnet_transform_tensor placed them. This is the entry ggml's
+// mul_mat uses for model weights. epi, when the graph fuses the ops that
+// follow the matmul into it, is applied to every output tile while it is
+// still in cache, and dst holds epi->type elements; NULL stores plain f32.
+GGML_API void ggml_bitnet_mul_mat_task_compute_tensor(struct ggml_tensor * src0, void * qlut, void * lut_scales, void * dst, int n, int k, int m,
+                                                      const struct ggml_bitnet_epilogue * epi);
+#endif
 GGML_API void ggml_bitnet_transform_tensor(struct ggml_tensor * tensor);
+// Releases the extras of the tensors in buffer, and the NUMA copies of their
+// weights, when the model owning it is unloaded. Call it before the buffer
+// is freed; its tensors must not reach the BitNet kernels afterwards.
+// ggml_bitnet_free releases those of every buffer.
+GGML_API void ggml_bitnet_free_buffer(ggml_backend_buffer_t buffer);
 GGML_API int ggml_bitnet_get_type_bits(enum ggml_type type);
+// Applies to tensors transformed afterwards
+GGML_API void ggml_bitnet_set_numa_mode(enum ggml_bitnet_numa_mode mode);
+GGML_API enum ggml_bitnet_numa_mode ggml_bitnet_get_numa_mode(void);
+// Packed weights of a transformed tensor for the calling thread: its node's
+// replica when the weights are replicated, extra->qweights otherwise
+GGML_API uint8_t * ggml_bitnet_local_qweights(const struct bitnet_tensor_extra * extra);
+// Threads of the BitNet pool, counting the calling thread; <= 0 for
+// BITNET_THREADS, else one per performance core. The pool is resized in
+// place, so other tenants may be running matmuls meanwhile; it grows to at
+// most one thread per allowed CPU, or the count it was started with.
 GGML_API void ggml_bitnet_set_n_threads(int n_threads);
+// Several models served by one process share its pool. A tenant caps the
+// threads its matmuls use, counting the calling thread (<= 0 for all of
+// them), and batch tenants give way to interactive ones between work
+// chunks. Returns the tenant id, -1 once all are taken.
+GGML_API int ggml_bitnet_tenant_register(const char * name, int n_threads, enum ggml_bitnet_priority priority);
+// Runs the matmuls of the tensors in buffer, i.e. of the model it was
+// loaded into, as tenant. Call it once the model is loaded. It applies to
+// ggml_bitnet_mul_mat_task_init_tensor and task_compute_tensor; the
+// task_init and task_compute that take bare data run as tenant 0.
+GGML_API void ggml_bitnet_tenant_bind(ggml_backend_buffer_t buffer, int tenant);
+// Kernel instrumentation, recorded when BITNET_TRACE or BITNET_METRICS is
+// set. Writes the Chrome trace (Perfetto JSON) of the recent spans to path;
+// call it between graph evaluations.
+GGML_API bool ggml_bitnet_trace_write(const char * path);
+// Prometheus text exposition of the counters, e.g. for a /metrics endpoint.
+// Copies at most size - 1 bytes of it into buf, NUL terminated, and returns
+// its full length.
+GGML_API size_t ggml_bitnet_metrics_text(char * buf, size_t size);
+// Fills the occupancy bitmaps of nrow I2_S rows of n_per_row weights, each
+// GGML_BITNET_I2_S_OCCUPANCY_ROW_SIZE(n_per_row) bytes, and returns how many
+// blocks hold only zeros. Pruned checkpoints have whole empty blocks; a
+// dense ternary weight almost never does, and is best multiplied without.
+// The sparse dot pays off from about half the blocks empty when the weight
+// sits in cache, from fewer when it streams from DRAM.
+GGML_API int64_t ggml_bitnet_i2_s_occupancy(const void * vx, int64_t nrow, int64_t n_per_row, uint8_t * occupancy);
+// Sums of the int8 activations y over each 128-value block, n / 128 of them:
+// what an empty I2_S block contributes to a dot product
+GGML_API void ggml_bitnet_i2_s_block_sums(int n, const int8_t * y, int32_t * sums);
+// ggml_vec_dot_i2_i8_s that never reads the empty blocks of a weight row.
+// Weight row r has its bitmap at occupancy + r * occ_stride, activation
+// column c its block sums at y_sums + c * (n / 128). The results are
+// identical to ggml_vec_dot_i2_i8_s.
+GGML_API void ggml_vec_dot_i2_i8_s_sparse(int n, float * s, size_t bs, const void * vx, size_t bx, const void * vy, size_t by, int nrc,
+                                          const uint8_t * occupancy, size_t occ_stride, const int32_t * y_sums);
+// Stores rows [row0, row0 + n) of output column col of an m-row matmul
+// from their raw accumulators acc, which scale turns into outputs. The
+// I2_S path calls this on each block of rows ggml_vec_dot_i2_i8_s returns,
+// with the product of the activation and weight scales; epi NULL stores
+// plain f32.
+GGML_API void ggml_bitnet_epilogue_rows(const float * acc, float scale, const struct ggml_bitnet_epilogue * epi,
+                                        void * dst, int64_t col, int m, int row0, int n);
+#if defined(GGML_BITNET_ARM_TL1) || defined(GGML_BITNET_X86_TL2)
+// Returns the generated kernel for an (m, k) weight, or NULL if none was generated
+GGML_API const struct bitnet_lut_kernel * ggml_bitnet_get_lut_kernel(int m, int k);
+#endif
 #if defined(GGML_BITNET_ARM_TL1)
 GGML_API void ggml_qgemm_lut(int m, int k, void* A, void* LUT, void* Scales, void* LUT_Scales, void* C);
 GGML_API void ggml_preprocessor(int m, int k, void* B, void* LUT_Scales, void* QLUT);
+// Activations of one LUT chunk, the unit threads build a column's LUT in
+#define GGML_BITNET_LUT_CHUNK 256
+// ggml_preprocessor in pieces, so several threads can build one column's
+// LUT: the abs-max of k activations, which gives the scale 127 / max once
+// every piece of the column is in, and the LUT of k activations, a
+// multiple of 16, for the scale at LUT_Scales. Same bytes as ggml_preprocessor.
+GGML_API float ggml_bitnet_lut_abs_max(int k, const void* B);
+GGML_API void ggml_bitnet_lut_ctor(int k, void* B, void* LUT_Scales, void* QLUT);
 #endif
 #if defined(GGML_BITNET_X86_TL2)
 GGML_API void ggml_qgemm_lut(int bs, int m, int k, int BK, void* A, void* sign, void* LUT, void* Scales, void* LUT_Scales, void* C);
@@ -91,6 +91,18 @@ def run_command(command, shell=False, threads=2, is_conversation=False):
                             performance_metrics['prompt_eval_ms_per_token'] = float(ms_per_token)
                         except:
                             pass
+                elif line.startswith('decoded ') and 'speed:' in line:
+                    # llama-speculative: decoded   45 tokens in    3.210 seconds, speed:   14.019 t/s
+                    try:
+                        performance_metrics['spec_speed'] = float(line.split('speed:')[1].split('t/s')[0])
+                    except:
+                        pass
+                elif line.startswith('accept') and '=' in line:
+                    # llama-speculative: accept    = 71.429%
+                    try:
+                        performance_metrics['accept_rate'] = float(line.split('=')[1].strip().rstrip('%'))
+                    except:
+                        pass
                 elif 'eval time' in line and 'prompt eval' not in line:
                     # Extract: eval time = 2136.86 ms / 19 runs ( 112.47 ms per token, 8.89 tokens per second)
                     parts = line.split('=')[1].strip() if '=' in line else ""
@@ -112,7 +124,12 @@ def run_command(command, shell=False, threads=2, is_conversation=False):
             print(f"="*60)
             if 'prompt_eval_speed' in performance_metrics:
                 print(f"📝 Prompt evaluation: {performance_metrics['prompt_eval_speed']:.2f} tokens/sec ({performance_metrics['prompt_eval_ms_per_token']:.2f} ms/token)")
-            if 'gen_speed' in performance_metrics:
+            if 'spec_speed' in performance_metrics:
+                # the per-model eval lines only cover one side of speculation
+                print(f"🚀 Text generation: {performance_metrics['spec_speed']:.2f} tokens/sec (speculative)")
+                if 'accept_rate' in performance_metrics:
+                    print(f"🎯 Draft acceptance: {performance_metrics['accept_rate']:.1f}%")
+            elif 'gen_speed' in performance_metrics:
                 print(f"🚀 Text generation: {performance_metrics['gen_speed']:.2f} tokens/sec ({performance_metrics['gen_ms_per_token']:.2f} ms/token)")
             print(f"⏱️  Total inference time: {total_time:.2f} seconds")
             print(f"🔧 ARM dot product optimizations: ENABLED")
@@ -153,12 +170,15 @@ def run_command(command, shell=False, threads=2, is_conversation=False):
 
 def run_inference():
     build_dir = "build"
+    # With a draft model, llama-speculative lets it propose --draft tokens
+    # that the target checks in one batched forward pass
+    binary = "llama-speculative" if args.model_draft else "llama-cli"
     if platform.system() == "Windows":
-        main_path = os.path.join(build_dir, "bin", "Release", "llama-cli.exe")
+        main_path = os.path.join(build_dir, "bin", "Release", binary + ".exe")
         if not os.path.exists(main_path):
-            main_path = os.path.join(build_dir, "bin", "llama-cli")
+            main_path = os.path.join(build_dir, "bin", binary)
     else:
-        main_path = os.path.join(build_dir, "bin", "llama-cli")
+        main_path = os.path.join(build_dir, "bin", binary)
     command = [
         f'{main_path}',
         '-m', args.model,
@@ -169,8 +189,16 @@ def run_inference():
         '-c', str(args.ctx_size),
         '--temp', str(args.temperature),
     ]
+    if args.model_draft:
+        if args.conversation:
+            print("❌ Speculative decoding does not support conversation mode")
+            sys.exit(1)
+        command.extend(['-md', args.model_draft, '--draft', str(args.draft)])
     if args.conversation:
         command.append("-cnv")
+    if args.kv_type != 'f16':
+        # llama.cpp keeps a quantized V cache only with flash attention
+        command.extend(['-ctk', args.kv_type, '-ctv', args.kv_type, '-fa'])
     run_command(command, threads=args.threads, is_conversation=args.conversation)
 
 def signal_handler(sig, frame):
@@ -188,6 +216,9 @@ if __name__ == "__main__":
     parser.add_argument("-c", "--ctx-size", type=int, help="Size of the prompt context", required=False, default=2048)
     parser.add_argument("-temp", "--temperature", type=float, help="Temperature, a hyperparameter that controls the randomness of the generated text", required=False, default=0.8)
     parser.add_argument("-cnv", "--conversation", action='store_true', help="Whether to enable chat mode or not (for instruct models.)")
+    parser.add_argument("-md", "--model-draft", type=str, help="Path to a smaller draft model sharing the target's vocabulary, e.g. bitnet_b1_58-large for bitnet_b1_58-3B; enables speculative decoding", required=False, default=None)
+    parser.add_argument("--draft", type=int, help="Number of tokens the draft model proposes per verification pass", required=False, default=5)
+    parser.add_argument("--kv-type", type=str, choices=['f16', 'q8_0', 'q4_0'], help="KV cache type; q8_0 halves and q4_0 quarters its memory against f16", required=False, default='f16')
 
     args = parser.parse_args()
     run_inference()
\ No newline at end of file
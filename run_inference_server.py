@@ -4,6 +4,7 @@ import signal
 import platform
 import argparse
 import subprocess
+import tempfile
 
 def run_command(command, shell=False):
     """Run a system command and ensure it succeeds."""
@@ -13,36 +14,195 @@ def run_command(command, shell=False):
         print(f"Error occurred while running command: {e}")
         sys.exit(1)
 
-def run_server():
-    build_dir = "build"
-    if platform.system() == "Windows":
-        server_path = os.path.join(build_dir, "bin", "Release", "llama-server.exe")
-        if not os.path.exists(server_path):
-            server_path = os.path.join(build_dir, "bin", "llama-server")
-    else:
-        server_path = os.path.join(build_dir, "bin", "llama-server")
-    
+def server_supports(server_path, flag):
+    # Older llama-server builds lack speculative decoding and slot saving
+    try:
+        help_text = subprocess.run([server_path, '--help'], capture_output=True, text=True).stdout
+    except OSError:
+        return False
+    return flag in help_text
+
+def server_command(server_path, model, threads, host, port):
     command = [
         f'{server_path}',
-        '-m', args.model,
+        '-m', model,
         '-c', str(args.ctx_size),
-        '-t', str(args.threads),
+        '-t', str(threads),
         '-n', str(args.n_predict),
         '-ngl', '0',
         '--temp', str(args.temperature),
-        '--host', args.host,
-        '--port', str(args.port),
+        '--host', host,
+        '--port', str(port),
+        '-np', str(args.parallel),
         '-cb'  # Enable continuous batching
     ]
     
     if args.prompt:
         command.extend(['-p', args.prompt])
+
+    if args.kv_type != 'f16':
+        # llama.cpp keeps a quantized V cache only with flash attention
+        command.extend(['-ctk', args.kv_type, '-ctv', args.kv_type, '-fa'])
+    return command
+
+def run_server():
+    build_dir = "build"
+    if platform.system() == "Windows":
+        server_path = os.path.join(build_dir, "bin", "Release", "llama-server.exe")
+        if not os.path.exists(server_path):
+            server_path = os.path.join(build_dir, "bin", "llama-server")
+    else:
+        server_path = os.path.join(build_dir, "bin", "llama-server")
+
+    if args.serve:
+        run_models(server_path)
+        return
+    
+    # With the prefix cache, llama-server listens next to the proxy that takes its address
+    host, port = ('127.0.0.1', args.port + 1) if args.prefix_cache else (args.host, args.port)
+    command = server_command(server_path, args.model, args.threads, host, port)
+
+    if args.model_draft:
+        if not server_supports(server_path, '--model-draft'):
+            print(f"{server_path} does not support a draft model; rebuild with a llama.cpp that has speculative decoding in the server")
+            sys.exit(1)
+        command.extend(['-md', args.model_draft, '--draft', str(args.draft)])
     
     # Note: -cnv flag is removed as it's not supported by the server
     
+    # The BitNet backend reads these when the server starts
+    if args.trace:
+        os.environ['BITNET_TRACE'] = args.trace
+    if args.metrics:
+        os.environ['BITNET_METRICS'] = args.metrics
+
+    if args.prefix_cache:
+        run_prefix_cache(server_path, command, f'{host}:{port}')
+        return
+
     print(f"Starting server on {args.host}:{args.port}")
     run_command(command)
 
+def run_prefix_cache(server_path, command, upstream):
+    if server_supports(server_path, '--slot-save-path'):
+        args.save_dir = args.prefix_cache_dir or tempfile.mkdtemp(prefix="bitnet-kv-")
+        os.makedirs(args.save_dir, exist_ok=True)
+        command.extend(['--slot-save-path', args.save_dir])
+    else:
+        # Routing by prefix still works, saved KV blocks need slot saving
+        print(f"{server_path} cannot save slots; the prefix cache keeps prefixes in the slots only")
+        args.save_dir = None
+    args.upstream = upstream
+    args.wait = 600
+
+    print(f"Starting server on {upstream} behind the prefix cache on {args.host}:{args.port}")
+    server = subprocess.Popen(command)
+    try:
+        status = prefix_cache.serve(args)
+    finally:
+        server.terminate()
+        server.wait()
+    sys.exit(status)
+
+def parse_serve(spec):
+    """name=path[,threads=N][,priority=interactive|batch] of one --serve model."""
+    name, _, rest = spec.partition('=')
+    fields = rest.split(',')
+    if not name or not fields[0]:
+        raise ValueError(f"--serve {spec}: expected name=path")
+    model = {'name': name, 'path': fields[0], 'threads': 0, 'batch': False}
+    for field in fields[1:]:
+        key, _, value = field.partition('=')
+        if key == 'threads' and value.isdigit():
+            model['threads'] = int(value)
+        elif key == 'priority' and value in ('interactive', 'batch'):
+            model['batch'] = value == 'batch'
+        else:
+            raise ValueError(f"--serve {spec}: unknown option {field}")
+    return model
+
+def plan_models(models, cpus):
+    """Splits cpus, the global thread budget, between the models.
+
+    Interactive models get disjoint slices: the thread quota they ask for, or
+    an even share of what those asking for none leave. Batch models run on
+    every CPU of the budget and are niced, so they soak up the cores
+    interactive models leave idle without raising their latency.
+    """
+    budget = len(cpus)
+    interactive = [m for m in models if not m['batch']]
+    auto = [m for m in interactive if m['threads'] <= 0]
+    left = budget - sum(m['threads'] for m in interactive)
+    if left < len(auto):
+        raise ValueError(f"the interactive models need more than the {budget} threads of the budget")
+    for i, m in enumerate(auto):
+        m['threads'] = left // len(auto) + (1 if i < left % len(auto) else 0)
+    start = 0
+    for m in interactive:
+        m['cpus'] = cpus[start:start + m['threads']]
+        start += m['threads']
+    for m in models:
+        if m['batch']:
+            m['threads'] = min(m['threads'], budget) if m['threads'] > 0 else budget
+            m['cpus'] = cpus
+    return models
+
+def per_model_path(path, name):
+    root, ext = os.path.splitext(path)
+    return f"{root}-{name}{ext}"
+
+def model_preexec(m):
+    # BITNET_CPUS only places the BitNet pool; llama.cpp's own threads and
+    # the HTTP workers would still roam every CPU, so confine the process
+    def preexec():
+        if hasattr(os, 'sched_setaffinity'):
+            os.sched_setaffinity(0, m['cpus'])
+        if m['batch'] and hasattr(os, 'nice'):
+            os.nice(10)
+    return preexec
+
+def run_models(server_path):
+    if args.prefix_cache or args.model_draft:
+        print("--serve runs one llama-server per model; it cannot be combined with --prefix-cache or --model-draft")
+        sys.exit(1)
+    try:
+        models = [parse_serve(spec) for spec in args.serve]
+        if len({m['name'] for m in models}) != len(models):
+            raise ValueError("every --serve model needs a name of its own")
+        cpus = sorted(os.sched_getaffinity(0)) if hasattr(os, 'sched_getaffinity') else list(range(os.cpu_count()))
+        models = plan_models(models, cpus[:args.thread_budget] if args.thread_budget > 0 else cpus)
+    except ValueError as e:
+        print(e)
+        sys.exit(1)
+
+    servers = []
+    backends = []
+    try:
+        for i, m in enumerate(models):
+            port = args.port + 1 + i
+            env = dict(os.environ)
+            # Pool size and CPU set of this model's BitNet backend
+            env['BITNET_THREADS'] = str(m['threads'])
+            env['BITNET_CPUS'] = ','.join(str(cpu) for cpu in m['cpus'])
+            if args.trace:
+                env['BITNET_TRACE'] = per_model_path(args.trace, m['name'])
+            if args.metrics:
+                env['BITNET_METRICS'] = per_model_path(args.metrics, m['name'])
+            print(f"Starting {m['name']} ({'batch' if m['batch'] else 'interactive'}, {m['threads']} threads"
+                  f" on CPUs {env['BITNET_CPUS']}) on 127.0.0.1:{port}")
+            command = server_command(server_path, m['path'], m['threads'], '127.0.0.1', port)
+            servers.append(subprocess.Popen(command, env=env, preexec_fn=model_preexec(m)))
+            backends.append(f"{m['name']}=127.0.0.1:{port}")
+
+        print(f"Serving {', '.join(m['name'] for m in models)} on {args.host}:{args.port}")
+        status = model_router.serve(argparse.Namespace(backend=backends, host=args.host, port=args.port, wait=600))
+    finally:
+        for server in servers:
+            server.terminate()
+        for server in servers:
+            server.wait()
+    sys.exit(status)
+
 def signal_handler(sig, frame):
     print("Ctrl+C pressed, shutting down server...")
     sys.exit(0)
@@ -59,6 +219,21 @@ if __name__ == "__main__":
     parser.add_argument("--temperature", type=float, help="Temperature for sampling", required=False, default=0.8)
     parser.add_argument("--host", type=str, help="IP address to listen on", required=False, default="127.0.0.1")
     parser.add_argument("--port", type=int, help="Port to listen on", required=False, default=8080)
+    parser.add_argument("-np", "--parallel", type=int, help="Number of concurrent slots; the context is split evenly between them", required=False, default=1)
+    parser.add_argument("--trace", type=str, help="Write a Chrome trace of the BitNet kernels to this file when the server exits", required=False, default=None)
+    parser.add_argument("--metrics", type=str, help="Keep Prometheus counters of the BitNet kernels in this file, rewritten every second", required=False, default=None)
+    parser.add_argument("-md", "--model-draft", type=str, help="Path to a smaller draft model sharing the target's vocabulary; enables speculative decoding", required=False, default=None)
+    parser.add_argument("--draft", type=int, help="Number of tokens the draft model proposes per verification pass", required=False, default=5)
+    parser.add_argument("--prefix-cache", action='store_true', help="Reuse the KV cache of shared prompt prefixes across requests; llama-server moves to --port + 1 behind a proxy")
+    parser.add_argument("--prefix-cache-dir", type=str, help="Directory for saved KV blocks, a temporary one by default", required=False, default=None)
+    parser.add_argument("--kv-type", type=str, choices=['f16', 'q8_0', 'q4_0'], help="KV cache type; q8_0 halves and q4_0 quarters its memory against f16", required=False, default='f16')
+    parser.add_argument("--serve", type=str, action='append', help="name=path[,threads=N][,priority=interactive|batch]: serve this model too, chosen by the request's model field; repeat for every model, the first is the default", required=False, default=None)
+    parser.add_argument("--thread-budget", type=int, help="Threads, one per CPU, that all --serve models share; every CPU this process may use by default", required=False, default=0)
     
+    sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "utils"))
+    import prefix_cache
+    import model_router
+    prefix_cache.add_arguments(parser)
+
     args = parser.parse_args()
     run_server()
@@ -84,10 +84,41 @@ ARCH_ALIAS = {
 def system_info():
     return platform.system(), ARCH_ALIAS[platform.machine()]
 
-def get_model_name():
-    if args.hf_repo:
-        return SUPPORTED_HF_MODELS[args.hf_repo]["model_name"]
-    return os.path.basename(os.path.normpath(args.model_dir))
+# Kernels codegen_tl1.py / codegen_tl2.py generate per model: the model
+# whose shapes they cover, then BM, BK and bm for each of its shapes
+CODEGEN_KERNELS = {
+    "tl1": {
+        "bitnet_b1_58-large": ("bitnet_b1_58-large", "256,128,256", "128,64,128", "32,64,32"),
+        "Llama3-8B-1.58-100B-tokens": ("Llama3-8B-1.58-100B-tokens", "256,128,256,128", "128,64,128,64", "32,64,32,64"),
+        "bitnet_b1_58-3B": ("bitnet_b1_58-3B", "160,320,320", "64,128,64", "32,64,32"),
+    },
+    "tl2": {
+        "bitnet_b1_58-large": ("bitnet_b1_58-large", "256,128,256", "96,192,96", "32,32,32"),
+        "Llama3-8B-1.58-100B-tokens": ("Llama3-8B-1.58-100B-tokens", "256,128,256,128", "96,96,96,96", "32,32,32,32"),
+        "bitnet_b1_58-3B": ("bitnet_b1_58-3B", "160,320,320", "96,96,96", "32,32,32"),
+    },
+}
+
+def get_model_name(hf_repo=None, model_dir=None):
+    if hf_repo is None and model_dir is None:
+        hf_repo, model_dir = args.hf_repo, args.model_dir
+    if hf_repo:
+        return SUPPORTED_HF_MODELS[hf_repo]["model_name"]
+    return os.path.basename(os.path.normpath(model_dir))
+
+def draft_requested():
+    return args.draft_hf_repo is not None or args.draft_model_dir is not None
+
+def codegen_model(model_name, kernels):
+    # Models sharing an architecture share their kernels
+    llama3_f3_models = set([model['model_name'] for model in SUPPORTED_HF_MODELS.values() if model['model_name'].startswith("Falcon") or model['model_name'].startswith("Llama")])
+    if model_name in llama3_f3_models:
+        return kernels["Llama3-8B-1.58-100B-tokens"]
+    if model_name == "BitNet-b1.58-2B-4T":
+        return kernels["bitnet_b1_58-3B"]
+    if model_name in kernels:
+        return kernels[model_name]
+    raise NotImplementedError()
 
 def run_command(command, shell=False, log_step=None):
     """Run a system command and ensure it succeeds."""
@@ -106,10 +137,34 @@ def run_command(command, shell=False, log_step=None):
             logging.error(f"Error occurred while running command: {e}")
         sys.exit(1)
 
-def prepare_model():
+def kernel_lut_layout():
+    # m, k, BM, BK and bm per kernel, as convert-hf-to-gguf-bitnet.py records them
+    from configparser import ConfigParser
+    config = ConfigParser()
+    config.read("include/kernel_config.ini")
+    layout = []
+    for kernel in config.sections():
+        layout += [int(config.get(kernel, key)) for key in ("m", "k", "bm", "bk", "bmm")]
+    return layout
+
+def gguf_lut_layout(gguf_path):
+    # None for files converted before the layout was recorded
+    from gguf import GGUFReader
+    field = GGUFReader(gguf_path).get_field("bitnet.lut.layout")
+    if field is None:
+        return None
+    return [int(field.parts[i][0]) for i in field.data]
+
+def lut_layout_compatible(file_layout, layout):
+    # The build may hold more kernels than the file was converted with, e.g.
+    # a speculative draft's; only the tiling of the shapes both know matters
+    def tiles(flat):
+        return {(flat[i], flat[i + 1]): flat[i + 2:i + 5] for i in range(0, len(flat), 5)}
+    current = tiles(layout)
+    return all(current.get(shape, tiling) == tiling for shape, tiling in tiles(file_layout).items())
+
+def prepare_model(hf_url, model_dir):
     _, arch = system_info()
-    hf_url = args.hf_repo
-    model_dir = args.model_dir
     quant_type = args.quant_type
     quant_embd = args.quant_embd
     if hf_url is not None:
@@ -124,6 +179,13 @@ def prepare_model():
     else:
         logging.info(f"Loading model from directory {model_dir}.")
     gguf_path = os.path.join(model_dir, "ggml-model-" + quant_type + ".gguf")
+    if quant_type.startswith("tl") and os.path.exists(gguf_path) and os.path.getsize(gguf_path) > 0:
+        # TL weights are stored in kernel tile order, so a file converted for
+        # another tiling (e.g. before utils/kernel_tuning.py) gives wrong results
+        layout = gguf_lut_layout(gguf_path)
+        if layout is not None and not lut_layout_compatible(layout, kernel_lut_layout()):
+            logging.info(f"{gguf_path} was converted for other LUT kernels, converting it again")
+            os.remove(gguf_path)
     if not os.path.exists(gguf_path) or os.path.getsize(gguf_path) == 0:
         logging.info(f"Converting HF model to GGUF format...")
         if quant_type.startswith("tl"):
@@ -155,49 +217,38 @@ def setup_gguf():
 
 def gen_code():
     _, arch = system_info()
-    
-    llama3_f3_models = set([model['model_name'] for model in SUPPORTED_HF_MODELS.values() if model['model_name'].startswith("Falcon") or model['model_name'].startswith("Llama")])
+    lut_type = "tl1" if arch == "arm64" else "tl2"
 
-    if arch == "arm64":
-        if args.use_pretuned:
-            pretuned_kernels = os.path.join("preset_kernels", get_model_name())
-            if not os.path.exists(pretuned_kernels):
-                logging.error(f"Pretuned kernels not found for model {args.hf_repo}")
-                sys.exit(1)
-            if args.quant_type == "tl1":
-                shutil.copyfile(os.path.join(pretuned_kernels, "bitnet-lut-kernels-tl1.h"), "include/bitnet-lut-kernels.h")
-                shutil.copyfile(os.path.join(pretuned_kernels, "kernel_config_tl1.ini"), "include/kernel_config.ini")
-            elif args.quant_type == "tl2":
-                shutil.copyfile(os.path.join(pretuned_kernels, "bitnet-lut-kernels-tl2.h"), "include/bitnet-lut-kernels.h")
-                shutil.copyfile(os.path.join(pretuned_kernels, "kernel_config_tl2.ini"), "include/kernel_config.ini")
-        if get_model_name() == "bitnet_b1_58-large":
-            run_command([sys.executable, "utils/codegen_tl1.py", "--model", "bitnet_b1_58-large", "--BM", "256,128,256", "--BK", "128,64,128", "--bm", "32,64,32"], log_step="codegen")
-        elif get_model_name() in llama3_f3_models:
-            run_command([sys.executable, "utils/codegen_tl1.py", "--model", "Llama3-8B-1.58-100B-tokens", "--BM", "256,128,256,128", "--BK", "128,64,128,64", "--bm", "32,64,32,64"], log_step="codegen")
-        elif get_model_name() == "bitnet_b1_58-3B":
-            run_command([sys.executable, "utils/codegen_tl1.py", "--model", "bitnet_b1_58-3B", "--BM", "160,320,320", "--BK", "64,128,64", "--bm", "32,64,32"], log_step="codegen")
-        elif get_model_name() == "BitNet-b1.58-2B-4T":
-            run_command([sys.executable, "utils/codegen_tl1.py", "--model", "bitnet_b1_58-3B", "--BM", "160,320,320", "--BK", "64,128,64", "--bm", "32,64,32"], log_step="codegen")
-        else:
-            raise NotImplementedError()
-    else:
-        if args.use_pretuned:
-            # cp preset_kernels/model_name/bitnet-lut-kernels_tl1.h to include/bitnet-lut-kernels.h
-            pretuned_kernels = os.path.join("preset_kernels", get_model_name())
-            if not os.path.exists(pretuned_kernels):
-                logging.error(f"Pretuned kernels not found for model {args.hf_repo}")
-                sys.exit(1)
+    if args.use_pretuned:
+        if draft_requested():
+            logging.error("Pretuned kernels cover one model; generate them for a draft model instead")
+            sys.exit(1)
+        pretuned_kernels = os.path.join("preset_kernels", get_model_name())
+        if not os.path.exists(pretuned_kernels):
+            logging.error(f"Pretuned kernels not found for model {args.hf_repo}")
+            sys.exit(1)
+        if arch != "arm64":
             shutil.copyfile(os.path.join(pretuned_kernels, "bitnet-lut-kernels-tl2.h"), "include/bitnet-lut-kernels.h")
-        if get_model_name() == "bitnet_b1_58-large":
-            run_command([sys.executable, "utils/codegen_tl2.py", "--model", "bitnet_b1_58-large", "--BM", "256,128,256", "--BK", "96,192,96", "--bm", "32,32,32"], log_step="codegen")
-        elif get_model_name() in llama3_f3_models:
-            run_command([sys.executable, "utils/codegen_tl2.py", "--model", "Llama3-8B-1.58-100B-tokens", "--BM", "256,128,256,128", "--BK", "96,96,96,96", "--bm", "32,32,32,32"], log_step="codegen")
-        elif get_model_name() == "bitnet_b1_58-3B":
-            run_command([sys.executable, "utils/codegen_tl2.py", "--model", "bitnet_b1_58-3B", "--BM", "160,320,320", "--BK", "96,96,96", "--bm", "32,32,32"], log_step="codegen")
-        elif get_model_name() == "BitNet-b1.58-2B-4T":
-            run_command([sys.executable, "utils/codegen_tl2.py", "--model", "bitnet_b1_58-3B", "--BM", "160,320,320", "--BK", "96,96,96", "--bm", "32,32,32"], log_step="codegen")    
-        else:
-            raise NotImplementedError()
+        elif args.quant_type == "tl1":
+            shutil.copyfile(os.path.join(pretuned_kernels, "bitnet-lut-kernels-tl1.h"), "include/bitnet-lut-kernels.h")
+            shutil.copyfile(os.path.join(pretuned_kernels, "kernel_config_tl1.ini"), "include/kernel_config.ini")
+        elif args.quant_type == "tl2":
+            shutil.copyfile(os.path.join(pretuned_kernels, "bitnet-lut-kernels-tl2.h"), "include/bitnet-lut-kernels.h")
+            shutil.copyfile(os.path.join(pretuned_kernels, "kernel_config_tl2.ini"), "include/kernel_config.ini")
+
+    # One build serves the target and its speculative draft, so it gets the
+    # kernels of both: the codegen scripts take a model list with the tiles
+    # of every model's shapes in that order
+    models = [codegen_model(get_model_name(), CODEGEN_KERNELS[lut_type])]
+    if draft_requested():
+        draft = codegen_model(get_model_name(args.draft_hf_repo, args.draft_model_dir), CODEGEN_KERNELS[lut_type])
+        if draft[0] != models[0][0]:
+            models.append(draft)
+    run_command([sys.executable, f"utils/codegen_{lut_type}.py",
+                 "--model", ",".join(m[0] for m in models),
+                 "--BM", ",".join(m[1] for m in models),
+                 "--BK", ",".join(m[2] for m in models),
+                 "--bm", ",".join(m[3] for m in models)], log_step="codegen")
 
 
 def compile():
@@ -219,7 +270,10 @@ def main():
     setup_gguf()
     gen_code()
     compile()
-    prepare_model()
+    prepare_model(args.hf_repo, args.model_dir)
+    if draft_requested():
+        # Without a directory of its own the draft is downloaded next to the target
+        prepare_model(args.draft_hf_repo, args.draft_model_dir or (args.model_dir if args.hf_repo else "models"))
     
 def parse_args():
     _, arch = system_info()
@@ -230,6 +284,8 @@ def parse_args():
     parser.add_argument("--quant-type", "-q", type=str, help="Quantization type", choices=SUPPORTED_QUANT_TYPES[arch], default="i2_s")
     parser.add_argument("--quant-embd", action="store_true", help="Quantize the embeddings to f16")
     parser.add_argument("--use-pretuned", "-p", action="store_true", help="Use the pretuned kernel parameters")
+    parser.add_argument("--draft-hf-repo", type=str, help="Draft model for speculative decoding, built and converted along with the target", choices=SUPPORTED_HF_MODELS.keys())
+    parser.add_argument("--draft-model-dir", type=str, help="Directory to save/load the draft model", default=None)
     return parser.parse_args()
 
 def signal_handler(sig, frame):
@@ -0,0 +1,68 @@
+#include "bitnet-cpu-features.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__aarch64__) && defined(__linux__)
+#include <sys/auxv.h>
+#ifndef HWCAP_ASIMDDP
+#define HWCAP_ASIMDDP (1 << 20)
+#endif
+#ifndef HWCAP2_I8MM
+#define HWCAP2_I8MM (1 << 13)
+#endif
+#endif
+
+static bool bitnet_cpu_feature_disabled(const char * disable, const char * name) {
+    if (disable == nullptr) {
+        return false;
+    }
+    const size_t len = strlen(name);
+    for (const char * p = strstr(disable, name); p != nullptr; p = strstr(p + 1, name)) {
+        const bool starts = p == disable || p[-1] == ',';
+        const bool ends = p[len] == '\0' || p[len] == ',';
+        if (starts && ends) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bitnet_cpu_features bitnet_detect_cpu_features(void) {
+    bitnet_cpu_features f = {};
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+    __builtin_cpu_init();
+    f.avx2 = __builtin_cpu_supports("avx2");
+    f.avxvnni = f.avx2 && __builtin_cpu_supports("avxvnni");
+    f.avx512vnni = __builtin_cpu_supports("avx512vnni") && __builtin_cpu_supports("avx512bw");
+#endif
+
+#if defined(__aarch64__)
+    // Advanced SIMD is mandatory on AArch64
+    f.neon = true;
+#if defined(__linux__)
+    const unsigned long hwcap = getauxval(AT_HWCAP);
+    const unsigned long hwcap2 = getauxval(AT_HWCAP2);
+    f.dotprod = (hwcap & HWCAP_ASIMDDP) != 0;
+    f.i8mm = (hwcap2 & HWCAP2_I8MM) != 0;
+#elif defined(__APPLE__)
+    // Every Apple silicon core has dotprod; i8mm arrived with M2
+    f.dotprod = true;
+#endif
+#endif
+
+    const char * disable = getenv("BITNET_CPU_DISABLE");
+    if (bitnet_cpu_feature_disabled(disable, "avx2"))       f.avx2 = false;
+    if (bitnet_cpu_feature_disabled(disable, "avxvnni"))    f.avxvnni = false;
+    if (bitnet_cpu_feature_disabled(disable, "avx512vnni")) f.avx512vnni = false;
+    if (bitnet_cpu_feature_disabled(disable, "dotprod"))    f.dotprod = false;
+    if (bitnet_cpu_feature_disabled(disable, "i8mm"))       f.i8mm = false;
+
+    return f;
+}
+
+const bitnet_cpu_features * bitnet_get_cpu_features(void) {
+    static const bitnet_cpu_features features = bitnet_detect_cpu_features();
+    return &features;
+}
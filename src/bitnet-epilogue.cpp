@@ -0,0 +1,164 @@
+#include "bitnet-epilogue.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// Rows converted per pass; non-f32 outputs stage them here, in L1
+#define BITNET_EPILOGUE_CHUNK 64
+
+static inline float bitnet_to_float(int32_t v) { return (float)v; }
+static inline float bitnet_to_float(float v) { return v; }
+
+#if defined(__ARM_NEON)
+static inline float32x4_t bitnet_load_f32x4(const int32_t * p) { return vcvtq_f32_s32(vld1q_s32(p)); }
+static inline float32x4_t bitnet_load_f32x4(const float * p) { return vld1q_f32(p); }
+#elif defined(__AVX2__)
+static inline __m256 bitnet_load_f32x8(const int32_t * p) { return _mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i *)p)); }
+static inline __m256 bitnet_load_f32x8(const float * p) { return _mm256_loadu_ps(p); }
+#endif
+
+// y = acc * scale, plus bias when there is one. scale is already the
+// reciprocal of the LUT scale times the weight scale, so no lane divides.
+template <typename T>
+static void bitnet_epilogue_scale(const T * acc, float scale, const float * bias, float * y, int n) {
+    int i = 0;
+#if defined(__ARM_NEON)
+    for (; i + 4 <= n; i += 4) {
+        float32x4_t v = vmulq_n_f32(bitnet_load_f32x4(acc + i), scale);
+        if (bias != nullptr) {
+            v = vaddq_f32(v, vld1q_f32(bias + i));
+        }
+        vst1q_f32(y + i, v);
+    }
+#elif defined(__AVX2__)
+    const __m256 s = _mm256_set1_ps(scale);
+    for (; i + 8 <= n; i += 8) {
+        __m256 v = _mm256_mul_ps(bitnet_load_f32x8(acc + i), s);
+        if (bias != nullptr) {
+            v = _mm256_add_ps(v, _mm256_loadu_ps(bias + i));
+        }
+        _mm256_storeu_ps(y + i, v);
+    }
+#endif
+    for (; i < n; ++i) {
+        y[i] = bitnet_to_float(acc[i]) * scale;
+        if (bias != nullptr) {
+            y[i] += bias[i];
+        }
+    }
+}
+
+static void bitnet_epilogue_act(enum ggml_bitnet_activation act, float * y, int n) {
+    switch (act) {
+        case GGML_BITNET_ACT_SILU:
+            for (int i = 0; i < n; ++i) {
+                y[i] = y[i] / (1.0f + expf(-y[i]));
+            }
+            break;
+        case GGML_BITNET_ACT_RELU_SQR:
+            for (int i = 0; i < n; ++i) {
+                const float r = std::max(y[i], 0.0f);
+                y[i] = r * r;
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+static void bitnet_epilogue_store_f16(const float * y, ggml_fp16_t * dst, int n) {
+    int i = 0;
+#if defined(__ARM_NEON)
+    for (; i + 4 <= n; i += 4) {
+        vst1_f16((float16_t *)(dst + i), vcvt_f16_f32(vld1q_f32(y + i)));
+    }
+#elif defined(__AVX2__) && defined(__F16C__)
+    for (; i + 8 <= n; i += 8) {
+        _mm_storeu_si128((__m128i *)(dst + i), _mm256_cvtps_ph(_mm256_loadu_ps(y + i), _MM_FROUND_TO_NEAREST_INT));
+    }
+#endif
+    for (; i < n; ++i) {
+        dst[i] = ggml_fp32_to_fp16(y[i]);
+    }
+}
+
+static void bitnet_epilogue_store_i8(const float * y, float out_scale, int8_t * dst, int n) {
+    const float inv = out_scale != 0.0f ? 1.0f / out_scale : 0.0f;
+    int i = 0;
+#if defined(__ARM_NEON)
+    for (; i + 8 <= n; i += 8) {
+        const int32x4_t lo = vcvtnq_s32_f32(vmulq_n_f32(vld1q_f32(y + i), inv));
+        const int32x4_t hi = vcvtnq_s32_f32(vmulq_n_f32(vld1q_f32(y + i + 4), inv));
+        const int8x8_t q = vqmovn_s16(vcombine_s16(vqmovn_s32(lo), vqmovn_s32(hi)));
+        vst1_s8(dst + i, vmax_s8(q, vdup_n_s8(-127)));
+    }
+#elif defined(__AVX2__)
+    const __m256 s = _mm256_set1_ps(inv);
+    for (; i + 8 <= n; i += 8) {
+        const __m256i q = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_loadu_ps(y + i), s));
+        const __m128i q16 = _mm_packs_epi32(_mm256_castsi256_si128(q), _mm256_extracti128_si256(q, 1));
+        const __m128i q8 = _mm_max_epi8(_mm_packs_epi16(q16, q16), _mm_set1_epi8(-127));
+        _mm_storel_epi64((__m128i *)(dst + i), q8);
+    }
+#endif
+    for (; i < n; ++i) {
+        const float q = nearbyintf(y[i] * inv);
+        dst[i] = (int8_t)std::min(127.0f, std::max(-127.0f, q));
+    }
+}
+
+template <typename T>
+static void bitnet_epilogue_rows(const T * acc, float scale, const ggml_bitnet_epilogue * epi,
+                                 void * dst, int64_t col, int m, int row0, int n) {
+    const int64_t offset = col * m + row0;
+    if (epi == nullptr || epi->type == GGML_BITNET_OUT_F32) {
+        // f32 outputs are finished in place, without a staging pass
+        float * y = (float *)dst + offset;
+        bitnet_epilogue_scale(acc, scale, epi != nullptr && epi->bias != nullptr ? epi->bias + row0 : nullptr, y, n);
+        if (epi == nullptr) {
+            return;
+        }
+        bitnet_epilogue_act(epi->act, y, n);
+        if (epi->residual != nullptr) {
+            const float * r = epi->residual + offset;
+            for (int i = 0; i < n; ++i) {
+                y[i] += r[i];
+            }
+        }
+        return;
+    }
+
+    alignas(64) float y[BITNET_EPILOGUE_CHUNK];
+    for (int i0 = 0; i0 < n; i0 += BITNET_EPILOGUE_CHUNK) {
+        const int len = std::min(BITNET_EPILOGUE_CHUNK, n - i0);
+        bitnet_epilogue_scale(acc + i0, scale, epi->bias != nullptr ? epi->bias + row0 + i0 : nullptr, y, len);
+        bitnet_epilogue_act(epi->act, y, len);
+        if (epi->residual != nullptr) {
+            const float * r = epi->residual + offset + i0;
+            for (int i = 0; i < len; ++i) {
+                y[i] += r[i];
+            }
+        }
+        if (epi->type == GGML_BITNET_OUT_F16) {
+            bitnet_epilogue_store_f16(y, (ggml_fp16_t *)dst + offset + i0, len);
+        } else {
+            bitnet_epilogue_store_i8(y, epi->out_scale, (int8_t *)dst + offset + i0, len);
+        }
+    }
+}
+
+void bitnet_epilogue_rows_i32(const int32_t * acc, float scale, const ggml_bitnet_epilogue * epi,
+                              void * dst, int64_t col, int m, int row0, int n) {
+    bitnet_epilogue_rows(acc, scale, epi, dst, col, m, row0, n);
+}
+
+void ggml_bitnet_epilogue_rows(const float * acc, float scale, const struct ggml_bitnet_epilogue * epi,
+                               void * dst, int64_t col, int m, int row0, int n) {
+    bitnet_epilogue_rows(acc, scale, epi, dst, col, m, row0, n);
+}
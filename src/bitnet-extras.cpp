@@ -0,0 +1,147 @@
+#include "bitnet-extras.h"
+#include "bitnet-numa.h"
+#include "bitnet-threading.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+struct bitnet_extras_arena {
+    ggml_backend_buffer_t buffer;
+    std::vector<void *> blocks;
+    size_t count;   // extras handed out, the last block holds the remainder
+};
+
+// Slot of one extra, padded so no two share a cache line
+static constexpr size_t bitnet_extras_slot =
+    (sizeof(bitnet_tensor_extra) + BITNET_CACHE_LINE_SIZE - 1) / BITNET_CACHE_LINE_SIZE * BITNET_CACHE_LINE_SIZE;
+
+static std::vector<bitnet_extras_arena> bitnet_extras_arenas;
+static std::mutex bitnet_extras_mutex;
+static std::atomic<uint64_t> bitnet_extras_gen{0};
+
+static bitnet_tensor_extra * bitnet_extras_at(const bitnet_extras_arena & arena, size_t i) {
+    return (bitnet_tensor_extra *)((char *)arena.blocks[i / BITNET_EXTRAS_PER_BLOCK] + i % BITNET_EXTRAS_PER_BLOCK * bitnet_extras_slot);
+}
+
+static void bitnet_extras_release(bitnet_extras_arena & arena) {
+    // Extras of other models may have learned a link into this arena; the
+    // links are relearned on the next token, so drop all of them
+    for (bitnet_extras_arena & other : bitnet_extras_arenas) {
+        for (size_t i = 0; i < other.count; ++i) {
+            __atomic_store_n(&bitnet_extras_at(other, i)->next, nullptr, __ATOMIC_RELAXED);
+        }
+    }
+    bitnet_extras_gen.fetch_add(1);
+    for (size_t i = 0; i < arena.count; ++i) {
+        bitnet_numa_release(bitnet_extras_at(arena, i)->numa);
+        free(bitnet_extras_at(arena, i)->occupancy);
+    }
+    for (void * block : arena.blocks) {
+        free(block);
+    }
+    arena.blocks.clear();
+    arena.count = 0;
+}
+
+bitnet_tensor_extra * bitnet_extras_alloc(const struct ggml_tensor * tensor) {
+    std::lock_guard<std::mutex> lock(bitnet_extras_mutex);
+    bitnet_extras_arena * arena = nullptr;
+    for (bitnet_extras_arena & a : bitnet_extras_arenas) {
+        if (a.buffer == tensor->buffer) {
+            arena = &a;
+            break;
+        }
+    }
+    if (arena == nullptr) {
+        bitnet_extras_arenas.push_back({ tensor->buffer, {}, 0 });
+        arena = &bitnet_extras_arenas.back();
+    }
+
+    if (arena->count == arena->blocks.size() * BITNET_EXTRAS_PER_BLOCK) {
+        void * block = nullptr;
+        if (posix_memalign(&block, BITNET_CACHE_LINE_SIZE, BITNET_EXTRAS_PER_BLOCK * bitnet_extras_slot) != 0) {
+            return nullptr;
+        }
+        arena->blocks.push_back(block);
+    }
+    bitnet_tensor_extra * extra = bitnet_extras_at(*arena, arena->count++);
+    memset(extra, 0, sizeof(*extra));
+    return extra;
+}
+
+// The scan reads every weight at load time, which pages in the whole
+// mmap'd model, and dense ternary weights almost never have an empty
+// block, so only pruned models opt in
+static bool bitnet_sparse_enabled() {
+    static const bool enabled = [] {
+        const char * env = getenv("BITNET_SPARSE");
+        return env != nullptr && atoi(env) != 0;
+    }();
+    return enabled;
+}
+
+uint8_t * bitnet_extras_occupancy(const uint8_t * qweights, int64_t n_blocks, size_t block_bytes, uint8_t empty) {
+    if (!bitnet_sparse_enabled() || n_blocks <= 0) {
+        return nullptr;
+    }
+    uint8_t * occupancy = (uint8_t *)calloc((size_t)(n_blocks + 7) / 8, 1);
+    if (occupancy == nullptr) {
+        return nullptr;
+    }
+    int64_t n_empty = 0;
+    for (int64_t i = 0; i < n_blocks; ++i) {
+        const uint8_t * block = qweights + i * block_bytes;
+        size_t j = 0;
+        while (j < block_bytes && block[j] == empty) {
+            ++j;
+        }
+        if (j < block_bytes) {
+            occupancy[i / 8] |= (uint8_t)(1 << (i % 8));
+        } else {
+            ++n_empty;
+        }
+    }
+    // Dense weights skip the bit tests altogether
+    if (n_empty == 0) {
+        free(occupancy);
+        return nullptr;
+    }
+    return occupancy;
+}
+
+uint64_t bitnet_extras_generation() {
+    return bitnet_extras_gen.load(std::memory_order_acquire);
+}
+
+void bitnet_extras_release_all() {
+    std::lock_guard<std::mutex> lock(bitnet_extras_mutex);
+    for (bitnet_extras_arena & arena : bitnet_extras_arenas) {
+        bitnet_extras_release(arena);
+    }
+    bitnet_extras_arenas.clear();
+}
+
+void ggml_bitnet_tenant_bind(ggml_backend_buffer_t buffer, int tenant) {
+    std::lock_guard<std::mutex> lock(bitnet_extras_mutex);
+    for (bitnet_extras_arena & arena : bitnet_extras_arenas) {
+        if (arena.buffer == buffer) {
+            for (size_t i = 0; i < arena.count; ++i) {
+                __atomic_store_n(&bitnet_extras_at(arena, i)->tenant, tenant, __ATOMIC_RELAXED);
+            }
+        }
+    }
+}
+
+void ggml_bitnet_free_buffer(ggml_backend_buffer_t buffer) {
+    std::lock_guard<std::mutex> lock(bitnet_extras_mutex);
+    for (auto it = bitnet_extras_arenas.begin(); it != bitnet_extras_arenas.end(); ++it) {
+        if (it->buffer == buffer) {
+            bitnet_extras_release(*it);
+            bitnet_extras_arenas.erase(it);
+            return;
+        }
+    }
+}
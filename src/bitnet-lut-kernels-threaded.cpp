@@ -1,253 +1,488 @@
 #include "bitnet-lut-kernels-threaded.h"
+#include "bitnet-numa.h"
+#include "bitnet-epilogue.h"
+#include "bitnet-trace.h"
+#include "bitnet-extras.h"
+#include "bitnet-topology.h"
+#include <cstdlib>
 #include <cstring>
 #include <algorithm>
+#include <atomic>
+#include <iostream>
 
-// Threaded version of qgemm_lut_3200_8640
-int32_t qgemm_lut_3200_8640_threaded(void* A, void* LUT, void* Scales, void* LUT_Scales, void* C) {
+#if defined(GGML_BITNET_ARM_TL1)
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// Sum the per-slice partial accumulators of one tile into dst. Integer adds
+// are exact, so the result matches the single-threaded CBits bit for bit.
+static void bitnet_reduce_partials(int32_t* dst, const int32_t* partials, int n_parts, int stride, int BM) {
+    int i = 0;
+#if defined(__ARM_NEON)
+    for (; i + 4 <= BM; i += 4) {
+        int32x4_t acc = vld1q_s32(partials + i);
+        for (int p = 1; p < n_parts; ++p) {
+            acc = vaddq_s32(acc, vld1q_s32(partials + p * stride + i));
+        }
+        vst1q_s32(dst + i, acc);
+    }
+#elif defined(__AVX2__)
+    for (; i + 8 <= BM; i += 8) {
+        __m256i acc = _mm256_load_si256((const __m256i*)(partials + i));
+        for (int p = 1; p < n_parts; ++p) {
+            acc = _mm256_add_epi32(acc, _mm256_load_si256((const __m256i*)(partials + p * stride + i)));
+        }
+        _mm256_store_si256((__m256i*)(dst + i), acc);
+    }
+#endif
+    for (; i < BM; ++i) {
+        int32_t acc = partials[i];
+        for (int p = 1; p < n_parts; ++p) {
+            acc += partials[p * stride + i];
+        }
+        dst[i] = acc;
+    }
+}
+
+// Rows of a slice are padded to a whole cache line so neighbouring partials
+// never share one
+static inline int bitnet_partials_stride(int BM) {
+    return (BM + BITNET_CACHE_LINE_SIZE / 4 - 1) / (BITNET_CACHE_LINE_SIZE / 4) * (BITNET_CACHE_LINE_SIZE / 4);
+}
+
+// K slices per tile. K is split only when there are not enough tiles to keep
+// every thread busy, and never below BITNET_MIN_K_BLOCKS_PER_SLICE blocks
+// per slice.
+static int bitnet_qgemm_lut_parts(int n_tiles, int total_k_blocks) {
     if (g_bitnet_thread_pool == nullptr) {
         bitnet_threading_init();
     }
-    
-    const int BM = 160;  // BM3200_8640
-    const int BK = 64;   // BBK3200_8640
-    const int total_k_blocks = 8640 / BK;
-    
-    // For small matrices, use single-threaded version
-    if (total_k_blocks <= 2) {
-        return qgemm_lut_3200_8640(A, LUT, Scales, LUT_Scales, C);
-    }
-    
-    // Allocate thread-safe output buffer
-    alignas(32) uint32_t* CBits = aligned_alloc<uint32_t>(BM);
-    if (CBits == nullptr) {
-        // Fallback to stack allocation
-        alignas(32) uint32_t stack_CBits[BM];
-        CBits = stack_CBits;
-    }
-    
-    memset(CBits, 0, BM * sizeof(uint32_t));
-    
-    int num_threads = bitnet_get_optimal_thread_count();
-    int k_blocks_per_thread = (total_k_blocks + num_threads - 1) / num_threads;
-    
-    // Process K blocks in parallel
-    for (int t = 0; t < num_threads; ++t) {
-        int start_k = t * k_blocks_per_thread;
-        int end_k = std::min(start_k + k_blocks_per_thread, total_k_blocks);
-        
-        if (start_k >= end_k) continue;
-        
-        g_bitnet_thread_pool->enqueue([=]() {
-            // Each thread processes a range of K blocks
-            for (int32_t k_outer = start_k; k_outer < end_k; ++k_outer) {
-                // Calculate offsets for this K block
-                int lut_offset = k_outer * BK / 2 * 32;
-                int a_offset = k_outer * BK / 2 / 2 * BM;
-                
-                // Process this K block
-                tbl_impl_3200_8640(CBits, 
-                                  (int8_t*)LUT + lut_offset,
-                                  (uint8_t*)A + a_offset);
-            }
-        });
-    }
-    
-    g_bitnet_thread_pool->wait_all();
-    
-    // Final scaling (single-threaded, as it's fast)
-    for (int i = 0; i < BM; i++) {
-        ((bitnet_float_type*)C)[i] = ((int32_t*)CBits)[i] / 
-                                    ((bitnet_float_type*)LUT_Scales)[0] * 
-                                    ((bitnet_float_type*)Scales)[0];
-    }
-    
-    if (CBits != nullptr && BM > 160) {
-        free(CBits);
-    }
-    
-    return 0;
+    // Callers take part in parallel_for, so they count as a thread
+    const int num_threads = g_bitnet_thread_pool->concurrency();
+
+    int n_parts = 1;
+    if (n_tiles < num_threads) {
+        n_parts = (num_threads + n_tiles - 1) / n_tiles;
+        n_parts = std::min(n_parts, total_k_blocks / BITNET_MIN_K_BLOCKS_PER_SLICE);
+        n_parts = std::max(n_parts, 1);
+    }
+    return n_parts;
 }
 
-// Threaded version of qgemm_lut_3200_3200
-int32_t qgemm_lut_3200_3200_threaded(void* A, void* LUT, void* Scales, void* LUT_Scales, void* C) {
+// Leading bytes of the first row tiles of the next matmul's weights, pulled
+// into the last-level cache by threads that run out of tiles of the current
+// one. Those are the tiles the next call's threads claim first, and each is
+// read from its first K block on, so its head is what they need first.
+struct bitnet_prefetch_plan {
+    const bitnet_tensor_extra* next;
+    int n_tiles;
+    int64_t bytes_per_tile;
+};
+
+// Bytes of next weights prefetched per matmul: BITNET_PREFETCH, or half
+// the last-level cache so the prefetch cannot evict the current weights
+static int64_t bitnet_prefetch_budget() {
+    static const int64_t budget = [] {
+        const char* env = getenv("BITNET_PREFETCH");
+        if (env != nullptr) {
+            return (int64_t)strtoll(env, nullptr, 10);
+        }
+        const size_t llc = bitnet_get_topology().llc_size;
+        return llc > 0 ? (int64_t)llc / 2 : (int64_t)1 << 20;
+    }();
+    return budget;
+}
+
+// Plans the prefetch of next for a call over n columns. Prefill is compute
+// bound and reuses each weight across many columns, so only decode-sized
+// calls prefetch.
+static bool bitnet_prefetch_plan_for(const bitnet_tensor_extra* next, int n, bitnet_prefetch_plan* pf) {
     if (g_bitnet_thread_pool == nullptr) {
         bitnet_threading_init();
     }
-    
-    const int BM = 160;  // BM3200_3200
-    const int BK = 128;  // BBK3200_3200
-    const int total_k_blocks = 3200 / BK;
-    
-    // For small matrices, use single-threaded version
-    if (total_k_blocks <= 2) {
-        return qgemm_lut_3200_3200(A, LUT, Scales, LUT_Scales, C);
-    }
-    
-    // Allocate thread-safe output buffer
-    alignas(32) uint32_t* CBits = aligned_alloc<uint32_t>(BM);
-    if (CBits == nullptr) {
-        alignas(32) uint32_t stack_CBits[BM];
-        CBits = stack_CBits;
-    }
-    
-    memset(CBits, 0, BM * sizeof(uint32_t));
-    
-    int num_threads = bitnet_get_optimal_thread_count();
-    int k_blocks_per_thread = (total_k_blocks + num_threads - 1) / num_threads;
-    
-    // Process K blocks in parallel
-    for (int t = 0; t < num_threads; ++t) {
-        int start_k = t * k_blocks_per_thread;
-        int end_k = std::min(start_k + k_blocks_per_thread, total_k_blocks);
-        
-        if (start_k >= end_k) continue;
-        
-        g_bitnet_thread_pool->enqueue([=]() {
-            for (int32_t k_outer = start_k; k_outer < end_k; ++k_outer) {
-                int lut_offset = k_outer * BK / 2 * 32;
-                int a_offset = k_outer * BK / 2 / 2 * BM;
-                
-                tbl_impl_3200_3200(CBits, 
-                                  (int8_t*)LUT + lut_offset,
-                                  (uint8_t*)A + a_offset);
+    const int64_t budget = bitnet_prefetch_budget();
+    if (next == nullptr || budget <= 0 || n > BITNET_BATCH_CHUNK_COLS || next->n_tile_num <= 0) {
+        return false;
+    }
+    const int64_t tile_bytes = __atomic_load_n(&next->tile_bytes, __ATOMIC_RELAXED);
+    if (tile_bytes == 0) {
+        return false;
+    }
+    pf->next = next;
+    pf->n_tiles = std::min(next->n_tile_num, g_bitnet_thread_pool->concurrency());
+    pf->bytes_per_tile = std::min(tile_bytes, budget / pf->n_tiles) / BITNET_CACHE_LINE_SIZE * BITNET_CACHE_LINE_SIZE;
+    return pf->bytes_per_tile > 0;
+}
+
+int64_t bitnet_prefetch_bytes(const bitnet_tensor_extra* extra, int n) {
+    bitnet_prefetch_plan pf;
+    if (!bitnet_prefetch_plan_for(__atomic_load_n(&extra->next, __ATOMIC_RELAXED), n, &pf)) {
+        return 0;
+    }
+    return pf.n_tiles * pf.bytes_per_tile;
+}
+
+static void bitnet_prefetch_tile(const bitnet_prefetch_plan* pf, int tile) {
+    const uint8_t* head = ggml_bitnet_local_qweights(pf->next) + tile * pf->next->tile_bytes;
+    for (int64_t off = 0; off < pf->bytes_per_tile; off += BITNET_CACHE_LINE_SIZE) {
+        __builtin_prefetch(head + off, 0, 1);
+    }
+}
+
+// One column of a LUT built in chunks. Its sources, slices of the
+// activation, fold their abs-max in as they finish, and the last one turns
+// it into the LUT scale. The LUT scale covers all of K, so no chunk can start before then.
+struct alignas(BITNET_CACHE_LINE_SIZE) bitnet_lut_column {
+    uint32_t max_bits;  // abs-max as f32 bits, which order like the values for x >= 0
+    int32_t pending;    // sources not folded in yet
+    int32_t ready;      // the column's LUT scale is written
+};
+
+struct bitnet_lut_split {
+    int k;
+    int chunks;         // GGML_BITNET_LUT_CHUNK pieces per column
+    bitnet_float_type* B;
+    bitnet_float_type* lut_scales;
+    int8_t* qlut;
+    bitnet_lut_column cols[BITNET_LUT_SPLIT_MAX_COLS];
+};
+
+static void bitnet_lut_split_init(bitnet_lut_split* lut, int n, int k, void* B, void* lut_scales, void* qlut, int sources) {
+    lut->k = k;
+    lut->chunks = (k + GGML_BITNET_LUT_CHUNK - 1) / GGML_BITNET_LUT_CHUNK;
+    lut->B = (bitnet_float_type*)B;
+    lut->lut_scales = (bitnet_float_type*)lut_scales;
+    lut->qlut = (int8_t*)qlut;
+    for (int col = 0; col < n; ++col) {
+        lut->cols[col].max_bits = 0;
+        lut->cols[col].pending = sources;
+        lut->cols[col].ready = 0;
+    }
+}
+
+// Folds count values x of column col into its abs-max
+static void bitnet_lut_fold(bitnet_lut_split* lut, int col, const bitnet_float_type* x, int count) {
+    bitnet_lut_column* c = &lut->cols[col];
+    const float max = ggml_bitnet_lut_abs_max(count, x);
+    uint32_t bits;
+    memcpy(&bits, &max, sizeof(bits));
+    uint32_t seen = __atomic_load_n(&c->max_bits, __ATOMIC_RELAXED);
+    while (bits > seen && !__atomic_compare_exchange_n(&c->max_bits, &seen, bits, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+    // The last source sees every other one's max through the acq_rel count
+    if (__atomic_sub_fetch(&c->pending, 1, __ATOMIC_ACQ_REL) == 0) {
+        bits = __atomic_load_n(&c->max_bits, __ATOMIC_RELAXED);
+        float col_max;
+        memcpy(&col_max, &bits, sizeof(col_max));
+        // The expression per_tensor_quant uses, so the LUT is bit-identical
+        lut->lut_scales[col] = 127 / col_max;
+        __atomic_store_n(&c->ready, 1, __ATOMIC_RELEASE);
+    }
+}
+
+// Builds LUT chunk item, column-major over the chunks of every column. Jobs
+// put chunk items after all the sources of their columns and items are
+// claimed in order, so this only waits for sources still running.
+static void bitnet_lut_chunk(bitnet_lut_split* lut, int64_t item) {
+    const int col = (int)(item / lut->chunks);
+    const int off = (int)(item % lut->chunks) * GGML_BITNET_LUT_CHUNK;
+    for (int spins = 0; !__atomic_load_n(&lut->cols[col].ready, __ATOMIC_ACQUIRE); ++spins) {
+        if (spins < BITNET_SPIN_COUNT) {
+            bitnet_cpu_relax();
+        } else {
+            std::this_thread::yield();
+        }
+    }
+    const int64_t i = (int64_t)col * lut->k + off;
+    ggml_bitnet_lut_ctor(std::min(GGML_BITNET_LUT_CHUNK, lut->k - off), lut->B + i, lut->lut_scales + col, lut->qlut + i * 16);
+}
+
+// Stores one BM tile of output column col, rows row0.. of C. The scale is
+// formed once per tile as Scales / LUT_Scales, as the generated
+// qgemm_lut_* do, so threaded and serial outputs match bit for bit. Both
+// round differently from the original CBits / LUT_Scales * Scales, which
+// divided every output, and can differ from it in the last bit.
+static inline void bitnet_finish_tile(const int32_t* CBits, void* LUT_Scales, void* Scales,
+                                      const ggml_bitnet_epilogue* epi, void* C, int64_t col, int m, int row0, int BM) {
+    const float scale = ((bitnet_float_type*)Scales)[0] / ((bitnet_float_type*)LUT_Scales)[0];
+    bitnet_epilogue_rows_i32(CBits, scale, epi, C, col, m, row0, BM);
+}
+
+// Runs body(A, lo, hi) over the items of a weight tiled into n_tiles row
+// tiles, where items [tile * per_tile, (tile + 1) * per_tile) read row tile
+// tile of A. Replicated weights are read from the claiming thread's local
+// copy. Partitioned ones are claimed node by node: every thread drains the
+// tiles on its own node before it helps with the others. With a prefetch
+// plan one more item per prefetched tile follows the last compute item, so
+// only threads with nothing left to compute pick them up.
+template <typename F>
+static void bitnet_parallel_tiles(const bitnet_numa_weights* numa, void* A, int n_tiles, int per_tile, F&& body,
+                                  const bitnet_prefetch_plan* pf = nullptr) {
+    const int64_t n_items = (int64_t)n_tiles * per_tile;
+    if (numa == nullptr || numa->mode != GGML_BITNET_NUMA_PARTITION) {
+        g_bitnet_thread_pool->parallel_for(0, n_items + (pf != nullptr ? pf->n_tiles : 0), 1, [&](int64_t lo, int64_t hi) {
+            if (lo < n_items) {
+                body(numa != nullptr ? numa->replicas[bitnet_numa_local_index(numa)] : A, lo, std::min(hi, n_items));
+            }
+            for (int64_t item = std::max(lo, n_items); item < hi; ++item) {
+                bitnet_prefetch_tile(pf, (int)(item - n_items));
+            }
+        }).wait();
+        return;
+    }
+
+    struct alignas(BITNET_CACHE_LINE_SIZE) bitnet_node_cursor {
+        std::atomic<int64_t> next;
+    };
+    bitnet_node_cursor cursors[BITNET_NUMA_MAX_NODES];
+    for (int i = 0; i < numa->n_nodes; ++i) {
+        cursors[i].next.store((int64_t)numa->tile_begin[i] * per_tile, std::memory_order_relaxed);
+    }
+    // One claimant per thread; whoever starts first may well do it all
+    g_bitnet_thread_pool->parallel_for(0, g_bitnet_thread_pool->concurrency(), 1, [&](int64_t, int64_t) {
+        const int home = bitnet_numa_local_index(numa);
+        for (int d = 0; d < numa->n_nodes; ++d) {
+            const int node = (home + d) % numa->n_nodes;
+            const int64_t end = (int64_t)numa->tile_begin[node + 1] * per_tile;
+            for (int64_t item; (item = cursors[node].next.fetch_add(1, std::memory_order_relaxed)) < end; ) {
+                body(A, item, item + 1);
+            }
+        }
+    }).wait();
+}
+
+// Whether K block k_outer of row tile tile has a nonzero weight; without an
+// occupancy bitmap every block does
+static inline bool bitnet_block_occupied(const uint8_t* occupancy, int total_k_blocks, int tile, int k_outer) {
+    const int64_t i = (int64_t)tile * total_k_blocks + k_outer;
+    return occupancy == nullptr || ((occupancy[i / 8] >> (i % 8)) & 1);
+}
+
+// Split-K partials of every (tile, K slice), then per tile the count of
+// its slices still running
+static inline size_t bitnet_partials_count(int n_tiles, int n_parts, int BM) {
+    return (size_t)n_tiles * n_parts * bitnet_partials_stride(BM) + n_tiles;
+}
+
+size_t bitnet_qgemm_lut_threaded_scratch_size(int m, int k, int BM, int BK) {
+    const int n_tiles = m / BM;
+    const int n_parts = bitnet_qgemm_lut_parts(n_tiles, k / BK);
+    if (n_tiles * n_parts <= 1) {
+        return 0;
+    }
+    return bitnet_partials_count(n_tiles, n_parts, BM) * sizeof(int32_t);
+}
+
+// C is the output matrix and col the column this call computes. Empty
+// blocks in occupancy add nothing - their pairs all look up the zero
+// entry - so neither their weights nor their LUT rows are read.
+static int32_t bitnet_qgemm_lut_placed(const bitnet_numa_weights* numa, const ggml_bitnet_epilogue* epi,
+                                       bitnet_tbl_impl_t tbl_impl, int m, int k, int BM, int BK,
+                                       void* A, void* LUT, void* Scales, void* LUT_Scales, void* C, int64_t col,
+                                       const bitnet_prefetch_plan* pf = nullptr, const uint8_t* occupancy = nullptr) {
+    GGML_ASSERT(BM <= BITNET_MAX_BM);
+    const int n_tiles = m / BM;
+    const int total_k_blocks = k / BK;
+    const int64_t a_tile_stride = (int64_t)BM * k / 4;
+    const int stride = bitnet_partials_stride(BM);
+    const int n_parts = bitnet_qgemm_lut_parts(n_tiles, total_k_blocks);
+
+    if (n_tiles * n_parts <= 1) {
+        if (numa != nullptr && numa->mode == GGML_BITNET_NUMA_REPLICATE) {
+            A = numa->replicas[bitnet_numa_local_index(numa)];
+        }
+        alignas(BITNET_CACHE_LINE_SIZE) int32_t CBits[BITNET_MAX_BM];
+        memset(CBits, 0, BM * sizeof(int32_t));
+        for (int32_t k_outer = 0; k_outer < total_k_blocks; ++k_outer) {
+            if (bitnet_block_occupied(occupancy, total_k_blocks, 0, k_outer)) {
+                tbl_impl(CBits, (int8_t*)LUT + k_outer * BK / 2 * 32, (uint8_t*)A + k_outer * BK / 2 / 2 * BM);
+            }
+        }
+        bitnet_finish_tile(CBits, LUT_Scales, Scales, epi, C, col, m, 0, BM);
+        return 0;
+    }
+
+    // Every item writes its own slice of a pool arena; those were sized by
+    // ggml_bitnet_mul_mat_get_wsize, so this only allocates when the
+    // kernels are called without planning, e.g. from bitnet-bench
+    BitNetScratchLease scratch = g_bitnet_thread_pool->lease_scratch();
+    int32_t* partials = scratch->get<int32_t>(bitnet_partials_count(n_tiles, n_parts, BM));
+    if (partials == nullptr) {
+        return -1;
+    }
+    memset(partials, 0, (size_t)n_tiles * n_parts * stride * sizeof(int32_t));
+    int32_t* slices_left = partials + (size_t)n_tiles * n_parts * stride;
+    for (int tile = 0; tile < n_tiles; ++tile) {
+        slices_left[tile] = n_parts;
+    }
+
+    const int k_blocks_per_part = (total_k_blocks + n_parts - 1) / n_parts;
+
+    // Each work item owns one (tile, K slice) accumulator, so no two threads
+    // ever write the same CBits
+    bitnet_parallel_tiles(numa, A, n_tiles, n_parts, [&](void* A_local, int64_t lo, int64_t hi) {
+        for (int64_t item = lo; item < hi; ++item) {
+            const int tile = item / n_parts;
+            const int part = item % n_parts;
+            const int k_begin = part * k_blocks_per_part;
+            const int k_end = std::min(total_k_blocks, k_begin + k_blocks_per_part);
+
+            int32_t* CBits = partials + item * stride;
+            uint8_t* A_tile = (uint8_t*)A_local + tile * a_tile_stride;
+            for (int32_t k_outer = k_begin; k_outer < k_end; ++k_outer) {
+                if (bitnet_block_occupied(occupancy, total_k_blocks, tile, k_outer)) {
+                    tbl_impl(CBits, (int8_t*)LUT + k_outer * BK / 2 * 32, A_tile + k_outer * BK / 2 / 2 * BM);
+                }
             }
-        });
-    }
-    
-    g_bitnet_thread_pool->wait_all();
-    
-    // Final scaling
-    for (int i = 0; i < BM; i++) {
-        ((bitnet_float_type*)C)[i] = ((int32_t*)CBits)[i] / 
-                                    ((bitnet_float_type*)LUT_Scales)[0] * 
-                                    ((bitnet_float_type*)Scales)[0];
-    }
-    
-    if (CBits != nullptr && BM > 160) {
-        free(CBits);
-    }
-    
+
+            if (n_parts == 1) {
+                bitnet_finish_tile(CBits, LUT_Scales, Scales, epi, C, col, m, tile * BM, BM);
+            } else if (__atomic_sub_fetch(&slices_left[tile], 1, __ATOMIC_ACQ_REL) == 0) {
+                // The last slice of the tile merges them all in a fixed
+                // order, then scales: no barrier between slices and merge
+                int32_t* tile_partials = partials + (int64_t)tile * n_parts * stride;
+                bitnet_reduce_partials(tile_partials, tile_partials, n_parts, stride, BM);
+                bitnet_finish_tile(tile_partials, LUT_Scales, Scales, epi, C, col, m, tile * BM, BM);
+            }
+        }
+    }, pf);
+
     return 0;
 }
 
-// Threaded version of qgemm_lut_8640_3200
-int32_t qgemm_lut_8640_3200_threaded(void* A, void* LUT, void* Scales, void* LUT_Scales, void* C) {
+int32_t bitnet_qgemm_lut_threaded(bitnet_tbl_impl_t tbl_impl, int m, int k, int BM, int BK,
+                                  void* A, void* LUT, void* Scales, void* LUT_Scales, void* C) {
+    return bitnet_qgemm_lut_placed(nullptr, nullptr, tbl_impl, m, k, BM, BK, A, LUT, Scales, LUT_Scales, C, 0);
+}
+
+static int32_t bitnet_qgemm_lut_batch_placed(const bitnet_numa_weights* numa, const ggml_bitnet_epilogue* epi,
+                                             bitnet_tbl_impl_batch_t tbl_impl_batch, int n, int m, int k, int BM, int BK,
+                                             void* A, void* LUT, void* Scales, void* LUT_Scales, void* C,
+                                             const bitnet_prefetch_plan* pf = nullptr, const uint8_t* occupancy = nullptr) {
+    GGML_ASSERT(BM <= BITNET_MAX_BM);
     if (g_bitnet_thread_pool == nullptr) {
         bitnet_threading_init();
     }
-    
-    const int BM = 320;  // BM8640_3200
-    const int BK = 64;   // BBK8640_3200
-    const int total_k_blocks = 3200 / BK;
-    
-    // For small matrices, use single-threaded version
-    if (total_k_blocks <= 2) {
-        return qgemm_lut_8640_3200(A, LUT, Scales, LUT_Scales, C);
-    }
-    
-    // Allocate thread-safe output buffer
-    alignas(32) uint32_t* CBits = aligned_alloc<uint32_t>(BM);
-    if (CBits == nullptr) {
-        alignas(32) uint32_t stack_CBits[BM];
-        CBits = stack_CBits;
-    }
-    
-    memset(CBits, 0, BM * sizeof(uint32_t));
-    
-    int num_threads = bitnet_get_optimal_thread_count();
-    int k_blocks_per_thread = (total_k_blocks + num_threads - 1) / num_threads;
-    
-    // Process K blocks in parallel
-    for (int t = 0; t < num_threads; ++t) {
-        int start_k = t * k_blocks_per_thread;
-        int end_k = std::min(start_k + k_blocks_per_thread, total_k_blocks);
-        
-        if (start_k >= end_k) continue;
-        
-        g_bitnet_thread_pool->enqueue([=]() {
-            for (int32_t k_outer = start_k; k_outer < end_k; ++k_outer) {
-                int lut_offset = k_outer * BK / 2 * 32;
-                int a_offset = k_outer * BK / 2 / 2 * BM;
-                
-                tbl_impl_8640_3200(CBits, 
-                                  (int8_t*)LUT + lut_offset,
-                                  (uint8_t*)A + a_offset);
+
+    const int n_tiles = m / BM;
+    const int total_k_blocks = k / BK;
+    const int n_chunks = (n + BITNET_BATCH_CHUNK_COLS - 1) / BITNET_BATCH_CHUNK_COLS;
+    const int64_t a_tile_stride = (int64_t)BM * k / 4;
+    const int64_t lut_col_stride = (int64_t)k / 2 * 32;
+
+    // Continuous batching decodes one column per slot, so n is anything up
+    // to the slot count. Columns are split into chunks of at most
+    // BITNET_BATCH_CHUNK_COLS and every chunk into kernel groups whose sizes
+    // differ by at most one - 7 columns run as 4 + 3, not 4 + 2 + 1 - so
+    // each group takes the widest BATCH_SIZE specialisation that fits.
+    // Chunks of one tile are adjacent so a thread keeps reusing the same
+    // weight tile from cache.
+    bitnet_parallel_tiles(numa, A, n_tiles, n_chunks, [&](void* A_local, int64_t lo, int64_t hi) {
+        alignas(BITNET_CACHE_LINE_SIZE) int32_t CBits[BITNET_BATCH_CHUNK_COLS * BITNET_MAX_BM];
+        for (int64_t item = lo; item < hi; ++item) {
+            const int tile = item / n_chunks;
+            const int chunk = item % n_chunks;
+            const int col0 = (int64_t)chunk * n / n_chunks;
+            const int cols = (int64_t)(chunk + 1) * n / n_chunks - col0;
+            const int n_groups = (cols + GGML_BITNET_TL1_MAX_BATCH - 1) / GGML_BITNET_TL1_MAX_BATCH;
+
+            memset(CBits, 0, (size_t)cols * BM * sizeof(int32_t));
+            int8_t* lut = (int8_t*)LUT + col0 * lut_col_stride;
+            uint8_t* A_tile = (uint8_t*)A_local + tile * a_tile_stride;
+            // K-block outermost: all groups of the chunk read one weight
+            // block while it is still in L1
+            for (int32_t k_outer = 0; k_outer < total_k_blocks; ++k_outer) {
+                if (!bitnet_block_occupied(occupancy, total_k_blocks, tile, k_outer)) {
+                    continue;
+                }
+                uint8_t* A_block = A_tile + k_outer * BK / 2 / 2 * BM;
+                for (int g = 0; g < n_groups; ++g) {
+                    const int g0 = g * cols / n_groups;
+                    const int g1 = (g + 1) * cols / n_groups;
+                    tbl_impl_batch(CBits + g0 * BM, lut + g0 * lut_col_stride + k_outer * BK / 2 * 32, A_block, g1 - g0);
+                }
             }
-        });
-    }
-    
-    g_bitnet_thread_pool->wait_all();
-    
-    // Final scaling
-    for (int i = 0; i < BM; i++) {
-        ((bitnet_float_type*)C)[i] = ((int32_t*)CBits)[i] / 
-                                    ((bitnet_float_type*)LUT_Scales)[0] * 
-                                    ((bitnet_float_type*)Scales)[0];
-    }
-    
-    if (CBits != nullptr && BM > 320) {
-        free(CBits);
-    }
-    
+
+            for (int b = 0; b < cols; ++b) {
+                bitnet_finish_tile(CBits + b * BM, (bitnet_float_type*)LUT_Scales + col0 + b, Scales, epi,
+                                   C, col0 + b, m, tile * BM, BM);
+            }
+        }
+    }, pf);
+
     return 0;
 }
 
-// Threaded preprocessor
-void ggml_preprocessor_threaded(int m, int k, void* B, void* LUT_Scales, void* QLUT) {
+int32_t bitnet_qgemm_lut_batch_threaded(bitnet_tbl_impl_batch_t tbl_impl_batch, int n, int m, int k, int BM, int BK,
+                                        void* A, void* LUT, void* Scales, void* LUT_Scales, void* C) {
+    return bitnet_qgemm_lut_batch_placed(nullptr, nullptr, tbl_impl_batch, n, m, k, BM, BK, A, LUT, Scales, LUT_Scales, C);
+}
+
+// LUTs of n activation columns of k values. With a thread per column each
+// builds whole columns. Otherwise one job takes every column in slices: the
+// first items fold the abs-max of one slice each, the LUT chunks after them
+// start as soon as the slices of their column are in, with no barrier
+// between the two.
+static void bitnet_lut_build(int n, int k, void* B, void* LUT_Scales, void* QLUT) {
     if (g_bitnet_thread_pool == nullptr) {
         bitnet_threading_init();
     }
-    
-    // For small matrices, use single-threaded version
-    if (m < 1024 || k < 1024) {
-        ggml_preprocessor(m, k, B, LUT_Scales, QLUT);
+    const int num_threads = g_bitnet_thread_pool->concurrency();
+    if (n >= num_threads || n > BITNET_LUT_SPLIT_MAX_COLS) {
+        g_bitnet_thread_pool->parallel_for(0, n, 1, [&](int64_t lo, int64_t hi) {
+            for (int64_t col = lo; col < hi; ++col) {
+                bitnet_float_type* b = (bitnet_float_type*)B + col * k;
+                bitnet_float_type* lut_scales = (bitnet_float_type*)LUT_Scales + col;
+                *lut_scales = 127 / ggml_bitnet_lut_abs_max(k, b);
+                ggml_bitnet_lut_ctor(k, b, lut_scales, (int8_t*)QLUT + col * k / 2 * 32);
+            }
+        }).wait();
         return;
     }
-    
-    // Split work by K dimension for preprocessing
-    int num_threads = bitnet_get_optimal_thread_count();
-    int k_tile_size = k / num_threads;
-    if (k_tile_size < 64) k_tile_size = 64;
-    
-    for (int t = 0; t < num_threads; ++t) {
-        int start_k = t * k_tile_size;
-        int end_k = std::min(start_k + k_tile_size, k);
-        
-        if (start_k >= end_k) continue;
-        
-        g_bitnet_thread_pool->enqueue([=]() {
-            // Process this K slice
-            if (m == 3200 && k == 8640) {
-                preprocessor_k<8640>((char*)B + start_k * m * sizeof(bitnet_float_type), 
-                                   LUT_Scales, 
-                                   (char*)QLUT + start_k * m * 2);
-            }
-            else if (m == 3200 && k == 3200) {
-                preprocessor_k<3200>((char*)B + start_k * m * sizeof(bitnet_float_type), 
-                                   LUT_Scales, 
-                                   (char*)QLUT + start_k * m * 2);
-            }
-            else if (m == 8640 && k == 3200) {
-                preprocessor_k<3200>((char*)B + start_k * m * sizeof(bitnet_float_type), 
-                                   LUT_Scales, 
-                                   (char*)QLUT + start_k * m * 2);
+
+    // Enough slices, of whole chunks, for every thread to take one
+    const int chunks = (k + GGML_BITNET_LUT_CHUNK - 1) / GGML_BITNET_LUT_CHUNK;
+    const int slices = std::max(1, std::min(chunks, num_threads / n));
+    bitnet_lut_split lut;
+    bitnet_lut_split_init(&lut, n, k, B, LUT_Scales, QLUT, slices);
+    const int64_t n_slices = (int64_t)n * slices;
+    g_bitnet_thread_pool->parallel_for(0, n_slices + (int64_t)n * lut.chunks, 1, [&](int64_t lo, int64_t hi) {
+        for (int64_t item = lo; item < hi; ++item) {
+            if (item >= n_slices) {
+                bitnet_lut_chunk(&lut, item - n_slices);
+                continue;
             }
-        });
+            const int col = (int)(item / slices);
+            const int slice = (int)(item % slices);
+            const int c0 = slice * lut.chunks / slices * GGML_BITNET_LUT_CHUNK;
+            const int c1 = std::min(k, (slice + 1) * lut.chunks / slices * GGML_BITNET_LUT_CHUNK);
+            bitnet_lut_fold(&lut, col, lut.B + (int64_t)col * k + c0, c1 - c0);
+        }
+    }).wait();
+}
+
+// Threaded preprocessor. The LUT scale is the abs-max over all of K, so the
+// chunks of the LUT are built once every slice of the column has its max.
+void ggml_preprocessor_threaded(int m, int k, void* B, void* LUT_Scales, void* QLUT) {
+    ggml_preprocessor_batch_threaded(1, m, k, B, LUT_Scales, QLUT);
+}
+
+void ggml_preprocessor_batch_threaded(int n, int m, int k, void* B, void* LUT_Scales, void* QLUT) {
+    // As ggml_preprocessor, leave the LUT alone for shapes without a kernel
+    if (ggml_bitnet_get_lut_kernel(m, k) == nullptr) {
+        return;
     }
-    
-    g_bitnet_thread_pool->wait_all();
+    bitnet_lut_build(n, k, B, LUT_Scales, QLUT);
 }
 
-// Main threaded dispatch function
+// Main threaded dispatch function. Like ggml_qgemm_lut, this computes a
+// single BM tile of the (m, k) weight.
 void ggml_qgemm_lut_threaded(int m, int k, void* A, void* LUT, void* Scales, void* LUT_Scales, void* C) {
-    if (m == 3200 && k == 8640) {
-        qgemm_lut_3200_8640_threaded(A, LUT, Scales, LUT_Scales, C);
-    }
-    else if (m == 3200 && k == 3200) {
-        qgemm_lut_3200_3200_threaded(A, LUT, Scales, LUT_Scales, C);
-    }
-    else if (m == 8640 && k == 3200) {
-        qgemm_lut_8640_3200_threaded(A, LUT, Scales, LUT_Scales, C);
+    const bitnet_lut_kernel* kernel = ggml_bitnet_get_lut_kernel(m, k);
+    if (kernel != nullptr) {
+        bitnet_qgemm_lut_threaded(kernel->tbl_impl, kernel->BM, k, kernel->BM, kernel->BK, A, LUT, Scales, LUT_Scales, C);
     }
     else {
         // Fallback to single-threaded version
@@ -255,13 +490,95 @@ void ggml_qgemm_lut_threaded(int m, int k, void* A, void* LUT, void* Scales, voi
     }
 }
 
-// Threaded matrix multiplication with automatic kernel selection
-void ggml_bitnet_mul_mat_threaded(void* src0, void* scales, void* qlut, void* lut_scales, 
-                                 void* lut_biases, void* dst, int n, int k, int m, int bits) {
-    if (g_bitnet_thread_pool == nullptr) {
-        bitnet_threading_init();
+static void bitnet_mul_mat_columns(const bitnet_lut_kernel* kernel, const bitnet_numa_weights* numa,
+                                   const ggml_bitnet_epilogue* epi, int BM, int BK, void* src0, void* scales,
+                                   void* qlut, void* lut_scales, void* dst, int n, int k, int m,
+                                   const bitnet_prefetch_plan* pf = nullptr, const uint8_t* occupancy = nullptr) {
+    // TL1 packs two bits per weight, read once per call for all columns
+    BitNetTraceScope trace(BITNET_TRACE_LUT_LOOKUP, n, k, m, (uint64_t)m * k / 4);
+    // Prefill and multi-slot decode: share each unpacked weight vector
+    // across a group of columns
+    if (n > 1 && kernel->tbl_impl_batch != nullptr) {
+        bitnet_qgemm_lut_batch_placed(numa, epi, kernel->tbl_impl_batch, n, m, k, BM, BK, src0, qlut, scales, lut_scales, dst, pf,
+                                      occupancy);
+        return;
+    }
+
+    for (int col = 0; col < n; ++col) {
+        // The preprocessor emits k / 2 * 32 LUT bytes and one scale per column
+        int8_t* col_qlut = (int8_t*)qlut + (int64_t)col * k / 2 * 32;
+        bitnet_float_type* col_lut_scales = (bitnet_float_type*)lut_scales + col;
+
+        bitnet_qgemm_lut_placed(numa, epi, kernel->tbl_impl, m, k, BM, BK, src0, col_qlut, scales, col_lut_scales, dst, col,
+                                col == n - 1 ? pf : nullptr, occupancy);
     }
-    
-    // Use threaded LUT kernels
-    ggml_qgemm_lut_threaded(m, k, src0, qlut, scales, lut_scales, dst);
 }
+
+// The matmul this thread ran last, to learn which one follows which
+static thread_local bitnet_tensor_extra* tls_prev_extra = nullptr;
+static thread_local uint64_t tls_prev_generation = 0;
+
+// Links the previous matmul of this thread to extra. Graphs run their
+// matmuls in the same order every token, so after the first one each
+// extra's next is the weight that is needed after it.
+static void bitnet_learn_order(bitnet_tensor_extra* extra) {
+    const uint64_t generation = bitnet_extras_generation();
+    bitnet_tensor_extra* prev = tls_prev_generation == generation ? tls_prev_extra : nullptr;
+    if (prev != nullptr && prev != extra && __atomic_load_n(&prev->next, __ATOMIC_RELAXED) != extra) {
+        __atomic_store_n(&prev->next, extra, __ATOMIC_RELAXED);
+    }
+    tls_prev_extra = extra;
+    tls_prev_generation = generation;
+}
+
+// Threaded matrix multiplication with automatic kernel selection. Computes
+// all m output rows for each of the n activation columns, splitting the
+// BM tiles across the pool. Shapes without a generated kernel are skipped,
+// as they are by ggml_qgemm_lut.
+void ggml_bitnet_mul_mat_threaded(void* src0, void* scales, void* qlut, void* lut_scales,
+                                 void* dst, int n, int k, int m) {
+    const bitnet_lut_kernel* kernel = ggml_bitnet_get_lut_kernel(m, k);
+    if (kernel == nullptr) {
+        return;
+    }
+    bitnet_mul_mat_columns(kernel, nullptr, nullptr, kernel->BM, kernel->BK, src0, scales, qlut, lut_scales, dst, n, k, m);
+}
+
+void ggml_bitnet_mul_mat_extra_threaded(const struct bitnet_tensor_extra* extra, void* qlut, void* lut_scales,
+                                        void* dst, int n, int k, int m) {
+    ggml_bitnet_mul_mat_extra_epilogue(extra, qlut, lut_scales, dst, n, k, m, nullptr);
+}
+
+void ggml_bitnet_mul_mat_extra_epilogue(const struct bitnet_tensor_extra* extra, void* qlut, void* lut_scales,
+                                        void* dst, int n, int k, int m, const struct ggml_bitnet_epilogue* epi) {
+    const bitnet_lut_kernel* kernel = ggml_bitnet_get_lut_kernel(m, k);
+    if (kernel == nullptr || extra->n_tile_num <= 0) {
+        return;
+    }
+    // tbl_impl has its tile shape baked in; the extra was built from the same
+    // registry, so its BK and n_tile_num describe that tiling
+    const int BM = m / extra->n_tile_num;
+    if (BM != kernel->BM || extra->BK != kernel->BK) {
+        std::cerr << "BitNet: tensor tiling " << BM << "x" << extra->BK
+                  << " does not match kernel " << kernel->BM << "x" << kernel->BK
+                  << " for " << m << "x" << k << std::endl;
+        return;
+    }
+    // Extras are shared by every thread running the model, but only ever
+    // written with these relaxed stores
+    bitnet_tensor_extra* self = const_cast<bitnet_tensor_extra*>(extra);
+    if (__atomic_load_n(&self->tile_bytes, __ATOMIC_RELAXED) == 0) {
+        __atomic_store_n(&self->tile_bytes, (int64_t)BM * k / 4, __ATOMIC_RELAXED);
+    }
+    bitnet_learn_order(self);
+
+    // The work split below and every parallel_for under it follow the quota
+    // of the model this weight belongs to
+    BitNetTenantScope tenant(__atomic_load_n(&self->tenant, __ATOMIC_RELAXED));
+    bitnet_prefetch_plan pf;
+    const bool prefetch = bitnet_prefetch_plan_for(__atomic_load_n(&self->next, __ATOMIC_RELAXED), n, &pf);
+    bitnet_mul_mat_columns(kernel, extra->numa, epi, BM, extra->BK, extra->qweights, extra->scales, qlut, lut_scales, dst, n, k, m,
+                           prefetch ? &pf : nullptr, extra->occupancy);
+}
+
+#endif
@@ -0,0 +1,195 @@
+#include "bitnet-numa.h"
+#include "bitnet-threading.h"
+#include "bitnet-topology.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// policy value from <linux/mempolicy.h>; the raw syscall keeps libnuma out of the build
+#define BITNET_MPOL_BIND 2
+
+static enum ggml_bitnet_numa_mode bitnet_numa_env_mode() {
+    const char * env = getenv("BITNET_NUMA");
+    if (env == nullptr || strcmp(env, "off") == 0) {
+        return GGML_BITNET_NUMA_OFF;
+    }
+    if (strcmp(env, "replicate") == 0) {
+        return GGML_BITNET_NUMA_REPLICATE;
+    }
+    if (strcmp(env, "partition") == 0) {
+        return GGML_BITNET_NUMA_PARTITION;
+    }
+    fprintf(stderr, "BitNet: unknown BITNET_NUMA=%s, expected off, replicate or partition\n", env);
+    return GGML_BITNET_NUMA_OFF;
+}
+
+static std::atomic<int> & bitnet_numa_mode() {
+    static std::atomic<int> mode(bitnet_numa_env_mode());
+    return mode;
+}
+
+void ggml_bitnet_set_numa_mode(enum ggml_bitnet_numa_mode mode) {
+    bitnet_numa_mode().store(mode);
+}
+
+enum ggml_bitnet_numa_mode ggml_bitnet_get_numa_mode(void) {
+    return (enum ggml_bitnet_numa_mode)bitnet_numa_mode().load();
+}
+
+#ifdef __linux__
+
+// Anonymous pages are only backed on first touch, so binding the range
+// before the weights are copied in decides where they live
+static bool bitnet_numa_bind(void * addr, size_t size, int node) {
+    if (size == 0) {
+        return true;
+    }
+    unsigned long mask[(BITNET_NUMA_MAX_NODES * 8 + 63) / 64 + 1] = {};
+    if (node < 0 || node >= (int)(sizeof(mask) * 8)) {
+        return false;
+    }
+    mask[node / 64] |= 1ul << (node % 64);
+    return syscall(SYS_mbind, addr, size, BITNET_MPOL_BIND, mask, sizeof(mask) * 8, 0) == 0;
+}
+
+static uint8_t * bitnet_numa_map(size_t size) {
+    void * p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return p == MAP_FAILED ? nullptr : (uint8_t *)p;
+}
+
+// Nodes of the CPUs the pool threads run on, with the number of threads on
+// each. Unpinned pools may run anywhere, so every allowed CPU counts.
+static std::map<int, int> bitnet_numa_pool_nodes() {
+    const bitnet_topology & topo = bitnet_get_topology();
+    bitnet_threading_init();
+    const size_t n_threads = (size_t)g_bitnet_thread_pool->num_threads() + 1;
+    const size_t n_cpus = n_threads <= topo.cpus.size() ? n_threads : topo.cpus.size();
+    std::map<int, int> nodes;
+    for (size_t i = 0; i < n_cpus; ++i) {
+        if (topo.cpus[i].numa_node >= 0) {
+            nodes[topo.cpus[i].numa_node]++;
+        }
+    }
+    return nodes;
+}
+
+bitnet_numa_weights * bitnet_numa_place(const uint8_t * qweights, size_t size, size_t tile_size, int n_tiles) {
+    enum ggml_bitnet_numa_mode mode = ggml_bitnet_get_numa_mode();
+    if (mode == GGML_BITNET_NUMA_OFF || qweights == nullptr || size == 0) {
+        return nullptr;
+    }
+    std::map<int, int> nodes = bitnet_numa_pool_nodes();
+    if (nodes.size() < 2) {
+        return nullptr;
+    }
+    // Only whole row tiles can be split
+    if (mode == GGML_BITNET_NUMA_PARTITION && (tile_size == 0 || n_tiles < (int)nodes.size())) {
+        mode = GGML_BITNET_NUMA_REPLICATE;
+    }
+
+    const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    bitnet_numa_weights * numa = new bitnet_numa_weights();
+    numa->mode = mode;
+    numa->size = (size + page - 1) / page * page;
+    int total_threads = 0;
+    for (const auto & node : nodes) {
+        if (numa->n_nodes == BITNET_NUMA_MAX_NODES) {
+            break;
+        }
+        numa->nodes[numa->n_nodes++] = node.first;
+        total_threads += node.second;
+    }
+
+    bool ok = true;
+    if (mode == GGML_BITNET_NUMA_REPLICATE) {
+        for (int i = 0; i < numa->n_nodes && ok; ++i) {
+            numa->replicas[i] = bitnet_numa_map(numa->size);
+            ok = numa->replicas[i] != nullptr && bitnet_numa_bind(numa->replicas[i], numa->size, numa->nodes[i]);
+            if (ok) {
+                memcpy(numa->replicas[i], qweights, size);
+            }
+        }
+    } else {
+        // Each node gets a share of the tiles proportional to its threads,
+        // so all nodes finish their local work at about the same time
+        int threads_before = 0;
+        for (int i = 0; i < numa->n_nodes; ++i) {
+            numa->tile_begin[i] = (int)((int64_t)n_tiles * threads_before / total_threads);
+            threads_before += nodes[numa->nodes[i]];
+        }
+        numa->tile_begin[numa->n_nodes] = n_tiles;
+        numa->data = bitnet_numa_map(numa->size);
+        ok = numa->data != nullptr;
+        for (int i = 0; i < numa->n_nodes && ok; ++i) {
+            // Pages straddling two shares stay with the first node
+            const size_t begin = (numa->tile_begin[i] * tile_size + page - 1) / page * page;
+            const size_t end = i + 1 == numa->n_nodes ? numa->size
+                             : (numa->tile_begin[i + 1] * tile_size + page - 1) / page * page;
+            ok = end <= begin || bitnet_numa_bind(numa->data + begin, end - begin, numa->nodes[i]);
+        }
+        if (ok) {
+            memcpy(numa->data, qweights, size);
+        }
+    }
+
+    if (!ok) {
+        fprintf(stderr, "BitNet: cannot place weights on NUMA nodes, keeping them in place\n");
+        bitnet_numa_release(numa);
+        return nullptr;
+    }
+    return numa;
+}
+
+void bitnet_numa_release(bitnet_numa_weights * numa) {
+    if (numa == nullptr) {
+        return;
+    }
+    for (int i = 0; i < numa->n_nodes; ++i) {
+        if (numa->replicas[i] != nullptr) {
+            munmap(numa->replicas[i], numa->size);
+        }
+    }
+    if (numa->data != nullptr) {
+        munmap(numa->data, numa->size);
+    }
+    delete numa;
+}
+
+#else
+
+bitnet_numa_weights * bitnet_numa_place(const uint8_t * qweights, size_t size, size_t tile_size, int n_tiles) {
+    return nullptr;
+}
+
+void bitnet_numa_release(bitnet_numa_weights * numa) {
+    delete numa;
+}
+
+#endif
+
+int bitnet_numa_local_index(const bitnet_numa_weights * numa) {
+    const int node = bitnet_current_numa_node();
+    for (int i = 0; i < numa->n_nodes; ++i) {
+        if (numa->nodes[i] == node) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+uint8_t * ggml_bitnet_local_qweights(const struct bitnet_tensor_extra * extra) {
+    if (extra->numa != nullptr && extra->numa->mode == GGML_BITNET_NUMA_REPLICATE) {
+        return extra->numa->replicas[bitnet_numa_local_index(extra->numa)];
+    }
+    return extra->qweights;
+}
@@ -1,159 +1,419 @@
 #include "bitnet-threading.h"
-#include <iostream>
+#include "ggml-bitnet.h"
+#include "bitnet-topology.h"
+#include "bitnet-trace.h"
 #include <algorithm>
+#include <cstdio>
+#include <cstring>
 #include <unistd.h>
 
 // Global thread pool instance
 std::unique_ptr<BitNetThreadPool> g_bitnet_thread_pool = nullptr;
 
-void bitnet_threading_init() {
-    if (g_bitnet_thread_pool == nullptr) {
-        g_bitnet_thread_pool = std::make_unique<BitNetThreadPool>();
-        std::cout << "BitNet threading initialized with " 
-                  << std::thread::hardware_concurrency() << " threads" << std::endl;
+// Registered tenants; entries below the count are never written again, so
+// parallel_for reads them without a lock
+static bitnet_tenant bitnet_tenants[BITNET_MAX_TENANTS + 1] = { { "default", 0, false } };
+static std::atomic<int> bitnet_n_tenants{1};
+static std::mutex bitnet_tenants_mutex;
+
+// Serialises creating, resizing and destroying g_bitnet_thread_pool
+static std::mutex bitnet_pool_mutex;
+
+namespace {
+
+struct WorkerContext {
+    const BitNetThreadPool* pool;
+    int id;
+};
+
+thread_local WorkerContext tls_worker = { nullptr, -1 };
+
+// Scratch of threads that find every arena of the pool on loan
+thread_local BitNetScratch tls_scratch;
+
+thread_local int tls_tenant = 0;
+
+inline uint64_t xorshift64(uint64_t& state) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+} // namespace
+
+BitNetThreadPool::BitNetThreadPool(int n_threads, int max_threads) {
+    const int n_active_threads = std::max(1, n_threads > 0 ? n_threads : bitnet_get_optimal_thread_count());
+    const int num_threads = std::max(n_active_threads, max_threads);
+    n_active.store(n_active_threads);
+
+    // Oversubscribed pools are left to the scheduler, pinning two workers to
+    // one CPU would only serialise them
+    const bitnet_topology& topo = bitnet_get_topology();
+    const bool pin = (size_t)num_threads + 1 <= topo.cpus.size();
+
+    for (int i = 0; i < num_threads; ++i) {
+        workers.emplace_back(new Worker());
+        workers.back()->rng_state = 0x9E3779B97F4A7C15ull * (uint64_t)(i + 1);
+    }
+    for (int i = 0; i <= num_threads; ++i) {
+        scratch_slots.emplace_back(new ScratchSlot());
+    }
+    for (int i = 0; i < num_threads; ++i) {
+        const int cpu = pin ? topo.cpus[i + 1].cpu : -1;
+        threads.emplace_back([this, i, cpu]() {
+            if (cpu >= 0) {
+                set_cpu_affinity(cpu);
+            }
+            worker_loop(i);
+        });
     }
 }
 
-void bitnet_threading_cleanup() {
-    if (g_bitnet_thread_pool != nullptr) {
-        g_bitnet_thread_pool.reset();
-        std::cout << "BitNet threading cleaned up" << std::endl;
+BitNetThreadPool::~BitNetThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(park_mtx);
+        stop.store(true);
+        wake_epoch.fetch_add(1);
+    }
+    park_cv.notify_all();
+    resize_cv.notify_all();
+
+    for (auto& thread : threads) {
+        if (thread.joinable()) {
+            thread.join();
+        }
     }
 }
 
-int bitnet_get_optimal_thread_count() {
-    // For Raspberry Pi 5, we want to use all 4 cores
-    int hw_threads = std::thread::hardware_concurrency();
-    
-    // Cap at 4 for Pi 5, but allow fewer if system has less
-    int optimal = std::min(4, hw_threads);
-    
-    // Don't use more threads than we have cores
-    optimal = std::min(optimal, hw_threads);
-    
-    return std::max(1, optimal);  // At least 1 thread
-}
-
-// Specialized threading functions for BitNet operations
-namespace BitNetThreading {
-
-// Threaded matrix multiplication for LUT kernels
-template<typename KernelFunc>
-void parallel_lut_kernel(int m, int k, 
-                        void* A, void* LUT, void* Scales, void* LUT_Scales, void* C,
-                        KernelFunc kernel_func) {
-    
-    if (g_bitnet_thread_pool == nullptr) {
-        bitnet_threading_init();
-    }
-    
-    int num_threads = bitnet_get_optimal_thread_count();
-    
-    // For small matrices, use single thread
-    if (m < 512 || k < 512) {
-        kernel_func(m, k, A, LUT, Scales, LUT_Scales, C);
-        return;
+int bitnet_tenant_register(const char* name, int n_threads, bool batch) {
+    std::lock_guard<std::mutex> lock(bitnet_tenants_mutex);
+    const int id = bitnet_n_tenants.load(std::memory_order_relaxed);
+    if (id > BITNET_MAX_TENANTS) {
+        return -1;
     }
-    
-    // Calculate optimal tile size for Pi 5 cache hierarchy
-    // L1 cache: 32KB, L2 cache: 512KB per core
-    int tile_size = 64;  // Start with 64x64 tiles
-    
-    // Adjust tile size based on matrix dimensions
-    if (m > 2048) tile_size = 128;
-    if (m > 4096) tile_size = 256;
-    
-    TileDistributor distributor(m, 1, tile_size, num_threads);  // Column dimension is 1 for LUT
-    ProgressTracker progress(distributor.total_tiles());
-    
-    // Process tiles in parallel
-    for (int t = 0; t < num_threads; ++t) {
-        g_bitnet_thread_pool->enqueue([&, t]() {
-            MatrixTile tile(0, 0, 0, 0, 0);
-            
-            while (distributor.get_next_tile(tile)) {
-                // Prefetch data for this tile
-                int tile_rows = tile.end_row - tile.start_row;
-                
-                // Prefetch input data
-                prefetch_for_read((char*)A + tile.start_row * k / 8);  // A is uint8_t, 8 bits per element
-                prefetch_for_read((char*)LUT + tile.start_row * k * 16);  // LUT is int8_t
-                prefetch_for_write((char*)C + tile.start_row * sizeof(float));
-                
-                // Create temporary output buffer for this tile
-                float* tile_output = aligned_alloc<float>(tile_rows);
-                if (tile_output == nullptr) {
-                    // Fallback to stack allocation
-                    float stack_output[256];
-                    tile_output = stack_output;
-                }
-                
-                // Process this tile
-                kernel_func(tile_rows, k, 
-                           (char*)A + tile.start_row * k / 8,
-                           (char*)LUT + tile.start_row * k * 16,
-                           Scales, LUT_Scales, tile_output);
-                
-                // Copy result back to main output
-                memcpy((char*)C + tile.start_row * sizeof(float), 
-                       tile_output, tile_rows * sizeof(float));
-                
-                // Free temporary buffer if allocated
-                if (tile_output != nullptr && tile_rows > 256) {
-                    free(tile_output);
-                }
-                
-                progress.mark_completed();
+    bitnet_tenant& tenant = bitnet_tenants[id];
+    snprintf(tenant.name, sizeof(tenant.name), "%s", name != nullptr ? name : "");
+    tenant.n_threads = n_threads;
+    tenant.batch = batch;
+    bitnet_n_tenants.store(id + 1, std::memory_order_release);
+    return id;
+}
+
+const bitnet_tenant& bitnet_tenant_get(int id) {
+    if (id <= 0 || id >= bitnet_n_tenants.load(std::memory_order_acquire)) {
+        return bitnet_tenants[0];
+    }
+    return bitnet_tenants[id];
+}
+
+int bitnet_tenant_current() {
+    return tls_tenant;
+}
+
+BitNetTenantScope::BitNetTenantScope(int tenant) : prev(tls_tenant) {
+    tls_tenant = tenant;
+}
+
+BitNetTenantScope::~BitNetTenantScope() {
+    tls_tenant = prev;
+}
+
+int BitNetThreadPool::current_worker() const {
+    return tls_worker.pool == this ? tls_worker.id : -1;
+}
+
+BitNetScratchLease BitNetThreadPool::lease_scratch() {
+    for (auto& slot : scratch_slots) {
+        bool expected = false;
+        if (!slot->busy.load(std::memory_order_relaxed) &&
+            slot->busy.compare_exchange_strong(expected, true, std::memory_order_acquire, std::memory_order_relaxed)) {
+            return BitNetScratchLease(&slot->busy, &slot->scratch);
+        }
+    }
+    return BitNetScratchLease(nullptr, &tls_scratch);
+}
+
+bool BitNetThreadPool::reserve_scratch(size_t bytes) {
+    bool ok = true;
+    for (auto& slot : scratch_slots) {
+        if (slot->scratch.size() >= bytes) {
+            continue;
+        }
+        // Another model's kernel may be using the arena; growing it frees
+        // the old block, so wait for it to be handed back
+        bool expected = false;
+        while (!slot->busy.compare_exchange_weak(expected, true, std::memory_order_acquire, std::memory_order_relaxed)) {
+            expected = false;
+            std::this_thread::yield();
+        }
+        ok = slot->scratch.reserve(bytes) && ok;
+        slot->busy.store(false, std::memory_order_release);
+    }
+    return ok;
+}
+
+void BitNetThreadPool::submit(BitNetTask* task, bool batch) {
+    pending.fetch_add(1);
+
+    int id = current_worker();
+    if (id >= 0) {
+        workers[id]->deque.push(task);
+    } else {
+        std::lock_guard<std::mutex> lock(inject_mtx);
+        InjectQueue& q = inject[batch ? 1 : 0];
+        const size_t size = (size_t)q.size.load(std::memory_order_relaxed);
+        if (size == q.ring.size()) {
+            std::vector<BitNetTask*> ring(std::max<size_t>(64, size * 2));
+            for (size_t i = 0; i < size; ++i) {
+                ring[i] = q.ring[(q.head + i) % size];
             }
-        });
+            q.ring.swap(ring);
+            q.head = 0;
+        }
+        q.ring[(q.head + size) % q.ring.size()] = task;
+        q.size.fetch_add(1);
+    }
+    wake_one();
+}
+
+void BitNetThreadPool::wake_one() {
+    // Pairs with the num_parked increment / wake_epoch load in worker_loop:
+    // either the parking worker sees the new epoch, or we see it parked.
+    wake_epoch.fetch_add(1);
+    if (num_parked.load() > 0) {
+        { std::lock_guard<std::mutex> lock(park_mtx); }
+        park_cv.notify_one();
+    }
+}
+
+BitNetTask* BitNetThreadPool::steal_task(uint64_t& rng_state, int skip) {
+    // Interactive tenants first, batch jobs only get the threads they leave
+    for (InjectQueue& q : inject) {
+        if (q.size.load(std::memory_order_relaxed) == 0) {
+            continue;
+        }
+        std::lock_guard<std::mutex> lock(inject_mtx);
+        if (q.size.load(std::memory_order_relaxed) > 0) {
+            BitNetTask* task = q.ring[q.head];
+            q.head = (q.head + 1) % q.ring.size();
+            q.size.fetch_sub(1);
+            if (bitnet_trace_enabled()) {
+                bitnet_trace_count(BITNET_TRACE_POOL_STEALS, 1);
+            }
+            return task;
+        }
+    }
+
+    const int n = (int)workers.size();
+    const int start = (int)(xorshift64(rng_state) % (uint64_t)n);
+    BitNetTask* task = nullptr;
+    for (int i = 0; i < n; ++i) {
+        int victim = (start + i) % n;
+        if (victim != skip && workers[victim]->deque.steal(task)) {
+            if (bitnet_trace_enabled()) {
+                bitnet_trace_count(BITNET_TRACE_POOL_STEALS, 1);
+            }
+            return task;
+        }
+    }
+    return nullptr;
+}
+
+BitNetTask* BitNetThreadPool::find_task(int id) {
+    BitNetTask* task = nullptr;
+    if (workers[id]->deque.pop(task)) {
+        return task;
+    }
+    return steal_task(workers[id]->rng_state, id);
+}
+
+void BitNetThreadPool::run_task(BitNetTask* task) {
+    task->execute();
+    if (pending.fetch_sub(1) == 1 && num_waiters.load() > 0) {
+        { std::lock_guard<std::mutex> lock(done_mtx); }
+        done_cv.notify_all();
+    }
+}
+
+void BitNetThreadPool::worker_loop(int id) {
+    tls_worker = { this, id };
+
+    char name[32];
+    snprintf(name, sizeof(name), "worker %d", id);
+    bitnet_trace_thread_name(name);
+
+    // Everything between two tasks - stealing, spinning, parking - is idle
+    uint64_t idle_since = bitnet_trace_enabled() ? bitnet_trace_now() : 0;
+    auto run = [&](BitNetTask* task) {
+        if (!bitnet_trace_enabled()) {
+            run_task(task);
+            return;
+        }
+        const uint64_t t0 = bitnet_trace_now();
+        if (idle_since != 0) {
+            bitnet_trace_record(BITNET_TRACE_POOL_IDLE, idle_since, t0 - idle_since, 0, 0, 0, 0);
+        }
+        run_task(task);
+        idle_since = bitnet_trace_now();
+        bitnet_trace_record(BITNET_TRACE_POOL_TASK, t0, idle_since - t0, 0, 0, 0, 0);
+    };
+
+    while (true) {
+        if (id >= n_active.load()) {
+            // Resized away: finish the helpers of our own nested jobs, then
+            // wait to be needed again
+            BitNetTask* own = nullptr;
+            while (workers[id]->deque.pop(own)) {
+                run(own);
+            }
+            std::unique_lock<std::mutex> lock(park_mtx);
+            resize_cv.wait(lock, [&] { return stop.load() || id < n_active.load(); });
+            if (id >= n_active.load()) {
+                // Stopping; the active workers drain the shared queues
+                return;
+            }
+            continue;
+        }
+
+        BitNetTask* task = find_task(id);
+
+        // Spin a little before parking, tokens arrive back to back
+        for (int spin = 0; task == nullptr && spin < BITNET_SPIN_COUNT; ++spin) {
+            bitnet_cpu_relax();
+            if ((spin & 63) == 63) {
+                task = find_task(id);
+            }
+        }
+
+        if (task != nullptr) {
+            run(task);
+            continue;
+        }
+
+        uint64_t epoch = wake_epoch.load();
+        std::unique_lock<std::mutex> lock(park_mtx);
+        num_parked.fetch_add(1);
+        // Re-check after announcing ourselves so a concurrent submit is not lost
+        if (wake_epoch.load() == epoch && !stop.load()) {
+            lock.unlock();
+            task = find_task(id);
+            lock.lock();
+            if (task == nullptr) {
+                park_cv.wait(lock, [&] { return stop.load() || wake_epoch.load() != epoch; });
+            }
+        }
+        num_parked.fetch_sub(1);
+        lock.unlock();
+
+        if (task != nullptr) {
+            run(task);
+            continue;
+        }
+        if (stop.load()) {
+            // Drain whatever is still queued before exiting
+            while ((task = find_task(id)) != nullptr) {
+                run(task);
+            }
+            return;
+        }
     }
-    
-    // Wait for all threads to complete
-    g_bitnet_thread_pool->wait_all();
 }
 
-// Threaded preprocessor for LUT construction
-template<typename PreprocessFunc>
-void parallel_preprocess(int m, int k,
-                        void* B, void* LUT_Scales, void* QLUT,
-                        PreprocessFunc preprocess_func) {
-    
+void BitNetThreadPool::resize(int n_threads) {
+    const int n = std::max(1, std::min(n_threads, max_threads()));
+    {
+        std::lock_guard<std::mutex> lock(park_mtx);
+        n_active.store(n);
+    }
+    resize_cv.notify_all();
+}
+
+void BitNetThreadPool::wait_all() {
+    uint64_t rng_state = 0x2545F4914F6CDD1Dull ^ (uint64_t)(uintptr_t)&rng_state;
+    int self = current_worker();
+
+    while (pending.load() > 0) {
+        // Help instead of idling, the caller is a free core
+        BitNetTask* task = self >= 0 ? find_task(self) : steal_task(rng_state, -1);
+        if (task != nullptr) {
+            run_task(task);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(done_mtx);
+        num_waiters.fetch_add(1);
+        // Tasks still in flight on other threads: sleep until the latch opens
+        done_cv.wait(lock, [&] { return pending.load() == 0; });
+        num_waiters.fetch_sub(1);
+    }
+}
+
+// Threads of the pool, counting the calling thread: BITNET_THREADS, so
+// processes sharing a host can split its cores, else the optimal count
+static int bitnet_pool_thread_count() {
+    if (const char* env = getenv("BITNET_THREADS")) {
+        const int n = atoi(env);
+        if (n > 0) {
+            return n;
+        }
+    }
+    return bitnet_get_optimal_thread_count();
+}
+
+// Workers a pool for n_workers is started with: one per CPU but the
+// caller's, so ggml_bitnet_set_n_threads can grow it in place later
+static int bitnet_pool_capacity(int n_workers) {
+    return std::max(n_workers, (int)bitnet_get_topology().cpus.size() - 1);
+}
+
+void bitnet_threading_init() {
+    std::lock_guard<std::mutex> lock(bitnet_pool_mutex);
+    if (g_bitnet_thread_pool == nullptr) {
+        // parallel_for callers take chunks themselves, so one core is left
+        // for the calling thread instead of a worker
+        int n_workers = std::max(1, bitnet_pool_thread_count() - 1);
+        g_bitnet_thread_pool = std::make_unique<BitNetThreadPool>(n_workers, bitnet_pool_capacity(n_workers));
+        fprintf(stderr, "BitNet threading initialized with %d worker threads\n", n_workers);
+    }
+}
+
+void ggml_bitnet_set_n_threads(int n_threads) {
+    const int n_workers = std::max(1, (n_threads > 0 ? n_threads : bitnet_pool_thread_count()) - 1);
+    std::lock_guard<std::mutex> lock(bitnet_pool_mutex);
     if (g_bitnet_thread_pool == nullptr) {
-        bitnet_threading_init();
-    }
-    
-    int num_threads = bitnet_get_optimal_thread_count();
-    
-    // For small matrices, use single thread
-    if (m < 1024 || k < 1024) {
-        preprocess_func(m, k, B, LUT_Scales, QLUT);
+        g_bitnet_thread_pool = std::make_unique<BitNetThreadPool>(n_workers, bitnet_pool_capacity(n_workers));
         return;
     }
-    
-    // Split work by K dimension for preprocessing
-    int k_tile_size = k / num_threads;
-    if (k_tile_size < 64) k_tile_size = 64;  // Minimum tile size
-    
-    for (int t = 0; t < num_threads; ++t) {
-        int start_k = t * k_tile_size;
-        int end_k = std::min(start_k + k_tile_size, k);
-        
-        if (start_k >= end_k) continue;
-        
-        g_bitnet_thread_pool->enqueue([=]() {
-            // Prefetch data
-            prefetch_for_read((char*)B + start_k * m * sizeof(float));
-            prefetch_for_write((char*)QLUT + start_k * m * 2);  // 2 bits per element
-            
-            // Process this K slice
-            preprocess_func(m, end_k - start_k, 
-                           (char*)B + start_k * m * sizeof(float),
-                           LUT_Scales,
-                           (char*)QLUT + start_k * m * 2);
-        });
+    // Other tenants may be inside parallel_for, so the pool is resized in
+    // place rather than replaced
+    if (n_workers > g_bitnet_thread_pool->max_threads()) {
+        fprintf(stderr, "BitNet: pool started with %d workers, not resizing to %d\n",
+                g_bitnet_thread_pool->max_threads(), n_workers);
     }
-    
-    g_bitnet_thread_pool->wait_all();
+    g_bitnet_thread_pool->resize(n_workers);
+}
+
+int ggml_bitnet_tenant_register(const char * name, int n_threads, enum ggml_bitnet_priority priority) {
+    return bitnet_tenant_register(name, n_threads, priority == GGML_BITNET_PRIORITY_BATCH);
 }
 
-} // namespace BitNetThreading
+void bitnet_threading_cleanup() {
+    std::lock_guard<std::mutex> lock(bitnet_pool_mutex);
+    if (g_bitnet_thread_pool != nullptr) {
+        g_bitnet_thread_pool.reset();
+        fprintf(stderr, "BitNet threading cleaned up\n");
+    }
+}
+
+int bitnet_get_optimal_thread_count() {
+    const bitnet_topology& topo = bitnet_get_topology();
+
+    // Little cores slow down every matmul they take part in, so they only
+    // count when there is nothing faster
+    int optimal = topo.n_perf_cores > 0 ? topo.n_perf_cores : topo.n_cores;
+    if (topo.cpu_quota > 0) {
+        optimal = std::min(optimal, topo.cpu_quota);
+    }
+    return std::max(1, optimal);
+}
@@ -0,0 +1,316 @@
+#include "bitnet-topology.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <set>
+#include <string>
+#include <thread>
+
+#ifdef __linux__
+#include <sched.h>
+#include <dirent.h>
+#endif
+
+std::vector<int> bitnet_parse_cpu_list(const char * list) {
+    std::vector<int> cpus;
+    if (list == nullptr) {
+        return cpus;
+    }
+    const char * p = list;
+    while (*p != '\0') {
+        char * next = nullptr;
+        long lo = strtol(p, &next, 10);
+        if (next == p) {
+            ++p;
+            continue;
+        }
+        long hi = lo;
+        p = next;
+        if (*p == '-') {
+            hi = strtol(p + 1, &next, 10);
+            p = next;
+        }
+        for (long c = lo; c <= hi && c >= 0; ++c) {
+            cpus.push_back((int)c);
+        }
+        while (*p != '\0' && *p != ',') {
+            ++p;
+        }
+        if (*p == ',') {
+            ++p;
+        }
+    }
+    std::sort(cpus.begin(), cpus.end());
+    cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+    return cpus;
+}
+
+#ifdef __linux__
+
+static bool bitnet_read_line(const std::string & path, std::string & out) {
+    FILE * f = fopen(path.c_str(), "r");
+    if (f == nullptr) {
+        return false;
+    }
+    char buf[4096];
+    bool ok = fgets(buf, sizeof(buf), f) != nullptr;
+    fclose(f);
+    if (ok) {
+        out = buf;
+        while (!out.empty() && (out.back() == '\n' || out.back() == ' ')) {
+            out.pop_back();
+        }
+    }
+    return ok;
+}
+
+static int bitnet_read_int(const std::string & path, int fallback) {
+    std::string line;
+    return bitnet_read_line(path, line) ? atoi(line.c_str()) : fallback;
+}
+
+static int bitnet_first_cpu(const std::string & path, int fallback) {
+    std::string line;
+    if (!bitnet_read_line(path, line)) {
+        return fallback;
+    }
+    std::vector<int> cpus = bitnet_parse_cpu_list(line.c_str());
+    return cpus.empty() ? fallback : cpus[0];
+}
+
+// Lowest CPU sharing the highest cache level of cpu
+static int bitnet_llc_of(int cpu, int fallback) {
+    const std::string dir = "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/cache/";
+    int best_level = -1;
+    int llc = fallback;
+    for (int i = 0; ; ++i) {
+        const std::string index = dir + "index" + std::to_string(i) + "/";
+        const int level = bitnet_read_int(index + "level", -1);
+        if (level < 0) {
+            break;
+        }
+        if (level > best_level) {
+            best_level = level;
+            llc = bitnet_first_cpu(index + "shared_cpu_list", fallback);
+        }
+    }
+    return llc;
+}
+
+// Size of the highest cache level of cpu, e.g. "2048K"
+static size_t bitnet_llc_size_of(int cpu) {
+    const std::string dir = "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/cache/";
+    int best_level = -1;
+    size_t size = 0;
+    for (int i = 0; ; ++i) {
+        const std::string index = dir + "index" + std::to_string(i) + "/";
+        const int level = bitnet_read_int(index + "level", -1);
+        if (level < 0) {
+            break;
+        }
+        std::string line;
+        if (level > best_level && bitnet_read_line(index + "size", line)) {
+            best_level = level;
+            char * unit = nullptr;
+            size = strtoull(line.c_str(), &unit, 10);
+            if (*unit == 'K') {
+                size <<= 10;
+            } else if (*unit == 'M') {
+                size <<= 20;
+            }
+        }
+    }
+    return size;
+}
+
+static std::map<int, int> bitnet_numa_nodes() {
+    std::map<int, int> node_of;
+    DIR * dir = opendir("/sys/devices/system/node");
+    if (dir == nullptr) {
+        return node_of;
+    }
+    while (struct dirent * entry = readdir(dir)) {
+        int node = -1;
+        if (sscanf(entry->d_name, "node%d", &node) != 1) {
+            continue;
+        }
+        std::string line;
+        if (bitnet_read_line("/sys/devices/system/node/" + std::string(entry->d_name) + "/cpulist", line)) {
+            for (int cpu : bitnet_parse_cpu_list(line.c_str())) {
+                node_of[cpu] = node;
+            }
+        }
+    }
+    closedir(dir);
+    return node_of;
+}
+
+// CPUs worth of time cgroup v2 (cpu.max) or v1 (cfs quota) grants, 0 if unlimited
+static int bitnet_cgroup_cpu_quota() {
+    std::string line;
+    long quota = -1;
+    long period = 0;
+    if (bitnet_read_line("/sys/fs/cgroup/cpu.max", line)) {
+        if (sscanf(line.c_str(), "%ld %ld", &quota, &period) != 2) {
+            quota = -1;
+        }
+    } else {
+        quota = bitnet_read_int("/sys/fs/cgroup/cpu/cpu.cfs_quota_us", -1);
+        period = bitnet_read_int("/sys/fs/cgroup/cpu/cpu.cfs_period_us", 0);
+    }
+    if (quota <= 0 || period <= 0) {
+        return 0;
+    }
+    return (int)std::max<long>(1, (quota + period - 1) / period);
+}
+
+#endif
+
+static std::vector<int> bitnet_allowed_cpus() {
+    std::vector<int> allowed;
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &set)) {
+                allowed.push_back(cpu);
+            }
+        }
+    }
+#endif
+    if (allowed.empty()) {
+        const int n = std::max(1, (int)std::thread::hardware_concurrency());
+        for (int cpu = 0; cpu < n; ++cpu) {
+            allowed.push_back(cpu);
+        }
+    }
+
+    // An explicit list can only narrow the set the OS lets us use
+    if (const char * env = getenv("BITNET_CPUS")) {
+        std::vector<int> wanted = bitnet_parse_cpu_list(env);
+        std::vector<int> both;
+        std::set_intersection(allowed.begin(), allowed.end(), wanted.begin(), wanted.end(), std::back_inserter(both));
+        if (both.empty()) {
+            fprintf(stderr, "BitNet: BITNET_CPUS=%s has no CPU this process may use, ignoring it\n", env);
+        } else {
+            allowed.swap(both);
+        }
+    }
+    return allowed;
+}
+
+static bitnet_topology bitnet_discover_topology() {
+    bitnet_topology topo;
+    const std::vector<int> allowed = bitnet_allowed_cpus();
+
+    std::vector<bitnet_cpu_info> cpus;
+    for (int cpu : allowed) {
+        bitnet_cpu_info info = { cpu, cpu, 0, -1, 0, 0, true, true };
+        cpus.push_back(info);
+    }
+
+#ifdef __linux__
+    const std::map<int, int> node_of = bitnet_numa_nodes();
+    // Intel hybrid parts list their P-cores here; elsewhere the class comes
+    // from capacity
+    std::string hybrid_line;
+    const bool hybrid = bitnet_read_line("/sys/devices/cpu_core/cpus", hybrid_line);
+    const std::vector<int> p_cores = bitnet_parse_cpu_list(hybrid ? hybrid_line.c_str() : "");
+
+    int max_capacity = 0;
+    for (bitnet_cpu_info & info : cpus) {
+        const std::string dir = "/sys/devices/system/cpu/cpu" + std::to_string(info.cpu) + "/";
+        info.core = bitnet_first_cpu(dir + "topology/thread_siblings_list", info.cpu);
+        info.package = bitnet_read_int(dir + "topology/physical_package_id", 0);
+        auto node = node_of.find(info.cpu);
+        info.numa_node = node != node_of.end() ? node->second : -1;
+        info.llc = bitnet_llc_of(info.cpu, info.package);
+        info.capacity = bitnet_read_int(dir + "cpu_capacity", 0);
+        if (info.capacity == 0) {
+            info.capacity = bitnet_read_int(dir + "cpufreq/cpuinfo_max_freq", 0);
+        }
+        max_capacity = std::max(max_capacity, info.capacity);
+    }
+    for (bitnet_cpu_info & info : cpus) {
+        if (hybrid) {
+            info.performance = std::binary_search(p_cores.begin(), p_cores.end(), info.cpu);
+        } else {
+            // Boost bins differ a little between equal cores, so allow 10%
+            info.performance = info.capacity == 0 || info.capacity * 10 >= max_capacity * 9;
+        }
+    }
+    topo.cpu_quota = bitnet_cgroup_cpu_quota();
+    if (!cpus.empty()) {
+        topo.llc_size = bitnet_llc_size_of(cpus[0].cpu);
+    }
+#endif
+
+    // The first allowed thread of every core is its primary
+    std::set<int> seen_cores;
+    std::set<int> llcs;
+    std::set<int> nodes;
+    for (bitnet_cpu_info & info : cpus) {
+        info.smt_primary = seen_cores.insert(info.core).second;
+        if (info.smt_primary) {
+            topo.n_cores++;
+            topo.n_perf_cores += info.performance ? 1 : 0;
+        }
+        llcs.insert(info.llc);
+        nodes.insert(info.numa_node);
+    }
+    topo.n_llc = (int)llcs.size();
+    topo.n_numa_nodes = (int)nodes.size();
+    for (const bitnet_cpu_info & info : cpus) {
+        if (info.cpu >= (int)topo.node_of_cpu.size()) {
+            topo.node_of_cpu.resize(info.cpu + 1, -1);
+        }
+        topo.node_of_cpu[info.cpu] = info.numa_node;
+    }
+
+    // Placement order: class by class, node by node, round-robin over the
+    // LLC domains of the node
+    auto rank = [](const bitnet_cpu_info & info) {
+        return (info.smt_primary ? 0 : 2) + (info.performance ? 0 : 1);
+    };
+    for (int r = 0; r < 4; ++r) {
+        for (int node : nodes) {
+            std::map<int, std::vector<bitnet_cpu_info>> by_llc;
+            for (const bitnet_cpu_info & info : cpus) {
+                if (rank(info) == r && info.numa_node == node) {
+                    by_llc[info.llc].push_back(info);
+                }
+            }
+            for (size_t i = 0; !by_llc.empty(); ++i) {
+                for (auto it = by_llc.begin(); it != by_llc.end(); ) {
+                    if (i < it->second.size()) {
+                        topo.cpus.push_back(it->second[i]);
+                        ++it;
+                    } else {
+                        it = by_llc.erase(it);
+                    }
+                }
+            }
+        }
+    }
+    return topo;
+}
+
+const bitnet_topology & bitnet_get_topology() {
+    static const bitnet_topology topo = bitnet_discover_topology();
+    return topo;
+}
+
+int bitnet_current_numa_node() {
+#ifdef __linux__
+    const bitnet_topology & topo = bitnet_get_topology();
+    const int cpu = sched_getcpu();
+    if (cpu >= 0 && cpu < (int)topo.node_of_cpu.size()) {
+        return topo.node_of_cpu[cpu];
+    }
+#endif
+    return -1;
+}
@@ -0,0 +1,293 @@
+#include "bitnet-trace.h"
+#include "bitnet-threading.h"
+#include "ggml-bitnet.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+struct bitnet_trace_event {
+    uint64_t t0;
+    uint64_t dur;
+    uint64_t bytes;
+    int32_t op;
+    int32_t n;
+    int32_t k;
+    int32_t m;
+};
+
+// Written by its owner thread only, with plain load + store; other threads
+// just read, so relaxed atomics are all the counters need
+struct alignas(BITNET_CACHE_LINE_SIZE) bitnet_trace_slot {
+    std::atomic<uint64_t> calls[BITNET_TRACE_OP_COUNT];
+    std::atomic<uint64_t> ns[BITNET_TRACE_OP_COUNT];
+    std::atomic<uint64_t> bytes[BITNET_TRACE_OP_COUNT];
+    std::atomic<uint64_t> counters[BITNET_TRACE_COUNTER_COUNT];
+    std::atomic<uint64_t> n_events;
+    bitnet_trace_event * events;    // ring of BITNET_TRACE_EVENTS, BITNET_TRACE_SPANS only
+    char name[32];
+    std::atomic<bool> ready;        // events and name are set, readers may look
+};
+
+static const char * const bitnet_trace_op_names[BITNET_TRACE_OP_COUNT] = {
+    "lut_build", "lut_lookup", "pool_task", "pool_idle",
+};
+
+static bitnet_trace_slot bitnet_trace_slots[BITNET_TRACE_MAX_THREADS];
+static std::atomic<int> bitnet_trace_n_slots{0};
+static uint64_t bitnet_trace_epoch = 0;
+
+// nullptr until the thread first records, the sentinel once it found no slot
+static thread_local bitnet_trace_slot * tls_trace_slot = nullptr;
+static bitnet_trace_slot bitnet_trace_untraced;
+
+#if !defined(GGML_BITNET_NO_TRACE)
+static const char * bitnet_trace_path() { return getenv("BITNET_TRACE"); }
+static const char * bitnet_metrics_path() { return getenv("BITNET_METRICS"); }
+
+// Rewrites BITNET_METRICS every second, so no compute thread waits on the
+// file and it moves whichever kernels run
+static std::mutex bitnet_metrics_mutex;
+static std::condition_variable bitnet_metrics_cv;
+static bool bitnet_metrics_stop = false;
+static std::thread bitnet_metrics_thread;
+
+static int bitnet_trace_mode_from_env();
+int bitnet_trace_mode = bitnet_trace_mode_from_env();
+#else
+static const int bitnet_trace_mode = 0;
+#endif
+
+uint64_t bitnet_trace_now() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static inline void bitnet_trace_add(std::atomic<uint64_t> & counter, uint64_t value) {
+    counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+// The calling thread's slot, claimed under name on first use
+static bitnet_trace_slot * bitnet_trace_slot_get(const char * name = nullptr) {
+    if (tls_trace_slot == nullptr) {
+        const int id = bitnet_trace_n_slots.fetch_add(1);
+        if (id >= BITNET_TRACE_MAX_THREADS) {
+            tls_trace_slot = &bitnet_trace_untraced;
+            return nullptr;
+        }
+        bitnet_trace_slot * slot = &bitnet_trace_slots[id];
+        if (name != nullptr) {
+            snprintf(slot->name, sizeof(slot->name), "%s", name);
+        } else {
+            snprintf(slot->name, sizeof(slot->name), "thread %d", id);
+        }
+        if (bitnet_trace_mode & BITNET_TRACE_SPANS) {
+            slot->events = (bitnet_trace_event *)calloc(BITNET_TRACE_EVENTS, sizeof(bitnet_trace_event));
+        }
+        slot->ready.store(true, std::memory_order_release);
+        tls_trace_slot = slot;
+    }
+    return tls_trace_slot != &bitnet_trace_untraced ? tls_trace_slot : nullptr;
+}
+
+// Writes to a temporary next to path and renames it over path, so readers
+// never see half a file
+static bool bitnet_trace_write_file(const char * path, const std::string & text) {
+    const std::string tmp = std::string(path) + ".tmp";
+    FILE * f = fopen(tmp.c_str(), "w");
+    if (f == nullptr) {
+        return false;
+    }
+    const bool ok = fwrite(text.data(), 1, text.size(), f) == text.size();
+    if (fclose(f) != 0 || !ok) {
+        remove(tmp.c_str());
+        return false;
+    }
+    return rename(tmp.c_str(), path) == 0;
+}
+
+static std::string bitnet_metrics_text() {
+    const int n_slots = std::min(bitnet_trace_n_slots.load(), BITNET_TRACE_MAX_THREADS);
+    std::string text;
+    char line[256];
+
+    struct metric {
+        const char * name;
+        const char * help;
+    };
+    const metric op_metrics[] = {
+        { "bitnet_op_seconds_total", "Time each thread spent in a BitNet kernel phase" },
+        { "bitnet_op_calls_total",   "Calls of a BitNet kernel phase on each thread" },
+        { "bitnet_op_bytes_total",   "Bytes a BitNet kernel phase streamed: LUT bytes built, weight bytes read" },
+    };
+    for (int i = 0; i < 3; ++i) {
+        snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s counter\n", op_metrics[i].name, op_metrics[i].help, op_metrics[i].name);
+        text += line;
+        for (int s = 0; s < n_slots; ++s) {
+            const bitnet_trace_slot & slot = bitnet_trace_slots[s];
+            if (!slot.ready.load(std::memory_order_acquire)) {
+                continue;
+            }
+            for (int op = 0; op < BITNET_TRACE_OP_COUNT; ++op) {
+                const uint64_t calls = slot.calls[op].load(std::memory_order_relaxed);
+                if (calls == 0) {
+                    continue;
+                }
+                if (i == 0) {
+                    snprintf(line, sizeof(line), "%s{thread=\"%s\",op=\"%s\"} %.9f\n", op_metrics[i].name, slot.name,
+                             bitnet_trace_op_names[op], slot.ns[op].load(std::memory_order_relaxed) * 1e-9);
+                } else {
+                    const uint64_t value = i == 1 ? calls : slot.bytes[op].load(std::memory_order_relaxed);
+                    snprintf(line, sizeof(line), "%s{thread=\"%s\",op=\"%s\"} %" PRIu64 "\n", op_metrics[i].name, slot.name,
+                             bitnet_trace_op_names[op], value);
+                }
+                text += line;
+            }
+        }
+    }
+
+    const metric counter_metrics[BITNET_TRACE_COUNTER_COUNT] = {
+        { "bitnet_lut_cache_hits_total", "task_init calls served from the LUT cache" },
+        { "bitnet_pool_steals_total",    "Tasks a thread took from another worker's deque or the injector" },
+    };
+    for (int c = 0; c < BITNET_TRACE_COUNTER_COUNT; ++c) {
+        snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s counter\n", counter_metrics[c].name, counter_metrics[c].help, counter_metrics[c].name);
+        text += line;
+        for (int s = 0; s < n_slots; ++s) {
+            const bitnet_trace_slot & slot = bitnet_trace_slots[s];
+            if (!slot.ready.load(std::memory_order_acquire)) {
+                continue;
+            }
+            snprintf(line, sizeof(line), "%s{thread=\"%s\"} %" PRIu64 "\n", counter_metrics[c].name, slot.name,
+                     slot.counters[c].load(std::memory_order_relaxed));
+            text += line;
+        }
+    }
+    return text;
+}
+
+void bitnet_trace_record(enum bitnet_trace_op op, uint64_t t0, uint64_t dur, int n, int k, int m, uint64_t bytes) {
+    bitnet_trace_slot * slot = bitnet_trace_slot_get();
+    if (slot == nullptr) {
+        return;
+    }
+    bitnet_trace_add(slot->calls[op], 1);
+    bitnet_trace_add(slot->ns[op], dur);
+    bitnet_trace_add(slot->bytes[op], bytes);
+    if (slot->events != nullptr) {
+        const uint64_t i = slot->n_events.load(std::memory_order_relaxed);
+        slot->events[i % BITNET_TRACE_EVENTS] = { t0, dur, bytes, (int32_t)op, n, k, m };
+        slot->n_events.store(i + 1, std::memory_order_release);
+    }
+}
+
+void bitnet_trace_count(enum bitnet_trace_counter counter, uint64_t value) {
+    bitnet_trace_slot * slot = bitnet_trace_slot_get();
+    if (slot != nullptr) {
+        bitnet_trace_add(slot->counters[counter], value);
+    }
+}
+
+void bitnet_trace_thread_name(const char * name) {
+    if (!bitnet_trace_enabled()) {
+        return;
+    }
+    // Workers name themselves before they record anything
+    bitnet_trace_slot_get(name);
+}
+
+bool ggml_bitnet_trace_write(const char * path) {
+    const int n_slots = std::min(bitnet_trace_n_slots.load(), BITNET_TRACE_MAX_THREADS);
+    std::string text = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+    char line[256];
+    bool first = true;
+    for (int s = 0; s < n_slots; ++s) {
+        const bitnet_trace_slot & slot = bitnet_trace_slots[s];
+        if (!slot.ready.load(std::memory_order_acquire)) {
+            continue;
+        }
+        snprintf(line, sizeof(line), "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                 first ? "" : ",\n", s, slot.name);
+        text += line;
+        first = false;
+        if (slot.events == nullptr) {
+            continue;
+        }
+        const uint64_t n_events = slot.n_events.load(std::memory_order_acquire);
+        const uint64_t begin = n_events > BITNET_TRACE_EVENTS ? n_events - BITNET_TRACE_EVENTS : 0;
+        for (uint64_t i = begin; i < n_events; ++i) {
+            const bitnet_trace_event & e = slot.events[i % BITNET_TRACE_EVENTS];
+            snprintf(line, sizeof(line),
+                     ",\n{\"ph\":\"X\",\"name\":\"%s\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,"
+                     "\"args\":{\"n\":%d,\"k\":%d,\"m\":%d,\"bytes\":%" PRIu64 "}}",
+                     bitnet_trace_op_names[e.op], s, (e.t0 - bitnet_trace_epoch) * 1e-3, e.dur * 1e-3, e.n, e.k, e.m, e.bytes);
+            text += line;
+        }
+    }
+    text += "\n]}\n";
+    return bitnet_trace_write_file(path, text);
+}
+
+size_t ggml_bitnet_metrics_text(char * buf, size_t size) {
+    const std::string text = bitnet_metrics_text();
+    if (buf != nullptr && size > 0) {
+        const size_t len = std::min(text.size(), size - 1);
+        memcpy(buf, text.data(), len);
+        buf[len] = '\0';
+    }
+    return text.size();
+}
+
+#if !defined(GGML_BITNET_NO_TRACE)
+static void bitnet_metrics_loop() {
+    std::unique_lock<std::mutex> lock(bitnet_metrics_mutex);
+    while (!bitnet_metrics_cv.wait_for(lock, std::chrono::seconds(1), [] { return bitnet_metrics_stop; })) {
+        lock.unlock();
+        bitnet_trace_write_file(bitnet_metrics_path(), bitnet_metrics_text());
+        lock.lock();
+    }
+}
+
+static void bitnet_trace_at_exit() {
+    if (bitnet_metrics_thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(bitnet_metrics_mutex);
+            bitnet_metrics_stop = true;
+        }
+        bitnet_metrics_cv.notify_all();
+        bitnet_metrics_thread.join();
+    }
+    if (bitnet_trace_path() != nullptr) {
+        ggml_bitnet_trace_write(bitnet_trace_path());
+    }
+    if (bitnet_metrics_path() != nullptr) {
+        bitnet_trace_write_file(bitnet_metrics_path(), bitnet_metrics_text());
+    }
+}
+
+static int bitnet_trace_mode_from_env() {
+    int mode = 0;
+    if (bitnet_metrics_path() != nullptr) {
+        mode |= BITNET_TRACE_COUNTERS;
+    }
+    if (bitnet_trace_path() != nullptr) {
+        mode |= BITNET_TRACE_COUNTERS | BITNET_TRACE_SPANS;
+    }
+    if (mode != 0) {
+        bitnet_trace_epoch = bitnet_trace_now();
+        atexit(bitnet_trace_at_exit);
+    }
+    if (bitnet_metrics_path() != nullptr) {
+        bitnet_metrics_thread = std::thread(bitnet_metrics_loop);
+    }
+    return mode;
+}
+#endif
@@ -0,0 +1,21 @@
+// Generated TL2 kernels, the only code built with -mavx2 -mfma (see
+// src/CMakeLists.txt). ggml-bitnet-lut.cpp stays at the baseline ISA and
+// only routes work here once the CPU reports AVX2.
+#if defined(GGML_BITNET_X86_TL2)
+
+// The generated header defines ggml_bitnet_transform_tensor itself; it is
+// renamed here so the baseline dispatcher can check the CPU before any of
+// this unit's code runs
+#define ggml_bitnet_transform_tensor bitnet_tl2_transform_tensor
+#include "bitnet-lut-kernels.h"
+#undef ggml_bitnet_transform_tensor
+
+extern "C" bool bitnet_tl2_kernels_available(void) {
+#if defined(__AVX2__)
+    return true;
+#else
+    return false;
+#endif
+}
+
+#endif
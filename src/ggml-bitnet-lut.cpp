@@ -1,4 +1,5 @@
 #include <vector>
+#include <atomic>
 #include <type_traits>
 
 #include <string.h>
@@ -7,10 +8,61 @@
 
 #include "ggml-bitnet.h"
 #include "ggml-quants.h"
+#if !defined(GGML_BITNET_X86_TL2)
+// The TL2 kernels are AVX2 code, built in ggml-bitnet-lut-tl2.cpp
 #include "bitnet-lut-kernels.h"
+#endif
+#include "bitnet-lut-kernels-threaded.h"
+#include "bitnet-cpu-features.h"
+#include "bitnet-extras.h"
+#include "bitnet-trace.h"
 
 #if defined(GGML_BITNET_ARM_TL1)
 
+// LUTs of the last few preprocessed activations. Q/K/V and gate/up read the
+// same activation, so only the first matmul of each group builds its LUT.
+// Entries are matched on the activation tensor and the graph generation.
+// get_wsize starts a new generation when ggml plans a graph, and so does
+// task_init when it sees a weight that was already multiplied in the
+// current one: every weight is multiplied once per evaluation, so that is
+// a graph being run again without being planned. A tensor whose data holds
+// the next token's values therefore never hits the LUT of its old contents.
+// Every thread keeps its own entries, so no other thread can evict a LUT a
+// GEMM is still reading.
+#define GGML_BITNET_LUT_CACHE_ENTRIES 2
+// Larger LUTs (prefill) are built in the caller's work buffer instead
+#define GGML_BITNET_LUT_CACHE_MAX_BYTES (16 * 1024 * 1024)
+
+struct bitnet_lut_cache_entry {
+    const struct ggml_tensor * src;
+    const void * data;
+    uint64_t generation;
+    int n;
+    int k;
+    size_t capacity;
+    uint64_t last_use;
+    void * block;
+    bitnet_float_type * lut_scales;
+    int8_t * qlut;
+};
+
+struct bitnet_lut_cache {
+    bitnet_lut_cache_entry entries[GGML_BITNET_LUT_CACHE_ENTRIES] = {};
+    uint64_t clock = 0;
+
+    void clear() {
+        for (bitnet_lut_cache_entry & entry : entries) {
+            aligned_free(entry.block);
+            entry = bitnet_lut_cache_entry();
+        }
+    }
+
+    ~bitnet_lut_cache() { clear(); }
+};
+
+static thread_local bitnet_lut_cache tls_lut_cache;
+static std::atomic<uint64_t> bitnet_lut_generation{1};
+
 void ggml_bitnet_init(void) {
     // LOG(INFO) << "ggml_bitnet_init";
 
@@ -22,10 +74,6 @@ void ggml_bitnet_init(void) {
     // if (wrapper == nullptr) {
     //     wrapper = new BITNET::BITNETGeMMWrapper<bitnet_bitnet_float_type>();
     // }
-    if (bitnet_tensor_extras == nullptr) {
-        bitnet_tensor_extras = new bitnet_tensor_extra[GGML_BITNET_MAX_NODES];
-    }
-    bitnet_tensor_extras_index = 0;
 }
 
 void ggml_bitnet_free(void) {
@@ -38,12 +86,10 @@ void ggml_bitnet_free(void) {
 
     // delete wrapper;
     // wrapper = nullptr;
-    for (size_t i = 0; i < bitnet_tensor_extras_index; i++) {
-        // aligned_free(bitnet_tensor_extras[i].qweights);
-        // aligned_free(bitnet_tensor_extras[i].scales);
-    }
-    delete[] bitnet_tensor_extras;
-    bitnet_tensor_extras = nullptr;
+    bitnet_extras_release_all();
+    // Other threads' entries go stale and are freed when those threads exit
+    tls_lut_cache.clear();
+    bitnet_lut_generation.fetch_add(1, std::memory_order_release);
 }
 
 static bool do_permutate(enum ggml_type type) {
@@ -60,9 +106,7 @@ bool ggml_bitnet_can_mul_mat(const struct ggml_tensor * src0, const struct ggml_
         src1->type == GGML_TYPE_F32 &&
         dst->type == GGML_TYPE_F32 &&
         src0->backend == GGML_BACKEND_TYPE_CPU) {
-        if (src1->ne[1] <= 1) {
-            return true;
-        }
+        return true;
     }
     return false;
 }
@@ -71,9 +115,23 @@ size_t ggml_bitnet_mul_mat_get_wsize(const struct ggml_tensor * src0, const stru
     const size_t ne01 = src0->ne[1];
     const size_t ne10 = src1->ne[0];
     const size_t ne11 = src1->ne[1];
-    const int bits = ggml_bitnet_get_type_bits(src0->type);
+    GGML_UNUSED(dst);
+
+    // A new graph is being planned: the activations of the last one are gone
+    bitnet_lut_generation.fetch_add(1, std::memory_order_release);
+
+    // Graphs are planned before they run, so size the split-K scratch of
+    // this shape now and keep task_compute free of allocations. Without
+    // NUMA placement nothing has started the pool yet.
+    const bitnet_lut_kernel * kernel = ggml_bitnet_get_lut_kernel(ne01, ne10);
+    if (kernel != nullptr) {
+        bitnet_threading_init();
+        const size_t scratch = bitnet_qgemm_lut_threaded_scratch_size(ne01, ne10, kernel->BM, kernel->BK);
+        g_bitnet_thread_pool->reserve_scratch(scratch);
+    }
     
-    size_t wsize = ne10 * ne11 * 15 * sizeof(int8_t) + 1 * ne11 * 2 * sizeof(bitnet_float_type);
+    // lut_ctor writes 16 LUT bytes per activation
+    size_t wsize = ne10 * ne11 * 16 * sizeof(int8_t) + 1 * ne11 * 2 * sizeof(bitnet_float_type);
     if (sizeof(bitnet_float_type) == 2) {
         // Need fp32 to fp16 conversion
         wsize += std::max(ne10, ne01) * ne11 * sizeof(bitnet_float_type);
@@ -82,6 +140,109 @@ size_t ggml_bitnet_mul_mat_get_wsize(const struct ggml_tensor * src0, const stru
     return wsize;
 }
 
+void ggml_bitnet_mul_mat_task_init(void * src1, void * qlut, void * lut_scales, void * lut_biases, int n, int k, int m, int bits) {
+    GGML_UNUSED(lut_biases);
+    GGML_UNUSED(bits);
+    BitNetTraceScope trace(BITNET_TRACE_LUT_BUILD, n, k, m, (uint64_t)n * k * 16);
+    ggml_preprocessor_batch_threaded(n, m, k, src1, lut_scales, qlut);
+}
+
+// Generation of the evaluation a matmul of extra's weight belongs to
+static uint64_t bitnet_lut_generation_of(bitnet_tensor_extra * extra) {
+    uint64_t generation = bitnet_lut_generation.load(std::memory_order_acquire);
+    if (__atomic_load_n(&extra->lut_generation, __ATOMIC_RELAXED) == generation) {
+        generation = bitnet_lut_generation.fetch_add(1, std::memory_order_acq_rel) + 1;
+    }
+    __atomic_store_n(&extra->lut_generation, generation, __ATOMIC_RELAXED);
+    return generation;
+}
+
+static void bitnet_task_init_cached(const struct ggml_tensor * src1, void ** qlut, void ** lut_scales, int n, int k, int m, int bits, uint64_t generation) {
+    // lut_ctor writes 16 LUT bytes per activation, as in get_wsize
+    const size_t qlut_size = (size_t)n * k * 16;
+    // Shapes without a kernel leave the LUT unwritten, so never cache them
+    if (qlut_size > GGML_BITNET_LUT_CACHE_MAX_BYTES || ggml_bitnet_get_lut_kernel(m, k) == nullptr) {
+        ggml_bitnet_mul_mat_task_init(src1->data, *qlut, *lut_scales, nullptr, n, k, m, bits);
+        return;
+    }
+
+    bitnet_lut_cache & cache = tls_lut_cache;
+    bitnet_lut_cache_entry * victim = &cache.entries[0];
+    for (bitnet_lut_cache_entry & entry : cache.entries) {
+        // The LUT only depends on K and the activation, never on the weight
+        if (entry.block != nullptr && entry.src == src1 && entry.data == src1->data &&
+            entry.generation == generation && entry.n == n && entry.k == k) {
+            entry.last_use = ++cache.clock;
+            if (bitnet_trace_enabled()) {
+                bitnet_trace_count(BITNET_TRACE_LUT_CACHE_HITS, 1);
+            }
+            *qlut = entry.qlut;
+            *lut_scales = entry.lut_scales;
+            return;
+        }
+        if (entry.last_use < victim->last_use) {
+            victim = &entry;
+        }
+    }
+
+    const size_t scales_size = ((n * sizeof(bitnet_float_type) - 1) / 64 + 1) * 64;
+    const size_t size = qlut_size + scales_size;
+    if (victim->capacity < size) {
+        aligned_free(victim->block);
+        victim->block = aligned_malloc(size);
+        victim->capacity = victim->block != nullptr ? size : 0;
+        if (victim->block == nullptr) {
+            victim->last_use = 0;
+            ggml_bitnet_mul_mat_task_init(src1->data, *qlut, *lut_scales, nullptr, n, k, m, bits);
+            return;
+        }
+    }
+    // The LUT goes first so it keeps the 64-byte alignment of the block
+    victim->qlut = (int8_t *)victim->block;
+    victim->lut_scales = (bitnet_float_type *)((char *)victim->block + qlut_size);
+    victim->src = src1;
+    victim->data = src1->data;
+    victim->generation = generation;
+    victim->n = n;
+    victim->k = k;
+    victim->last_use = ++cache.clock;
+    ggml_bitnet_mul_mat_task_init(src1->data, victim->qlut, victim->lut_scales, nullptr, n, k, m, bits);
+
+    *qlut = victim->qlut;
+    *lut_scales = victim->lut_scales;
+}
+
+void ggml_bitnet_mul_mat_task_init_tensor(const struct ggml_tensor * src0, const struct ggml_tensor * src1, void ** qlut, void ** lut_scales, int n, int k, int m) {
+    bitnet_tensor_extra * extra = (bitnet_tensor_extra *)src0->extra;
+    const int bits = ggml_bitnet_get_type_bits(src0->type);
+    // Without an extra there is nowhere to tell evaluations apart
+    if (extra == nullptr) {
+        ggml_bitnet_mul_mat_task_init(src1->data, *qlut, *lut_scales, nullptr, n, k, m, bits);
+        return;
+    }
+    // The LUT is built within the thread quota of the weight's model, as
+    // task_compute_tensor runs its GEMM
+    BitNetTenantScope tenant(__atomic_load_n(&extra->tenant, __ATOMIC_RELAXED));
+    bitnet_task_init_cached(src1, qlut, lut_scales, n, k, m, bits, bitnet_lut_generation_of(extra));
+}
+
+void ggml_bitnet_mul_mat_task_compute(void * src0, void * scales, void * qlut, void * lut_scales, void * lut_biases, void * dst, int n, int k, int m, int bits) {
+    // TL1 has no LUT biases and a single weight width
+    GGML_UNUSED(lut_biases);
+    GGML_UNUSED(bits);
+    ggml_bitnet_mul_mat_threaded(src0, scales, qlut, lut_scales, dst, n, k, m);
+}
+
+void ggml_bitnet_mul_mat_task_compute_tensor(struct ggml_tensor * src0, void * qlut, void * lut_scales, void * dst, int n, int k, int m,
+                                             const struct ggml_bitnet_epilogue * epi) {
+    // Shapes without a kernel are skipped, as ggml_bitnet_mul_mat_threaded does
+    if (ggml_bitnet_get_lut_kernel(m, k) == nullptr) {
+        return;
+    }
+    ggml_bitnet_transform_tensor(src0);
+    ggml_bitnet_mul_mat_extra_epilogue((const bitnet_tensor_extra *)src0->extra, qlut, lut_scales, dst, n, k, m, epi);
+}
+
 int ggml_bitnet_get_type_bits(enum ggml_type type) {
     switch (type) {
         case GGML_TYPE_TL1:
@@ -95,6 +256,25 @@ int ggml_bitnet_get_type_bits(enum ggml_type type) {
 
 #endif
 #if defined(GGML_BITNET_X86_TL2)
+// Defined in ggml-bitnet-lut-tl2.cpp
+extern "C" void bitnet_tl2_transform_tensor(struct ggml_tensor * tensor);
+extern "C" bool bitnet_tl2_kernels_available(void);
+
+static bool initialized = false;
+
+// The TL2 kernels are AVX2 only; older x86 cores fall back to ggml. Builds
+// whose CMake could not give the kernel unit its flags have no kernels.
+static bool bitnet_tl2_usable(void) {
+    static const bool usable = bitnet_get_cpu_features()->avx2 && bitnet_tl2_kernels_available();
+    return usable;
+}
+
+void ggml_bitnet_transform_tensor(struct ggml_tensor * tensor) {
+    if (bitnet_tl2_usable()) {
+        bitnet_tl2_transform_tensor(tensor);
+    }
+}
+
 void ggml_bitnet_init(void) {
     // LOG(INFO) << "ggml_bitnet_init";
 
@@ -106,10 +286,6 @@ void ggml_bitnet_init(void) {
     // if (wrapper == nullptr) {
     //     wrapper = new BITNET::BITNETGeMMWrapper<bitnet_bitnet_float_type>();
     // }
-    if (bitnet_tensor_extras == nullptr) {
-        bitnet_tensor_extras = new bitnet_tensor_extra[GGML_BITNET_MAX_NODES];
-    }
-    bitnet_tensor_extras_index = 0;
 }
 
 void ggml_bitnet_free(void) {
@@ -122,16 +298,14 @@ void ggml_bitnet_free(void) {
 
     // delete wrapper;
     // wrapper = nullptr;
-    for (size_t i = 0; i < bitnet_tensor_extras_index; i++) {
-        // aligned_free(bitnet_tensor_extras[i].qweights);
-        // aligned_free(bitnet_tensor_extras[i].scales);
-    }
-    delete[] bitnet_tensor_extras;
-    bitnet_tensor_extras = nullptr;
+    bitnet_extras_release_all();
 }
 
 bool ggml_bitnet_can_mul_mat(const struct ggml_tensor * src0, const struct ggml_tensor * src1, const struct ggml_tensor * dst) {
-    if ((is_type_supported(src0->type)) &&
+    if (!bitnet_tl2_usable()) {
+        return false;
+    }
+    if ((src0->type == GGML_TYPE_Q4_0 || src0->type == GGML_TYPE_TL2) &&
         src1->type == GGML_TYPE_F32 &&
         dst->type == GGML_TYPE_F32 &&
         src0->backend == GGML_BACKEND_TYPE_CPU) {
@@ -144,7 +318,8 @@ size_t ggml_bitnet_mul_mat_get_wsize(const struct ggml_tensor * src0, const stru
     const size_t ne01 = src0->ne[1];
     const size_t ne10 = src1->ne[0];
     const size_t ne11 = src1->ne[1];
-    
+    GGML_UNUSED(dst);
+
     size_t wsize = ne10 * ne11 * 11 * sizeof(int8_t) + 2 * ne11 * 2 * sizeof(bitnet_float_type);
     if (sizeof(bitnet_float_type) == 2) {
         // Need fp32 to fp16 conversion
@@ -0,0 +1,11 @@
+// I2_S kernels built with -mavx512f -mavx512bw -mavx512vnni (see src/CMakeLists.txt)
+#include "ggml-bitnet-mad-impl.h"
+
+const bitnet_mad_kernels * ggml_bitnet_mad_kernels_avx512vnni(void) {
+#if defined(__AVX512VNNI__) && defined(__AVX512BW__)
+    static const bitnet_mad_kernels kernels = { "avx512vnni", vec_dot_i2_i8_s_impl, vec_dot_i2_i8_s_sparse_impl };
+    return &kernels;
+#else
+    return nullptr;
+#endif
+}
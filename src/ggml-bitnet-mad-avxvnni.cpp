@@ -0,0 +1,11 @@
+// I2_S kernels built with -mavx2 -mavxvnni (see src/CMakeLists.txt)
+#include "ggml-bitnet-mad-impl.h"
+
+const bitnet_mad_kernels * ggml_bitnet_mad_kernels_avxvnni(void) {
+#if defined(__AVXVNNI__)
+    static const bitnet_mad_kernels kernels = { "avxvnni", vec_dot_i2_i8_s_impl, vec_dot_i2_i8_s_sparse_impl };
+    return &kernels;
+#else
+    return nullptr;
+#endif
+}
@@ -0,0 +1,11 @@
+// I2_S kernels built with -march=armv8.2-a+dotprod (see src/CMakeLists.txt)
+#include "ggml-bitnet-mad-impl.h"
+
+const bitnet_mad_kernels * ggml_bitnet_mad_kernels_dotprod(void) {
+#if defined(__ARM_FEATURE_DOTPROD)
+    static const bitnet_mad_kernels kernels = { "dotprod", vec_dot_i2_i8_s_impl, vec_dot_i2_i8_s_sparse_impl };
+    return &kernels;
+#else
+    return nullptr;
+#endif
+}
@@ -0,0 +1,12 @@
+// I2_S kernels built with -march=armv8.2-a+dotprod+i8mm (see src/CMakeLists.txt).
+// Off unless configured with -DBITNET_I8MM=ON; the dotprod variant runs instead.
+#include "ggml-bitnet-mad-impl.h"
+
+const bitnet_mad_kernels * ggml_bitnet_mad_kernels_i8mm(void) {
+#if defined(__ARM_FEATURE_MATMUL_INT8) && defined(GGML_BITNET_I8MM)
+    static const bitnet_mad_kernels kernels = { "i8mm", vec_dot_i2_i8_s_impl, vec_dot_i2_i8_s_sparse_impl };
+    return &kernels;
+#else
+    return nullptr;
+#endif
+}
@@ -3,362 +3,214 @@
 
 #include "ggml-bitnet.h"
 #include "ggml-quants.h"
+#include "ggml-bitnet-mad-impl.h"
+#include "bitnet-cpu-features.h"
+#include "bitnet-threading.h"
 #include <cmath>
 #include <cstring>
+#include <algorithm>
 
-#define QK_I2_S 128
-#define QK_I2 128
-
-#if defined(__AVX__) || defined(__AVX2__) || defined(__AVX512F__) || defined(__SSSE3__)
+#if defined(__SSE2__)
 #include <immintrin.h>
-// horizontally add 8 int32_t
-static inline int hsum_i32_8(const __m256i a) {
-    const __m128i sum128 = _mm_add_epi32(_mm256_castsi256_si128(a), _mm256_extractf128_si256(a, 1));
-    const __m128i hi64 = _mm_unpackhi_epi64(sum128, sum128);
-    const __m128i sum64 = _mm_add_epi32(hi64, sum128);
-    const __m128i hi32  = _mm_shuffle_epi32(sum64, _MM_SHUFFLE(2, 3, 0, 1));
-    return _mm_cvtsi128_si32(_mm_add_epi32(sum64, hi32));
-}
-#elif defined(__loongarch_asx)
-// horizontally add 8 int32_t
-static inline int hsum_i32_8(const __m256i a) {
-
-    __m256i tmp1 = __lasx_xvpermi_q(a, a, 0x11);
-    __m256i tmp2 = __lasx_xvpermi_q(a, a, 0x00);
-
-    __m128i  tmp1_128 = lasx_extracti128_lo(tmp1);
-    __m128i  tmp2_128 = lasx_extracti128_lo(tmp2);
+#endif
 
-    __m128i sum128 = __lsx_vadd_w(tmp1_128, tmp2_128);
+#define QK_I2 128
 
-    __m128i ev = __lsx_vpickev_w(sum128, sum128);
-    __m128i od = __lsx_vpickod_w(sum128, sum128);
-    __m128i sum64 = __lsx_vadd_w(ev, od);
+// Elements each thread reduces or packs per chunk: whole I2_S blocks, large
+// enough to amortise scheduling, small enough to balance across cores
+#define I2_S_QUANT_CHUNK (QK_I2 * 512)
 
-    int sum64_1, sum64_2;
-    sum64_1 = __lsx_vpickve2gr_w(sum64, 0);
-    sum64_2 = __lsx_vpickve2gr_w(sum64, 1);
+static float i2_s_max_abs(const float * x, int64_t n) {
+    int64_t i = 0;
+    float max = 0.0f;
+#if defined(__AVX2__)
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    __m256 vmax = _mm256_setzero_ps();
+    for (; i + 8 <= n; i += 8) {
+        vmax = _mm256_max_ps(vmax, _mm256_andnot_ps(sign, _mm256_loadu_ps(x + i)));
+    }
+    __m128 m4 = _mm_max_ps(_mm256_castps256_ps128(vmax), _mm256_extractf128_ps(vmax, 1));
+    m4 = _mm_max_ps(m4, _mm_movehl_ps(m4, m4));
+    m4 = _mm_max_ss(m4, _mm_shuffle_ps(m4, m4, 1));
+    max = _mm_cvtss_f32(m4);
+#elif defined(__SSE2__)
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    __m128 vmax = _mm_setzero_ps();
+    for (; i + 4 <= n; i += 4) {
+        vmax = _mm_max_ps(vmax, _mm_andnot_ps(sign, _mm_loadu_ps(x + i)));
+    }
+    vmax = _mm_max_ps(vmax, _mm_movehl_ps(vmax, vmax));
+    vmax = _mm_max_ss(vmax, _mm_shuffle_ps(vmax, vmax, 1));
+    max = _mm_cvtss_f32(vmax);
+#elif defined(__ARM_NEON)
+    float32x4_t vmax = vdupq_n_f32(0.0f);
+    for (; i + 4 <= n; i += 4) {
+        vmax = vmaxq_f32(vmax, vabsq_f32(vld1q_f32(x + i)));
+    }
+    max = vmaxvq_f32(vmax);
+#endif
+    for (; i < n; i++) {
+        max = fmaxf(max, fabsf(x[i]));
+    }
+    return max;
+}
 
-    return  sum64_1 + sum64_2;
+// q8 -> 0, 1, 2
+//       |  |  |
+//      -1, 0, 1
+static inline uint8_t i2_s_ternarize(float v, double i2_scale) {
+    if (fabs((double)v) < 1e-6) {
+        return 1;
+    }
+    return (double)v * i2_scale > 0 ? 2 : 0;
 }
-#endif
 
 size_t quantize_i2_s(const float * src, void * dst, int64_t nrow, int64_t n_per_row, const float * quant_weights) {
     // 2 bits per weight
 
     size_t row_size = ggml_row_size(GGML_TYPE_I2_S, n_per_row);
 
-    int n = nrow * n_per_row;
+    const int64_t n = nrow * n_per_row;
+    const int64_t nb = n / QK_I2;
 
-    // f32 -> q8
-    double max = 0;
-    for (int i = 0; i < n; ++i) {
-        max = fmax(max, (double)fabs((double)src[i]));
-    }
-    double i2_scale = max;
+    // Creates the pool on first use; later calls only take its lock
+    bitnet_threading_init();
 
-    uint8_t* q8 = (uint8_t*)malloc(n * sizeof(uint8_t));
-    for (int i=0; i<n; i++) {
-        if (fabs((double)(src[i])) < 1e-6) {
-            q8[i] = 1;
-            continue;
+    // f32 -> max |w|, reduced per chunk then across chunks
+    const int64_t n_chunks = (n + I2_S_QUANT_CHUNK - 1) / I2_S_QUANT_CHUNK;
+    std::vector<float> chunk_max(n_chunks, 0.0f);
+    g_bitnet_thread_pool->parallel_for(0, n_chunks, 1, [&](int64_t lo, int64_t hi) {
+        for (int64_t c = lo; c < hi; ++c) {
+            const int64_t begin = c * I2_S_QUANT_CHUNK;
+            chunk_max[c] = i2_s_max_abs(src + begin, std::min<int64_t>(I2_S_QUANT_CHUNK, n - begin));
         }
-        q8[i] = (double)src[i] * i2_scale > 0 ? 2 : 0;
+    }).wait();
+    double max = 0;
+    for (int64_t c = 0; c < n_chunks; ++c) {
+        max = fmax(max, (double)chunk_max[c]);
     }
+    double i2_scale = max;
 
-    memset(dst, 0, n * sizeof(uint8_t) / 4);
-
-    // q8 -> 0, 1, 2
-    //       |  |  |
-    //      -1, 0, 1
-
+    // Ternarize and pack one 128-weight block at a time: byte j of a block
+    // holds weights j, j + 32, j + 64 and j + 96 from the high bits down
     uint8_t* i2_weight = (uint8_t*)dst;
-    for (int i = 0; i < n / QK_I2; i++) {
-        for (int j = 0; j < QK_I2; j++) {
-            int group_idx = j / 32;
-            int group_pos = j % 32;
-            uint8_t temp = (q8[i * QK_I2 + j] << (6 - 2 * group_idx));
-            i2_weight[i * 32 + group_pos] |= temp;            
+    g_bitnet_thread_pool->parallel_for(0, nb, I2_S_QUANT_CHUNK / QK_I2, [&](int64_t lo, int64_t hi) {
+        for (int64_t i = lo; i < hi; ++i) {
+            const float * x = src + i * QK_I2;
+            uint8_t * q = i2_weight + i * 32;
+            for (int j = 0; j < 32; j++) {
+                q[j] = (uint8_t)((i2_s_ternarize(x[j],      i2_scale) << 6) |
+                                 (i2_s_ternarize(x[j + 32], i2_scale) << 4) |
+                                 (i2_s_ternarize(x[j + 64], i2_scale) << 2) |
+                                  i2_s_ternarize(x[j + 96], i2_scale));
+            }
         }
-    }
+    }).wait();
+
+    // a trailing partial block is not packed
+    memset(i2_weight + nb * 32, 0, n / 4 - nb * 32);
 
     float* scale_ptr = (float*)((char*)i2_weight + n / 4);
     scale_ptr[0] = i2_scale;
 
-    free(q8);
-
     // 32B for alignment
     return nrow * row_size / 4 + 32;
 }
 
-void ggml_vec_dot_i2_i8_s(int n, float * s, size_t bs, const void * vx, size_t bx, const void * vy, size_t by, int nrc) {
-    const uint8_t *    x = (uint8_t *)vx;
-    const int8_t  *    y = (int8_t *)vy;
-
-    const int nb = n / QK_I2_S;
-    const int group32_num = nb / 32;
-    const int la_num = nb % 32;
-    const int groupla_num = nb % 32 != 0 ? 1 : 0;
-
-#if defined(__AVX2__)
-
-    __m256i mask = _mm256_set1_epi8(0x03);
-    __m256i accu = _mm256_setzero_si256();
-
-    for (int i=0; i < group32_num; i++){
-        __m256i accu32 = _mm256_setzero_si256();
-        for (int j=0; j < 32; j++) {
-        // 128 index
-        __m256i xq8_3 = _mm256_loadu_si256((const __m256i*)(x + i * 32 * 32 + j * 32));
-        __m256i xq8_2 = _mm256_srli_epi16(xq8_3, 2);
-        __m256i xq8_1 = _mm256_srli_epi16(xq8_3, 4);
-        __m256i xq8_0 = _mm256_srli_epi16(xq8_3, 6);
-
-        // each 32 index
-        xq8_3 = _mm256_and_si256(xq8_3, mask);
-        xq8_2 = _mm256_and_si256(xq8_2, mask);
-        xq8_1 = _mm256_and_si256(xq8_1, mask);
-        xq8_0 = _mm256_and_si256(xq8_0, mask);
-
-        // each 32 index
-        __m256i yq8_0 = _mm256_loadu_si256((const __m256i*)(y + i * 128 * 32 + j * 128 + 0));
-        __m256i yq8_1 = _mm256_loadu_si256((const __m256i*)(y + i * 128 * 32 + j * 128 + 32));
-        __m256i yq8_2 = _mm256_loadu_si256((const __m256i*)(y + i * 128 * 32 + j * 128 + 64));
-        __m256i yq8_3 = _mm256_loadu_si256((const __m256i*)(y + i * 128 * 32 + j * 128 + 96));
+// The variant built with this translation unit's own flags: plain NEON on a
+// baseline aarch64 build, AVX2 or scalar on x86 depending on the toolchain
+// defaults
+static const bitnet_mad_kernels * ggml_bitnet_mad_kernels_base(void) {
+#if defined(__ARM_FEATURE_DOTPROD)
+    static const bitnet_mad_kernels kernels = { "dotprod", vec_dot_i2_i8_s_impl, vec_dot_i2_i8_s_sparse_impl };
+#elif defined(__ARM_NEON)
+    static const bitnet_mad_kernels kernels = { "neon", vec_dot_i2_i8_s_impl, vec_dot_i2_i8_s_sparse_impl };
+#elif defined(__AVX2__)
+    static const bitnet_mad_kernels kernels = { "avx2", vec_dot_i2_i8_s_impl, vec_dot_i2_i8_s_sparse_impl };
+#else
+    static const bitnet_mad_kernels kernels = { "scalar", vec_dot_i2_i8_s_impl, vec_dot_i2_i8_s_sparse_impl };
+#endif
+    return &kernels;
+}
 
-        // 128 index accumulation add
-        // split into 32 accumulation block
-        // each block each 128 index accumulated 4index
-        // each index maximum 256
-        // each block maximum 4 * 256
-        // each block accumulation maximum 127 * 256
-        // each 32 group index (128 index in one group) needs cast to int32
-        xq8_0 = _mm256_maddubs_epi16(xq8_0, yq8_0);
-        xq8_1 = _mm256_maddubs_epi16(xq8_1, yq8_1);
-        xq8_2 = _mm256_maddubs_epi16(xq8_2, yq8_2);
-        xq8_3 = _mm256_maddubs_epi16(xq8_3, yq8_3);
+// Best compiled variant the host supports. A variant whose translation unit
+// was built without its flags reports NULL and is skipped.
+static const bitnet_mad_kernels * ggml_bitnet_mad_select(void) {
+    const bitnet_cpu_features * cpu = bitnet_get_cpu_features();
+    const bitnet_mad_kernels * kernels = nullptr;
 
-        accu32 = _mm256_add_epi16(accu32, _mm256_add_epi16(xq8_0, xq8_1));
-        accu32 = _mm256_add_epi16(accu32, _mm256_add_epi16(xq8_2, xq8_3));
-        }
-        accu = _mm256_add_epi32(_mm256_madd_epi16(accu32, _mm256_set1_epi16(1)), accu);
+#if defined(__x86_64__) || defined(__i386__)
+    if (kernels == nullptr && cpu->avx512vnni) {
+        kernels = ggml_bitnet_mad_kernels_avx512vnni();
     }
-
-    for (int i = 0; i < groupla_num; i++){
-        __m256i accula = _mm256_setzero_si256();
-        for (int j = 0; j < la_num; j++) {
-        // 128 index
-        __m256i xq8_3 = _mm256_loadu_si256((const __m256i*)(x + group32_num * 32 * 32 + j * 32));
-        __m256i xq8_2 = _mm256_srli_epi16(xq8_3, 2);
-        __m256i xq8_1 = _mm256_srli_epi16(xq8_3, 4);
-        __m256i xq8_0 = _mm256_srli_epi16(xq8_3, 6);
-
-        // each 32 index
-        xq8_3 = _mm256_and_si256(xq8_3, mask);
-        xq8_2 = _mm256_and_si256(xq8_2, mask);
-        xq8_1 = _mm256_and_si256(xq8_1, mask);
-        xq8_0 = _mm256_and_si256(xq8_0, mask);
-
-        // each 32 index
-        __m256i yq8_0 = _mm256_loadu_si256((const __m256i*)(y + group32_num * 128 * 32 + j * 128 + 0));
-        __m256i yq8_1 = _mm256_loadu_si256((const __m256i*)(y + group32_num * 128 * 32 + j * 128 + 32));
-        __m256i yq8_2 = _mm256_loadu_si256((const __m256i*)(y + group32_num * 128 * 32 + j * 128 + 64));
-        __m256i yq8_3 = _mm256_loadu_si256((const __m256i*)(y + group32_num * 128 * 32 + j * 128 + 96));
-
-        // 128 index accumulation add
-        // split into 32 accumulation block
-        // each block each 128 index accumulated 4index
-        // each index maximum 256
-        // each block maximum 4 * 256
-        // each block accumulation maximum 127 * 256
-        // each 32 group index (128 index in one group) needs cast to int32
-        xq8_0 = _mm256_maddubs_epi16(xq8_0, yq8_0);
-        xq8_1 = _mm256_maddubs_epi16(xq8_1, yq8_1);
-        xq8_2 = _mm256_maddubs_epi16(xq8_2, yq8_2);
-        xq8_3 = _mm256_maddubs_epi16(xq8_3, yq8_3);
-
-        accula = _mm256_add_epi16(accula, _mm256_add_epi16(xq8_0, xq8_1));
-        accula = _mm256_add_epi16(accula, _mm256_add_epi16(xq8_2, xq8_3));
-        }
-        accu = _mm256_add_epi32(accu, _mm256_madd_epi16(accula, _mm256_set1_epi16(1)));
+    if (kernels == nullptr && cpu->avxvnni) {
+        kernels = ggml_bitnet_mad_kernels_avxvnni();
     }
-    int sumi = hsum_i32_8(accu);
-    *s = (float)sumi;
-
-#elif defined(__ARM_NEON)
-
-    int32x4_t accu_0 = vdupq_n_s32(0);
-    int32x4_t accu_1 = vdupq_n_s32(0);
-    int32x4_t accu_2 = vdupq_n_s32(0);
-    int32x4_t accu_3 = vdupq_n_s32(0);
-    const uint8x16_t mask = vdupq_n_u8(3);
+    if (kernels == nullptr && cpu->avx2) {
+        kernels = ggml_bitnet_mad_kernels_avx2();
+    }
+#elif defined(__aarch64__)
+    if (kernels == nullptr && cpu->i8mm) {
+        kernels = ggml_bitnet_mad_kernels_i8mm();
+    }
+    if (kernels == nullptr && cpu->dotprod) {
+        kernels = ggml_bitnet_mad_kernels_dotprod();
+    }
+#endif
+    (void)cpu;
 
-    for (int i=0; i < group32_num; i++) {
+    return kernels != nullptr ? kernels : ggml_bitnet_mad_kernels_base();
+}
 
-#if defined(__ARM_FEATURE_DOTPROD)
-        // Using dot product instructions - accumulate directly into int32x4_t
-#else
-        int16x8_t accu32_0 = vdupq_n_s16(0);
-        int16x8_t accu32_1 = vdupq_n_s16(0);
-        int16x8_t accu32_2 = vdupq_n_s16(0);
-        int16x8_t accu32_3 = vdupq_n_s16(0);
-#endif
+static inline const bitnet_mad_kernels * ggml_bitnet_mad_get(void) {
+    static const bitnet_mad_kernels * kernels = ggml_bitnet_mad_select();
+    return kernels;
+}
 
-        for (int j=0; j < 32; j++) {
-            uint8x16_t xq8_6 = vld1q_u8(x + i * 32 * 32 + j * 32);
-            uint8x16_t xq8_7 = vld1q_u8(x + i * 32 * 32 + j * 32 + 16);
-            uint8x16_t xq8_4 = vshrq_n_u8(xq8_6, 2);
-            uint8x16_t xq8_5 = vshrq_n_u8(xq8_7, 2);
-            uint8x16_t xq8_2 = vshrq_n_u8(xq8_6, 4);
-            uint8x16_t xq8_3 = vshrq_n_u8(xq8_7, 4);
-            uint8x16_t xq8_0 = vshrq_n_u8(xq8_6, 6);
-            uint8x16_t xq8_1 = vshrq_n_u8(xq8_7, 6);
+const char * ggml_bitnet_i2_s_isa(void) {
+    return ggml_bitnet_mad_get()->isa;
+}
 
-            int8x16_t q8_0 = vreinterpretq_s8_u8(vandq_u8(xq8_0, mask));
-            int8x16_t q8_1 = vreinterpretq_s8_u8(vandq_u8(xq8_1, mask));
-            int8x16_t q8_2 = vreinterpretq_s8_u8(vandq_u8(xq8_2, mask));
-            int8x16_t q8_3 = vreinterpretq_s8_u8(vandq_u8(xq8_3, mask));
-            int8x16_t q8_4 = vreinterpretq_s8_u8(vandq_u8(xq8_4, mask));
-            int8x16_t q8_5 = vreinterpretq_s8_u8(vandq_u8(xq8_5, mask));
-            int8x16_t q8_6 = vreinterpretq_s8_u8(vandq_u8(xq8_6, mask));
-            int8x16_t q8_7 = vreinterpretq_s8_u8(vandq_u8(xq8_7, mask));
+// ggml calls this one row at a time (nrc = 1); nrc > 1 is API-only
+void ggml_vec_dot_i2_i8_s(int n, float * s, size_t bs, const void * vx, size_t bx, const void * vy, size_t by, int nrc) {
+    ggml_bitnet_mad_get()->vec_dot_i2_i8_s(n, s, bs, vx, bx, vy, by, nrc);
+}
 
-            const int8x16_t yq8_0 = vld1q_s8(y + i * 128 * 32 + j * 128 + 0);
-            const int8x16_t yq8_1 = vld1q_s8(y + i * 128 * 32 + j * 128 + 16);
-            const int8x16_t yq8_2 = vld1q_s8(y + i * 128 * 32 + j * 128 + 32);
-            const int8x16_t yq8_3 = vld1q_s8(y + i * 128 * 32 + j * 128 + 48);
-            const int8x16_t yq8_4 = vld1q_s8(y + i * 128 * 32 + j * 128 + 64);
-            const int8x16_t yq8_5 = vld1q_s8(y + i * 128 * 32 + j * 128 + 80);
-            const int8x16_t yq8_6 = vld1q_s8(y + i * 128 * 32 + j * 128 + 96);
-            const int8x16_t yq8_7 = vld1q_s8(y + i * 128 * 32 + j * 128 + 112);
+void ggml_vec_dot_i2_i8_s_sparse(int n, float * s, size_t bs, const void * vx, size_t bx, const void * vy, size_t by, int nrc,
+                                 const uint8_t * occupancy, size_t occ_stride, const int32_t * y_sums) {
+    ggml_bitnet_mad_get()->vec_dot_i2_i8_s_sparse(n, s, bs, vx, bx, vy, by, nrc, occupancy, occ_stride, y_sums);
+}
 
-#if defined(__ARM_FEATURE_DOTPROD)
-            accu_0 = vdotq_s32(accu_0, q8_0, yq8_0);
-            accu_1 = vdotq_s32(accu_1, q8_1, yq8_1);
-            accu_2 = vdotq_s32(accu_2, q8_2, yq8_2);
-            accu_3 = vdotq_s32(accu_3, q8_3, yq8_3);
-            accu_0 = vdotq_s32(accu_0, q8_4, yq8_4);
-            accu_1 = vdotq_s32(accu_1, q8_5, yq8_5);
-            accu_2 = vdotq_s32(accu_2, q8_6, yq8_6);
-            accu_3 = vdotq_s32(accu_3, q8_7, yq8_7);
-#else
-            accu32_0 = vmlal_s8(accu32_0, vget_low_s8(q8_0), vget_low_s8(yq8_0));
-            accu32_1 = vmlal_s8(accu32_1, vget_high_s8(q8_0), vget_high_s8(yq8_0));
-            accu32_2 = vmlal_s8(accu32_2, vget_low_s8(q8_1), vget_low_s8(yq8_1));
-            accu32_3 = vmlal_s8(accu32_3, vget_high_s8(q8_1), vget_high_s8(yq8_1));
-            accu32_0 = vmlal_s8(accu32_0, vget_low_s8(q8_2), vget_low_s8(yq8_2));
-            accu32_1 = vmlal_s8(accu32_1, vget_high_s8(q8_2), vget_high_s8(yq8_2));
-            accu32_2 = vmlal_s8(accu32_2, vget_low_s8(q8_3), vget_low_s8(yq8_3));
-            accu32_3 = vmlal_s8(accu32_3, vget_high_s8(q8_3), vget_high_s8(yq8_3));
-            accu32_0 = vmlal_s8(accu32_0, vget_low_s8(q8_4), vget_low_s8(yq8_4));
-            accu32_1 = vmlal_s8(accu32_1, vget_high_s8(q8_4), vget_high_s8(yq8_4));
-            accu32_2 = vmlal_s8(accu32_2, vget_low_s8(q8_5), vget_low_s8(yq8_5));
-            accu32_3 = vmlal_s8(accu32_3, vget_high_s8(q8_5), vget_high_s8(yq8_5));
-            accu32_0 = vmlal_s8(accu32_0, vget_low_s8(q8_6), vget_low_s8(yq8_6));
-            accu32_1 = vmlal_s8(accu32_1, vget_high_s8(q8_6), vget_high_s8(yq8_6));
-            accu32_2 = vmlal_s8(accu32_2, vget_low_s8(q8_7), vget_low_s8(yq8_7));
-            accu32_3 = vmlal_s8(accu32_3, vget_high_s8(q8_7), vget_high_s8(yq8_7));
-#endif
+int64_t ggml_bitnet_i2_s_occupancy(const void * vx, int64_t nrow, int64_t n_per_row, uint8_t * occupancy) {
+    // An empty block is code 1 in every slot
+    static const uint8_t empty[32] = {
+        0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55,
+        0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55,
+    };
+    const int64_t nb = n_per_row / QK_I2;
+    const size_t occ_size = GGML_BITNET_I2_S_OCCUPANCY_ROW_SIZE(n_per_row);
+    int64_t n_empty = 0;
+    for (int64_t r = 0; r < nrow; r++) {
+        const uint8_t * x = (const uint8_t *)vx + r * (n_per_row / 4);
+        uint8_t * occ = occupancy + r * occ_size;
+        memset(occ, 0, occ_size);
+        for (int64_t b = 0; b < nb; b++) {
+            if (memcmp(x + b * 32, empty, 32) != 0) {
+                occ[b / 8] |= (uint8_t)(1 << (b % 8));
+            } else {
+                n_empty++;
+            }
         }
-
-#if defined(__ARM_FEATURE_DOTPROD)
-        // Dot product path - no additional accumulation needed, 
-        // vdotq_s32 already accumulates into accu_0, accu_1, accu_2, accu_3
-#else
-        accu_0 = vaddq_s32(accu_0, vmovl_s16(vget_low_s16(accu32_0)));
-        accu_0 = vaddq_s32(accu_0, vmovl_high_s16(accu32_0));
-        accu_1 = vaddq_s32(accu_1, vmovl_s16(vget_low_s16(accu32_1)));
-        accu_1 = vaddq_s32(accu_1, vmovl_high_s16(accu32_1));
-        accu_2 = vaddq_s32(accu_2, vmovl_s16(vget_low_s16(accu32_2)));
-        accu_2 = vaddq_s32(accu_2, vmovl_high_s16(accu32_2));
-        accu_3 = vaddq_s32(accu_3, vmovl_s16(vget_low_s16(accu32_3)));
-        accu_3 = vaddq_s32(accu_3, vmovl_high_s16(accu32_3));
-#endif
     }
+    return n_empty;
+}
 
-    for (int i = 0; i < groupla_num; i++){
-#if defined(__ARM_FEATURE_DOTPROD)
-        // Using dot product instructions - accumulate directly into int32x4_t
-#else
-        int16x8_t accula_0 = vdupq_n_s16(0);
-        int16x8_t accula_1 = vdupq_n_s16(0);
-        int16x8_t accula_2 = vdupq_n_s16(0);
-        int16x8_t accula_3 = vdupq_n_s16(0);
-#endif
-        for (int j = 0; j < la_num; j++) {
-            uint8x16_t xq8_6 = vld1q_u8(x + group32_num * 32 * 32 + j * 32);
-            uint8x16_t xq8_7 = vld1q_u8(x + group32_num * 32 * 32 + j * 32 + 16);
-            uint8x16_t xq8_4 = vshrq_n_u8(xq8_6, 2);
-            uint8x16_t xq8_5 = vshrq_n_u8(xq8_7, 2);
-            uint8x16_t xq8_2 = vshrq_n_u8(xq8_6, 4);
-            uint8x16_t xq8_3 = vshrq_n_u8(xq8_7, 4);
-            uint8x16_t xq8_0 = vshrq_n_u8(xq8_6, 6);
-            uint8x16_t xq8_1 = vshrq_n_u8(xq8_7, 6);
-
-            int8x16_t q8_0 = vreinterpretq_s8_u8(vandq_u8(xq8_0, mask));
-            int8x16_t q8_1 = vreinterpretq_s8_u8(vandq_u8(xq8_1, mask));
-            int8x16_t q8_2 = vreinterpretq_s8_u8(vandq_u8(xq8_2, mask));
-            int8x16_t q8_3 = vreinterpretq_s8_u8(vandq_u8(xq8_3, mask));
-            int8x16_t q8_4 = vreinterpretq_s8_u8(vandq_u8(xq8_4, mask));
-            int8x16_t q8_5 = vreinterpretq_s8_u8(vandq_u8(xq8_5, mask));
-            int8x16_t q8_6 = vreinterpretq_s8_u8(vandq_u8(xq8_6, mask));
-            int8x16_t q8_7 = vreinterpretq_s8_u8(vandq_u8(xq8_7, mask));
-
-            const int8x16_t yq8_0 = vld1q_s8(y + group32_num * 128 * 32 + j * 128 + 0);
-            const int8x16_t yq8_1 = vld1q_s8(y + group32_num * 128 * 32 + j * 128 + 16);
-            const int8x16_t yq8_2 = vld1q_s8(y + group32_num * 128 * 32 + j * 128 + 32);
-            const int8x16_t yq8_3 = vld1q_s8(y + group32_num * 128 * 32 + j * 128 + 48);
-            const int8x16_t yq8_4 = vld1q_s8(y + group32_num * 128 * 32 + j * 128 + 64);
-            const int8x16_t yq8_5 = vld1q_s8(y + group32_num * 128 * 32 + j * 128 + 80);
-            const int8x16_t yq8_6 = vld1q_s8(y + group32_num * 128 * 32 + j * 128 + 96);
-            const int8x16_t yq8_7 = vld1q_s8(y + group32_num * 128 * 32 + j * 128 + 112);
-
-#if defined(__ARM_FEATURE_DOTPROD)
-            accu_0 = vdotq_s32(accu_0, q8_0, yq8_0);
-            accu_1 = vdotq_s32(accu_1, q8_1, yq8_1);
-            accu_2 = vdotq_s32(accu_2, q8_2, yq8_2);
-            accu_3 = vdotq_s32(accu_3, q8_3, yq8_3);
-            accu_0 = vdotq_s32(accu_0, q8_4, yq8_4);
-            accu_1 = vdotq_s32(accu_1, q8_5, yq8_5);
-            accu_2 = vdotq_s32(accu_2, q8_6, yq8_6);
-            accu_3 = vdotq_s32(accu_3, q8_7, yq8_7);
-#else
-            accula_0 = vmlal_s8(accula_0, vget_low_s8(q8_0), vget_low_s8(yq8_0));
-            accula_1 = vmlal_s8(accula_1, vget_high_s8(q8_0), vget_high_s8(yq8_0));
-            accula_2 = vmlal_s8(accula_2, vget_low_s8(q8_1), vget_low_s8(yq8_1));
-            accula_3 = vmlal_s8(accula_3, vget_high_s8(q8_1), vget_high_s8(yq8_1));
-            accula_0 = vmlal_s8(accula_0, vget_low_s8(q8_2), vget_low_s8(yq8_2));
-            accula_1 = vmlal_s8(accula_1, vget_high_s8(q8_2), vget_high_s8(yq8_2));
-            accula_2 = vmlal_s8(accula_2, vget_low_s8(q8_3), vget_low_s8(yq8_3));
-            accula_3 = vmlal_s8(accula_3, vget_high_s8(q8_3), vget_high_s8(yq8_3));
-            accula_0 = vmlal_s8(accula_0, vget_low_s8(q8_4), vget_low_s8(yq8_4));
-            accula_1 = vmlal_s8(accula_1, vget_high_s8(q8_4), vget_high_s8(yq8_4));
-            accula_2 = vmlal_s8(accula_2, vget_low_s8(q8_5), vget_low_s8(yq8_5));
-            accula_3 = vmlal_s8(accula_3, vget_high_s8(q8_5), vget_high_s8(yq8_5));
-            accula_0 = vmlal_s8(accula_0, vget_low_s8(q8_6), vget_low_s8(yq8_6));
-            accula_1 = vmlal_s8(accula_1, vget_high_s8(q8_6), vget_high_s8(yq8_6));
-            accula_2 = vmlal_s8(accula_2, vget_low_s8(q8_7), vget_low_s8(yq8_7));
-            accula_3 = vmlal_s8(accula_3, vget_high_s8(q8_7), vget_high_s8(yq8_7));
-#endif
+void ggml_bitnet_i2_s_block_sums(int n, const int8_t * y, int32_t * sums) {
+    for (int b = 0; b < n / QK_I2; b++) {
+        int32_t sum = 0;
+        for (int j = 0; j < QK_I2; j++) {
+            sum += y[b * QK_I2 + j];
         }
-#if defined(__ARM_FEATURE_DOTPROD)
-        // Dot product path - no additional accumulation needed
-#else
-        accu_0 = vaddq_s32(accu_0, vmovl_s16(vget_low_s16(accula_0)));
-        accu_0 = vaddq_s32(accu_0, vmovl_high_s16(accula_0));
-        accu_1 = vaddq_s32(accu_1, vmovl_s16(vget_low_s16(accula_1)));
-        accu_1 = vaddq_s32(accu_1, vmovl_high_s16(accula_1));
-        accu_2 = vaddq_s32(accu_2, vmovl_s16(vget_low_s16(accula_2)));
-        accu_2 = vaddq_s32(accu_2, vmovl_high_s16(accula_2));
-        accu_3 = vaddq_s32(accu_3, vmovl_s16(vget_low_s16(accula_3)));
-        accu_3 = vaddq_s32(accu_3, vmovl_high_s16(accula_3));
-#endif
+        sums[b] = sum;
     }
-    accu_0 = vaddq_s32(accu_0, accu_1);
-    accu_2 = vaddq_s32(accu_2, accu_3);
-    accu_0 = vaddq_s32(accu_0, accu_2);
-    int sumi = vaddlvq_s32(accu_0);
-    *s = (float)sumi;
-
-#endif
-}
\ No newline at end of file
+}
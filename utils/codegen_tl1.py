@@ -5,10 +5,9 @@ from configparser import ConfigParser
 def gen_ctor_code():
     kernel_code = "\n\
 #include \"ggml-bitnet.h\"\n\
-#define GGML_BITNET_MAX_NODES 8192\n\
+#include \"bitnet-numa.h\"\n\
+#include \"bitnet-extras.h\"\n\
 static bool initialized = false;\n\
-static bitnet_tensor_extra * bitnet_tensor_extras = nullptr;\n\
-static size_t bitnet_tensor_extras_index = 0;\n\
 static void * aligned_malloc(size_t size) {{\n\
 #if defined(_WIN32)\n\
     return _aligned_malloc(size, 64);\n\
@@ -26,18 +25,26 @@ static void aligned_free(void * ptr) {{\n\
 #endif\n\
 }}\n\
 \n\
-void per_tensor_quant(int k, void* lut_scales_, void* b_) {{\n\
-    bitnet_float_type* lut_scales = (bitnet_float_type*)lut_scales_;\n\
-    bitnet_float_type* b = (bitnet_float_type*)b_;\n\
+// Abs-max of k activations, the reduction the LUT scale is taken from\n\
+float lut_abs_max(int k, const bitnet_float_type* b) {{\n\
 #ifdef __ARM_NEON\n\
-    float32x4_t temp_max = vdupq_n_f32(0);\n\
-    for (int i=0; i < k / 4; i++) {{\n\
-      float32x4_t vec_bs = vld1q_f32(b + 4 * i);\n\
-      float32x4_t abssum = vabsq_f32(vec_bs);\n\
-      temp_max = vmaxq_f32(abssum, temp_max);\n\
+    // four independent maxima so the loop is bound by loads, not vmaxq latency\n\
+    float32x4_t temp_max0 = vdupq_n_f32(0);\n\
+    float32x4_t temp_max1 = vdupq_n_f32(0);\n\
+    float32x4_t temp_max2 = vdupq_n_f32(0);\n\
+    float32x4_t temp_max3 = vdupq_n_f32(0);\n\
+    int i = 0;\n\
+    for (; i + 16 <= k; i += 16) {{\n\
+      temp_max0 = vmaxq_f32(vabsq_f32(vld1q_f32(b + i)), temp_max0);\n\
+      temp_max1 = vmaxq_f32(vabsq_f32(vld1q_f32(b + i + 4)), temp_max1);\n\
+      temp_max2 = vmaxq_f32(vabsq_f32(vld1q_f32(b + i + 8)), temp_max2);\n\
+      temp_max3 = vmaxq_f32(vabsq_f32(vld1q_f32(b + i + 12)), temp_max3);\n\
     }}\n\
-    float32_t scales = 127 / vmaxvq_f32(temp_max);\n\
-    *lut_scales = scales;\n\
+    for (; i + 4 <= k; i += 4) {{\n\
+      temp_max0 = vmaxq_f32(vabsq_f32(vld1q_f32(b + i)), temp_max0);\n\
+    }}\n\
+    float32x4_t temp_max = vmaxq_f32(vmaxq_f32(temp_max0, temp_max1), vmaxq_f32(temp_max2, temp_max3));\n\
+    return vmaxvq_f32(temp_max);\n\
 #elif defined __AVX2__\n\
     __m256 max_vec = _mm256_set1_ps(0.f);\n\
     const __m256 vec_sign = _mm256_set1_ps(-0.0f);\n\
@@ -50,11 +57,23 @@ void per_tensor_quant(int k, void* lut_scales_, void* b_) {{\n\
     __m128 max1 = _mm_max_ps(_mm256_extractf128_ps(max_vec, 1), _mm256_castps256_ps128(max_vec));\n\
     max1 = _mm_max_ps(max1, _mm_movehl_ps(max1, max1));\n\
     max1 = _mm_max_ss(max1, _mm_movehdup_ps(max1));\n\
-    float scales = 127 / _mm_cvtss_f32(max1);\n\
-    *lut_scales = scales;\n\
+    return _mm_cvtss_f32(max1);\n\
+#else\n\
+    float max = 0;\n\
+    for (int i = 0; i < k; i++) {{\n\
+        const float a = b[i] < 0 ? -b[i] : b[i];\n\
+        max = a > max ? a : max;\n\
+    }}\n\
+    return max;\n\
 #endif\n\
 }}\n\
 \n\
+void per_tensor_quant(int k, void* lut_scales_, void* b_) {{\n\
+    bitnet_float_type* lut_scales = (bitnet_float_type*)lut_scales_;\n\
+    bitnet_float_type* b = (bitnet_float_type*)b_;\n\
+    *lut_scales = 127 / lut_abs_max(k, b);\n\
+}}\n\
+\n\
 void partial_max_reset(void* lut_scales_) {{\n\
     bitnet_float_type* lut_scales = (bitnet_float_type*)lut_scales_;\n\
     *lut_scales = 0.0;\n\
@@ -221,6 +240,94 @@ def gen_body_core_code(bm, by):
 
     return all_code
 
+def gen_batch_body_core_code(bm, by):
+    length = 4
+    all_code = ""
+    for i in range(length):
+        core_code = "\n\
+            uint8x16_t vec_a_{0} = vld1q_u8(a + i * KK / 2 + k * 32 * 2 + {0} * 16);\n\
+            uint8x16_t vec_a{0}_top = vshrq_n_u8(vec_a_{0}, 4);\n\
+            uint8x16_t vec_a{0}_bot = vandq_u8(vec_a_{0}, vec_mask);\n\
+#pragma unroll\n\
+            for (int bs = 0; bs < BATCH_SIZE; bs++) {{\n\
+                const int8_t* lut_bs = lut + bs * LUT_STRIDE;\n\
+                int8x16_t  vec_v_{0}_left_tmp0 = vqtbl1q_s8(vld1q_s8(lut_bs + ({1} * k + {2}) * 16), vec_a{0}_top);\n\
+                int8x16_t  vec_v_{0}_left_tmp1 = vqtbl1q_s8(vld1q_s8(lut_bs + ({1} * k + {3}) * 16), vec_a{0}_top);\n\
+                int8x16_t  vec_v_{0}_right_tmp0 = vqtbl1q_s8(vld1q_s8(lut_bs + ({1} * k + {4}) * 16), vec_a{0}_bot);\n\
+                int8x16_t  vec_v_{0}_right_tmp1 = vqtbl1q_s8(vld1q_s8(lut_bs + ({1} * k + {5}) * 16), vec_a{0}_bot);\n\
+                int8x16x2_t  vec_v_left_{0} = vzipq_s8(vec_v_{0}_left_tmp1, vec_v_{0}_left_tmp0);\n\
+                int8x16x2_t  vec_v_right_{0} = vzipq_s8(vec_v_{0}_right_tmp1, vec_v_{0}_right_tmp0);\n\
+                vec_c[bs][{6}] += vec_v_left_{0}.val[0];\n\
+                vec_c[bs][{6}] += vec_v_right_{0}.val[0];\n\
+                vec_c[bs][{7}] += vec_v_left_{0}.val[1];\n\
+                vec_c[bs][{7}] += vec_v_right_{0}.val[1];\n\
+            }}\n\
+        ".format(i, 2 * by // 2, (4 * i) % (2 * by // 2), (4 * i + 1) % (2 * by // 2), (4 * i + 2) % (2 * by // 2), (4 * i + 3) % (2 * by // 2), (i * 2) // (by // 2) * 2 + 0, (i * 2) // (by // 2) * 2 + 1)
+
+        all_code = "".join([all_code, core_code])
+
+    all_code = "".join([all_code, "\n       }\n\n"])
+
+    all_code = "".join([all_code, "\
+#pragma unroll\n\
+        for (int bs = 0; bs < BATCH_SIZE; bs++) {\n"])
+    for i in range(bm // 8):
+        core_code = "\
+            int32x4_t vec_v_bot_low_low_{0} = vmovl_s16(vget_low_s16(vec_c[bs][{0}]));\n\
+            int32x4_t vec_v_bot_low_high_{0} = vmovl_high_s16(vec_c[bs][{0}]);\n\
+            vst1q_s32(c + bs * BM_ + i + {1}, vld1q_s32(c + bs * BM_ + i + {1}) + vec_v_bot_low_low_{0});\n\
+            vst1q_s32(c + bs * BM_ + i + {2}, vld1q_s32(c + bs * BM_ + i + {2}) + vec_v_bot_low_high_{0});\n".format(i, i * 8, i * 8 + 4)
+        all_code = "".join([all_code, core_code])
+    all_code = "".join([all_code, "        }\n"])
+
+    return all_code
+
+def gen_tbl_impl_batch(pre, bm, k):
+    # Same tiling as tbl_impl_{pre}, but every weight vector is unpacked once
+    # and looked up in BATCH_SIZE activation LUTs. c holds BATCH_SIZE rows of
+    # BM int32 accumulators, lut holds BATCH_SIZE full-K column LUTs.
+    kernel_code = "\n\
+template<int BATCH_SIZE>\n\
+inline void tbl_impl_batch_{0}_b(int32_t* c, int8_t* lut, uint8_t* a) {{\n\
+#ifdef __ARM_NEON\n\
+    const int KK = BBK{0} / 2;\n\
+    const int BM_ = BM{0};\n\
+    const int LUT_STRIDE = {1} / 2 * 32;\n\
+    const uint8x16_t vec_mask = vdupq_n_u8(0x0f);\n\
+    const int8x16_t vec_zero = vdupq_n_s16(0x0000);\n\
+    int16x8_t vec_c[BATCH_SIZE][{2}];\n\
+\n\
+#pragma unroll\n\
+    for (int i = 0; i < BM{0}; i += {3}) {{\n\
+#pragma unroll\n\
+        for (int bs = 0; bs < BATCH_SIZE; bs++) {{\n\
+            #pragma unroll\n\
+            for (int i=0; i<{2}; i++) {{\n\
+                vec_c[bs][i] = vandq_s16(vec_c[bs][i], vec_zero);\n\
+            }}\n\
+        }}\n\
+\n\
+#pragma unroll\n\
+        for (int k = 0; k < KK / {4}; k++) {{\n\
+            ".format(pre, k, bm // 8, bm, 256 // bm // 2)
+
+    kernel_code = "".join([kernel_code, gen_batch_body_core_code(bm, 256 // bm), "\n\
+    }\n\
+#endif\n\
+}\n"])
+
+    kernel_code = "".join([kernel_code, "\n\
+inline void tbl_impl_batch_{0}(int32_t* c, int8_t* lut, uint8_t* a, int bs) {{\n\
+    switch (bs) {{\n\
+        case 4: tbl_impl_batch_{0}_b<4>(c, lut, a); break;\n\
+        case 3: tbl_impl_batch_{0}_b<3>(c, lut, a); break;\n\
+        case 2: tbl_impl_batch_{0}_b<2>(c, lut, a); break;\n\
+        default: tbl_impl_batch_{0}_b<1>(c, lut, a); break;\n\
+    }}\n\
+}}\n".format(pre)])
+
+    return kernel_code
+
 def gen_tbl_impl(pre, BM, BK, bm, k):
 
     kernel_code = "\
@@ -273,13 +380,17 @@ int32_t qgemm_lut_{0}(void* A, void* LUT, void* Scales, void* LUT_Scales, void*
     for (int32_t k_outer = 0; k_outer < {2} / BBK{0}; ++k_outer) {{\n\
         tbl_impl_{0}((&(((int32_t*)CBits)[0])), (&(((int8_t*)LUT)[(k_outer * BBK{0} / 2 * 32)])), (&(((uint8_t*)A)[(k_outer * BBK{0} / 2 / 2 * BM{0})])));\n\
     }}\n\
+    // One divide per tile; bitnet_epilogue_rows_i32 uses the same expression\n\
+    const bitnet_float_type scale = ((bitnet_float_type*)Scales)[0] / ((bitnet_float_type*)LUT_Scales)[0];\n\
 #pragma unroll\n\
-    for (int i = 0; i < BM{0}; i++) {{\n\
-        ((bitnet_float_type*)C)[i] = (((int32_t*)CBits)[i]) / ((bitnet_float_type*)LUT_Scales)[0] * ((bitnet_float_type*)Scales)[0];\n\
+    for (int i = 0; i < BM{0}; i += 4) {{\n\
+        vst1q_f32(((bitnet_float_type*)C) + i, vmulq_n_f32(vcvtq_f32_s32(vld1q_s32(((int32_t*)CBits) + i)), scale));\n\
     }}\n\
   return 0;\n\
 }};\n".format(pre, min(32, BK), k)])
 
+    kernel_code = "".join([kernel_code, gen_tbl_impl_batch(pre, bm, k)])
+
     return kernel_code
 
 def gen_top_api(kernel_shapes):
@@ -305,16 +416,50 @@ def gen_top_api(kernel_shapes):
     }}\n\
 ".format(kernel_shapes[i][0], kernel_shapes[i][1])])
     kernel_code = "".join([kernel_code, "}\n"])
+    kernel_code = "".join([kernel_code, "\n\
+static const bitnet_lut_kernel bitnet_lut_kernels[] = {\n"])
+    for i in range(len(kernel_shapes)):
+        kernel_code = "".join([kernel_code, "    {{ {0}, {1}, BM{0}_{1}, BBK{0}_{1}, tbl_impl_{0}_{1}, tbl_impl_batch_{0}_{1}, qgemm_lut_{0}_{1}, preprocessor_k<{1}> }},\n".format(kernel_shapes[i][0], kernel_shapes[i][1])])
+    kernel_code = "".join([kernel_code, "};\n\
+\n\
+const bitnet_lut_kernel * ggml_bitnet_get_lut_kernel(int m, int k) {\n\
+    for (size_t i = 0; i < sizeof(bitnet_lut_kernels) / sizeof(bitnet_lut_kernels[0]); i++) {\n\
+        if (bitnet_lut_kernels[i].m == m && bitnet_lut_kernels[i].k == k) {\n\
+            return &bitnet_lut_kernels[i];\n\
+        }\n\
+    }\n\
+    return nullptr;\n\
+}\n"])
     return kernel_code
 
 def gen_preprocess_code():
     kernel_code = "\n\
+// Abs-max and LUT construction back to back on one column: the int8 LUT\n\
+// needs the column-wide scale first, and the max sweep leaves B in L1 for\n\
+// lut_ctor. per_tensor_quant writes the scale, so no reset is needed.\n\
 template<int K>\n\
 void preprocessor_k(void* B, void* LUT_Scales, void* QLUT) {{\n\
-  partial_max_reset((&(((bitnet_float_type*)LUT_Scales)[0])));\n\
-  per_tensor_quant(K, (&(((bitnet_float_type*)LUT_Scales)[0])), (&(((bitnet_float_type*)B)[0])));\n\
-  \n\
-  lut_ctor<K>((&(((int8_t*)QLUT)[0])), (&(((bitnet_float_type*)B)[0])), (&(((bitnet_float_type*)LUT_Scales)[0])));\n\
+  bitnet_float_type* b = (bitnet_float_type*)B;\n\
+  bitnet_float_type* lut_scales = (bitnet_float_type*)LUT_Scales;\n\
+  per_tensor_quant(K, lut_scales, b);\n\
+  lut_ctor<K>((int8_t*)QLUT, b, lut_scales);\n\
+}}\n\
+float ggml_bitnet_lut_abs_max(int k, const void* B) {{\n\
+  return lut_abs_max(k, (const bitnet_float_type*)B);\n\
+}}\n\
+// lut_ctor writes 16 LUT bytes per activation, 16 activations at a time,\n\
+// so any run of them is built by the same code as the whole column\n\
+void ggml_bitnet_lut_ctor(int k, void* B, void* LUT_Scales, void* QLUT) {{\n\
+  int8_t* qlut = (int8_t*)QLUT;\n\
+  bitnet_float_type* b = (bitnet_float_type*)B;\n\
+  bitnet_float_type* lut_scales = (bitnet_float_type*)LUT_Scales;\n\
+  int i = 0;\n\
+  for (; i + GGML_BITNET_LUT_CHUNK <= k; i += GGML_BITNET_LUT_CHUNK) {{\n\
+    lut_ctor<GGML_BITNET_LUT_CHUNK>(qlut + i * 16, b + i, lut_scales);\n\
+  }}\n\
+  for (; i < k; i += 16) {{\n\
+    lut_ctor<16>(qlut + i * 16, b + i, lut_scales);\n\
+  }}\n\
 }}\n"
     return kernel_code
 
@@ -350,40 +495,57 @@ void ggml_bitnet_transform_tensor(struct ggml_tensor * tensor) {\n\
     uint8_t * qweights;\n\
     bitnet_float_type * scales;\n\
 \n\
-    scales = (bitnet_float_type *) aligned_malloc(sizeof(bitnet_float_type));\n\
     qweights = (uint8_t *) tensor->data;\n\
-    float * i2_scales = (float * )(qweights + k * m / 4);\n\
-    scales[0] = (bitnet_float_type) i2_scales[0];\n\
+    // The converter stores the fp32 scale right behind the packed weights,\n\
+    // so the extra points into the mmap'd tensor data instead of a copy\n\
+    scales = (bitnet_float_type *) (qweights + k * m / 4);\n\
+\n\
+    // Multi-socket hosts keep the packed weights next to the threads reading them\n\
+    bitnet_numa_weights * numa = bitnet_numa_place(qweights, (size_t)k * m / 4, (size_t)bm * k / 4, n_tile_num);\n\
+    if (numa != nullptr && numa->mode == GGML_BITNET_NUMA_PARTITION) {\n\
+        qweights = numa->data;\n\
+    }\n\
+\n\
+    // Pruned weights have (row tile, K block) blocks of zero pairs only (0x44),\n\
+    // which the kernels skip\n\
+    uint8_t * occupancy = bitnet_extras_occupancy(qweights, (int64_t)n_tile_num * (k / BK), (size_t)BK / 4 * bm, 0x44);\n\
 \n\
-    tensor->extra = bitnet_tensor_extras + bitnet_tensor_extras_index;\n\
-    bitnet_tensor_extras[bitnet_tensor_extras_index++] = {\n\
+    bitnet_tensor_extra * extra = bitnet_extras_alloc(tensor);\n\
+    GGML_ASSERT(extra != nullptr);\n\
+    tensor->extra = extra;\n\
+    *extra = {\n\
         /* .lut_scales_size = */ lut_scales_size,\n\
         /* .BK              = */ BK,\n\
         /* .n_tile_num      = */ n_tile_num,\n\
         /* .qweights        = */ qweights,\n\
-        /* .scales          = */ scales\n\
+        /* .scales          = */ scales,\n\
+        /* .numa            = */ numa,\n\
+        /* .occupancy       = */ occupancy\n\
     };\n\
 }\n"])
 
     return kernel_code
 
+# (M, K) of every BitNet weight shape per model, shared with kernel_tuning.py
+ModelShapeDict = {
+    "bitnet_b1_58-large"                : [[1536, 4096],
+                                           [1536, 1536],
+                                           [4096, 1536]],
+    "bitnet_b1_58-3B"                   : [[3200, 8640],
+                                           [3200, 3200],
+                                           [8640, 3200]],
+    "Llama3-8B-1.58-100B-tokens"        : [[14336, 4096],
+                                           [4096, 14336],
+                                           [1024, 4096],
+                                           [4096, 4096]] 
+}
+
 if __name__ == "__main__":
-    ModelShapeDict = {
-        "bitnet_b1_58-large"                : [[1536, 4096],
-                                               [1536, 1536],
-                                               [4096, 1536]],
-        "bitnet_b1_58-3B"                   : [[3200, 8640],
-                                               [3200, 3200],
-                                               [8640, 3200]],
-        "Llama3-8B-1.58-100B-tokens"        : [[14336, 4096],
-                                               [4096, 14336],
-                                               [1024, 4096],
-                                               [4096, 4096]] 
-    }
-    
     parser = argparse.ArgumentParser(description='gen impl')
     parser.add_argument('--model',default="input", type=str, dest="model", 
-                        help="choose from bitnet_b1_58-large/bitnet_b1_58-3B/Llama3-8B-1.58-100B-tokens.")
+                        help="choose from bitnet_b1_58-large/bitnet_b1_58-3B/Llama3-8B-1.58-100B-tokens; "
+                             "a comma-separated list builds the kernels of all of them, e.g. a speculative draft and its target, "
+                             "with BM / BK / bm given for their shapes in that order.")
     parser.add_argument('--BM',default="input", type=str,
                         help="block length when cutting one weight (M, K) into M / BM weights (BM, K).")
     parser.add_argument('--BK',default="input", type=str,
@@ -392,7 +554,8 @@ if __name__ == "__main__":
                         help="using simd instructions to compute (bm, 256 / bm) in one block")
     args = parser.parse_args()
 
-    kernel_shapes = ModelShapeDict[args.model]
+    kernel_shapes = [shape for model in args.model.split(',') for shape in ModelShapeDict[model]]
+    assert len(set(map(tuple, kernel_shapes))) == len(kernel_shapes), "the models share a weight shape; generate it once"
 
     BM_list = [int(item) for item in args.BM.split(',')]
     BK_list = [int(item) for item in args.BK.split(',')]
@@ -402,6 +565,8 @@ if __name__ == "__main__":
     
     for i in range(len(kernel_shapes)):
         assert kernel_shapes[i][0] % BM_list[i] == 0, "M %% BM should be 0"
+        # The threaded kernels keep BM accumulators per column on the stack
+        assert BM_list[i] <= 512, "BM above BITNET_MAX_BM (512) is not supported"
         assert kernel_shapes[i][1] % BK_list[i] == 0, "K %% BK should be 0"
         assert bm_list[i] in [32, 64], "choose bm from [32, 64]"
 
@@ -5,12 +5,11 @@ from configparser import ConfigParser
 def gen_ctor_code():
     kernel_code = "\n\
 #include \"ggml-bitnet.h\"\n\
+#include \"bitnet-numa.h\"\n\
+#include \"bitnet-extras.h\"\n\
 #include <cstring>\n\
 #include <immintrin.h>\n\
-#define GGML_BITNET_MAX_NODES 8192\n\
 static bool initialized = false;\n\
-static bitnet_tensor_extra * bitnet_tensor_extras = nullptr;\n\
-static size_t bitnet_tensor_extras_index = 0;\n\
 static void * aligned_malloc(size_t size) {\n\
 #if defined(_WIN32)\n\
     return _aligned_malloc(size, 64);\n\
@@ -517,10 +516,12 @@ int32_t two_qgemm_lut_{0}(void* A, void* LUT, void* Scales, void* LUT_Scales, vo
     }}\n\
 #pragma unroll\n\
     for (int bs = 0; bs < BATCH_SIZE; bs++) {{\n\
+        // One divide per column instead of one per output\n\
+        const float scale = ((float*)Scales)[0] / ((float*)LUT_Scales)[bs];\n\
 #pragma unroll\n\
         for (int i = 0; i < BM{0}; i++) {{\n\
             ((int32_t*)C)[i] += (int32_t)(((int32_t*)CBits)[i + bs * BM{0}]);\n\
-            ((float*)C)[i] = (float)(((int32_t*)C)[i]) / ((float*)LUT_Scales)[bs] * ((float*)Scales)[0];\n\
+            ((float*)C)[i] = (float)(((int32_t*)C)[i]) * scale;\n\
         }}\n\
     }}\n\
   return 0;\n\
@@ -621,6 +622,20 @@ def gen_top_api(kernel_shapes, k_list):
     }}\n\
 ".format(kernel_shapes[i][0], kernel_shapes[i][1], k_list[i][0], k_list[i][1], "{}_{}".format(kernel_shapes[i][0], kernel_shapes[i][1]))])
     kernel_code = "".join([kernel_code, "}\n"])
+    kernel_code = "".join([kernel_code, "\n\
+static const bitnet_lut_kernel bitnet_lut_kernels[] = {\n"])
+    for i in range(len(kernel_shapes)):
+        kernel_code = "".join([kernel_code, "    {{ {0}, {1}, BM{0}_{1}, BBK{0}_{1}, {3}, {2} }},\n".format(kernel_shapes[i][0], kernel_shapes[i][1], k_list[i][0], k_list[i][1])])
+    kernel_code = "".join([kernel_code, "};\n\
+\n\
+const bitnet_lut_kernel * ggml_bitnet_get_lut_kernel(int m, int k) {\n\
+    for (size_t i = 0; i < sizeof(bitnet_lut_kernels) / sizeof(bitnet_lut_kernels[0]); i++) {\n\
+        if (bitnet_lut_kernels[i].m == m && bitnet_lut_kernels[i].k == k) {\n\
+            return &bitnet_lut_kernels[i];\n\
+        }\n\
+    }\n\
+    return nullptr;\n\
+}\n"])
     return kernel_code
 
 def gen_transform_code(kernel_shapes):
@@ -654,20 +669,27 @@ void ggml_bitnet_transform_tensor(struct ggml_tensor * tensor) {\n\
     uint8_t * qweights;\n\
     bitnet_float_type * scales;\n\
 \n\
-    scales = (bitnet_float_type *) aligned_malloc(sizeof(bitnet_float_type));\n\
     qweights = (uint8_t *) tensor->data;\n\
     int nbytes = (k - 256) * m / 3 * 5 / 8 + 256 * m / 2 * 4 / 8;\n\
     if (nbytes % 32 != 0) nbytes = 32 - nbytes % 32 + nbytes;\n\
-    float * i2_scales = (float * )(qweights + nbytes);\n\
-    scales[0] = (bitnet_float_type) i2_scales[0];\n\
+    // The converter stores the fp32 scale right behind the packed weights,\n\
+    // so the extra points into the mmap'd tensor data instead of a copy\n\
+    scales = (bitnet_float_type *) (qweights + nbytes);\n\
+\n\
+    // TL2 tiles are not contiguous, so the weights can only be replicated;\n\
+    // ggml picks the local copy through ggml_bitnet_local_qweights\n\
+    bitnet_numa_weights * numa = bitnet_numa_place(qweights, nbytes, 0, n_tile_num);\n\
 \n\
-    tensor->extra = bitnet_tensor_extras + bitnet_tensor_extras_index;\n\
-    bitnet_tensor_extras[bitnet_tensor_extras_index++] = {\n\
+    bitnet_tensor_extra * extra = bitnet_extras_alloc(tensor);\n\
+    GGML_ASSERT(extra != nullptr);\n\
+    tensor->extra = extra;\n\
+    *extra = {\n\
         /* .lut_scales_size = */ lut_scales_size,\n\
         /* .BK              = */ BK,\n\
         /* .n_tile_num      = */ n_tile_num,\n\
         /* .qweights        = */ qweights,\n\
-        /* .scales          = */ scales\n\
+        /* .scales          = */ scales,\n\
+        /* .numa            = */ numa\n\
     };\n\
 }\n"])
 
@@ -679,23 +701,26 @@ def get_three_k_two_k(K, bk):
     two_k = K - three_k
     return two_k, three_k
 
-if __name__ == "__main__":
-    ModelShapeDict = {
-        "bitnet_b1_58-large"                : [[1536, 4096],
-                                               [1536, 1536],
-                                               [4096, 1536]],
-        "bitnet_b1_58-3B"                   : [[3200, 8640],
-                                               [3200, 3200],
-                                               [8640, 3200]],
-        "Llama3-8B-1.58-100B-tokens"        : [[14336, 4096],
-                                               [4096, 14336],
-                                               [1024, 4096],
-                                               [4096, 4096]] 
-    }
+# (M, K) of every BitNet weight shape per model, shared with kernel_tuning.py
+ModelShapeDict = {
+    "bitnet_b1_58-large"                : [[1536, 4096],
+                                           [1536, 1536],
+                                           [4096, 1536]],
+    "bitnet_b1_58-3B"                   : [[3200, 8640],
+                                           [3200, 3200],
+                                           [8640, 3200]],
+    "Llama3-8B-1.58-100B-tokens"        : [[14336, 4096],
+                                           [4096, 14336],
+                                           [1024, 4096],
+                                           [4096, 4096]] 
+}
 
+if __name__ == "__main__":
     parser = argparse.ArgumentParser(description='gen impl')
     parser.add_argument('--model',default="input", type=str, dest="model", 
-                        help="choose from bitnet_b1_58-large/bitnet_b1_58-3B/Llama3-8B-1.58-100B-tokens.")
+                        help="choose from bitnet_b1_58-large/bitnet_b1_58-3B/Llama3-8B-1.58-100B-tokens; "
+                             "a comma-separated list builds the kernels of all of them, e.g. a speculative draft and its target, "
+                             "with BM / BK / bm given for their shapes in that order.")
     parser.add_argument('--BM',default="input", type=str,
                         help="block length when cutting one weight (M, K) into M / BM weights (BM, K).")
     parser.add_argument('--BK',default="input", type=str,
@@ -704,7 +729,8 @@ if __name__ == "__main__":
                         help="using simd instructions to compute (bm, 192 / bm) in one block")
     args = parser.parse_args()
 
-    kernel_shapes = ModelShapeDict[args.model]
+    kernel_shapes = [shape for model in args.model.split(',') for shape in ModelShapeDict[model]]
+    assert len(set(map(tuple, kernel_shapes))) == len(kernel_shapes), "the models share a weight shape; generate it once"
 
     BM_list = [int(item) for item in args.BM.split(',')]
     BK_list = [int(item) for item in args.BK.split(',')]
@@ -156,6 +156,18 @@ class Model(ABC):
         self.gguf_writer.add_file_type(self.ftype)
         logger.info(f"gguf: file type = {self.ftype}")
 
+        if self.ftype in (gguf.GGMLQuantizationType.TL1, gguf.GGMLQuantizationType.TL2):
+            # The LUT weights are stored in the tile order of the kernels
+            # built from this config; record it so a retuned build can tell
+            layout = read_lut_layout()
+            self.gguf_writer.add_array(LUT_LAYOUT_KEY, layout)
+            logger.info(f"gguf: LUT kernel layout = {layout}")
+        if self.ftype == gguf.GGMLQuantizationType.TL1:
+            # TL1 weights fill a multiple of 512 bytes, so their scales stay
+            # right behind them and every row tile of the mmap'd file starts
+            # on a cache line. TL2 weights are padded to 32 bytes only.
+            self.gguf_writer.add_custom_alignment(64)
+
     def write_tensors(self):
         block_count = self.hparams.get("n_layers", self.hparams.get("num_hidden_layers", self.hparams.get("n_layer")))
         tensor_map = gguf.get_tensor_name_map(self.model_arch, block_count)
@@ -460,6 +472,17 @@ class Model(ABC):
         special_vocab = gguf.SpecialVocab(self.dir_model, n_vocab=len(tokens))
         special_vocab.add_to_gguf(self.gguf_writer)
 
+# m, k, BM, BK and bm of every LUT kernel shape, in kernel_config.ini order
+LUT_LAYOUT_KEY = "bitnet.lut.layout"
+
+def read_lut_layout(config_path='include/kernel_config.ini'):
+    config = configparser.ConfigParser()
+    config.read(config_path)
+    layout = []
+    for kernel in config.sections():
+        layout += [int(config.get(kernel, key)) for key in ('m', 'k', 'bm', 'bk', 'bmm')]
+    return layout
+
 # TL1
 
 def process_tl1(weight, BM, BY, bm, by, M, K):
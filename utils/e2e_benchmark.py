@@ -1,59 +1,484 @@
-import os
-import sys
-import logging
+"""End-to-end benchmark suite for BitNet models.
+
+Two kinds of runs, each repeated for every combination of the swept values:
+
+- llama-bench measures prefill (pp, one test per prompt length, so longer
+  contexts cost more attention) and decode (tg) throughput for every model,
+  thread count and batch size;
+- llama-server is started per model, thread count and client count, and
+  that many concurrent clients stream completions of every prompt length.
+  The time to the first token (TTFT) and the gaps between later tokens
+  (inter-token latency, ITL) are recorded per token and reported as
+  percentiles, with the aggregate decode throughput.
+
+Kernel types are a property of the GGUF file, so the I2_S, TL1 and TL2
+kernels are compared by passing one model per type (-m i2_s=... -m tl1=...);
+without a label the type is read from the file name.
+
+Every run also records the peak RSS of the llama process and, where the
+host exposes a power sensor (RAPL energy counters or a hwmon power input),
+its average power draw and tokens/sec/watt. Results are written as JSON;
+given --baseline, every metric is compared against that earlier run and the
+suite exits non-zero if any got worse by more than --tolerance. Decode
+speedups over the smallest thread count are reported too, so thread scaling
+that stops paying off shows up as a regression rather than going unnoticed.
+
+usage: python utils/e2e_benchmark.py -m models/bitnet_b1_58-3B/ggml-model-i2_s.gguf -t 1,2,4 -p 128,512 \\
+           --clients 1,4 -o results.json --baseline baseline.json
+"""
+
 import argparse
+import glob
+import http.client
+import json
+import logging
+import math
+import os
 import platform
+import re
+import socket
 import subprocess
+import sys
+import threading
+import time
 
-def run_command(command, shell=False, log_step=None):
-    """Run a system command and ensure it succeeds."""
-    if log_step:
-        log_file = os.path.join(args.log_dir, log_step + ".log")
-        with open(log_file, "w") as f:
-            try:
-                subprocess.run(command, shell=shell, check=True, stdout=f, stderr=f)
-            except subprocess.CalledProcessError as e:
-                logging.error(f"Error occurred while running command: {e}, check details in {log_file}")
-                sys.exit(1)
-    else:
+ROOT_DIR = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+logger = logging.getLogger("e2e_benchmark")
+
+# Metrics compared against the baseline and whether a larger value is better
+METRICS = {
+    "tps": True,
+    "tps_per_watt": True,
+    "speedup": True,
+    "ttft_ms_p50": False,
+    "ttft_ms_p90": False,
+    "ttft_ms_p99": False,
+    "itl_ms_p50": False,
+    "itl_ms_p90": False,
+    "itl_ms_p99": False,
+    "peak_rss_mb": False,
+}
+
+
+def find_binary(name):
+    build_dir = os.path.join(ROOT_DIR, "build")
+    if platform.system() == "Windows":
+        path = os.path.join(build_dir, "bin", "Release", name + ".exe")
+        if os.path.exists(path):
+            return path
+    path = os.path.join(build_dir, "bin", name)
+    return path if os.path.exists(path) else None
+
+
+def int_list(value):
+    return [int(v) for v in value.split(",") if v]
+
+
+def parse_model(spec):
+    """[kernel=]path of one -m model; the kernel type defaults to the one in the file name."""
+    label, sep, path = spec.partition("=")
+    if not sep or not label or os.path.sep in label:
+        path = spec
+        match = re.search(r"(i2_s|tl1|tl2)", os.path.basename(spec), re.IGNORECASE)
+        label = match.group(1).lower() if match else os.path.splitext(os.path.basename(spec))[0]
+    return {"kernel": label, "path": path}
+
+
+def percentile(values, q):
+    """Nearest-rank percentile of values, None if there are none."""
+    if not values:
+        return None
+    ordered = sorted(values)
+    rank = max(0, min(len(ordered) - 1, math.ceil(q / 100.0 * len(ordered)) - 1))
+    return ordered[rank]
+
+
+def host_info():
+    info = {"system": platform.system(), "machine": platform.machine(), "cpus": os.cpu_count(), "cpu": platform.processor()}
+    try:
+        with open("/proc/cpuinfo") as f:
+            for line in f:
+                key, _, value = line.partition(":")
+                # x86 names the CPU in "model name", Raspberry Pi kernels in "Model"
+                if key.strip() in ("model name", "Model"):
+                    info["cpu"] = value.strip()
+                    break
+    except OSError:
+        pass
+    try:
+        info["commit"] = subprocess.run(["git", "rev-parse", "HEAD"], cwd=ROOT_DIR, capture_output=True, text=True).stdout.strip()
+    except OSError:
+        pass
+    return info
+
+
+class PowerMeter:
+    """Average power of the host between start() and stop().
+
+    Uses the RAPL package energy counters where they are readable, otherwise
+    samples the hwmon power inputs. stop() returns None on hosts with neither.
+    """
+
+    def __init__(self):
+        self.rapl = [d for d in glob.glob("/sys/class/powercap/intel-rapl:*")
+                     if d.count(":") == 1 and os.access(os.path.join(d, "energy_uj"), os.R_OK)]
+        self.hwmon = [] if self.rapl else [p for p in glob.glob("/sys/class/hwmon/hwmon*/power*_input") if os.access(p, os.R_OK)]
+        self.thread = None
+
+    @property
+    def available(self):
+        return bool(self.rapl or self.hwmon)
+
+    @staticmethod
+    def _read(path):
+        with open(path) as f:
+            return int(f.read())
+
+    def _sample(self):
+        while not self.done.wait(0.2):
+            self.samples.append(sum(self._read(p) for p in self.hwmon) / 1e6)
+
+    def start(self):
+        self.begin = time.monotonic()
+        if self.rapl:
+            self.energy = [self._read(os.path.join(d, "energy_uj")) for d in self.rapl]
+        elif self.hwmon:
+            self.samples = []
+            self.done = threading.Event()
+            self.thread = threading.Thread(target=self._sample, daemon=True)
+            self.thread.start()
+
+    def stop(self):
+        elapsed = time.monotonic() - self.begin
+        if self.rapl:
+            joules = 0.0
+            for d, begin in zip(self.rapl, self.energy):
+                end = self._read(os.path.join(d, "energy_uj"))
+                if end < begin:
+                    # The counter wrapped around
+                    end += self._read(os.path.join(d, "max_energy_range_uj"))
+                joules += (end - begin) / 1e6
+            return joules / elapsed if elapsed > 0 else None
+        if self.hwmon:
+            self.done.set()
+            self.thread.join()
+            return sum(self.samples) / len(self.samples) if self.samples else None
+        return None
+
+
+def wait_peak_rss(proc):
+    """Waits for proc and returns its peak RSS in MB, None where unknown."""
+    if not hasattr(os, "wait4"):
+        proc.wait()
+        return None
+    _, status, usage = os.wait4(proc.pid, 0)
+    proc.returncode = os.waitstatus_to_exitcode(status) if hasattr(os, "waitstatus_to_exitcode") else status
+    # ru_maxrss is in KB on Linux and in bytes on macOS
+    return usage.ru_maxrss / (1024 * 1024 if platform.system() == "Darwin" else 1024)
+
+
+def power_metrics(watts, tps):
+    if watts is None:
+        return {}
+    return {"watts": round(watts, 2), "tps_per_watt": round(tps / watts, 4) if watts > 0 else None}
+
+
+def run_llama_bench(bench_path, model, threads, batch, n_prompt, n_gen, log_file, meter):
+    """One llama-bench run of a single pp or tg test; returns its metrics."""
+    command = [bench_path, "-m", model["path"], "-ngl", "0", "-o", "json", "-r", str(args.repetitions),
+               "-t", str(threads), "-b", str(batch), "-p", str(n_prompt), "-n", str(n_gen)]
+    with open(log_file, "a") as log:
+        log.write(" ".join(command) + "\n")
+        log.flush()
+        meter.start()
+        proc = subprocess.Popen(command, stdout=subprocess.PIPE, stderr=log, text=True)
+        output = proc.stdout.read()
+        rss = wait_peak_rss(proc)
+        watts = meter.stop()
+    if proc.returncode != 0:
+        logger.error(f"llama-bench failed, check details in {log_file}")
+        return None
+    try:
+        test = json.loads(output)[0]
+    except (ValueError, IndexError):
+        logger.error(f"Could not parse the llama-bench output, check details in {log_file}")
+        return None
+    # Averaged over the whole run, model loading included
+    metrics = {"tps": round(test["avg_ts"], 3), "tps_stddev": round(test["stddev_ts"], 3),
+               "peak_rss_mb": round(rss, 1) if rss is not None else None}
+    metrics.update(power_metrics(watts, test["avg_ts"]))
+    return metrics
+
+
+def run_bench_suite(bench_path, models, results, meter):
+    log_file = os.path.join(args.log_dir, "llama-bench.log")
+    for model in models:
+        for threads in args.threads:
+            for batch in args.batch_size:
+                tests = [("pp", p, 0) for p in args.n_prompt] + [("tg", 0, n) for n in args.n_token]
+                for kind, n_prompt, n_gen in tests:
+                    key = f"bench/{model['kernel']}/t{threads}/b{batch}/{kind}{n_prompt or n_gen}"
+                    logger.info(f"running {key}")
+                    metrics = run_llama_bench(bench_path, model, threads, batch, n_prompt, n_gen, log_file, meter)
+                    if metrics:
+                        results[key] = {"params": {"kind": "bench", "kernel": model["kernel"], "model": model["path"],
+                                                   "threads": threads, "batch": batch, "test": kind,
+                                                   "n_prompt": n_prompt, "n_gen": n_gen},
+                                        "metrics": metrics}
+
+
+class Client:
+    def __init__(self, port):
+        self.port = port
+
+    def call(self, path, payload, timeout=600):
+        conn = http.client.HTTPConnection("127.0.0.1", self.port, timeout=timeout)
+        conn.request("POST", path, body=json.dumps(payload), headers={"Content-Type": "application/json"})
+        return conn, conn.getresponse()
+
+    def healthy(self):
+        try:
+            conn = http.client.HTTPConnection("127.0.0.1", self.port, timeout=5)
+            conn.request("GET", "/health")
+            ok = conn.getresponse().status == 200
+            conn.close()
+            return ok
+        except OSError:
+            return False
+
+    def tokenize(self, text):
+        conn, resp = self.call("/tokenize", {"content": text})
+        tokens = json.loads(resp.read())["tokens"]
+        conn.close()
+        return tokens
+
+    def complete(self, prompt, n_predict):
+        """Streams one completion; returns the arrival times of its tokens after the send time."""
+        payload = {"prompt": prompt, "n_predict": n_predict, "stream": True, "cache_prompt": False,
+                   "ignore_eos": True, "temperature": 0}
+        sent = time.monotonic()
+        conn, resp = self.call("/completion", payload)
+        arrivals = []
         try:
-            subprocess.run(command, shell=shell, check=True)
-        except subprocess.CalledProcessError as e:
-            logging.error(f"Error occurred while running command: {e}")
-        sys.exit(1)
+            if resp.status != 200:
+                raise OSError(f"/completion returned {resp.status}: {resp.read()[:200]}")
+            for line in resp:
+                if not line.startswith(b"data: "):
+                    continue
+                event = json.loads(line[6:])
+                if event.get("stop"):
+                    break
+                arrivals.append(time.monotonic() - sent)
+        finally:
+            conn.close()
+        return arrivals
+
+
+def free_port():
+    with socket.socket() as s:
+        s.bind(("127.0.0.1", 0))
+        return s.getsockname()[1]
+
+
+def run_load(client, prompt, n_gen, clients):
+    """args.requests completions from each of clients concurrent clients."""
+    ttft, itl, tokens, errors = [], [], [0], []
+    lock = threading.Lock()
+
+    def worker():
+        for _ in range(args.requests):
+            try:
+                arrivals = client.complete(prompt, n_gen)
+            except (OSError, ValueError) as e:
+                with lock:
+                    errors.append(str(e))
+                return
+            with lock:
+                if arrivals:
+                    ttft.append(arrivals[0] * 1000)
+                    itl.extend((b - a) * 1000 for a, b in zip(arrivals, arrivals[1:]))
+                tokens[0] += len(arrivals)
+
+    workers = [threading.Thread(target=worker) for _ in range(clients)]
+    begin = time.monotonic()
+    for w in workers:
+        w.start()
+    for w in workers:
+        w.join()
+    return ttft, itl, tokens[0], time.monotonic() - begin, errors
+
+
+def run_server_suite(server_path, models, results, meter):
+    batch = max(args.batch_size)
+    for model in models:
+        for threads in args.threads:
+            for clients in args.clients:
+                port = free_port()
+                # llama-server splits the context evenly between its slots
+                ctx = (max(args.n_prompt) + max(args.n_token) + 16) * clients
+                command = [server_path, "-m", model["path"], "-ngl", "0", "-t", str(threads), "-b", str(batch),
+                           "-c", str(ctx), "-np", str(clients), "-cb", "--host", "127.0.0.1", "--port", str(port)]
+                log_file = os.path.join(args.log_dir, f"llama-server-{model['kernel']}-t{threads}-c{clients}.log")
+                with open(log_file, "w") as log:
+                    server = subprocess.Popen(command, stdout=log, stderr=log)
+                client = Client(port)
+                try:
+                    deadline = time.monotonic() + args.wait
+                    while not client.healthy():
+                        if server.poll() is not None or time.monotonic() > deadline:
+                            raise OSError(f"llama-server did not come up, check details in {log_file}")
+                        time.sleep(0.5)
+                    unit = client.tokenize(" the")
+                    client.complete(unit * 8, 4)  # warm-up
+                    for n_prompt in args.n_prompt:
+                        for n_gen in args.n_token:
+                            key = f"server/{model['kernel']}/t{threads}/c{clients}/p{n_prompt}/n{n_gen}"
+                            logger.info(f"running {key}")
+                            prompt = (unit * n_prompt)[:n_prompt]
+                            meter.start()
+                            ttft, itl, tokens, elapsed, errors = run_load(client, prompt, n_gen, clients)
+                            watts = meter.stop()
+                            if errors:
+                                logger.error(f"{key}: {len(errors)} requests failed, first: {errors[0]}")
+                                continue
+                            tps = tokens / elapsed if elapsed > 0 else 0.0
+                            metrics = {"tps": round(tps, 3), "requests": clients * args.requests}
+                            for q in (50, 90, 99):
+                                metrics[f"ttft_ms_p{q}"] = round(percentile(ttft, q), 2) if ttft else None
+                                metrics[f"itl_ms_p{q}"] = round(percentile(itl, q), 2) if itl else None
+                            metrics.update(power_metrics(watts, tps))
+                            results[key] = {"params": {"kind": "server", "kernel": model["kernel"], "model": model["path"],
+                                                       "threads": threads, "batch": batch, "clients": clients,
+                                                       "n_prompt": n_prompt, "n_gen": n_gen},
+                                            "metrics": metrics}
+                except (OSError, ValueError, KeyError) as e:
+                    logger.error(f"{model['kernel']} with {threads} threads and {clients} clients: {e}")
+                finally:
+                    server.terminate()
+                    rss = wait_peak_rss(server)
+                # The server's peak covers every prompt length it served
+                for entry in results.values():
+                    p = entry["params"]
+                    if (p["kind"], p["model"], p["threads"], p.get("clients")) == ("server", model["path"], threads, clients):
+                        entry["metrics"]["peak_rss_mb"] = round(rss, 1) if rss is not None else None
+
+
+def add_speedups(results):
+    """Throughput of every run over the same run at the smallest thread count."""
+    groups = {}
+    for entry in results.values():
+        p = entry["params"]
+        group = tuple(sorted((k, v) for k, v in p.items() if k != "threads"))
+        groups.setdefault(group, []).append(entry)
+    for entries in groups.values():
+        base = min(entries, key=lambda e: e["params"]["threads"])
+        for entry in entries:
+            if base["metrics"]["tps"] > 0:
+                entry["metrics"]["speedup"] = round(entry["metrics"]["tps"] / base["metrics"]["tps"], 3)
+
+
+def compare(results, baseline, tolerance):
+    """Lists the metrics that got worse than in the baseline by more than tolerance."""
+    regressions = []
+    for key, entry in sorted(results.items()):
+        old = baseline.get("results", {}).get(key)
+        if old is None:
+            continue
+        for metric, higher_is_better in METRICS.items():
+            before, after = old["metrics"].get(metric), entry["metrics"].get(metric)
+            if not before or after is None:
+                continue
+            change = (after - before) / before
+            if (-change if higher_is_better else change) > tolerance:
+                regressions.append((key, metric, before, after, change))
+    return regressions
+
+
+def print_summary(results):
+    for key, entry in sorted(results.items()):
+        m = entry["metrics"]
+        line = f"{key:48s} {m['tps']:10.2f} t/s"
+        if "speedup" in m:
+            line += f"  x{m['speedup']:.2f}"
+        if m.get("ttft_ms_p50") is not None:
+            line += f"  ttft p50 {m['ttft_ms_p50']:.1f} ms  itl p50/p99 {m['itl_ms_p50']:.1f}/{m['itl_ms_p99']:.1f} ms"
+        if m.get("tps_per_watt") is not None:
+            line += f"  {m['tps_per_watt']:.3f} t/s/W"
+        if m.get("peak_rss_mb") is not None:
+            line += f"  {m['peak_rss_mb']:.0f} MB"
+        print(line)
+
 
 def run_benchmark():
-    build_dir =  os.path.join(os.path.dirname(os.path.dirname(os.path.abspath(__file__))), "build")
-    if platform.system() == "Windows":
-        bench_path = os.path.join(build_dir, "bin", "Release", "llama-bench.exe")
-        if not os.path.exists(bench_path):
-            bench_path = os.path.join(build_dir, "bin", "llama-bench")
-    else:
-        bench_path = os.path.join(build_dir, "bin", "llama-bench")
-    if not os.path.exists(bench_path):
-        logging.error(f"Benchmark binary not found, please build first.")
-        sys.exit(1)
-    command = [
-        f'{bench_path}',
-        '-m', args.model,
-        '-n', str(args.n_token),
-        '-ngl', '0',
-        '-b', '1',
-        '-t', str(args.threads),
-        '-p', str(args.n_prompt),
-        '-r', '5'
-    ]
-    run_command(command)
+    models = [parse_model(spec) for spec in args.model]
+    os.makedirs(args.log_dir, exist_ok=True)
+    meter = PowerMeter()
+    if not meter.available:
+        logger.info("no readable power sensor, tokens/sec/watt is not reported")
+    results = {}
+
+    if not args.skip_bench:
+        bench_path = find_binary("llama-bench")
+        if not bench_path:
+            logging.error("Benchmark binary not found, please build first.")
+            sys.exit(1)
+        run_bench_suite(bench_path, models, results, meter)
+    if not args.skip_server:
+        server_path = find_binary("llama-server")
+        if not server_path:
+            logging.error("llama-server not found, please build first or pass --skip-server.")
+            sys.exit(1)
+        run_server_suite(server_path, models, results, meter)
+
+    add_speedups(results)
+    print_summary(results)
+    report = {"host": host_info(), "time": time.strftime("%Y-%m-%dT%H:%M:%S"), "config": vars(args), "results": results}
+    if args.output:
+        with open(args.output, "w") as f:
+            json.dump(report, f, indent=2)
+        logger.info(f"results written to {args.output}")
+
+    if not args.baseline:
+        return 0
+    with open(args.baseline) as f:
+        baseline = json.load(f)
+    if baseline.get("host", {}).get("cpu") != report["host"]["cpu"]:
+        logger.warning(f"the baseline was measured on {baseline.get('host', {}).get('cpu')}, not on {report['host']['cpu']}")
+    regressions = compare(results, baseline, args.tolerance)
+    for key, metric, before, after, change in regressions:
+        print(f"REGRESSION {key} {metric}: {before} -> {after} ({change:+.1%})")
+    missing = sorted(set(baseline.get("results", {})) - set(results))
+    if missing:
+        logger.warning(f"{len(missing)} baseline runs were not measured, e.g. {missing[0]}")
+    if regressions:
+        return 1
+    logger.info(f"no regression beyond {args.tolerance:.0%} against {args.baseline}")
+    return 0
+
 
 def parse_args():
-    parser = argparse.ArgumentParser(description='Setup the environment for running the inference')
-    parser.add_argument("-m", "--model", type=str, help="Path to model file", required=True)
-    parser.add_argument("-n", "--n-token", type=int, help="Number of generated tokens", required=False, default=128)
-    parser.add_argument("-p", "--n-prompt", type=int, help="Prompt to generate text from", required=False, default=512)
-    parser.add_argument("-t", "--threads", type=int, help="Number of threads to use", required=False, default=2)
+    parser = argparse.ArgumentParser(description="Sweep llama-bench and llama-server over threads, batch sizes, contexts, kernels and clients")
+    parser.add_argument("-m", "--model", type=str, action="append", required=True,
+                        help="[kernel=]path of a model; repeat for every kernel type to compare (i2_s, tl1, tl2)")
+    parser.add_argument("-n", "--n-token", type=int_list, help="Comma-separated numbers of generated tokens", required=False, default=[128])
+    parser.add_argument("-p", "--n-prompt", type=int_list, help="Comma-separated prompt lengths (context sizes) in tokens", required=False, default=[512])
+    parser.add_argument("-t", "--threads", type=int_list, help="Comma-separated thread counts", required=False, default=[2])
+    parser.add_argument("-b", "--batch-size", type=int_list, help="Comma-separated prefill batch sizes; llama-server uses the largest", required=False, default=[2048])
+    parser.add_argument("-r", "--repetitions", type=int, help="llama-bench repetitions of every test", required=False, default=5)
+    parser.add_argument("--clients", type=int_list, help="Comma-separated numbers of concurrent llama-server clients", required=False, default=[1])
+    parser.add_argument("--requests", type=int, help="Completions every client sends per server run", required=False, default=3)
+    parser.add_argument("--skip-bench", action="store_true", help="Do not run llama-bench")
+    parser.add_argument("--skip-server", action="store_true", help="Do not run llama-server")
+    parser.add_argument("--wait", type=float, help="Seconds to wait for llama-server to load a model", required=False, default=600)
+    parser.add_argument("-o", "--output", type=str, help="Write the results as JSON to this file", required=False, default=None)
+    parser.add_argument("--baseline", type=str, help="JSON results of an earlier run to compare against; exits with 1 on a regression", required=False, default=None)
+    parser.add_argument("--tolerance", type=float, help="Relative change of a metric that counts as a regression", required=False, default=0.1)
+    parser.add_argument("--log-dir", type=str, help="Directory for the llama-bench and llama-server logs", required=False, default="logs")
     return parser.parse_args()
 
+
 if __name__ == "__main__":
     logging.basicConfig(level=logging.INFO)
     args = parse_args()
-    run_benchmark()
\ No newline at end of file
+    sys.exit(run_benchmark())
@@ -0,0 +1,106 @@
+"""HTTP plumbing shared by the proxies in front of llama-server.
+
+model_router.py and prefix_cache.py both relay requests to llama-server
+processes and stream the answers back as they come, token by token for
+streamed completions. This module holds what they have in common: the
+upstream connection, the relay, the readiness wait and the server loop.
+"""
+
+import http.client
+import json
+import logging
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+
+class Upstream:
+    """A llama-server at host:port, under the name clients know it by."""
+
+    def __init__(self, address, name=None):
+        host, port = address.rsplit(":", 1)
+        self.host = host
+        self.port = int(port)
+        self.name = name or address
+
+    def request(self, method, path, body=None, timeout=None):
+        conn = http.client.HTTPConnection(self.host, self.port, timeout=timeout)
+        headers = {"Content-Type": "application/json"} if body is not None else {}
+        conn.request(method, path, body=body, headers=headers)
+        return conn, conn.getresponse()
+
+    def healthy(self):
+        try:
+            conn, resp = self.request("GET", "/health", timeout=5)
+            resp.read()
+            conn.close()
+            return resp.status == 200
+        except OSError:
+            return False
+
+
+class ProxyHandler(BaseHTTPRequestHandler):
+    """Request handler that relays to an Upstream; subclasses route."""
+
+    logger = logging.getLogger("http_proxy")
+
+    def log_message(self, fmt, *args):
+        self.logger.debug(fmt % args)
+
+    def reply(self, status, payload):
+        data = json.dumps(payload).encode()
+        self.send_response(status)
+        self.send_header("Content-Type", "application/json")
+        self.send_header("Content-Length", str(len(data)))
+        self.end_headers()
+        self.wfile.write(data)
+
+    def relay(self, upstream, method, body):
+        """Sends the request to upstream and streams its answer back. Returns
+        the upstream status, 502 when it could not be reached."""
+        try:
+            conn, resp = upstream.request(method, self.path, body)
+        except OSError as e:
+            self.reply(502, {"error": {"message": f"{upstream.name}: {e}", "type": "unavailable"}})
+            return 502
+        try:
+            self.send_response(resp.status)
+            for name, value in resp.getheaders():
+                # The body is re-sent as read and ends when the connection closes
+                if name.lower() not in ("transfer-encoding", "connection", "content-length"):
+                    self.send_header(name, value)
+            self.send_header("Connection", "close")
+            self.end_headers()
+            while True:
+                chunk = resp.read1(65536)
+                if not chunk:
+                    break
+                self.wfile.write(chunk)
+                self.wfile.flush()
+            return resp.status
+        finally:
+            conn.close()
+
+
+def wait_ready(upstreams, timeout):
+    """Waits up to timeout seconds for every upstream to answer /health,
+    returns the names of those that did not."""
+    deadline = time.monotonic() + timeout
+    pending = list(upstreams)
+    while pending and time.monotonic() < deadline:
+        pending = [u for u in pending if not u.healthy()]
+        if pending:
+            time.sleep(0.5)
+    return [u.name for u in pending]
+
+
+def serve_forever(handler, host, port):
+    """Serves handler on host:port, a thread per connection, until interrupted."""
+    server = ThreadingHTTPServer((host, port), handler)
+    server.daemon_threads = True
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+    finally:
+        server.server_close()
+    return 0
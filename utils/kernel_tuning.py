@@ -0,0 +1,275 @@
+"""On-device autotuner for the TL1/TL2 LUT kernels.
+
+For every weight shape of a model this searches the codegen tiling
+parameters (BM, BK, bm) on the machine it runs on: each round generates a
+candidate bitnet-lut-kernels.h through codegen_tl1.py / codegen_tl2.py,
+rebuilds bitnet-bench and times the GEMM of every shape. Shapes are tiled
+independently, so every round tries one new candidate per shape at once.
+
+The winning header and kernel_config.ini are cached per (CPU model, model,
+quant type) and copied into include/ unless --no-apply is given. A later run
+on the same CPU reuses the cache instead of tuning again.
+
+usage: python utils/kernel_tuning.py --model Llama3-8B-1.58-100B-tokens -q tl1 -t 4
+"""
+
+import argparse
+import json
+import logging
+import os
+import platform
+import re
+import shutil
+import subprocess
+import sys
+from configparser import ConfigParser
+from pathlib import Path
+
+ROOT_DIR = Path(__file__).resolve().parent.parent
+INCLUDE_DIR = ROOT_DIR / "include"
+KERNEL_HEADER = "bitnet-lut-kernels.h"
+KERNEL_CONFIG = "kernel_config.ini"
+
+sys.path.insert(0, str(Path(__file__).resolve().parent))
+from codegen_tl1 import ModelShapeDict  # noqa: E402
+
+logger = logging.getLogger("kernel_tuning")
+
+# Tile sizes the generated kernels support; BITNET_MAX_BM bounds BM
+BM_CHOICES = [64, 96, 128, 160, 192, 256, 320, 384, 512]
+QUANT_TYPES = {
+    "tl1": {
+        "codegen": "utils/codegen_tl1.py",
+        "cmake": ["-DBITNET_ARM_TL1=ON"],
+        "BK": [64, 128, 256],
+        "bm": [32, 64],
+        # hand-picked values setup_env.py uses, tried first
+        "defaults": {
+            "bitnet_b1_58-large": ([256, 128, 256], [128, 64, 128], [32, 64, 32]),
+            "bitnet_b1_58-3B": ([160, 320, 320], [64, 128, 64], [32, 64, 32]),
+            "Llama3-8B-1.58-100B-tokens": ([256, 128, 256, 128], [128, 64, 128, 64], [32, 64, 32, 64]),
+        },
+    },
+    "tl2": {
+        "codegen": "utils/codegen_tl2.py",
+        "cmake": ["-DBITNET_X86_TL2=ON"],
+        "BK": [96, 192],
+        "bm": [32],
+        "defaults": {
+            "bitnet_b1_58-large": ([256, 128, 256], [96, 192, 96], [32, 32, 32]),
+            "bitnet_b1_58-3B": ([160, 320, 320], [96, 96, 96], [32, 32, 32]),
+            "Llama3-8B-1.58-100B-tokens": ([256, 128, 256, 128], [96, 96, 96, 96], [32, 32, 32, 32]),
+        },
+    },
+}
+
+
+def run_command(command, log_file=None, capture=False):
+    """Run a command from the repository root and stop the tuner if it fails."""
+    try:
+        if capture:
+            return subprocess.run(command, cwd=ROOT_DIR, check=True, capture_output=True, text=True).stdout
+        if log_file:
+            with open(log_file, "a") as f:
+                subprocess.run(command, cwd=ROOT_DIR, check=True, stdout=f, stderr=f)
+        else:
+            subprocess.run(command, cwd=ROOT_DIR, check=True)
+    except subprocess.CalledProcessError as e:
+        details = f", check details in {log_file}" if log_file else ""
+        logging.error(f"Error occurred while running command: {e}{details}")
+        raise
+    return None
+
+
+def cpu_model():
+    """A stable name for the CPU this runs on, used as the cache key."""
+    name = None
+    if os.path.exists("/proc/device-tree/model"):
+        with open("/proc/device-tree/model", errors="ignore") as f:
+            name = f.read().strip("\x00\n ")
+    elif os.path.exists("/proc/cpuinfo"):
+        fields = {}
+        with open("/proc/cpuinfo", errors="ignore") as f:
+            for line in f:
+                if ":" in line:
+                    key, value = line.split(":", 1)
+                    fields.setdefault(key.strip(), value.strip())
+        if "model name" in fields:
+            name = fields["model name"]
+        elif "CPU part" in fields:
+            name = "arm-{}-{}".format(fields.get("CPU implementer", "unknown"), fields["CPU part"])
+    if not name:
+        name = platform.processor() or platform.machine()
+    return re.sub(r"[^A-Za-z0-9]+", "-", name).strip("-").lower()
+
+
+def candidates(quant_type, m, k, default):
+    """(BM, BK, bm) tilings codegen accepts for one shape, the default first."""
+    spec = QUANT_TYPES[quant_type]
+    out = [default]
+    for BM in BM_CHOICES:
+        if m % BM != 0:
+            continue
+        for BK in spec["BK"]:
+            if quant_type == "tl1" and k % BK != 0:
+                continue
+            if quant_type == "tl2" and (BK > k or (k % BK) % 32 != 0):
+                continue
+            for bm in spec["bm"]:
+                if BM % bm == 0 and (BM, BK, bm) != default:
+                    out.append((BM, BK, bm))
+    return out
+
+
+def generate(quant_type, model, tiles, log_file):
+    """Write include/bitnet-lut-kernels.h and kernel_config.ini for one tiling per shape."""
+    BM, BK, bm = zip(*tiles)
+    run_command([sys.executable, QUANT_TYPES[quant_type]["codegen"], "--model", model,
+                 "--BM", ",".join(map(str, BM)), "--BK", ",".join(map(str, BK)), "--bm", ",".join(map(str, bm))],
+                log_file=log_file)
+
+
+def build(build_dir, quant_type, log_file, configured):
+    if not configured:
+        run_command(["cmake", "-B", str(build_dir), "-DCMAKE_BUILD_TYPE=Release", "-DBITNET_BUILD_BENCH=ON",
+                     *QUANT_TYPES[quant_type]["cmake"]], log_file=log_file)
+    run_command(["cmake", "--build", str(build_dir), "--target", "bitnet-bench", "--config", "Release",
+                 "-j", str(os.cpu_count() or 1)], log_file=log_file)
+
+
+def bench(build_dir, quant_type, threads, batch, min_time):
+    """Time of the GEMM of every shape in include/kernel_config.ini, in us."""
+    exe = Path(build_dir) / "bin" / "bitnet-bench"
+    out = run_command([str(exe), "--config", str(INCLUDE_DIR / KERNEL_CONFIG), "--threads", str(threads),
+                       "--batch", str(batch), "--filter", "qgemm_lut", "--min-time", str(min_time)], capture=True)
+    # the serial kernel is all TL2 has; TL1 is tuned on the threaded path it runs in
+    if quant_type == "tl1" and threads > 1:
+        kernel = "bitnet_qgemm_lut_batch_threaded" if batch > 1 else "bitnet_qgemm_lut_threaded"
+    else:
+        kernel = "ggml_qgemm_lut"
+    times = {}
+    for line in out.splitlines():
+        parts = line.split()
+        if len(parts) < 8 or not parts[0].startswith(kernel + "/"):
+            continue
+        if parts[-1] == "FAIL":
+            continue
+        m, k = map(int, parts[0].split("/")[1].split("x"))
+        times[(m, k)] = float(parts[3])
+    return times
+
+
+def tune(args, cache_dir):
+    spec = QUANT_TYPES[args.quant_type]
+    shapes = [tuple(s) for s in ModelShapeDict[args.model]]
+    defaults = list(zip(*spec["defaults"][args.model]))
+    search = [candidates(args.quant_type, m, k, defaults[i])[:args.max_candidates] for i, (m, k) in enumerate(shapes)]
+    rounds = max(len(c) for c in search)
+
+    log_file = Path(args.log_dir) / "kernel_tuning.log"
+    best = [None] * len(shapes)
+    results = [[] for _ in shapes]
+    configured = False
+    for r in range(rounds):
+        # shapes out of candidates rerun their current best, which is cheap to rebuild
+        tiles = [c[r] if r < len(c) else (best[i][1] if best[i] else c[0]) for i, c in enumerate(search)]
+        logging.info("Round {}/{}: {}".format(r + 1, rounds, ", ".join("{}x{}={}".format(m, k, t) for (m, k), t in zip(shapes, tiles))))
+        try:
+            generate(args.quant_type, args.model, tiles, log_file)
+            build(args.build_dir, args.quant_type, log_file, configured)
+            configured = True
+            times = bench(args.build_dir, args.quant_type, args.threads, args.batch, args.min_time)
+        except subprocess.CalledProcessError:
+            logging.warning("Round {} failed, skipping its candidates".format(r + 1))
+            continue
+        for i, shape in enumerate(shapes):
+            if shape not in times:
+                continue
+            results[i].append({"BM": tiles[i][0], "BK": tiles[i][1], "bm": tiles[i][2], "us": times[shape]})
+            if best[i] is None or times[shape] < best[i][0]:
+                best[i] = (times[shape], tiles[i])
+
+    if any(b is None for b in best):
+        raise RuntimeError("no candidate built and passed its check for some shapes, see {}".format(log_file))
+
+    generate(args.quant_type, args.model, [b[1] for b in best], log_file)
+    cache_dir.mkdir(parents=True, exist_ok=True)
+    shutil.copyfile(INCLUDE_DIR / KERNEL_HEADER, cache_dir / KERNEL_HEADER)
+    shutil.copyfile(INCLUDE_DIR / KERNEL_CONFIG, cache_dir / KERNEL_CONFIG)
+    summary = {
+        "cpu": cpu_model(),
+        "model": args.model,
+        "quant_type": args.quant_type,
+        "threads": args.threads,
+        "batch": args.batch,
+        "shapes": [
+            {"M": m, "K": k, "best": {"BM": b[1][0], "BK": b[1][1], "bm": b[1][2], "us": b[0]}, "tried": res}
+            for (m, k), b, res in zip(shapes, best, results)
+        ],
+    }
+    with open(cache_dir / "tuning.json", "w") as f:
+        json.dump(summary, f, indent=2)
+
+    for s in summary["shapes"]:
+        default = next((t for t in s["tried"] if (t["BM"], t["BK"], t["bm"]) == defaults[shapes.index((s["M"], s["K"]))]), None)
+        gain = " ({:+.1f}% vs default)".format(100.0 * (default["us"] / s["best"]["us"] - 1)) if default else ""
+        logging.info("{}x{}: BM={} BK={} bm={} {:.1f} us{}".format(s["M"], s["K"], s["best"]["BM"], s["best"]["BK"],
+                                                                     s["best"]["bm"], s["best"]["us"], gain))
+
+
+def main():
+    args = parse_args()
+    Path(args.log_dir).mkdir(parents=True, exist_ok=True)
+    logging.basicConfig(level=logging.INFO)
+
+    cache_dir = Path(args.cache_dir).expanduser() / cpu_model() / args.model / args.quant_type
+    logging.info(f"Tuning cache: {cache_dir}")
+
+    backup = {name: (INCLUDE_DIR / name).read_bytes() for name in (KERNEL_HEADER, KERNEL_CONFIG)
+              if (INCLUDE_DIR / name).exists()}
+    ok = False
+    try:
+        if args.force or not (cache_dir / KERNEL_HEADER).exists():
+            tune(args, cache_dir)
+        else:
+            logging.info("Using the cached tuning, pass --force to tune again")
+        ok = True
+    finally:
+        # codegen writes into include/; leave it as it was unless the result is applied
+        if ok and not args.no_apply:
+            shutil.copyfile(cache_dir / KERNEL_HEADER, INCLUDE_DIR / KERNEL_HEADER)
+            shutil.copyfile(cache_dir / KERNEL_CONFIG, INCLUDE_DIR / KERNEL_CONFIG)
+            logging.info("Tuned kernels written to include/, rebuild to use them")
+        else:
+            for name, data in backup.items():
+                (INCLUDE_DIR / name).write_bytes(data)
+
+
+def parse_args():
+    parser = argparse.ArgumentParser(description="Autotune the LUT kernel tiling on this machine")
+    parser.add_argument("--model", "-m", type=str, required=True, choices=ModelShapeDict.keys(),
+                        help="Model whose weight shapes are tuned")
+    parser.add_argument("--quant-type", "-q", type=str, choices=QUANT_TYPES.keys(),
+                        default="tl1" if platform.machine().lower() in ("aarch64", "arm64") else "tl2",
+                        help="LUT kernel flavour to tune")
+    parser.add_argument("--threads", "-t", type=int, default=os.cpu_count() or 1,
+                        help="Threads the kernels are timed with")
+    parser.add_argument("--batch", "-b", type=int, default=1,
+                        help="Activation columns per GEMM, 1 tunes for decoding")
+    parser.add_argument("--max-candidates", type=int, default=16,
+                        help="Most tilings tried per shape (each round rebuilds the kernels)")
+    parser.add_argument("--min-time", type=float, default=0.5,
+                        help="Seconds each timing repetition runs for")
+    parser.add_argument("--build-dir", type=str, default=str(ROOT_DIR / "build_tune"),
+                        help="CMake build directory used for the candidates")
+    parser.add_argument("--cache-dir", type=str, default="~/.cache/bitnet/kernels",
+                        help="Where tuned kernels are cached per CPU model")
+    parser.add_argument("--log-dir", "-ld", type=str, default="logs",
+                        help="Directory to save the logging info")
+    parser.add_argument("--force", action="store_true", help="Tune again even if a cached result exists")
+    parser.add_argument("--no-apply", action="store_true", help="Only fill the cache, keep include/ unchanged")
+    return parser.parse_args()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,89 @@
+"""Serves several models on one port, each from its own llama-server.
+
+llama-server loads a single model, so every model runs in a backend server
+of its own and this proxy sends each request to the one its "model" field
+names, as OpenAI clients set it. Requests without one go to the first
+model. GET /v1/models lists them all and /health is ok once all are up.
+
+The backends share the host through their BitNet thread pools rather than
+fighting over it: run_inference_server.py gives each a thread quota
+(BITNET_THREADS) and CPUs of its own (BITNET_CPUS) out of one global
+budget, and starts batch models niced on every CPU of the budget so they
+only get the cycles interactive models leave idle. All of them mmap their
+GGUF read-only and the BitNet kernels read the weights in place, so a file
+served by several backends sits in the page cache once.
+
+usage: python utils/model_router.py --port 8080 --backend 3b=127.0.0.1:8081 --backend 8b=127.0.0.1:8082
+
+run_inference_server.py --serve starts the backends and this proxy together.
+"""
+
+import argparse
+import json
+import logging
+
+from http_proxy import ProxyHandler, Upstream, serve_forever, wait_ready
+
+logger = logging.getLogger("model_router")
+
+
+class RouterHandler(ProxyHandler):
+    logger = logger
+    backends = []
+
+    def do_GET(self):
+        if self.path in ("/models", "/v1/models"):
+            models = [{"id": b.name, "object": "model", "owned_by": "bitnet"} for b in self.backends]
+            self.reply(200, {"object": "list", "data": models})
+            return
+        if self.path == "/health":
+            down = [b.name for b in self.backends if not b.healthy()]
+            if down:
+                self.reply(503, {"status": "loading", "models": down})
+            else:
+                self.reply(200, {"status": "ok"})
+            return
+        self.relay(self.backends[0], "GET", None)
+
+    def do_POST(self):
+        body = self.rfile.read(int(self.headers.get("Content-Length", 0)))
+        try:
+            name = json.loads(body).get("model")
+        except (ValueError, AttributeError):
+            name = None
+        backend = self.backends[0]
+        if name:
+            backend = next((b for b in self.backends if b.name == name), None)
+            if backend is None:
+                self.reply(404, {"error": {"message": f"model {name} is not served here", "type": "invalid_request_error"}})
+                return
+        self.relay(backend, "POST", body)
+
+
+def serve(args):
+    backends = []
+    for spec in args.backend:
+        name, address = spec.split("=", 1)
+        backends.append(Upstream(address, name))
+    down = wait_ready(backends, args.wait)
+    if down:
+        logger.error(f"models {', '.join(down)} did not come up")
+        return 1
+    RouterHandler.backends = backends
+    logger.info(f"serving {', '.join(b.name for b in backends)} on {args.host}:{args.port}")
+    return serve_forever(RouterHandler, args.host, args.port)
+
+
+def parse_args():
+    parser = argparse.ArgumentParser(description="Routes requests to one llama-server per model by their model field")
+    parser.add_argument("--backend", type=str, action="append", required=True,
+                        help="name=host:port of a llama-server; repeat for every model, the first is the default")
+    parser.add_argument("--host", type=str, default="127.0.0.1", help="IP address to listen on")
+    parser.add_argument("--port", type=int, default=8080, help="Port to listen on")
+    parser.add_argument("--wait", type=float, default=600, help="Seconds to wait for the servers to load their models")
+    return parser.parse_args()
+
+
+if __name__ == "__main__":
+    logging.basicConfig(level=logging.INFO)
+    raise SystemExit(serve(parse_args()))
@@ -0,0 +1,403 @@
+"""Shared-prefix KV cache in front of llama-server.
+
+An HTTP proxy that keeps a radix tree over the token IDs of the prompts it
+has served. llama-server reuses a slot's KV cache for the part of a new
+prompt that matches what the slot last held (cache_prompt), so the proxy
+routes every request to the free slot sharing the longest prefix with it,
+and prefill only runs over the new tokens.
+
+Prefixes that recur are also saved as KV blocks: the slot state is written
+to a file through the server's /slots API and hangs off the tree node at
+the end of the shared prefix. A request for which no free slot has its
+prefix restores the longest matching block into a slot first. Blocks are
+refcounted by the requests restoring them and evicted least recently used
+once --prefix-blocks are held.
+
+Only the routing is heuristic: the server compares the tokens itself, so a
+wrong guess costs a prefill, never a wrong answer.
+
+usage: python utils/prefix_cache.py --upstream 127.0.0.1:8081 --port 8080 -np 4 --save-dir /tmp/kv
+
+run_inference_server.py --prefix-cache starts llama-server and this proxy together.
+"""
+
+import argparse
+import json
+import logging
+import os
+import threading
+import time
+
+from http_proxy import ProxyHandler, Upstream, serve_forever, wait_ready
+
+logger = logging.getLogger("prefix_cache")
+
+# Endpoints whose prompt the proxy tokenizes to pick a slot; the rest pass through
+PROMPT_ENDPOINTS = ("/completion", "/completions", "/v1/completions")
+CHAT_ENDPOINTS = ("/chat/completions", "/v1/chat/completions")
+
+
+class PrefixBlock:
+    """A saved slot state whose tokens start with the path to its node."""
+
+    def __init__(self, filename, n_tokens):
+        self.filename = filename
+        self.n_tokens = n_tokens
+        self.refs = 0
+        self.last_used = time.monotonic()
+
+
+class RadixNode:
+    def __init__(self, edge, parent):
+        self.edge = edge          # tokens from the parent to this node
+        self.parent = parent
+        self.children = {}        # first token of the child's edge -> child
+        self.block = None
+        self.last_used = time.monotonic()
+
+
+def common_prefix(a, b, start=0):
+    n = min(len(a), len(b))
+    i = start
+    while i < n and a[i] == b[i]:
+        i += 1
+    return i
+
+
+class RadixTree:
+    """Token-ID radix tree of seen prompts, holding KV blocks at shared prefixes.
+
+    Seen prompts are kept up to max_tokens tokens each and the least recently
+    used leaves go once the tree holds more than budget tokens.
+    """
+
+    def __init__(self, max_tokens, budget):
+        self.root = RadixNode([], None)
+        self.max_tokens = max_tokens
+        self.budget = budget
+        self.n_tokens = 0
+
+    def match(self, tokens):
+        """Length of the longest path tokens follow, and the deepest block on it
+        with its depth."""
+        node, depth, block, block_depth = self.root, 0, None, 0
+        now = time.monotonic()
+        while depth < len(tokens):
+            child = node.children.get(tokens[depth])
+            if child is None:
+                break
+            n = common_prefix(child.edge, tokens[depth:depth + len(child.edge)])
+            depth += n
+            if n < len(child.edge):
+                break
+            node = child
+            node.last_used = now
+            if node.block is not None:
+                block, block_depth = node.block, depth
+        return depth, block, block_depth
+
+    def _split(self, node, n):
+        # node keeps the first n tokens of its edge, a new child the rest
+        tail = RadixNode(node.edge[n:], node)
+        tail.children, node.children = node.children, {tail.edge[0]: tail}
+        for child in tail.children.values():
+            child.parent = tail
+        tail.block, node.block = node.block, None
+        tail.last_used = node.last_used
+        node.edge = node.edge[:n]
+
+    def insert(self, tokens):
+        """Records tokens as seen, returns the node at their end."""
+        tokens = tokens[:self.max_tokens]
+        node, depth = self.root, 0
+        now = time.monotonic()
+        while depth < len(tokens):
+            child = node.children.get(tokens[depth])
+            if child is None:
+                child = RadixNode(list(tokens[depth:]), node)
+                node.children[tokens[depth]] = child
+                self.n_tokens += len(child.edge)
+                depth = len(tokens)
+            else:
+                n = common_prefix(child.edge, tokens[depth:depth + len(child.edge)])
+                if n < len(child.edge):
+                    self._split(child, n)
+                depth += n
+            node = child
+            node.last_used = now
+        return node
+
+    def node_at(self, tokens):
+        """The node ending exactly after tokens, split out when tokens end mid-edge."""
+        node, depth = self.root, 0
+        while depth < len(tokens):
+            child = node.children[tokens[depth]]
+            n = common_prefix(child.edge, tokens[depth:depth + len(child.edge)])
+            if n < len(child.edge):
+                self._split(child, n)
+            depth += n
+            node = child
+        return node
+
+    def blocks(self):
+        stack, out = [self.root], []
+        while stack:
+            node = stack.pop()
+            if node.block is not None:
+                out.append(node)
+            stack.extend(node.children.values())
+        return out
+
+    def prune(self, on_evict):
+        """Drops least recently used leaves until the tree fits its budget.
+        Leaves holding a block in use stay."""
+        while self.n_tokens > self.budget:
+            leaves, stack = [], [self.root]
+            while stack:
+                node = stack.pop()
+                if not node.children and node is not self.root and (node.block is None or node.block.refs == 0):
+                    leaves.append(node)
+                stack.extend(node.children.values())
+            if not leaves:
+                return
+            self.remove(min(leaves, key=lambda n: n.last_used), on_evict)
+
+    def remove(self, node, on_evict):
+        if node.block is not None:
+            on_evict(node.block)
+            node.block = None
+        if node.children:
+            return
+        parent = node.parent
+        del parent.children[node.edge[0]]
+        self.n_tokens -= len(node.edge)
+        # A parent left with one child and no block folds into it
+        if parent is not self.root and parent.block is None and len(parent.children) == 1:
+            (child,) = parent.children.values()
+            parent.edge = parent.edge + child.edge
+            parent.children = child.children
+            for grandchild in parent.children.values():
+                grandchild.parent = parent
+            parent.block = child.block
+
+
+class Slot:
+    def __init__(self, slot_id):
+        self.id = slot_id
+        self.tokens = []          # the prompt the slot's KV cache starts with
+        self.busy = False
+        self.last_used = 0.0
+
+
+class PrefixCache:
+    def __init__(self, upstream, n_slots, save_dir, min_prefix, max_blocks, max_tokens, budget):
+        self.upstream = Upstream(upstream)
+        self.slots = [Slot(i) for i in range(n_slots)]
+        self.save_dir = save_dir
+        self.min_prefix = min_prefix
+        self.max_blocks = max_blocks
+        self.tree = RadixTree(max_tokens, budget)
+        self.cond = threading.Condition()
+        self.next_block = 0
+        self.stats = {"requests": 0, "slot_hits": 0, "block_restores": 0, "block_saves": 0,
+                      "block_evictions": 0, "prompt_tokens": 0, "reused_tokens": 0}
+
+    def call(self, path, payload):
+        conn, resp = self.upstream.request("POST", path, json.dumps(payload).encode())
+        try:
+            data = resp.read()
+            if resp.status != 200:
+                raise RuntimeError(f"{path}: HTTP {resp.status} {data[:200]!r}")
+            return json.loads(data)
+        finally:
+            conn.close()
+
+    def tokenize(self, payload, chat):
+        if chat:
+            # The chat template is applied server-side; role and content in
+            # order keep the same prefix order, which is all routing needs
+            text = "".join(f"<{m.get('role', '')}>{m.get('content', '')}" for m in payload.get("messages", [])
+                           if isinstance(m.get("content", ""), str))
+        else:
+            text = payload.get("prompt", "")
+        if not isinstance(text, str) or not text:
+            return []
+        return self.call("/tokenize", {"content": text})["tokens"]
+
+    def _evict(self, block):
+        self.stats["block_evictions"] += 1
+        try:
+            os.remove(os.path.join(self.save_dir, block.filename))
+        except OSError:
+            pass
+
+    def acquire(self, tokens):
+        """Reserves the slot to run tokens on: the one sharing the longest
+        prefix, else one to restore the longest matching block into. Returns
+        the slot, the block to restore or None, and the tokens reused."""
+        with self.cond:
+            while all(s.busy for s in self.slots):
+                self.cond.wait()
+            free = [s for s in self.slots if not s.busy]
+            best = max(free, key=lambda s: (common_prefix(s.tokens, tokens), s.last_used))
+            reused = common_prefix(best.tokens, tokens)
+            block = None
+            if reused < self.min_prefix:
+                _, node_block, depth = self.tree.match(tokens)
+                # Fill the least recently used slot, keep the others' prefixes
+                best = min(free, key=lambda s: s.last_used)
+                reused = common_prefix(best.tokens, tokens)
+                if node_block is not None and depth > reused:
+                    block, reused = node_block, depth
+                    block.refs += 1
+                    block.last_used = time.monotonic()
+            elif reused > 0:
+                self.stats["slot_hits"] += 1
+            best.busy = True
+            self.stats["requests"] += 1
+            self.stats["prompt_tokens"] += len(tokens)
+            self.stats["reused_tokens"] += reused
+            return best, block, reused
+
+    def restore(self, slot, block):
+        try:
+            self.call(f"/slots/{slot.id}?action=restore", {"filename": block.filename})
+            with self.cond:
+                self.stats["block_restores"] += 1
+            return True
+        except (OSError, RuntimeError) as e:
+            logger.warning(f"restoring {block.filename} into slot {slot.id} failed: {e}")
+            return False
+        finally:
+            with self.cond:
+                block.refs -= 1
+
+    def release(self, slot, tokens, ok):
+        """Frees the slot after it ran tokens, saving their recurring prefix as
+        a block when none covers it yet."""
+        save = None
+        with self.cond:
+            slot.tokens = tokens if ok else []
+            slot.last_used = time.monotonic()
+            if ok and tokens:
+                seen, _, block_depth = self.tree.match(tokens)
+                shared = min(seen, self.tree.max_tokens)
+                # A block a few tokens short already serves this prefix
+                if self.max_blocks > 0 and shared - block_depth >= self.min_prefix:
+                    save = self.tree.node_at(tokens[:shared])
+                self.tree.insert(tokens)
+                self.tree.prune(self._evict)
+            if save is None:
+                slot.busy = False
+                self.cond.notify()
+                return
+            filename = f"prefix-{self.next_block}.bin"
+            self.next_block += 1
+        # The slot stays reserved while the server writes its state
+        try:
+            self.call(f"/slots/{slot.id}?action=save", {"filename": filename})
+            with self.cond:
+                # The node may have been merged away meanwhile, look it up again
+                node = self.tree.node_at(tokens[:shared]) if self.tree.match(tokens[:shared])[0] == shared else None
+                if node is None or node.block is not None:
+                    self._evict(PrefixBlock(filename, shared))
+                else:
+                    node.block = PrefixBlock(filename, shared)
+                    self.stats["block_saves"] += 1
+                    blocks = self.tree.blocks()
+                    while len(blocks) > self.max_blocks:
+                        idle = [n for n in blocks if n.block.refs == 0 and n is not node]
+                        if not idle:
+                            break
+                        victim = min(idle, key=lambda n: n.block.last_used)
+                        self.tree.remove(victim, self._evict)
+                        blocks = self.tree.blocks()
+        except (OSError, RuntimeError) as e:
+            logger.warning(f"saving slot {slot.id} failed: {e}")
+        finally:
+            with self.cond:
+                slot.busy = False
+                self.cond.notify()
+
+
+class CacheHandler(ProxyHandler):
+    logger = logger
+    cache = None
+
+    def forward(self, method, body):
+        return self.relay(self.cache.upstream, method, body) == 200
+
+    def do_GET(self):
+        if self.path == "/prefix-cache":
+            with self.cache.cond:
+                stats = dict(self.cache.stats, blocks=len(self.cache.tree.blocks()), tree_tokens=self.cache.tree.n_tokens)
+            self.reply(200, stats)
+            return
+        self.forward("GET", None)
+
+    def do_POST(self):
+        body = self.rfile.read(int(self.headers.get("Content-Length", 0)))
+        chat = self.path.endswith(CHAT_ENDPOINTS)
+        if not (chat or self.path.endswith(PROMPT_ENDPOINTS)):
+            self.forward("POST", body)
+            return
+        try:
+            payload = json.loads(body)
+            tokens = self.cache.tokenize(payload, chat)
+        except (ValueError, OSError, RuntimeError, KeyError):
+            self.forward("POST", body)
+            return
+
+        slot, block, reused = self.cache.acquire(tokens)
+        ok = False
+        try:
+            if block is not None and not self.cache.restore(slot, block):
+                reused = 0
+            logger.info(f"slot {slot.id}: {len(tokens)} prompt tokens, {reused} cached")
+            payload["id_slot"] = slot.id
+            payload["cache_prompt"] = True
+            ok = self.forward("POST", json.dumps(payload).encode())
+        finally:
+            self.cache.release(slot, tokens, ok)
+
+
+def serve(args):
+    if args.save_dir is None:
+        args.blocks = 0
+    cache = PrefixCache(args.upstream, args.parallel, args.save_dir, args.min_prefix, args.blocks,
+                        args.max_tokens, args.tree_budget)
+    if wait_ready([cache.upstream], args.wait):
+        logger.error(f"llama-server at {args.upstream} did not come up")
+        return 1
+    CacheHandler.cache = cache
+    logger.info(f"prefix cache on {args.host}:{args.port} in front of {args.upstream}")
+    return serve_forever(CacheHandler, args.host, args.port)
+
+
+def add_arguments(parser):
+    parser.add_argument("--prefix-min", dest="min_prefix", type=int, default=256,
+                        help="Shortest shared prefix, in tokens, worth routing on or saving as a KV block")
+    parser.add_argument("--prefix-blocks", dest="blocks", type=int, default=16,
+                        help="Saved KV blocks kept, least recently used go first; 0 saves none")
+    parser.add_argument("--prefix-max-tokens", dest="max_tokens", type=int, default=8192,
+                        help="Tokens of each prompt kept in the radix tree")
+    parser.add_argument("--prefix-tree-budget", dest="tree_budget", type=int, default=1 << 20,
+                        help="Tokens the radix tree holds in total")
+
+
+def parse_args():
+    parser = argparse.ArgumentParser(description="Shared-prefix KV cache proxy for llama-server")
+    parser.add_argument("--upstream", type=str, required=True, help="host:port of llama-server, started with --slot-save-path")
+    parser.add_argument("--save-dir", type=str, default=None,
+                        help="The directory llama-server's --slot-save-path points at; without it no KV blocks are saved")
+    parser.add_argument("--host", type=str, default="127.0.0.1", help="IP address to listen on")
+    parser.add_argument("--port", type=int, default=8080, help="Port to listen on")
+    parser.add_argument("-np", "--parallel", type=int, default=1, help="Slots llama-server was started with")
+    parser.add_argument("--wait", type=float, default=300, help="Seconds to wait for llama-server to load the model")
+    add_arguments(parser)
+    return parser.parse_args()
+
+
+if __name__ == "__main__":
+    logging.basicConfig(level=logging.INFO)
+    raise SystemExit(serve(parse_args()))